@@ -52,7 +52,8 @@ AABB::AABB(const Point3 &a, const Point3 &b, const Point3 &c) {
 
     
 AABB::AABB(const Mesh &mesh, unsigned int tri_id) {
-    std::vector<unsigned int> indices = mesh.read_triangle_indices_data(tri_id);
+    unsigned int indices[3];
+    mesh.read_triangle_indices_data(tri_id, indices);
     Point3 a = mesh.read_vertex_data(indices[0]);
     Point3 b = mesh.read_vertex_data(indices[1]);
     Point3 c = mesh.read_vertex_data(indices[2]);
@@ -102,6 +103,10 @@ Vector3 AABB::Dimensions() const {
     return max_ - min_;
 }
     
+Point3 AABB::Center() const {
+    return Point3(0.5f*(min_[0] + max_[0]), 0.5f*(min_[1] + max_[1]), 0.5f*(min_[2] + max_[2]));
+}
+    
 float AABB::Volume() const {
     if (max_[0] < min_[0]) {
         // empty box
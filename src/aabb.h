@@ -58,6 +58,9 @@ public:
     /// Returns the dimensions of the box in x, y, and z as a 3D vector.
     Vector3 Dimensions() const;
     
+    /// Returns the point at the center of the box.
+    Point3 Center() const;
+    
     /// Returns the volume of the box or -1.0 when empty and 0.0 if the box
     /// contains just a single point.
     float Volume() const;
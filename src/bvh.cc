@@ -1,5 +1,7 @@
 #include "bvh.h"
 
+#include "frustum.h"
+#include "job_system.h"
 #include "mesh.h"
 #include "ray.h"
 
@@ -9,15 +11,36 @@
 namespace mingfx {
 
     
-BVH::BVH() : root_(NULL) {
+BVH::BVH() : root_(NULL), num_leaves_(0) {
+}
+    
+BVH::BVH(BVH &&other) : root_(other.root_), num_leaves_(other.num_leaves_) {
+    other.root_ = NULL;
+    other.num_leaves_ = 0;
 }
     
 BVH::~BVH() {
     FreeNodeRecursive(root_);
 }
+
+BVH& BVH::operator=(BVH &&other) {
+    if (this != &other) {
+        FreeNodeRecursive(root_);
+        root_ = other.root_;
+        num_leaves_ = other.num_leaves_;
+        other.root_ = NULL;
+        other.num_leaves_ = 0;
+    }
+    return *this;
+}
     
 void BVH::CreateFromMesh(const Mesh &mesh) {
     FreeNodeRecursive(root_);
+    root_ = NULL;
+    num_leaves_ = 0;
+    if (mesh.num_triangles() == 0) {
+        return;
+    }
     
     std::vector<AABB> tri_boxes;
     for (int i=0; i<mesh.num_triangles(); i++) {
@@ -28,13 +51,41 @@ void BVH::CreateFromMesh(const Mesh &mesh) {
     
     root_ = new Node();
     BuildHierarchyRecursive(root_, tri_boxes);
+    num_leaves_ = (int)tri_boxes.size();
+}
+
+void BVH::CreateFromMesh(const Mesh &mesh, JobSystem *job_system) {
+    FreeNodeRecursive(root_);
+    root_ = NULL;
+    num_leaves_ = 0;
+    if (mesh.num_triangles() == 0) {
+        return;
+    }
+    
+    std::vector<AABB> tri_boxes(mesh.num_triangles());
+    ParallelFor(job_system, (int)tri_boxes.size(), 4096, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            tri_boxes[i] = AABB(mesh, i);
+            tri_boxes[i].set_user_data(i);
+        }
+    });
+    
+    root_ = new Node();
+    BuildHierarchyParallel(root_, tri_boxes, job_system);
+    num_leaves_ = (int)tri_boxes.size();
 }
 
 void BVH::CreateFromListOfBoxes(const std::vector<AABB> &boxes) {
     FreeNodeRecursive(root_);
+    root_ = NULL;
+    num_leaves_ = 0;
+    if (boxes.size() == 0) {
+        return;
+    }
 
     root_ = new Node();
     BuildHierarchyRecursive(root_, boxes);
+    num_leaves_ = (int)boxes.size();
 }
     
     
@@ -64,9 +115,44 @@ void BVH::BuildHierarchyRecursive(Node *node, std::vector<AABB> tri_boxes) {
         return;
     }
     
+    std::vector<AABB> left_boxes, right_boxes;
+    SplitNode(node, &tri_boxes, &left_boxes, &right_boxes);
+    
+    node->child1 = new Node();
+    BuildHierarchyRecursive(node->child1, left_boxes);
+    node->child2 = new Node();
+    BuildHierarchyRecursive(node->child2, right_boxes);
+}
+
+void BVH::BuildHierarchyParallel(Node *node, std::vector<AABB> tri_boxes, JobSystem *job_system) {
+    // below this size, sorting the boxes takes less time than starting a job
+    const int MIN_BOXES_PER_JOB = 2048;
+    if ((job_system == NULL) || ((int)tri_boxes.size() < MIN_BOXES_PER_JOB)) {
+        BuildHierarchyRecursive(node, tri_boxes);
+        return;
+    }
+    
+    std::vector<AABB> left_boxes, right_boxes;
+    SplitNode(node, &tri_boxes, &left_boxes, &right_boxes);
+    tri_boxes.clear();
+    tri_boxes.shrink_to_fit();
+    
+    // the nodes are built into separate subtrees, so the two halves do not
+    // touch each other's data
+    node->child1 = new Node();
+    node->child2 = new Node();
+    JobSystem::TaskGroup group(job_system);
+    group.Run([this, node, &left_boxes, job_system] {
+        BuildHierarchyParallel(node->child1, left_boxes, job_system);
+    });
+    BuildHierarchyParallel(node->child2, right_boxes, job_system);
+    group.Wait();
+}
+
+void BVH::SplitNode(Node *node, std::vector<AABB> *tri_boxes, std::vector<AABB> *left_boxes, std::vector<AABB> *right_boxes) {
     // calc the full bounding box for this node
-    for (int i=0; i<tri_boxes.size(); i++) {
-        node->box = node->box + tri_boxes[i];
+    for (int i=0; i<tri_boxes->size(); i++) {
+        node->box = node->box + (*tri_boxes)[i];
     }
     
     // sort boxes along the longest axis
@@ -76,29 +162,26 @@ void BVH::BuildHierarchyRecursive(Node *node, std::vector<AABB> tri_boxes) {
     dims[2] = fabsf(dims[2]);
 
     if ((dims[0] > dims[1]) && (dims[0] > dims[2])) {
-        std::sort(tri_boxes.begin(), tri_boxes.end(), sort_by_x);
+        std::sort(tri_boxes->begin(), tri_boxes->end(), sort_by_x);
     }
     else if ((dims[1] > dims[0]) && (dims[1] > dims[2])) {
-        std::sort(tri_boxes.begin(), tri_boxes.end(), sort_by_y);
+        std::sort(tri_boxes->begin(), tri_boxes->end(), sort_by_y);
     }
     else {
-        std::sort(tri_boxes.begin(), tri_boxes.end(), sort_by_z);
+        std::sort(tri_boxes->begin(), tri_boxes->end(), sort_by_z);
     }
     
     // assign half to child1 and half to child2
-    std::size_t const half_size = tri_boxes.size() / 2;
-    std::vector<AABB> left_boxes(tri_boxes.begin(), tri_boxes.begin() + half_size);
-    std::vector<AABB> right_boxes(tri_boxes.begin() + half_size, tri_boxes.end());
-    
-    node->child1 = new Node();
-    BuildHierarchyRecursive(node->child1, left_boxes);
-    node->child2 = new Node();
-    BuildHierarchyRecursive(node->child2, right_boxes);
+    std::size_t const half_size = tri_boxes->size() / 2;
+    left_boxes->assign(tri_boxes->begin(), tri_boxes->begin() + half_size);
+    right_boxes->assign(tri_boxes->begin() + half_size, tri_boxes->end());
 }
     
 std::vector<int> BVH::IntersectAndReturnUserData(const Ray &r) const {
     std::vector<int> data_list;
-    IntersectRecursive(r, root_, &data_list);
+    if (root_ != NULL) {
+        IntersectRecursive(r, root_, &data_list);
+    }
     return data_list;
 }
 
@@ -116,5 +199,64 @@ void BVH::IntersectRecursive(const Ray &r, Node *node, std::vector<int> *data_li
         }
 	}
 }
+    
+    
+std::vector<int> BVH::CullAndReturnUserData(const Frustum &frustum, CullStats *stats) const {
+    std::vector<int> data_list;
+    if (root_ != NULL) {
+        CullRecursive(frustum, root_, &data_list, stats);
+    }
+    if (stats != NULL) {
+        stats->objects_visible += (int)data_list.size();
+        stats->objects_culled += num_leaves_ - (int)data_list.size();
+    }
+    return data_list;
+}
+
+void BVH::CullRecursive(const Frustum &frustum, Node *node, std::vector<int> *data_list, CullStats *stats) const {
+    if (stats != NULL) {
+        stats->nodes_tested++;
+    }
+    Frustum::Result result = frustum.TestAABB(node->box);
+    if (result == Frustum::Result::OUTSIDE) {
+        return;
+    }
+    if ((node->child1 == NULL) && (node->child2 == NULL)) {
+        // reached a leaf node, add the object's user data to the list
+        data_list->push_back(node->box.user_data());
+    }
+    else if (result == Frustum::Result::INSIDE) {
+        // everything below this node is visible, no need for more tests
+        size_t before = data_list->size();
+        AddAllRecursive(node, data_list);
+        if (stats != NULL) {
+            stats->objects_accepted_untested += (int)(data_list->size() - before);
+        }
+    }
+    else {
+        // go deeper and check children
+        CullRecursive(frustum, node->child1, data_list, stats);
+        CullRecursive(frustum, node->child2, data_list, stats);
+    }
+}
+
+void BVH::AddAllRecursive(Node *node, std::vector<int> *data_list) const {
+    if ((node->child1 == NULL) && (node->child2 == NULL)) {
+        data_list->push_back(node->box.user_data());
+    }
+    else {
+        AddAllRecursive(node->child1, data_list);
+        AddAllRecursive(node->child2, data_list);
+    }
+}
+
+int BVH::num_leaves() const {
+    return num_leaves_;
+}
+
+size_t BVH::memory_bytes() const {
+    // each split makes two children, so n leaves take 2n-1 nodes in all
+    return (num_leaves_ > 0) ? (2 * (size_t)num_leaves_ - 1) * sizeof(Node) : 0;
+}
 
 } // end namespace
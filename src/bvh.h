@@ -22,6 +22,8 @@
 namespace mingfx {
     
 // forward declarations
+class Frustum;
+class JobSystem;
 class Mesh;
 class Ray;
     
@@ -42,7 +44,14 @@ public:
     /// Initializes the class with an empty hierarchy.
 	BVH();
     
+    /// Takes the hierarchy from other, which is left empty.
+    BVH(BVH &&other);
+    
 	virtual ~BVH();
+    
+    /// Frees the current hierarchy and takes the one from other, which is
+    /// left empty.
+    BVH& operator=(BVH &&other);
 
     /** Creates a bounding volume hierarchy where each leaf node contains a single
      triangle from the mesh.  For leaf nodes, the triangle index can be retrieved
@@ -56,6 +65,13 @@ public:
      */
     void CreateFromMesh(const Mesh &mesh);
     
+    /** Same as CreateFromMesh() above, but the triangle boxes are computed and
+     the larger subtrees are built at the same time as jobs on job_system.  The
+     hierarchy is the same as the one built by CreateFromMesh(mesh).  If
+     job_system is NULL, it is all built on the calling thread.
+     */
+    void CreateFromMesh(const Mesh &mesh, JobSystem *job_system);
+    
     
     /** Creates a BVH where each leaf node contains one of the boxes passed in
      to the function. 
@@ -73,6 +89,38 @@ public:
     std::vector<int> IntersectAndReturnUserData(const Ray &r) const;
 
     
+    /// Counters filled in by CullAndReturnUserData() to help tune scenes.
+    class CullStats {
+    public:
+        CullStats() : nodes_tested(0), objects_visible(0), objects_culled(0), objects_accepted_untested(0) {}
+        /// Number of BVH nodes whose boxes were tested against the frustum.
+        int nodes_tested;
+        /// Number of leaf objects returned as visible.
+        int objects_visible;
+        /// Number of leaf objects skipped because they are outside the frustum.
+        int objects_culled;
+        /// Number of visible leaf objects that did not need their own test
+        /// because a parent node was completely inside the frustum.
+        int objects_accepted_untested;
+    };
+    
+    /** Traverse the BVH to find the leaf nodes whose AABBs are inside or
+     partially inside the view frustum and return their user_data.  For a BVH
+     created with CreateFromListOfBoxes() from the bounding boxes of the objects
+     in a scene, this returns the ids of the objects that should be drawn.
+     Whole subtrees are skipped as soon as their box is outside the frustum, and
+     subtrees that are completely inside are accepted without further tests.
+     If stats is not NULL, the counters are added to it, so reset it each frame.
+     */
+    std::vector<int> CullAndReturnUserData(const Frustum &frustum, CullStats *stats = NULL) const;
+    
+    /// The number of leaf nodes (triangles or boxes) in the hierarchy.
+    int num_leaves() const;
+    
+    /// Bytes of memory used by the nodes of the hierarchy.
+    size_t memory_bytes() const;
+    
+    
 private:
     
     // Simple internal data structure for storing each node of the BVH tree.
@@ -94,10 +142,15 @@ private:
     BVH(const BVH &other);
 
     void BuildHierarchyRecursive(Node *node, std::vector<AABB> boxes);
+    void BuildHierarchyParallel(Node *node, std::vector<AABB> boxes, JobSystem *job_system);
+    void SplitNode(Node *node, std::vector<AABB> *boxes, std::vector<AABB> *left_boxes, std::vector<AABB> *right_boxes);
     void IntersectRecursive(const Ray &r, Node *node, std::vector<int> *data_list) const;
+    void CullRecursive(const Frustum &frustum, Node *node, std::vector<int> *data_list, CullStats *stats) const;
+    void AddAllRecursive(Node *node, std::vector<int> *data_list) const;
     void FreeNodeRecursive(Node* node);
     
 	Node* root_;
+    int num_leaves_;
 };
 
     
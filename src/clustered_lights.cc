@@ -0,0 +1,205 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "clustered_lights.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace mingfx {
+
+    ClusteredLights::ClusteredLights(int tiles_x, int tiles_y, int depth_slices) :
+        tiles_x_(std::max(tiles_x, 1)), tiles_y_(std::max(tiles_y, 1)), depth_slices_(std::max(depth_slices, 1)),
+        near_(0.1f), far_(100.0f), depth_scale_(1.0f), max_per_cluster_(0)
+    {
+        cluster_data_.resize(2 * num_clusters(), 0);
+    }
+
+    ClusteredLights::~ClusteredLights() {
+    }
+
+
+    int ClusteredLights::DepthSlice(float eye_depth) const {
+        float d = std::max(eye_depth, near_);
+        int s = (int)std::floor(std::log(d / near_) * depth_scale_);
+        return std::min(std::max(s, 0), depth_slices_ - 1);
+    }
+
+
+    int ClusteredLights::ClusterIndex(float ndc_x, float ndc_y, float eye_depth) const {
+        int x = (int)std::floor((0.5f * ndc_x + 0.5f) * (float)tiles_x_);
+        int y = (int)std::floor((0.5f * ndc_y + 0.5f) * (float)tiles_y_);
+        x = std::min(std::max(x, 0), tiles_x_ - 1);
+        y = std::min(std::max(y, 0), tiles_y_ - 1);
+        return x + tiles_x_ * (y + tiles_y_ * DepthSlice(eye_depth));
+    }
+
+
+    void ClusteredLights::AssignLights(const std::vector<Point3> &eye_positions,
+                                       const std::vector<float> &ranges,
+                                       const Matrix4 &projection)
+    {
+        // Recover the near and far planes from the projection matrix
+        if (projection(3,2) != 0.0f) {
+            // perspective
+            near_ = projection(2,3) / (projection(2,2) - 1.0f);
+            far_ = projection(2,3) / (projection(2,2) + 1.0f);
+        }
+        else {
+            // orthographic
+            near_ = (projection(2,3) + 1.0f) / projection(2,2);
+            far_ = (projection(2,3) - 1.0f) / projection(2,2);
+        }
+        // the slices are spaced exponentially, so near must be positive
+        near_ = std::max(near_, 1e-4f);
+        if (!(far_ > near_)) {
+            far_ = near_ + 1.0f;
+        }
+        depth_scale_ = (float)depth_slices_ / std::log(far_ / near_);
+
+        const int nlights = (int)std::min(eye_positions.size(), ranges.size());
+        light_bounds_.resize(6 * nlights);
+
+        // Pass 1: find the range of clusters touched by each light and count
+        // the number of lights that land in each cluster
+        std::fill(cluster_data_.begin(), cluster_data_.end(), 0);
+        for (int i=0; i<nlights; i++) {
+            int *b = &light_bounds_[6*i];
+            const Point3 &c = eye_positions[i];
+            const float r = ranges[i];
+
+            if (r <= 0.0f) {
+                // unbounded lights reach every cluster
+                b[0] = 0; b[1] = tiles_x_ - 1;
+                b[2] = 0; b[3] = tiles_y_ - 1;
+                b[4] = 0; b[5] = depth_slices_ - 1;
+            }
+            else {
+                // eye space looks down -z, so depth = -z
+                float zmin = -c[2] - r;
+                float zmax = -c[2] + r;
+                if ((zmax < near_) || (zmin > far_)) {
+                    b[0] = 1; b[1] = 0; // empty
+                    continue;
+                }
+
+                // Project the corners of the sphere's bounding box, with the
+                // part behind the near plane clipped off, to get a conservative
+                // screen-space rectangle
+                float front = std::min(c[2] + r, -near_);
+                float back = c[2] - r;
+                float xmin = 1.0f, xmax = -1.0f, ymin = 1.0f, ymax = -1.0f;
+                bool first = true;
+                for (int k=0; k<8; k++) {
+                    Point3 corner(c[0] + ((k & 1) ? r : -r),
+                                  c[1] + ((k & 2) ? r : -r),
+                                  (k & 4) ? front : back);
+                    Point3 ndc = projection * corner;
+                    if (first) {
+                        xmin = xmax = ndc[0];
+                        ymin = ymax = ndc[1];
+                        first = false;
+                    }
+                    else {
+                        xmin = std::min(xmin, ndc[0]);  xmax = std::max(xmax, ndc[0]);
+                        ymin = std::min(ymin, ndc[1]);  ymax = std::max(ymax, ndc[1]);
+                    }
+                }
+                if ((xmax < -1.0f) || (xmin > 1.0f) || (ymax < -1.0f) || (ymin > 1.0f)) {
+                    b[0] = 1; b[1] = 0; // off screen
+                    continue;
+                }
+
+                b[0] = std::max((int)std::floor((0.5f * xmin + 0.5f) * (float)tiles_x_), 0);
+                b[1] = std::min((int)std::floor((0.5f * xmax + 0.5f) * (float)tiles_x_), tiles_x_ - 1);
+                b[2] = std::max((int)std::floor((0.5f * ymin + 0.5f) * (float)tiles_y_), 0);
+                b[3] = std::min((int)std::floor((0.5f * ymax + 0.5f) * (float)tiles_y_), tiles_y_ - 1);
+                b[4] = DepthSlice(zmin);
+                b[5] = DepthSlice(std::min(zmax, far_));
+            }
+
+            for (int z=b[4]; z<=b[5]; z++) {
+                for (int y=b[2]; y<=b[3]; y++) {
+                    for (int x=b[0]; x<=b[1]; x++) {
+                        cluster_data_[2 * (x + tiles_x_ * (y + tiles_y_ * z)) + 1]++;
+                    }
+                }
+            }
+        }
+
+        // Prefix sum of the counts gives each cluster's offset into the index list
+        unsigned int total = 0;
+        max_per_cluster_ = 0;
+        for (int c=0; c<num_clusters(); c++) {
+            cluster_data_[2*c] = total;
+            total += cluster_data_[2*c + 1];
+            max_per_cluster_ = std::max(max_per_cluster_, (int)cluster_data_[2*c + 1]);
+            // reset the count, it is rebuilt while filling in pass 2
+            cluster_data_[2*c + 1] = 0;
+        }
+        light_indices_.resize(total);
+
+        // Pass 2: fill in the index lists
+        for (int i=0; i<nlights; i++) {
+            const int *b = &light_bounds_[6*i];
+            if (b[0] > b[1]) {
+                continue;
+            }
+            for (int z=b[4]; z<=b[5]; z++) {
+                for (int y=b[2]; y<=b[3]; y++) {
+                    for (int x=b[0]; x<=b[1]; x++) {
+                        unsigned int *cluster = &cluster_data_[2 * (x + tiles_x_ * (y + tiles_y_ * z))];
+                        light_indices_[cluster[0] + cluster[1]] = i;
+                        cluster[1]++;
+                    }
+                }
+            }
+        }
+    }
+
+
+    const std::vector<unsigned int>& ClusteredLights::cluster_data() const {
+        return cluster_data_;
+    }
+
+    const std::vector<unsigned int>& ClusteredLights::light_indices() const {
+        return light_indices_;
+    }
+
+    int ClusteredLights::tiles_x() const {
+        return tiles_x_;
+    }
+
+    int ClusteredLights::tiles_y() const {
+        return tiles_y_;
+    }
+
+    int ClusteredLights::depth_slices() const {
+        return depth_slices_;
+    }
+
+    int ClusteredLights::num_clusters() const {
+        return tiles_x_ * tiles_y_ * depth_slices_;
+    }
+
+    float ClusteredLights::near_plane() const {
+        return near_;
+    }
+
+    float ClusteredLights::far_plane() const {
+        return far_;
+    }
+
+    float ClusteredLights::depth_slice_scale() const {
+        return depth_scale_;
+    }
+
+    int ClusteredLights::max_lights_per_cluster() const {
+        return max_per_cluster_;
+    }
+
+} // end namespace
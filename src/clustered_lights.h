@@ -0,0 +1,112 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_CLUSTERED_LIGHTS_H_
+#define SRC_CLUSTERED_LIGHTS_H_
+
+#include "matrix4.h"
+#include "point3.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Sorts a list of point lights into a 3D grid of "clusters" that subdivides
+ the view frustum, so that a fragment shader only needs to loop over the few
+ lights that can actually reach it rather than every light in the scene.  The
+ frustum is divided into tiles_x by tiles_y tiles in screen space and
+ depth_slices slices in depth.  The depth slices are spaced exponentially
+ between the near and far planes so that clusters stay roughly cube-shaped.
+
+ Each light is treated as a sphere of influence in eye space.  Lights with a
+ range <= 0 have no falloff, so they are assigned to every cluster.
+
+ This class only does the CPU-side binning; DefaultShader uses it to build the
+ lists that it uploads to the GPU when there are more lights than fit in its
+ uniform block.  After calling AssignLights(), the lights that touch cluster c
+ are light_indices()[offset] ... light_indices()[offset + count - 1], where
+ offset = cluster_data()[2*c] and count = cluster_data()[2*c + 1].  Clusters
+ are numbered x + tiles_x * (y + tiles_y * z).
+ */
+class ClusteredLights {
+public:
+
+    /// Creates a grid of tiles_x * tiles_y * depth_slices clusters.
+    ClusteredLights(int tiles_x = 16, int tiles_y = 9, int depth_slices = 24);
+
+    virtual ~ClusteredLights();
+
+    /// Rebuilds the per-cluster light lists.  eye_positions and ranges must be
+    /// the same length; positions are in eye space (i.e., already multiplied by
+    /// the view matrix), and the near and far planes are extracted from the
+    /// projection matrix.
+    void AssignLights(const std::vector<Point3> &eye_positions,
+                      const std::vector<float> &ranges,
+                      const Matrix4 &projection);
+
+    /// Returns the cluster that contains a point, given its position in
+    /// normalized device coordinates (x,y in [-1,1]) and its positive distance
+    /// in front of the camera.  This matches the lookup done in default.frag.
+    int ClusterIndex(float ndc_x, float ndc_y, float eye_depth) const;
+
+
+    /// Two entries per cluster: the offset into light_indices() and the number
+    /// of lights in the cluster.
+    const std::vector<unsigned int>& cluster_data() const;
+
+    /// The concatenated per-cluster lists of light indices.
+    const std::vector<unsigned int>& light_indices() const;
+
+    int tiles_x() const;
+    int tiles_y() const;
+    int depth_slices() const;
+    int num_clusters() const;
+
+    /// The near plane distance found in the last call to AssignLights().
+    float near_plane() const;
+
+    /// The far plane distance found in the last call to AssignLights().
+    float far_plane() const;
+
+    /// Multiply log(eye_depth / near_plane()) by this to get the depth slice.
+    float depth_slice_scale() const;
+
+    /// The largest number of lights in any one cluster after the last call to
+    /// AssignLights(), useful for tuning the grid or light ranges.
+    int max_lights_per_cluster() const;
+
+private:
+
+    int DepthSlice(float eye_depth) const;
+
+    int tiles_x_;
+    int tiles_y_;
+    int depth_slices_;
+
+    float near_;
+    float far_;
+    float depth_scale_;
+    int max_per_cluster_;
+
+    std::vector<unsigned int> cluster_data_;
+    std::vector<unsigned int> light_indices_;
+
+    // scratch space reused from frame to frame, 6 ints (x0,x1,y0,y1,z0,z1) per light
+    std::vector<int> light_bounds_;
+};
+
+} // end namespace
+
+#endif
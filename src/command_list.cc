@@ -0,0 +1,174 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "command_list.h"
+
+#include "gl_state.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace mingfx {
+
+
+CommandList::CommandList() {
+}
+
+CommandList::~CommandList() {
+}
+
+
+void CommandList::Draw(DefaultShader *shader, const Matrix4 &model, const Matrix4 &view,
+                       const Matrix4 &projection, Mesh *mesh, const DefaultShader::MaterialProperties &material)
+{
+    if ((cameras_.empty()) || !(cameras_.back().view == view) || !(cameras_.back().projection == projection)) {
+        Camera camera;
+        camera.view = view;
+        camera.projection = projection;
+        cameras_.push_back(camera);
+    }
+
+    Command command;
+    command.shader = shader;
+    command.mesh = mesh;
+    command.material = &material;
+    command.model = model;
+    command.camera = (int)cameras_.size() - 1;
+    commands_.push_back(command);
+}
+
+
+void CommandList::Submit(bool sort_by_state) const {
+    std::vector<const CommandList*> lists;
+    lists.push_back(this);
+    Submit(lists, sort_by_state);
+}
+
+
+void CommandList::Submit(const std::vector<CommandList*> &lists, bool sort_by_state) {
+    Submit(std::vector<const CommandList*>(lists.begin(), lists.end()), sort_by_state);
+}
+
+
+namespace {
+
+// One recorded draw with the state it needs, in the order to sort by
+class SortEntry {
+public:
+    uintptr_t shader;
+    int camera;
+    GLuint texture;
+    uintptr_t material;
+    uintptr_t mesh;
+    int order;
+
+    bool operator<(const SortEntry &other) const {
+        if (shader != other.shader) return shader < other.shader;
+        if (camera != other.camera) return camera < other.camera;
+        if (texture != other.texture) return texture < other.texture;
+        if (material != other.material) return material < other.material;
+        if (mesh != other.mesh) return mesh < other.mesh;
+        return order < other.order;
+    }
+};
+
+} // end namespace
+
+
+void CommandList::Submit(const std::vector<const CommandList*> &lists, bool sort_by_state) {
+    // the lists each have their own cameras, so first find the ones that are
+    // the same across lists, which lets draws from different lists share a
+    // UseProgram() call
+    std::vector<const Camera*> cameras;
+    std::vector<std::vector<int>> camera_ids(lists.size());
+    for (int l=0; l<lists.size(); l++) {
+        for (int c=0; c<lists[l]->cameras_.size(); c++) {
+            const Camera &camera = lists[l]->cameras_[c];
+            int id = 0;
+            while ((id < cameras.size()) &&
+                   !((cameras[id]->view == camera.view) && (cameras[id]->projection == camera.projection))) {
+                id++;
+            }
+            if (id == cameras.size()) {
+                cameras.push_back(&camera);
+            }
+            camera_ids[l].push_back(id);
+        }
+    }
+
+    std::vector<const Command*> commands;
+    std::vector<SortEntry> entries;
+    for (int l=0; l<lists.size(); l++) {
+        for (int c=0; c<lists[l]->commands_.size(); c++) {
+            const Command &command = lists[l]->commands_[c];
+            SortEntry entry;
+            entry.shader = (uintptr_t)command.shader;
+            entry.camera = camera_ids[l][command.camera];
+            if (command.material->surface_texture_array != NULL) {
+                entry.texture = command.material->surface_texture_array->opengl_id();
+            }
+            else {
+                entry.texture = command.material->surface_texture.initialized() ?
+                    command.material->surface_texture.opengl_id() : 0;
+            }
+            entry.material = (uintptr_t)command.material;
+            entry.mesh = (uintptr_t)command.mesh;
+            entry.order = (int)commands.size();
+            entries.push_back(entry);
+            commands.push_back(&command);
+        }
+    }
+    if (sort_by_state) {
+        std::sort(entries.begin(), entries.end());
+    }
+
+    // set each piece of state only when it changes from the previous draw,
+    // leaving the program and each mesh bound in between
+    bool keep_bound = GLState::keep_bound();
+    GLState::set_keep_bound(true);
+    DefaultShader *shader = NULL;
+    int camera = -1;
+    const DefaultShader::MaterialProperties *material = NULL;
+    for (int i=0; i<entries.size(); i++) {
+        const Command *command = commands[entries[i].order];
+        const Camera *c = cameras[entries[i].camera];
+        if ((command->shader != shader) || (entries[i].camera != camera)) {
+            if (shader != NULL) {
+                shader->StopProgram();
+            }
+            shader = command->shader;
+            camera = entries[i].camera;
+            material = command->material;
+            shader->UseProgram(command->model, c->view, c->projection, *material);
+        }
+        else if (command->material != material) {
+            material = command->material;
+            shader->SetMaterial(*material);
+        }
+        shader->DrawWithinProgram(command->model, c->view, command->mesh);
+    }
+    GLState::set_keep_bound(keep_bound);
+    if (shader != NULL) {
+        shader->StopProgram();
+    }
+    GLState::ReleaseVertexArray();
+}
+
+
+void CommandList::Clear() {
+    commands_.clear();
+    cameras_.clear();
+}
+
+
+int CommandList::num_commands() const {
+    return (int)commands_.size();
+}
+
+
+} // end namespace
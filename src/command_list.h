@@ -0,0 +1,127 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_COMMAND_LIST_H_
+#define SRC_COMMAND_LIST_H_
+
+#include "default_shader.h"
+#include "matrix4.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+class Mesh;
+
+
+/** Records draw calls to make later, so that deciding what to draw (walking
+ the scene, culling, picking levels of detail) can happen on other threads,
+ while the OpenGL calls still all come from the thread with the OpenGL
+ context.  Recording does not make any OpenGL calls.  Each thread records to
+ its own CommandList, and then the main thread submits all of them together.
+ Submit() sorts the draws by shader, camera, texture, material, and mesh, so
+ that draws that share state run one after another and the state is only set
+ when it changes.  Example:
+ ~~~
+ void MyApp::DrawUsingOpenGL() {
+     const int num_lists = 8;
+     std::vector<CommandList> lists(num_lists);
+     JobSystem::TaskGroup group(job_system());
+     for (int i=0; i<num_lists; i++) {
+         group.Run([this, &lists, i] {
+             for (int j=i; j<objects_.size(); j+=num_lists) {
+                 if (objects_[j].visible(frustum_)) {
+                     lists[i].Draw(&shader_, objects_[j].transform, view_, proj_,
+                                   objects_[j].mesh, objects_[j].material);
+                 }
+             }
+         });
+     }
+     group.Wait();
+
+     std::vector<CommandList*> all;
+     for (int i=0; i<num_lists; i++) {
+         all.push_back(&lists[i]);
+     }
+     CommandList::Submit(all);
+ }
+ ~~~
+ Only pointers to the shader, mesh, and material are recorded, so they must
+ stay the same until the list is submitted.  The matrices are copied.
+ Sorting changes the order of the draws, so for draws that must happen in
+ order, e.g., transparent objects drawn back to front, pass false for
+ sort_by_state.
+ */
+class CommandList {
+public:
+
+    /// Creates an empty list.
+    CommandList();
+
+    virtual ~CommandList();
+
+    /// Records a draw that does the same thing as
+    /// shader->Draw(model, view, projection, mesh, material).  Each list must
+    /// only be used by one thread at a time.
+    void Draw(DefaultShader *shader, const Matrix4 &model, const Matrix4 &view,
+              const Matrix4 &projection, Mesh *mesh, const DefaultShader::MaterialProperties &material);
+
+    /// Makes all of the draws recorded in the list.  Call this from the
+    /// thread with the OpenGL context, e.g., in DrawUsingOpenGL().  The list
+    /// is not cleared, so a list that does not change can be submitted again
+    /// on the next frame.
+    void Submit(bool sort_by_state=true) const;
+
+    /// Makes all of the draws recorded in several lists, sorted together
+    /// unless sort_by_state is false, in which case the lists are drawn in
+    /// order.  Call this from the thread with the OpenGL context.
+    static void Submit(const std::vector<const CommandList*> &lists, bool sort_by_state=true);
+    static void Submit(const std::vector<CommandList*> &lists, bool sort_by_state=true);
+
+    /// Removes all of the recorded draws, keeping the memory for reuse.
+    void Clear();
+
+    /// The number of draws recorded since the last Clear().
+    int num_commands() const;
+
+private:
+
+    class Camera {
+    public:
+        Matrix4 view;
+        Matrix4 projection;
+    };
+
+    class Command {
+    public:
+        DefaultShader *shader;
+        Mesh *mesh;
+        const DefaultShader::MaterialProperties *material;
+        Matrix4 model;
+        // index into cameras_, since usually every draw uses the same one
+        int camera;
+    };
+
+    // for now, the copy constructor is private so no copies are allowed.
+    CommandList(const CommandList &other);
+    CommandList& operator=(const CommandList &other);
+
+    std::vector<Command> commands_;
+    std::vector<Camera> cameras_;
+};
+
+
+} // end namespace
+
+#endif
@@ -6,32 +6,23 @@
 
 #include "default_shader.h"
 
+#include "gl_state.h"
 #include "platform.h"
 
+#include <cstring>
+
 
 namespace mingfx {
     
-    DefaultShader::DefaultShader(bool addDefaultLight) {
-        for (int i = 0; i < MAX_LIGHTS; i++) {
-            lightPositions_[3 * i + 0] = 0.0f;
-            lightPositions_[3 * i + 1] = 0.0f;
-            lightPositions_[3 * i + 2] = 0.0f;
-
-            lightIas_[4 * i + 0] = 0.0f;
-            lightIas_[4 * i + 1] = 0.0f;
-            lightIas_[4 * i + 2] = 0.0f;
-            lightIas_[4 * i + 3] = 0.0f;
-
-            lightIds_[4 * i + 0] = 0.0f;
-            lightIds_[4 * i + 1] = 0.0f;
-            lightIds_[4 * i + 2] = 0.0f;
-            lightIds_[4 * i + 3] = 0.0f;
-
-            lightIss_[4 * i + 0] = 0.0f;
-            lightIss_[4 * i + 1] = 0.0f;
-            lightIss_[4 * i + 2] = 0.0f;
-            lightIss_[4 * i + 3] = 0.0f;
-        }
+    DefaultShader::DefaultShader(bool addDefaultLight) :
+        per_frame_dirty_(true), material_dirty_(true), per_frame_ubo_(0), material_ubo_(0),
+        model_matrix_loc_(-1), normal_matrix_loc_(-1), instanced_draw_loc_(-1), batched_draw_loc_(-1),
+        instanced_draw_(-1), batched_draw_(-1),
+        force_clustered_(false), light_data_buffer_(0), light_data_texture_(0),
+        cluster_buffer_(0), cluster_texture_(0), index_buffer_(0), index_texture_(0)
+    {
+        memset(&per_frame_, 0, sizeof(per_frame_));
+        memset(&material_, 0, sizeof(material_));
 
         if (addDefaultLight) {
             AddLight(LightProperties());
@@ -39,7 +30,22 @@ namespace mingfx {
     }
     
     DefaultShader::~DefaultShader() {
-        
+        // the buffers are all created by Init()
+        if (per_frame_ubo_ != 0) {
+            GLuint buffers[2] = { per_frame_ubo_, material_ubo_ };
+            GLState::ForgetBuffer(per_frame_ubo_);
+            GLState::ForgetBuffer(material_ubo_);
+            glDeleteBuffers(2, buffers);
+        }
+        if (light_data_buffer_ != 0) {
+            GLuint buffers[3] = { light_data_buffer_, cluster_buffer_, index_buffer_ };
+            GLuint textures[3] = { light_data_texture_, cluster_texture_, index_texture_ };
+            glDeleteBuffers(3, buffers);
+            for (int i=0; i<3; i++) {
+                GLState::ForgetTexture(textures[i]);
+            }
+            glDeleteTextures(3, textures);
+        }
     }
     
     void DefaultShader::AddLight(LightProperties light) {
@@ -52,6 +58,24 @@ namespace mingfx {
         update_light_arrays();
     }
     
+    void DefaultShader::ClearLights() {
+        lights_.clear();
+        update_light_arrays();
+    }
+    
+    void DefaultShader::set_clustered_lighting(bool on) {
+        force_clustered_ = on;
+        per_frame_dirty_ = true;
+    }
+    
+    bool DefaultShader::clustered_lighting() const {
+        return force_clustered_ || (lights_.size() > MAX_LIGHTS);
+    }
+    
+    const ClusteredLights& DefaultShader::light_clusters() const {
+        return clusters_;
+    }
+    
     void DefaultShader::update_light_arrays() {
         DefaultShader::LightProperties defaultlight;
         
@@ -64,24 +88,163 @@ namespace mingfx {
                 light = &defaultlight;
             }
             
-            lightPositions_[3*i + 0] = light->position[0];
-            lightPositions_[3*i + 1] = light->position[1];
-            lightPositions_[3*i + 2] = light->position[2];
-                
-            lightIas_[4*i + 0] = light->ambient_intensity[0];
-            lightIas_[4*i + 1] = light->ambient_intensity[1];
-            lightIas_[4*i + 2] = light->ambient_intensity[2];
-            lightIas_[4*i + 3] = light->ambient_intensity[3];
+            // positions are transformed to eye space in update_per_frame_block()
+            per_frame_.light_ambient[4*i + 0] = light->ambient_intensity[0];
+            per_frame_.light_ambient[4*i + 1] = light->ambient_intensity[1];
+            per_frame_.light_ambient[4*i + 2] = light->ambient_intensity[2];
+            per_frame_.light_ambient[4*i + 3] = light->ambient_intensity[3];
             
-            lightIds_[4*i + 0] = light->diffuse_intensity[0];
-            lightIds_[4*i + 1] = light->diffuse_intensity[1];
-            lightIds_[4*i + 2] = light->diffuse_intensity[2];
-            lightIds_[4*i + 3] = light->diffuse_intensity[3];
+            per_frame_.light_diffuse[4*i + 0] = light->diffuse_intensity[0];
+            per_frame_.light_diffuse[4*i + 1] = light->diffuse_intensity[1];
+            per_frame_.light_diffuse[4*i + 2] = light->diffuse_intensity[2];
+            per_frame_.light_diffuse[4*i + 3] = light->diffuse_intensity[3];
             
-            lightIss_[4*i + 0] = light->specular_intensity[0];
-            lightIss_[4*i + 1] = light->specular_intensity[1];
-            lightIss_[4*i + 2] = light->specular_intensity[2];
-            lightIss_[4*i + 3] = light->specular_intensity[3];
+            per_frame_.light_specular[4*i + 0] = light->specular_intensity[0];
+            per_frame_.light_specular[4*i + 1] = light->specular_intensity[1];
+            per_frame_.light_specular[4*i + 2] = light->specular_intensity[2];
+            per_frame_.light_specular[4*i + 3] = light->specular_intensity[3];
+        }
+        per_frame_.num_lights = std::min((int)lights_.size(), (int)MAX_LIGHTS);
+        per_frame_dirty_ = true;
+    }
+    
+    
+    void DefaultShader::update_per_frame_block(const Matrix4 &view, const Matrix4 &projection) {
+        // with clustered lighting the shader needs the viewport to find the
+        // cluster that contains each fragment
+        bool clustered = clustered_lighting();
+        float viewport[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        if (clustered) {
+            GLint vp[4];
+            glGetIntegerv(GL_VIEWPORT, vp);
+            for (int i=0; i<4; i++) {
+                viewport[i] = (float)vp[i];
+            }
+        }
+        
+        // the lights only need to be transformed to eye space again if the camera moved
+        if ((memcmp(per_frame_.view, view.value_ptr(), 16*sizeof(float)) == 0) &&
+            (memcmp(per_frame_.projection, projection.value_ptr(), 16*sizeof(float)) == 0) &&
+            (memcmp(per_frame_.viewport, viewport, 4*sizeof(float)) == 0) &&
+            (!per_frame_dirty_)) {
+            return;
+        }
+        
+        memcpy(per_frame_.view, view.value_ptr(), 16*sizeof(float));
+        memcpy(per_frame_.projection, projection.value_ptr(), 16*sizeof(float));
+        memcpy(per_frame_.viewport, viewport, 4*sizeof(float));
+        for (int i=0; i<per_frame_.num_lights; i++) {
+            Point3 light_in_eye_space = view * lights_[i].position;
+            per_frame_.light_positions[4*i + 0] = light_in_eye_space[0];
+            per_frame_.light_positions[4*i + 1] = light_in_eye_space[1];
+            per_frame_.light_positions[4*i + 2] = light_in_eye_space[2];
+            per_frame_.light_positions[4*i + 3] = lights_[i].range;
+        }
+        
+        per_frame_.use_clustered_lights = clustered;
+        if (clustered) {
+            update_light_clusters(view, projection);
+            per_frame_.cluster_grid[0] = (float)clusters_.tiles_x();
+            per_frame_.cluster_grid[1] = (float)clusters_.tiles_y();
+            per_frame_.cluster_grid[2] = (float)clusters_.depth_slices();
+            per_frame_.cluster_depth[0] = clusters_.near_plane();
+            per_frame_.cluster_depth[1] = clusters_.far_plane();
+            per_frame_.cluster_depth[2] = clusters_.depth_slice_scale();
+        }
+        
+        glBindBuffer(GL_UNIFORM_BUFFER, per_frame_ubo_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerFrameBlock), &per_frame_);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        per_frame_dirty_ = false;
+    }
+    
+    
+    // Replaces the contents of a buffer backing a buffer texture.  Buffer
+    // textures cannot be empty, so at least a few bytes are always allocated.
+    static void upload_texture_buffer(GLuint buffer, size_t nbytes, const void *data) {
+        static const unsigned int zeros[4] = {0, 0, 0, 0};
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        if (nbytes == 0) {
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(zeros), zeros, GL_STREAM_DRAW);
+        }
+        else {
+            glBufferData(GL_TEXTURE_BUFFER, nbytes, data, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+    
+    
+    void DefaultShader::update_light_clusters(const Matrix4 &view, const Matrix4 &projection) {
+        // 4 RGBA texels per light: eye space position + range, ambient, diffuse, specular
+        eye_positions_.resize(lights_.size());
+        ranges_.resize(lights_.size());
+        light_data_.resize(16 * lights_.size());
+        for (int i=0; i<lights_.size(); i++) {
+            eye_positions_[i] = view * lights_[i].position;
+            ranges_[i] = lights_[i].range;
+            float *d = &light_data_[16*i];
+            d[0] = eye_positions_[i][0];
+            d[1] = eye_positions_[i][1];
+            d[2] = eye_positions_[i][2];
+            d[3] = ranges_[i];
+            for (int c=0; c<4; c++) {
+                d[4 + c] = lights_[i].ambient_intensity[c];
+                d[8 + c] = lights_[i].diffuse_intensity[c];
+                d[12 + c] = lights_[i].specular_intensity[c];
+            }
+        }
+        
+        clusters_.AssignLights(eye_positions_, ranges_, projection);
+        
+        upload_texture_buffer(light_data_buffer_, light_data_.size() * sizeof(float),
+                              light_data_.empty() ? NULL : &light_data_[0]);
+        upload_texture_buffer(cluster_buffer_, clusters_.cluster_data().size() * sizeof(unsigned int),
+                              &clusters_.cluster_data()[0]);
+        upload_texture_buffer(index_buffer_, clusters_.light_indices().size() * sizeof(unsigned int),
+                              clusters_.light_indices().empty() ? NULL : &clusters_.light_indices()[0]);
+    }
+    
+    
+    void DefaultShader::update_material_block(const MaterialProperties &material) {
+        MaterialBlock m;
+        memset(&m, 0, sizeof(m));
+        for (int i=0; i<4; i++) {
+            m.ambient[i] = material.ambient_reflectance[i];
+            m.diffuse[i] = material.diffuse_reflectance[i];
+            m.specular[i] = material.specular_reflectance[i];
+        }
+        m.shininess = material.shinniness;
+        m.use_surface_texture = material.surface_texture.initialized();
+        if ((material.surface_texture_array != NULL) && material.surface_texture_array->initialized()) {
+            const TextureArray::Region &r = material.surface_texture_region;
+            m.use_surface_texture_array = 1;
+            m.surface_texture_layer = r.layer;
+            m.surface_texture_rect[0] = r.uv_min[0];
+            m.surface_texture_rect[1] = r.uv_min[1];
+            m.surface_texture_rect[2] = r.uv_max[0] - r.uv_min[0];
+            m.surface_texture_rect[3] = r.uv_max[1] - r.uv_min[1];
+        }
+        
+        if ((memcmp(&m, &material_, sizeof(MaterialBlock)) == 0) && (!material_dirty_)) {
+            return;
+        }
+        
+        material_ = m;
+        glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(MaterialBlock), &material_);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        material_dirty_ = false;
+    }
+    
+    
+    void DefaultShader::bind_surface_texture(const MaterialProperties &material) {
+        if (material_.use_surface_texture_array) {
+            GLState::BindTexture(SURFACE_TEXTURE_ARRAY_UNIT, GL_TEXTURE_2D_ARRAY, material.surface_texture_array->opengl_id());
+            GLState::ActiveTexture(0);
+        }
+        else if (material.surface_texture.initialized()) {
+            // the sampler is set to this unit in Init()
+            GLState::BindTexture(SURFACE_TEXTURE_UNIT, GL_TEXTURE_2D, material.surface_texture.opengl_id());
         }
     }
     
@@ -99,6 +262,65 @@ namespace mingfx {
         phongShader_.AddVertexShaderFromFile(Platform::FindMinGfxShaderFile("default.vert"));
         phongShader_.AddFragmentShaderFromFile(Platform::FindMinGfxShaderFile("default.frag"));
         phongShader_.LinkProgram();
+        phongShader_.BindUniformBlock("PerFrameData", PER_FRAME_BLOCK_BINDING);
+        phongShader_.BindUniformBlock("MaterialData", MATERIAL_BLOCK_BINDING);
+        
+        glGenBuffers(1, &per_frame_ubo_);
+        glBindBuffer(GL_UNIFORM_BUFFER, per_frame_ubo_);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(PerFrameBlock), NULL, GL_DYNAMIC_DRAW);
+        
+        glGenBuffers(1, &material_ubo_);
+        glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialBlock), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        
+        // Buffer textures for clustered lighting, filled in only when it is used
+        GLuint buffers[3];
+        GLuint textures[3];
+        GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (int i=0; i<3; i++) {
+            upload_texture_buffer(buffers[i], 0, NULL);
+            GLState::BindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        light_data_buffer_ = buffers[0];  light_data_texture_ = textures[0];
+        cluster_buffer_ = buffers[1];     cluster_texture_ = textures[1];
+        index_buffer_ = buffers[2];       index_texture_ = textures[2];
+        
+        // Samplers of different types may not share a texture unit, even if
+        // they are never read, so give each one its own unit up front
+        phongShader_.SetUniform("SurfaceTexture", SURFACE_TEXTURE_UNIT);
+        phongShader_.SetUniform("LightData", LIGHT_DATA_TEXTURE_UNIT);
+        phongShader_.SetUniform("LightClusters", LIGHT_CLUSTERS_TEXTURE_UNIT);
+        phongShader_.SetUniform("LightIndexList", LIGHT_INDEX_TEXTURE_UNIT);
+        phongShader_.SetUniform("BatchTransforms", BATCH_TRANSFORMS_TEXTURE_UNIT);
+        phongShader_.SetUniform("SurfaceTextureArray", SURFACE_TEXTURE_ARRAY_UNIT);
+        phongShader_.StopProgram();
+        
+        model_matrix_loc_ = phongShader_.GetUniformLocation("ModelMatrix");
+        normal_matrix_loc_ = phongShader_.GetUniformLocation("NormalMatrix");
+        instanced_draw_loc_ = phongShader_.GetUniformLocation("InstancedDraw");
+        batched_draw_loc_ = phongShader_.GetUniformLocation("BatchedDraw");
+        instanced_draw_ = -1;
+        batched_draw_ = -1;
+        
+        per_frame_dirty_ = true;
+        material_dirty_ = true;
+    }
+    
+    
+    void DefaultShader::set_draw_flags(int instanced, int batched) {
+        // uniforms keep their values in the program between draws
+        if (instanced != instanced_draw_) {
+            phongShader_.SetUniform(instanced_draw_loc_, instanced);
+            instanced_draw_ = instanced;
+        }
+        if (batched != batched_draw_) {
+            phongShader_.SetUniform(batched_draw_loc_, batched);
+            batched_draw_ = batched;
+        }
     }
     
     
@@ -108,6 +330,12 @@ namespace mingfx {
     {
         UseProgram(model, view, projection, material);
         
+        // Instanced meshes carry a transform per instance, so the normal matrix
+        // must be computed in the shader
+        if (mesh->num_instances()) {
+            set_draw_flags(1, 0);
+        }
+        
         // Draw the mesh using the shader program
         mesh->Draw();
         
@@ -115,6 +343,23 @@ namespace mingfx {
     }
     
     
+    void DefaultShader::Draw(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+                             MeshBatch *batch, const MaterialProperties &material)
+    {
+        UseProgram(model, view, projection, material);
+        
+        // Each mesh in the batch has its own transform, looked up in the shader
+        batch->UpdateGPUMemory();
+        set_draw_flags(1, 1);
+        GLState::BindTexture(BATCH_TRANSFORMS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, batch->transform_texture());
+        GLState::ActiveTexture(0);
+        
+        batch->Draw();
+        
+        StopProgram();
+    }
+    
+    
     void DefaultShader::UseProgram(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
                                    const MaterialProperties &material)
     {
@@ -124,35 +369,31 @@ namespace mingfx {
         
         Matrix4 normalMatrix = (view*model).Inverse().Transpose();
         
-        for (int i=0; i<lights_.size(); i++) {
-            Point3 light_in_eye_space = view * lights_[i].position;
-            lightPositions_[3*i + 0] = light_in_eye_space[0];
-            lightPositions_[3*i + 1] = light_in_eye_space[1];
-            lightPositions_[3*i + 2] = light_in_eye_space[2];
-        }
+        // Upload the per-frame and per-material blocks only if they changed
+        // since the last draw with this shader
+        update_per_frame_block(view, projection);
+        update_material_block(material);
         
         // Activate the shader program
         phongShader_.UseProgram();
         
-        // Pass uniforms and textures from C++ to the GPU Shader Program
-        phongShader_.SetUniform("ModelMatrix", model);
-        phongShader_.SetUniform("ViewMatrix", view);
-        phongShader_.SetUniform("ProjectionMatrix", projection);
-        phongShader_.SetUniform("NormalMatrix", normalMatrix);
+        // The binding points are shared by all programs, so the blocks are
+        // attached again, which GLState skips unless another DefaultShader
+        // attached its own in between
+        GLState::BindUniformBuffer(PER_FRAME_BLOCK_BINDING, per_frame_ubo_);
+        GLState::BindUniformBuffer(MATERIAL_BLOCK_BINDING, material_ubo_);
         
-        phongShader_.SetUniform("NumLights", (int)lights_.size());
-        phongShader_.SetUniformArray3("LightPositions", lightPositions_, MAX_LIGHTS);
-        phongShader_.SetUniformArray4("LightIntensitiesAmbient", lightIas_, MAX_LIGHTS);
-        phongShader_.SetUniformArray4("LightIntensitiesDiffuse", lightIds_, MAX_LIGHTS);
-        phongShader_.SetUniformArray4("LightIntensitiesSpecular", lightIss_, MAX_LIGHTS);
-        
-        phongShader_.SetUniform("MatReflectanceAmbient", material.ambient_reflectance);
-        phongShader_.SetUniform("MatReflectanceDiffuse", material.diffuse_reflectance);
-        phongShader_.SetUniform("MatReflectanceSpecular", material.specular_reflectance);
-        phongShader_.SetUniform("MatReflectanceShininess", material.shinniness);
-        phongShader_.SetUniform("UseSurfaceTexture", material.surface_texture.initialized());
-        if (material.surface_texture.initialized()) {
-            phongShader_.BindTexture("SurfaceTexture", material.surface_texture);
+        // Pass per-draw uniforms and textures from C++ to the GPU Shader Program,
+        // using the locations and sampler units set up in Init()
+        phongShader_.SetUniform(model_matrix_loc_, model);
+        phongShader_.SetUniform(normal_matrix_loc_, normalMatrix);
+        set_draw_flags(0, 0);
+        bind_surface_texture(material);
+        if (per_frame_.use_clustered_lights) {
+            GLState::BindTexture(LIGHT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, light_data_texture_);
+            GLState::BindTexture(LIGHT_CLUSTERS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, cluster_texture_);
+            GLState::BindTexture(LIGHT_INDEX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, index_texture_);
+            GLState::ActiveTexture(0);
         }
     }
     
@@ -163,6 +404,20 @@ namespace mingfx {
     }
     
     
+    void DefaultShader::DrawWithinProgram(const Matrix4 &model, const Matrix4 &view, Mesh *mesh) {
+        phongShader_.SetUniform(model_matrix_loc_, model);
+        phongShader_.SetUniform(normal_matrix_loc_, (view*model).Inverse().Transpose());
+        set_draw_flags(mesh->num_instances() ? 1 : 0, 0);
+        mesh->Draw();
+    }
+    
+    
+    void DefaultShader::SetMaterial(const MaterialProperties &material) {
+        update_material_block(material);
+        bind_surface_texture(material);
+    }
+    
+    
     
 } // end namespace
 
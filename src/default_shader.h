@@ -14,13 +14,16 @@
 #ifndef SRC_DEFAULT_SHADER_H_
 #define SRC_DEFAULT_SHADER_H_
 
+#include "clustered_lights.h"
 #include "color.h"
 #include "point3.h"
 #include "shader_program.h"
 #include "texture2d.h"
+#include "texture_array.h"
 #include "vector3.h"
 #include "matrix4.h"
 #include "mesh.h"
+#include "mesh_batch.h"
 
 
 
@@ -58,11 +61,23 @@ namespace mingfx {
     phong_shader.Draw(M, V, P, teapot, teapot_material);
  }
  ~~~
+ 
+ Up to MAX_LIGHTS lights are passed to the shader directly in a uniform block
+ and every fragment is lit by all of them.  To support scenes with many more
+ lights (hundreds or thousands of small point lights), the shader switches to
+ clustered forward lighting when more than MAX_LIGHTS lights are added or when
+ set_clustered_lighting(true) is called.  In this mode, each light's sphere of
+ influence (see LightProperties::range) is binned into a grid of clusters
+ covering the view frustum on the CPU (see ClusteredLights), the lists are
+ uploaded to the GPU in buffer textures, and each fragment only loops over the
+ lights in its own cluster.  Lights with a range of 0 reach every cluster, so
+ give lights a finite range to get the benefit of clustering.
  */
 class DefaultShader {
 public:
     
-    /// If changed, this needs to also be changed in the glsl shader code
+    /// If changed, this needs to also be changed in the glsl shader code.  This
+    /// is the most lights supported without clustered lighting.
     static const unsigned int MAX_LIGHTS = 10;
     
     
@@ -74,6 +89,11 @@ public:
         Color specular_reflectance;
         float shinniness;
         Texture2D surface_texture;
+        // Used instead of surface_texture when not NULL: the part of a
+        // TextureArray or TextureAtlas page holding this material's image.
+        // Materials that share an array can be drawn without rebinding.
+        const TextureArray *surface_texture_array;
+        TextureArray::Region surface_texture_region;
         // eventually, this might include a normal map, etc.
         
         // defaults
@@ -81,7 +101,8 @@ public:
             ambient_reflectance(0.25f, 0.25f, 0.25f),
             diffuse_reflectance(0.6f, 0.6f, 0.6f),
             specular_reflectance(0.4f, 0.4f, 0.4f),
-            shinniness(20.0f) {}
+            shinniness(20.0f),
+            surface_texture_array(NULL) {}
     };
     
     /// Small data structure to hold per-light properties
@@ -91,13 +112,18 @@ public:
         Color ambient_intensity;
         Color diffuse_intensity;
         Color specular_intensity;
+        /// Distance at which the light's contribution falls off smoothly to
+        /// zero.  The default, 0, means the light has infinite range and no
+        /// falloff.
+        float range;
         
         // defaults
         LightProperties() :
             position(10.0f, 10.0f, 10.0f),
             ambient_intensity(0.25f, 0.25f, 0.25f),
             diffuse_intensity(0.6f, 0.6f, 0.6f),
-            specular_intensity(0.6f, 0.6f, 0.6f) {}
+            specular_intensity(0.6f, 0.6f, 0.6f),
+            range(0.0f) {}
     };
     
     /// The constructor defaults to adding a single white light to the scene at
@@ -108,11 +134,25 @@ public:
     virtual ~DefaultShader();
 
     /// Multiple lights are supported, this adds one to the end of the list.
-    /// Up to MAX_LIGHTS can be added.
+    /// If more than MAX_LIGHTS are added, clustered lighting is used.
     void AddLight(LightProperties light);
     
     /// Changes the properties for a light that was already added.
     void SetLight(int i, LightProperties light);
+    
+    /// Removes all of the lights, including the default light.
+    void ClearLights();
+    
+    /// Forces clustered lighting on even when there are MAX_LIGHTS or fewer
+    /// lights.  Clustered lighting is always used with more than MAX_LIGHTS.
+    void set_clustered_lighting(bool on);
+    
+    /// True if the next draw will use clustered lighting.
+    bool clustered_lighting() const;
+    
+    /// The cluster grid, useful for checking how many lights land in each
+    /// cluster.  Only up to date after a draw with clustered lighting on.
+    const ClusteredLights& light_clusters() const;
 
 
     /// This loads vertex and fragment shaders from files, compiles them, and
@@ -126,10 +166,24 @@ public:
     /// This starts the shader and sets its uniform variables based upon the
     /// current set of lights, the material properties passed in, and the
     /// model, view, and projection matrices.  Then, it calls mesh->Draw().
-    /// After drawing, it disables the shader.
+    /// After drawing, it disables the shader.  If the mesh has instance
+    /// transforms and colors (see Mesh::SetInstanceTransforms()), each instance
+    /// is drawn with its own transform applied after the model matrix, and its
+    /// color multiplies the ambient and diffuse reflectance of the material.
+    ///
+    /// The view, projection, and lights are stored in a uniform buffer that is
+    /// only re-uploaded when one of them changes, and the material is stored in
+    /// a second uniform buffer that is only re-uploaded when the material
+    /// changes, so drawing many meshes with the same camera is cheap.
     void Draw(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
               Mesh *mesh, const MaterialProperties &material);
     
+    /// Draws all of the visible meshes in the batch with a single draw call.
+    /// Each mesh's own transform is applied after the model matrix, and its
+    /// color multiplies the ambient and diffuse reflectance of the material.
+    void Draw(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+              MeshBatch *batch, const MaterialProperties &material);
+    
     
     /// Only needed if you do not want to draw a Mesh.
     /// This does all of the same setup for drawing that the Draw() function does
@@ -142,23 +196,118 @@ public:
     /// and after drawing your geometry to turn off the shader.
     void StopProgram();
     
+    /// For drawing many meshes in a row with one UseProgram() call, as
+    /// CommandList does.  Between UseProgram() and StopProgram(), this draws
+    /// mesh with a new model matrix, keeping the camera and material that are
+    /// already set.
+    void DrawWithinProgram(const Matrix4 &model, const Matrix4 &view, Mesh *mesh);
+    
+    /// Between UseProgram() and StopProgram(), switches to a different
+    /// material for the next DrawWithinProgram().
+    void SetMaterial(const MaterialProperties &material);
+    
     
     int num_lights();
     
     LightProperties light(int i);
     
     
+    /// Uniform buffer binding point used for the per-frame block (view,
+    /// projection, lights).  Avoid these binding points in your own shaders
+    /// if you mix them with DefaultShader.
+    static const unsigned int PER_FRAME_BLOCK_BINDING = 0;
+    
+    /// Uniform buffer binding point used for the per-material block.
+    static const unsigned int MATERIAL_BLOCK_BINDING = 1;
+    
+    /// Texture units used for the surface texture and, with clustered
+    /// lighting, for the light data, cluster, and light index buffer textures.
+    static const int SURFACE_TEXTURE_UNIT = 0;
+    static const int LIGHT_DATA_TEXTURE_UNIT = 1;
+    static const int LIGHT_CLUSTERS_TEXTURE_UNIT = 2;
+    static const int LIGHT_INDEX_TEXTURE_UNIT = 3;
+    
+    /// Texture unit used for the transforms and colors of a MeshBatch.
+    static const int BATCH_TRANSFORMS_TEXTURE_UNIT = 4;
+    
+    /// Texture unit used for MaterialProperties::surface_texture_array.
+    static const int SURFACE_TEXTURE_ARRAY_UNIT = 5;
+    
 private:
     
+    // for now, the copy constructor is private so no copies are allowed.
+    // copies would share the OpenGL buffers, which the destructor deletes.
+    DefaultShader(const DefaultShader &other);
+    DefaultShader& operator=(const DefaultShader &other);
+    
+    // CPU-side copies of the std140 uniform blocks declared in default.vert and
+    // default.frag.  The layout of these structs must match the GLSL exactly.
+    struct PerFrameBlock {
+        float view[16];
+        float projection[16];
+        float light_positions[4*MAX_LIGHTS];
+        float light_ambient[4*MAX_LIGHTS];
+        float light_diffuse[4*MAX_LIGHTS];
+        float light_specular[4*MAX_LIGHTS];
+        int num_lights;
+        int use_clustered_lights;
+        int padding[2];
+        float cluster_grid[4];
+        float cluster_depth[4];
+        float viewport[4];
+    };
+    
+    struct MaterialBlock {
+        float ambient[4];
+        float diffuse[4];
+        float specular[4];
+        float shininess;
+        int use_surface_texture;
+        int use_surface_texture_array;
+        int surface_texture_layer;
+        float surface_texture_rect[4];
+    };
+    
+    void update_light_arrays();
+    void update_per_frame_block(const Matrix4 &view, const Matrix4 &projection);
+    void update_material_block(const MaterialProperties &material);
+    // binds the material's texture or texture array, after update_material_block()
+    void bind_surface_texture(const MaterialProperties &material);
+    void update_light_clusters(const Matrix4 &view, const Matrix4 &projection);
+    // sets the InstancedDraw and BatchedDraw uniforms if they changed
+    void set_draw_flags(int instanced, int batched);
+    
     std::vector<LightProperties> lights_;
 
-    // cached raw float arrays store data to send directly to the gpu
-    // GLSL requires fixed size arrays for these
-    float lightPositions_[3*MAX_LIGHTS];
-    float lightIas_[4*MAX_LIGHTS];
-    float lightIds_[4*MAX_LIGHTS];
-    float lightIss_[4*MAX_LIGHTS];
-    void update_light_arrays();
+    // cached data to send directly to the gpu
+    PerFrameBlock per_frame_;
+    MaterialBlock material_;
+    bool per_frame_dirty_;
+    bool material_dirty_;
+    
+    GLuint per_frame_ubo_;
+    GLuint material_ubo_;
+    
+    // locations of the uniforms set on every draw, looked up once in Init()
+    GLint model_matrix_loc_;
+    GLint normal_matrix_loc_;
+    GLint instanced_draw_loc_;
+    GLint batched_draw_loc_;
+    // the values the program has for InstancedDraw and BatchedDraw
+    int instanced_draw_;
+    int batched_draw_;
+    
+    bool force_clustered_;
+    ClusteredLights clusters_;
+    std::vector<Point3> eye_positions_;
+    std::vector<float> ranges_;
+    std::vector<float> light_data_;
+    GLuint light_data_buffer_;
+    GLuint light_data_texture_;
+    GLuint cluster_buffer_;
+    GLuint cluster_texture_;
+    GLuint index_buffer_;
+    GLuint index_texture_;
     
     ShaderProgram phongShader_;
 };
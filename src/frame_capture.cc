@@ -0,0 +1,152 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "frame_capture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+
+namespace mingfx {
+
+
+FrameCapture::FrameCapture() : capturing_(false), frames_captured_(0), max_queued_frames_(8),
+    stopping_(false), frames_written_(0)
+{
+}
+
+FrameCapture::~FrameCapture() {
+    Stop();
+}
+
+
+void FrameCapture::Start(const std::string &filename_prefix) {
+    Stop();
+    prefix_ = filename_prefix;
+    frames_captured_ = 0;
+    frames_written_ = 0;
+    stopping_ = false;
+    capturing_ = true;
+    writer_ = std::thread(&FrameCapture::WriteFrames, this);
+}
+
+
+void FrameCapture::Stop() {
+    if (!capturing_) {
+        return;
+    }
+    readback_.Finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    queue_changed_.notify_all();
+    writer_.join();
+    readback_.Clear();
+    capturing_ = false;
+}
+
+
+bool FrameCapture::capturing() const {
+    return capturing_;
+}
+
+
+void FrameCapture::CaptureFrame(int width, int height) {
+    if (!capturing_) {
+        return;
+    }
+    readback_.Update();
+    int number = frames_captured_;
+    readback_.Read(PixelReadback::COLOR, 0, 0, width, height,
+        [this, number](const PixelReadback::Result &result) {
+            QueueFrame(number, result);
+        });
+    frames_captured_++;
+}
+
+
+void FrameCapture::set_max_queued_frames(int max_frames) {
+    max_queued_frames_ = std::max(max_frames, 1);
+}
+
+int FrameCapture::frames_captured() const {
+    return frames_captured_;
+}
+
+int FrameCapture::frames_written() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_written_;
+}
+
+
+void FrameCapture::QueueFrame(int number, const PixelReadback::Result &result) {
+    Frame frame;
+    frame.number = number;
+    frame.width = result.width;
+    frame.height = result.height;
+    frame.rgba = result.data;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    queue_changed_.wait(lock, [this] { return queue_.size() < max_queued_frames_; });
+    queue_.push_back(std::move(frame));
+    lock.unlock();
+    queue_changed_.notify_all();
+}
+
+
+void FrameCapture::WriteFrames() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        queue_changed_.wait(lock, [this] { return queue_.size() || stopping_; });
+        if (queue_.empty()) {
+            return;
+        }
+        Frame frame = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        queue_changed_.notify_all();
+
+        bool written = WriteFrame(frame);
+
+        lock.lock();
+        if (written) {
+            frames_written_++;
+        }
+    }
+}
+
+
+bool FrameCapture::WriteFrame(const Frame &frame) {
+    char number[16];
+    snprintf(number, sizeof(number), "%06d", frame.number);
+    std::string filename = prefix_ + number + ".ppm";
+
+    std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!out) {
+        std::cerr << "FrameCapture: Could not write " << filename << std::endl;
+        return false;
+    }
+    out << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+
+    // OpenGL returns the bottom row first, and PPM starts with the top row
+    std::vector<unsigned char> row(3 * frame.width);
+    for (int y = frame.height-1; y >= 0; y--) {
+        const unsigned char *src = &frame.rgba[4 * y * frame.width];
+        for (int x = 0; x < frame.width; x++) {
+            row[3*x + 0] = src[4*x + 0];
+            row[3*x + 1] = src[4*x + 1];
+            row[3*x + 2] = src[4*x + 2];
+        }
+        out.write((const char*)&row[0], row.size());
+    }
+    return (bool)out;
+}
+
+
+} // end namespace
@@ -0,0 +1,129 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_FRAME_CAPTURE_H_
+#define SRC_FRAME_CAPTURE_H_
+
+#include "pixel_readback.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Saves every frame drawn to a numbered image file, e.g., to make a video,
+ without slowing down the program much.  The pixels are read back from the
+ graphics card with a PixelReadback, so drawing does not wait for them, and
+ the files are written on a separate thread.  GraphicsApp has one of these,
+ available from GraphicsApp::frame_capture(), and captures each frame after
+ all of the drawing is done while it is capturing.  Example:
+ ~~~
+ void MyApp::OnSpecialKeyDown(int key, int scancode, int modifiers) {
+     if (key == GLFW_KEY_V) {
+         if (frame_capture()->capturing()) {
+             frame_capture()->Stop();
+         }
+         else {
+             frame_capture()->Start("video/frame");
+         }
+     }
+ }
+ ~~~
+ This writes video/frame000000.ppm, video/frame000001.ppm, and so on.  The
+ images are saved as binary PPM files, which are quick to write and can be
+ turned into a video with, for example:
+ ~~~
+ ffmpeg -framerate 60 -i video/frame%06d.ppm -pix_fmt yuv420p video.mp4
+ ~~~
+ */
+class FrameCapture {
+public:
+
+    FrameCapture();
+
+    /// Stops capturing if needed, which must happen while the OpenGL context
+    /// still exists.
+    virtual ~FrameCapture();
+
+    /// Starts capturing frames to files named filename_prefix followed by the
+    /// frame number and ".ppm".  The directory must already exist.
+    void Start(const std::string &filename_prefix);
+
+    /// Waits for the frames that have been captured to be read back and
+    /// written, and then stops capturing.
+    void Stop();
+
+    /// True between Start() and Stop().
+    bool capturing() const;
+
+    /// Starts reading back the current frame, width x height pixels from the
+    /// framebuffer bound to GL_READ_FRAMEBUFFER, and hands frames that have
+    /// finished reading to the thread that writes them.  Call this once per
+    /// frame after drawing and before swapping buffers.  GraphicsApp calls it
+    /// for you.
+    void CaptureFrame(int width, int height);
+
+    /// Sets how many frames may wait to be written before CaptureFrame()
+    /// waits for the writing thread to catch up, which limits the memory
+    /// used when the disk is slower than the frame rate.  The default is 8.
+    void set_max_queued_frames(int max_frames);
+
+    /// Number of frames captured since Start().
+    int frames_captured() const;
+
+    /// Number of frames written to files since Start().
+    int frames_written() const;
+
+private:
+
+    class Frame {
+    public:
+        int number;
+        int width;
+        int height;
+        std::vector<unsigned char> rgba;
+    };
+
+    void QueueFrame(int number, const PixelReadback::Result &result);
+    void WriteFrames();
+    bool WriteFrame(const Frame &frame);
+
+    // for now, the copy constructor is private so no copies are allowed.
+    FrameCapture(const FrameCapture &other);
+    FrameCapture& operator=(const FrameCapture &other);
+
+    PixelReadback readback_;
+    std::string prefix_;
+    bool capturing_;
+    int frames_captured_;
+    int max_queued_frames_;
+
+    // shared with the thread that writes the files
+    mutable std::mutex mutex_;
+    std::condition_variable queue_changed_;
+    std::deque<Frame> queue_;
+    bool stopping_;
+    int frames_written_;
+    std::thread writer_;
+};
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,509 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "frame_profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+
+namespace mingfx {
+
+// number of frames that the averages and maximums are taken over
+static const int HISTORY_LENGTH = 60;
+
+
+FrameProfiler::Series::Series(const std::string &n, MeasurementType t) :
+    name(n), type(t), frame(-1), total(0.0), next(0)
+{
+}
+
+void FrameProfiler::Series::Add(int f, double value) {
+    if (f != frame) {
+        Finish();
+        frame = f;
+    }
+    total += value;
+}
+
+void FrameProfiler::Series::Finish() {
+    if (frame < 0) {
+        return;
+    }
+    if (history.size() < HISTORY_LENGTH) {
+        history.push_back(total);
+    }
+    else {
+        history[next] = total;
+    }
+    next = (next + 1) % HISTORY_LENGTH;
+    frame = -1;
+    total = 0.0;
+}
+
+
+FrameProfiler::CPUScope::CPUScope(FrameProfiler *profiler, const char *name) :
+    profiler_(profiler->enabled() ? profiler : NULL), name_(name), start_us_(0.0)
+{
+    if (profiler_ != NULL) {
+        start_us_ = profiler_->now_us();
+    }
+}
+
+FrameProfiler::CPUScope::~CPUScope() {
+    if (profiler_ != NULL) {
+        profiler_->AddCPUTime(name_, start_us_, profiler_->now_us());
+    }
+}
+
+
+FrameProfiler::GPUScope::GPUScope(FrameProfiler *profiler, const char *name) :
+    profiler_(profiler->enabled() ? profiler : NULL)
+{
+    if (profiler_ != NULL) {
+        profiler_->BeginGPU(name);
+    }
+}
+
+FrameProfiler::GPUScope::~GPUScope() {
+    if (profiler_ != NULL) {
+        profiler_->EndGPU();
+    }
+}
+
+
+FrameProfiler::FrameProfiler() : enabled_(false), overlay_visible_(false), trace_length_(300),
+    start_(std::chrono::steady_clock::now()), frame_(0), frame_start_us_(-1.0), gpu_offset_us_(0.0),
+    frame_series_("Frame", CPU_TIME)
+{
+}
+
+FrameProfiler::~FrameProfiler() {
+    Clear();
+}
+
+
+void FrameProfiler::set_enabled(bool enabled) {
+    enabled_ = enabled;
+}
+
+bool FrameProfiler::enabled() const {
+    return enabled_;
+}
+
+void FrameProfiler::set_overlay_visible(bool visible) {
+    overlay_visible_ = visible;
+    if (visible) {
+        enabled_ = true;
+    }
+}
+
+bool FrameProfiler::overlay_visible() const {
+    return overlay_visible_;
+}
+
+void FrameProfiler::set_trace_length(int num_frames) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trace_length_ = std::max(num_frames, 0);
+    trim_trace();
+}
+
+
+double FrameProfiler::now_us() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+}
+
+int FrameProfiler::frame_count() const {
+    return frame_;
+}
+
+
+void FrameProfiler::BeginFrame() {
+    if (!enabled_) {
+        return;
+    }
+    frame_start_us_ = now_us();
+
+    // The GPU has its own clock, so find the difference between the two once
+    // per frame to line up GPU times with CPU times in the trace.  This does
+    // not wait for the GPU to finish its work.
+    GLint64 gpu_ns = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpu_ns);
+    gpu_offset_us_ = frame_start_us_ - gpu_ns / 1000.0;
+}
+
+void FrameProfiler::EndFrame() {
+    // ranges issued before the profiler was turned off still need to be read
+    read_gpu_ranges();
+    if (!enabled_) {
+        return;
+    }
+    if (!open_gpu_ranges_.empty()) {
+        std::cerr << "FrameProfiler: " << open_gpu_ranges_.size() << " BeginGPU() calls were not matched by EndGPU() this frame." << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    double end_us = now_us();
+    // skip the frame time if the profiler was turned on partway through
+    if (frame_start_us_ >= 0.0) {
+        frame_series_.Add(frame_, (end_us - frame_start_us_) / 1000.0);
+        frame_series_.Finish();
+        Event e;
+        e.name_id = -1;
+        e.thread = thread_index();
+        e.frame = frame_;
+        e.start_us = frame_start_us_;
+        e.value = end_us - frame_start_us_;
+        trace_.push_back(e);
+    }
+
+    // GPU times arrive later, so only the CPU times and counters for this
+    // frame are known to be complete
+    for (int i=0; i<series_.size(); i++) {
+        if ((series_[i].type != GPU_TIME) && (series_[i].frame == frame_)) {
+            if (series_[i].type == COUNTER) {
+                Event e;
+                e.name_id = i;
+                e.thread = thread_index();
+                e.frame = frame_;
+                e.start_us = end_us;
+                e.value = series_[i].total;
+                trace_.push_back(e);
+            }
+            series_[i].Finish();
+        }
+    }
+    frame_++;
+    frame_start_us_ = -1.0;
+    trim_trace();
+}
+
+
+int FrameProfiler::series_id(const std::string &name, MeasurementType type) {
+    // assumes mutex_ is locked
+    std::map<std::string, int>::iterator it = series_ids_[type].find(name);
+    if (it != series_ids_[type].end()) {
+        return it->second;
+    }
+    int id = (int)series_.size();
+    series_.push_back(Series(name, type));
+    series_ids_[type][name] = id;
+    return id;
+}
+
+int FrameProfiler::thread_index() {
+    // assumes mutex_ is locked; 0 is the GPU, so threads start from 1
+    std::thread::id id = std::this_thread::get_id();
+    std::map<std::thread::id, int>::iterator it = threads_.find(id);
+    if (it != threads_.end()) {
+        return it->second;
+    }
+    int index = (int)threads_.size() + 1;
+    threads_[id] = index;
+    return index;
+}
+
+
+void FrameProfiler::AddCPUTime(const std::string &name, double start_us, double end_us) {
+    if (!enabled_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Event e;
+    e.name_id = series_id(name, CPU_TIME);
+    e.thread = thread_index();
+    e.frame = frame_;
+    e.start_us = start_us;
+    e.value = end_us - start_us;
+    series_[e.name_id].Add(frame_, e.value / 1000.0);
+    trace_.push_back(e);
+}
+
+void FrameProfiler::Count(const std::string &name, double value) {
+    if (!enabled_) {
+        return;
+    }
+    // the total for the frame goes in the trace at EndFrame()
+    std::lock_guard<std::mutex> lock(mutex_);
+    series_[series_id(name, COUNTER)].Add(frame_, value);
+}
+
+
+GLuint FrameProfiler::new_query() {
+    if (free_queries_.empty()) {
+        GLuint queries[8];
+        glGenQueries(8, queries);
+        free_queries_.insert(free_queries_.end(), queries, queries + 8);
+    }
+    GLuint q = free_queries_.back();
+    free_queries_.pop_back();
+    return q;
+}
+
+void FrameProfiler::BeginGPU(const std::string &name) {
+    if (!enabled_) {
+        return;
+    }
+    // Timestamps rather than GL_TIME_ELAPSED queries, since only one of
+    // those can be active at a time and these ranges may be nested
+    GPURange r;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        r.name_id = series_id(name, GPU_TIME);
+    }
+    r.frame = frame_;
+    r.begin_query = new_query();
+    r.end_query = 0;
+    r.offset_us = gpu_offset_us_;
+    glQueryCounter(r.begin_query, GL_TIMESTAMP);
+    open_gpu_ranges_.push_back(r);
+}
+
+void FrameProfiler::EndGPU() {
+    if (open_gpu_ranges_.empty()) {
+        if (enabled_) {
+            std::cerr << "FrameProfiler: EndGPU() called without a matching BeginGPU()." << std::endl;
+        }
+        return;
+    }
+    GPURange r = open_gpu_ranges_.back();
+    open_gpu_ranges_.pop_back();
+    r.end_query = new_query();
+    glQueryCounter(r.end_query, GL_TIMESTAMP);
+    pending_gpu_ranges_.push_back(r);
+}
+
+void FrameProfiler::read_gpu_ranges() {
+    // The queries finish in the order they were issued, so stop at the first
+    // one that is not ready rather than waiting for it
+    while (!pending_gpu_ranges_.empty()) {
+        GPURange &r = pending_gpu_ranges_.front();
+        GLint available = 0;
+        glGetQueryObjectiv(r.end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 begin_ns = 0, end_ns = 0;
+        glGetQueryObjectui64v(r.begin_query, GL_QUERY_RESULT, &begin_ns);
+        glGetQueryObjectui64v(r.end_query, GL_QUERY_RESULT, &end_ns);
+        free_queries_.push_back(r.begin_query);
+        free_queries_.push_back(r.end_query);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Event e;
+        e.name_id = r.name_id;
+        e.thread = 0;
+        e.frame = r.frame;
+        e.start_us = begin_ns / 1000.0 + r.offset_us;
+        e.value = (end_ns - begin_ns) / 1000.0;
+        series_[r.name_id].Add(r.frame, e.value / 1000.0);
+        trace_.push_back(e);
+        pending_gpu_ranges_.pop_front();
+    }
+}
+
+
+void FrameProfiler::trim_trace() {
+    // assumes mutex_ is locked; GPU events are added a few frames late, so
+    // the trace is not quite in order by frame
+    while ((!trace_.empty()) && (trace_.front().frame < frame_ - trace_length_)) {
+        trace_.pop_front();
+    }
+}
+
+
+void FrameProfiler::Clear() {
+    std::vector<GLuint> queries = free_queries_;
+    for (int i=0; i<open_gpu_ranges_.size(); i++) {
+        queries.push_back(open_gpu_ranges_[i].begin_query);
+    }
+    for (int i=0; i<pending_gpu_ranges_.size(); i++) {
+        queries.push_back(pending_gpu_ranges_[i].begin_query);
+        queries.push_back(pending_gpu_ranges_[i].end_query);
+    }
+    if (!queries.empty()) {
+        glDeleteQueries((GLsizei)queries.size(), &queries[0]);
+    }
+    free_queries_.clear();
+    open_gpu_ranges_.clear();
+    pending_gpu_ranges_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    series_.clear();
+    for (int i=0; i<3; i++) {
+        series_ids_[i].clear();
+    }
+    trace_.clear();
+    frame_series_ = Series("Frame", CPU_TIME);
+}
+
+
+std::vector<FrameProfiler::Stats> FrameProfiler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Stats> result;
+    for (int i=0; i<series_.size(); i++) {
+        const Series &s = series_[i];
+        Stats st;
+        st.name = s.name;
+        st.type = s.type;
+        st.last = 0.0;
+        st.average = 0.0;
+        st.max = 0.0;
+        if (!s.history.empty()) {
+            st.last = s.history[(s.next + HISTORY_LENGTH - 1) % HISTORY_LENGTH];
+            for (int j=0; j<s.history.size(); j++) {
+                st.average += s.history[j];
+                st.max = std::max(st.max, s.history[j]);
+            }
+            st.average /= s.history.size();
+        }
+        result.push_back(st);
+    }
+    return result;
+}
+
+double FrameProfiler::average_frame_ms() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    double sum = 0.0;
+    for (int i=0; i<frame_series_.history.size(); i++) {
+        sum += frame_series_.history[i];
+    }
+    return frame_series_.history.empty() ? 0.0 : sum / frame_series_.history.size();
+}
+
+
+void FrameProfiler::DrawOverlay(NVGcontext *ctx, float x, float y) const {
+    std::vector<Stats> all = stats();
+    double frame_ms = average_frame_ms();
+
+    // one row per name, with the CPU and GPU times side by side
+    std::vector<std::string> names;
+    std::vector<const Stats*> cpu, gpu, counters;
+    for (int i=0; i<all.size(); i++) {
+        if (all[i].type == COUNTER) {
+            counters.push_back(&all[i]);
+            continue;
+        }
+        int row = (int)(std::find(names.begin(), names.end(), all[i].name) - names.begin());
+        if (row == names.size()) {
+            names.push_back(all[i].name);
+            cpu.push_back(NULL);
+            gpu.push_back(NULL);
+        }
+        if (all[i].type == CPU_TIME) {
+            cpu[row] = &all[i];
+        }
+        else {
+            gpu[row] = &all[i];
+        }
+    }
+
+    const float line_height = 16.0f;
+    const float width = 340.0f;
+    const float height = line_height * (2 + names.size() + counters.size()) + 8.0f;
+    nvgBeginPath(ctx);
+    nvgRect(ctx, x, y, width, height);
+    nvgFillColor(ctx, nvgRGBA(0, 0, 0, 180));
+    nvgFill(ctx);
+
+    nvgFontSize(ctx, 14.0f);
+    nvgFontFace(ctx, "sans");
+    nvgTextAlign(ctx, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+    nvgFillColor(ctx, nvgRGBA(255, 255, 255, 255));
+
+    char text[128];
+    float ty = y + 4.0f;
+    snprintf(text, sizeof(text), "Frame %.2f ms (%.0f fps)", frame_ms, (frame_ms > 0.0) ? 1000.0 / frame_ms : 0.0);
+    nvgText(ctx, x + 6.0f, ty, text, NULL);
+    ty += line_height;
+    nvgFillColor(ctx, nvgRGBA(180, 180, 180, 255));
+    nvgText(ctx, x + 6.0f, ty, "avg / max ms", NULL);
+    nvgText(ctx, x + 170.0f, ty, "CPU", NULL);
+    nvgText(ctx, x + 260.0f, ty, "GPU", NULL);
+    ty += line_height;
+
+    nvgFillColor(ctx, nvgRGBA(255, 255, 255, 255));
+    for (int i=0; i<names.size(); i++) {
+        nvgText(ctx, x + 6.0f, ty, names[i].c_str(), NULL);
+        if (cpu[i] != NULL) {
+            snprintf(text, sizeof(text), "%.2f / %.2f", cpu[i]->average, cpu[i]->max);
+            nvgText(ctx, x + 170.0f, ty, text, NULL);
+        }
+        if (gpu[i] != NULL) {
+            snprintf(text, sizeof(text), "%.2f / %.2f", gpu[i]->average, gpu[i]->max);
+            nvgText(ctx, x + 260.0f, ty, text, NULL);
+        }
+        ty += line_height;
+    }
+    for (int i=0; i<counters.size(); i++) {
+        nvgText(ctx, x + 6.0f, ty, counters[i]->name.c_str(), NULL);
+        snprintf(text, sizeof(text), "%.0f", counters[i]->last);
+        nvgText(ctx, x + 170.0f, ty, text, NULL);
+        ty += line_height;
+    }
+}
+
+
+// escapes a name for use as a JSON string
+static std::string JSONString(const std::string &s) {
+    std::string out = "\"";
+    for (int i=0; i<s.size(); i++) {
+        char c = s[i];
+        if ((c == '"') || (c == '\\')) {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+bool FrameProfiler::SaveChromeTrace(const std::string &filename) const {
+    std::ofstream out(filename.c_str());
+    if (!out) {
+        std::cerr << "FrameProfiler: Cannot write to file " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+    for (std::map<std::thread::id, int>::const_iterator it = threads_.begin(); it != threads_.end(); ++it) {
+        out << "," << std::endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << it->second
+            << ",\"args\":{\"name\":\"Thread " << it->second << "\"}}";
+    }
+
+    char number[64];
+    for (std::deque<Event>::const_iterator it = trace_.begin(); it != trace_.end(); ++it) {
+        const Event &e = *it;
+        std::string name = (e.name_id < 0) ? std::string("Frame") : series_[e.name_id].name;
+        out << "," << std::endl << "{\"name\":" << JSONString(name) << ",\"pid\":1,\"tid\":" << e.thread;
+        snprintf(number, sizeof(number), "%.3f", e.start_us);
+        out << ",\"ts\":" << number;
+        if ((e.name_id >= 0) && (series_[e.name_id].type == COUNTER)) {
+            snprintf(number, sizeof(number), "%g", e.value);
+            out << ",\"ph\":\"C\",\"args\":{\"value\":" << number << "}}";
+        }
+        else {
+            snprintf(number, sizeof(number), "%.3f", e.value);
+            out << ",\"ph\":\"X\",\"dur\":" << number << ",\"args\":{\"frame\":" << e.frame << "}}";
+        }
+    }
+    out << std::endl << "]}" << std::endl;
+    return true;
+}
+
+
+} // end namespace
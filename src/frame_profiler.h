@@ -0,0 +1,268 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_FRAME_PROFILER_H_
+#define SRC_FRAME_PROFILER_H_
+
+#include "opengl_headers.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Measures where the time goes in each frame, both on the CPU and on the
+ graphics card (GPU), and keeps counts of things like draw calls or triangles.
+ GraphicsApp has one of these, available from GraphicsApp::profiler(), and
+ times each stage of its main loop with it (handling events,
+ UpdateSimulation(), DrawUsingOpenGL(), drawing the NanoGUI widgets,
+ DrawUsingNanoVG(), and swapping buffers), so all that is needed to see the
+ results is to turn it on.  Parts of your own code can be timed with scopes,
+ which measure from where they are created to the end of the block.  Example:
+ ~~~
+ void MyApp::InitOpenGL() {
+     profiler()->set_enabled(true);
+     profiler()->set_overlay_visible(true);
+ }
+
+ void MyApp::UpdateSimulation(double dt) {
+     FrameProfiler::CPUScope scope(profiler(), "Physics");
+     physics_.Step(dt);
+ }
+
+ void MyApp::DrawUsingOpenGL() {
+     {
+         FrameProfiler::GPUScope scope(profiler(), "Terrain");
+         terrain_.Draw(model, view, proj);
+     }
+     profiler()->Count("Trees drawn", num_visible_trees);
+ }
+
+ void MyApp::OnSpecialKeyDown(int key, int scancode, int modifiers) {
+     if (key == GLFW_KEY_P) {
+         profiler()->SaveChromeTrace("trace.json");
+     }
+ }
+ ~~~
+
+ GPU times are measured with OpenGL timer queries, which finish a few frames
+ after they are issued, so they are read back later rather than making the
+ CPU wait for the GPU.  CPU scopes may be used on any thread, but GPU scopes
+ must be used on the thread with the OpenGL context.  When the profiler is
+ not enabled, the scopes do nothing.
+
+ The most recent frames are also kept as a trace that SaveChromeTrace() writes
+ in the JSON format used by Chrome's trace viewer (chrome://tracing) and
+ https://ui.perfetto.dev, which show each scope as a bar on a timeline, with
+ one row per thread and one for the GPU.
+ */
+class FrameProfiler {
+public:
+
+    /// Kinds of measurements
+    enum MeasurementType {
+        CPU_TIME,
+        GPU_TIME,
+        COUNTER
+    };
+
+    /// The recent values of one named measurement, in milliseconds for times.
+    /// Values are per frame, so a scope used several times in one frame
+    /// reports the total.
+    class Stats {
+    public:
+        std::string name;
+        MeasurementType type;
+        /// The value for the last frame that finished.
+        double last;
+        /// The average over the last 60 frames that had this measurement.
+        double average;
+        /// The largest of the last 60 frames that had this measurement.
+        double max;
+    };
+
+    /// Times from where it is created to the end of the enclosing block on
+    /// the CPU.
+    class CPUScope {
+    public:
+        CPUScope(FrameProfiler *profiler, const char *name);
+        ~CPUScope();
+    private:
+        FrameProfiler *profiler_;
+        const char *name_;
+        double start_us_;
+    };
+
+    /// Times the OpenGL commands issued from where it is created to the end
+    /// of the enclosing block on the GPU.  These may be nested.
+    class GPUScope {
+    public:
+        GPUScope(FrameProfiler *profiler, const char *name);
+        ~GPUScope();
+    private:
+        FrameProfiler *profiler_;
+    };
+
+
+    /// Creates a profiler that is not yet enabled.
+    FrameProfiler();
+
+    virtual ~FrameProfiler();
+
+    /// Turns measuring on or off.  It is off by default, so that it costs
+    /// nothing unless it is needed.
+    void set_enabled(bool enabled);
+
+    /// True if measurements are being taken.
+    bool enabled() const;
+
+    /// Shows or hides the overlay that GraphicsApp draws in the top left of the
+    /// window.  Showing it also enables the profiler.
+    void set_overlay_visible(bool visible);
+
+    /// True if GraphicsApp should draw the overlay.
+    bool overlay_visible() const;
+
+    /// Sets how many of the most recent frames are kept for
+    /// SaveChromeTrace().  The default is 300.
+    void set_trace_length(int num_frames);
+
+
+    /// Marks the start of a frame.  GraphicsApp calls this, so only call it if
+    /// you write your own main loop.
+    void BeginFrame();
+
+    /// Marks the end of a frame and reads back the GPU times that are ready.
+    /// GraphicsApp calls this, so only call it if you write your own main loop.
+    void EndFrame();
+
+    /// Records a CPU time from start_us to end_us, as returned by now_us().
+    /// CPUScope calls this for you.
+    void AddCPUTime(const std::string &name, double start_us, double end_us);
+
+    /// Starts timing the OpenGL commands that follow on the GPU.  Must be
+    /// matched by a call to EndGPU().  GPUScope calls these for you.
+    void BeginGPU(const std::string &name);
+
+    /// Stops timing the most recent BeginGPU().
+    void EndGPU();
+
+    /// Adds value to a counter for the current frame, e.g., the number of
+    /// triangles drawn.  Counters start from 0 every frame.
+    void Count(const std::string &name, double value = 1.0);
+
+
+    /// The recent values of every measurement, in the order they were first
+    /// recorded.
+    std::vector<Stats> stats() const;
+
+    /// The average time of the last 60 whole frames on the CPU, in milliseconds.
+    double average_frame_ms() const;
+
+    /// Microseconds since the profiler was created.
+    double now_us() const;
+
+    /// Number of frames finished since the profiler was created.
+    int frame_count() const;
+
+
+    /// Draws a table of the measurements using NanoVG, with its top left
+    /// corner at (x,y) in pixels.  GraphicsApp calls this after
+    /// DrawUsingNanoVG() when overlay_visible() is true.
+    void DrawOverlay(NVGcontext *ctx, float x, float y) const;
+
+    /// Writes the most recent frames in Chrome's trace event format.  Returns
+    /// false if the file could not be written.
+    bool SaveChromeTrace(const std::string &filename) const;
+
+    /// Discards all of the measurements and deletes the OpenGL queries, which
+    /// must happen while the OpenGL context still exists.
+    void Clear();
+
+private:
+
+    // one timed range or counter value, kept for the trace
+    class Event {
+    public:
+        int name_id;
+        int thread;  // 0 for the GPU
+        int frame;
+        double start_us;
+        double value;  // duration in microseconds, or the counter's value
+    };
+
+    // running totals and history for one named measurement
+    class Series {
+    public:
+        Series(const std::string &n, MeasurementType t);
+        void Add(int frame, double value);
+        void Finish();
+        std::string name;
+        MeasurementType type;
+        int frame;
+        double total;
+        std::vector<double> history;
+        int next;
+    };
+
+    // a GPU range that has been issued but not yet read back
+    class GPURange {
+    public:
+        int name_id;
+        int frame;
+        GLuint begin_query;
+        GLuint end_query;
+        double offset_us;  // CPU time minus GPU time when it was issued
+    };
+
+    int series_id(const std::string &name, MeasurementType type);
+    int thread_index();
+    GLuint new_query();
+    void read_gpu_ranges();
+    void trim_trace();
+
+    // read by AddCPUTime() and Count(), which may be called on any thread
+    std::atomic<bool> enabled_;
+    bool overlay_visible_;
+    int trace_length_;
+    std::chrono::steady_clock::time_point start_;
+
+    int frame_;
+    double frame_start_us_;
+    double gpu_offset_us_;
+
+    // CPU times and counters may come from any thread
+    mutable std::mutex mutex_;
+    std::vector<Series> series_;
+    std::map<std::string, int> series_ids_[3];
+    std::map<std::thread::id, int> threads_;
+    std::deque<Event> trace_;
+    Series frame_series_;
+
+    std::vector<GPURange> open_gpu_ranges_;
+    std::deque<GPURange> pending_gpu_ranges_;
+    std::vector<GLuint> free_queries_;
+};
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,148 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "frustum.h"
+
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MINGFX_FRUSTUM_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+
+namespace mingfx {
+
+
+Frustum::Frustum() {
+    for (int i=0; i<8; i++) {
+        a_[i] = b_[i] = c_[i] = 0.0f;
+        d_[i] = 1.0f;
+    }
+}
+
+Frustum::Frustum(const Matrix4 &view, const Matrix4 &projection) {
+    Set(projection * view);
+}
+
+Frustum::~Frustum() {
+}
+
+
+void Frustum::Set(const Matrix4 &m) {
+    // Gribb and Hartmann's method: each plane is the sum or difference of the
+    // last row of the matrix and one of the other rows.
+    for (int i=0; i<NUM_PLANES; i++) {
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        float a = m(3,0) + sign * m(row,0);
+        float b = m(3,1) + sign * m(row,1);
+        float c = m(3,2) + sign * m(row,2);
+        float d = m(3,3) + sign * m(row,3);
+        float len = std::sqrt(a*a + b*b + c*c);
+        if (len > 0.0f) {
+            a /= len;  b /= len;  c /= len;  d /= len;
+        }
+        a_[i] = a;  b_[i] = b;  c_[i] = c;  d_[i] = d;
+    }
+    for (int i=NUM_PLANES; i<8; i++) {
+        a_[i] = b_[i] = c_[i] = 0.0f;
+        d_[i] = 1.0f;
+    }
+}
+
+
+Frustum::Result Frustum::TestAABB(const AABB &box) const {
+    // For each plane, compare the distance from the box center to the plane
+    // with the box's "radius" projected onto the plane normal.
+    Point3 bmin = box.min();
+    Point3 bmax = box.max();
+    float cx = 0.5f * (bmin[0] + bmax[0]);
+    float cy = 0.5f * (bmin[1] + bmax[1]);
+    float cz = 0.5f * (bmin[2] + bmax[2]);
+    float ex = 0.5f * (bmax[0] - bmin[0]);
+    float ey = 0.5f * (bmax[1] - bmin[1]);
+    float ez = 0.5f * (bmax[2] - bmin[2]);
+
+#ifdef MINGFX_FRUSTUM_USE_SSE
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy), vcz = _mm_set1_ps(cz);
+    const __m128 vex = _mm_set1_ps(ex), vey = _mm_set1_ps(ey), vez = _mm_set1_ps(ez);
+    const __m128 zero = _mm_setzero_ps();
+    int outside = 0;
+    int intersects = 0;
+    for (int i=0; i<8; i+=4) {
+        __m128 a = _mm_loadu_ps(&a_[i]);
+        __m128 b = _mm_loadu_ps(&b_[i]);
+        __m128 c = _mm_loadu_ps(&c_[i]);
+        __m128 d = _mm_loadu_ps(&d_[i]);
+        // dist = a*cx + b*cy + c*cz + d
+        __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, vcx), _mm_mul_ps(b, vcy)),
+                                 _mm_add_ps(_mm_mul_ps(c, vcz), d));
+        // radius = |a|*ex + |b|*ey + |c|*ez
+        __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, a), vex),
+                                              _mm_mul_ps(_mm_andnot_ps(sign_mask, b), vey)),
+                                   _mm_mul_ps(_mm_andnot_ps(sign_mask, c), vez));
+        outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), zero));
+        intersects |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, radius), zero));
+    }
+    if (outside) {
+        return Result::OUTSIDE;
+    }
+    return intersects ? Result::INTERSECTS : Result::INSIDE;
+#else
+    Result result = Result::INSIDE;
+    for (int i=0; i<NUM_PLANES; i++) {
+        float dist = a_[i]*cx + b_[i]*cy + c_[i]*cz + d_[i];
+        float radius = std::fabs(a_[i])*ex + std::fabs(b_[i])*ey + std::fabs(c_[i])*ez;
+        if (dist + radius < 0.0f) {
+            return Result::OUTSIDE;
+        }
+        if (dist - radius < 0.0f) {
+            result = Result::INTERSECTS;
+        }
+    }
+    return result;
+#endif
+}
+
+
+bool Frustum::IsVisible(const AABB &box) const {
+    return TestAABB(box) != Result::OUTSIDE;
+}
+
+
+bool Frustum::ContainsPoint(const Point3 &p) const {
+    for (int i=0; i<NUM_PLANES; i++) {
+        if (a_[i]*p[0] + b_[i]*p[1] + c_[i]*p[2] + d_[i] < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+int Frustum::CullAABBs(const std::vector<AABB> &boxes, std::vector<int> *visible_indices) const {
+    int count = 0;
+    for (int i=0; i<boxes.size(); i++) {
+        if (IsVisible(boxes[i])) {
+            visible_indices->push_back(i);
+            count++;
+        }
+    }
+    return count;
+}
+
+
+void Frustum::plane(int i, float *abcd) const {
+    abcd[0] = a_[i];
+    abcd[1] = b_[i];
+    abcd[2] = c_[i];
+    abcd[3] = d_[i];
+}
+
+
+} // end namespace
@@ -0,0 +1,109 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_FRUSTUM_H_
+#define SRC_FRUSTUM_H_
+
+#include "aabb.h"
+#include "matrix4.h"
+#include "point3.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** The six planes of a view frustum, used to quickly test whether objects are
+ visible so that objects that are off screen can be skipped rather than drawn.
+ The planes are extracted directly from the view and projection matrices, so
+ the frustum matches exactly what the camera sees.  Example:
+ ~~~
+ Frustum frustum(view, proj);
+ if (frustum.IsVisible(AABB(teapot_mesh))) {
+     shader.Draw(Matrix4(), view, proj, &teapot_mesh, material);
+ }
+ ~~~
+
+ For scenes with many objects, put their boxes in a BVH and use
+ BVH::CullAndReturnUserData() to find the visible ones hierarchically.
+
+ The box tests check a box against four planes at a time with SSE
+ instructions when the compiler supports them, and fall back to plain C++
+ otherwise.  Tests are conservative: a box reported as visible may still be
+ just outside the frustum near a corner, but a box reported as not visible is
+ guaranteed to be outside.
+ */
+class Frustum {
+public:
+
+    /// The result of testing a box against the frustum.
+    enum class Result {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    /// Creates a frustum that contains everything.
+    Frustum();
+
+    /// Creates a frustum in world coordinates from the camera's view and
+    /// projection matrices.
+    Frustum(const Matrix4 &view, const Matrix4 &projection);
+
+    virtual ~Frustum();
+
+    /// Recomputes the planes from a combined matrix.  Passing projection * view
+    /// gives planes in world coordinates, and projection * view * model gives
+    /// planes in the model's local coordinates.
+    void Set(const Matrix4 &view_projection);
+
+    /// Classifies the box as completely outside, partially inside, or
+    /// completely inside the frustum.
+    Result TestAABB(const AABB &box) const;
+
+    /// True if any part of the box might be inside the frustum.
+    bool IsVisible(const AABB &box) const;
+
+    /// True if the point is inside the frustum.
+    bool ContainsPoint(const Point3 &p) const;
+
+    /// Tests a list of boxes, adding the index of each potentially visible box
+    /// to visible_indices.  Returns the number of visible boxes.  For large
+    /// lists, a BVH is usually faster since whole groups of boxes are culled
+    /// at once.
+    int CullAABBs(const std::vector<AABB> &boxes, std::vector<int> *visible_indices) const;
+
+    /// Returns plane i (0=left, 1=right, 2=bottom, 3=top, 4=near, 5=far) as
+    /// (a,b,c,d) with a*x + b*y + c*z + d >= 0 for points inside.  The normal
+    /// (a,b,c) has unit length.
+    void plane(int i, float *abcd) const;
+
+    /// The number of planes.
+    static const int NUM_PLANES = 6;
+
+private:
+
+    // The planes are stored as a structure of arrays, padded out to 8 planes
+    // so that two groups of 4 can be tested at a time.  The padding planes
+    // always pass.
+    float a_[8];
+    float b_[8];
+    float c_[8];
+    float d_[8];
+};
+
+
+} // end namespace
+
+#endif
@@ -6,6 +6,8 @@
 
 #include "gl_points_and_lines.h"
 
+#include "gl_state.h"
+
 namespace mingfx {
     
 #define MAX_TEX_ATTRIBS 5
@@ -78,7 +80,7 @@ void GLPointsAndLines::UpdateGPUMemory() {
             glBufferSubData(GL_ARRAY_BUFFER, colorsMemOffset, colorsMemSize, &colors_[0]);
         }
         glGenVertexArrays(1, &vertex_array_);
-        glBindVertexArray(vertex_array_);
+        GLState::BindVertexArray(vertex_array_);
         glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
         
         // attribute 0 = vertices (required)
@@ -98,7 +100,7 @@ void GLPointsAndLines::UpdateGPUMemory() {
             glDisableVertexAttribArray(attribID);
         }
         
-        glBindVertexArray(0);
+        GLState::ReleaseVertexArray();
                 
         gpu_dirty_ = false;
     }
@@ -145,7 +147,7 @@ void GLPointsAndLines::Draw(Matrix4 model_matrix, Matrix4 view_matrix, Matrix4 p
     // set defaults to pass to shaders any for optional attribs
     glVertexAttrib4f(1, 1.0, 1.0, 1.0, 1.0);  // color = opaque white
     
-    glBindVertexArray(vertex_array_);
+    GLState::BindVertexArray(vertex_array_);
     
     GLenum mode = GL_LINES;
     if (draw_mode_ == DrawMode::LINE_LOOP) {
@@ -160,7 +162,7 @@ void GLPointsAndLines::Draw(Matrix4 model_matrix, Matrix4 view_matrix, Matrix4 p
     
     glDrawArrays  (GL_LINES, 0, num_vertices());
     
-    glBindVertexArray(0);
+    GLState::ReleaseVertexArray();
 
     line_shader_.StopProgram();
 }
@@ -0,0 +1,298 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "gl_state.h"
+
+
+namespace mingfx {
+
+
+namespace {
+
+// not a valid OpenGL id or enum, used for state that is not known
+const GLuint UNKNOWN = 0xFFFFFFFF;
+
+const GLenum CAPABILITIES[] = {
+    GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_POLYGON_OFFSET_FILL
+};
+const int NUM_CAPABILITIES = sizeof(CAPABILITIES) / sizeof(GLenum);
+
+const GLenum TEXTURE_TARGETS[] = {
+    GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER
+};
+const int NUM_TEXTURE_TARGETS = sizeof(TEXTURE_TARGETS) / sizeof(GLenum);
+
+
+// The state of the current context, as far as it is known
+class State {
+public:
+    State() : keep_bound(false) {
+        Invalidate();
+    }
+
+    void Invalidate() {
+        program = UNKNOWN;
+        vertex_array = UNKNOWN;
+        active_unit = UNKNOWN;
+        for (int u=0; u<GLState::MAX_TEXTURE_UNITS; u++) {
+            for (int t=0; t<NUM_TEXTURE_TARGETS; t++) {
+                textures[u][t] = UNKNOWN;
+            }
+        }
+        for (int b=0; b<GLState::MAX_UNIFORM_BUFFER_BINDINGS; b++) {
+            uniform_buffers[b] = UNKNOWN;
+        }
+        for (int c=0; c<NUM_CAPABILITIES; c++) {
+            capabilities[c] = UNKNOWN;
+        }
+        blend_source = UNKNOWN;
+        blend_destination = UNKNOWN;
+        cull_mode = UNKNOWN;
+        depth_mask = UNKNOWN;
+    }
+
+    GLuint program;
+    GLuint vertex_array;
+    GLuint active_unit;
+    GLuint textures[GLState::MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+    GLuint uniform_buffers[GLState::MAX_UNIFORM_BUFFER_BINDINGS];
+    GLuint capabilities[NUM_CAPABILITIES];
+    GLuint blend_source;
+    GLuint blend_destination;
+    GLuint cull_mode;
+    GLuint depth_mask;
+    // a setting rather than state, so Invalidate() leaves it alone
+    bool keep_bound;
+    GLState::Counters counters;
+};
+
+State& state() {
+    static State s;
+    return s;
+}
+
+int capability_index(GLenum capability) {
+    for (int c=0; c<NUM_CAPABILITIES; c++) {
+        if (CAPABILITIES[c] == capability) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+int texture_target_index(GLenum target) {
+    for (int t=0; t<NUM_TEXTURE_TARGETS; t++) {
+        if (TEXTURE_TARGETS[t] == target) {
+            return t;
+        }
+    }
+    return -1;
+}
+
+// returns true if the call is needed, counting it either way
+bool changes(GLuint *remembered, GLuint value) {
+    if (*remembered == value) {
+        state().counters.calls_skipped++;
+        return false;
+    }
+    *remembered = value;
+    state().counters.calls_issued++;
+    return true;
+}
+
+void set_capability(GLenum capability, bool enabled) {
+    int c = capability_index(capability);
+    if ((c >= 0) && !changes(&state().capabilities[c], enabled)) {
+        return;
+    }
+    if (c < 0) {
+        state().counters.calls_issued++;
+    }
+    if (enabled) {
+        glEnable(capability);
+    }
+    else {
+        glDisable(capability);
+    }
+}
+
+} // end namespace
+
+
+
+void GLState::UseProgram(GLuint program) {
+    if (changes(&state().program, program)) {
+        glUseProgram(program);
+    }
+}
+
+
+void GLState::BindVertexArray(GLuint vertex_array) {
+    if (changes(&state().vertex_array, vertex_array)) {
+        glBindVertexArray(vertex_array);
+    }
+}
+
+
+void GLState::ActiveTexture(int unit) {
+    if (changes(&state().active_unit, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+
+void GLState::BindTexture(GLenum target, GLuint texture) {
+    GLuint unit = state().active_unit;
+    int t = texture_target_index(target);
+    if ((unit < MAX_TEXTURE_UNITS) && (t >= 0)) {
+        if (changes(&state().textures[unit][t], texture)) {
+            glBindTexture(target, texture);
+        }
+        return;
+    }
+    state().counters.calls_issued++;
+    glBindTexture(target, texture);
+}
+
+
+void GLState::BindTexture(int unit, GLenum target, GLuint texture) {
+    int t = texture_target_index(target);
+    if ((unit >= 0) && (unit < MAX_TEXTURE_UNITS) && (t >= 0) && (state().textures[unit][t] == texture)) {
+        state().counters.calls_skipped++;
+        return;
+    }
+    ActiveTexture(unit);
+    BindTexture(target, texture);
+}
+
+
+void GLState::BindUniformBuffer(GLuint binding, GLuint buffer) {
+    if (binding < MAX_UNIFORM_BUFFER_BINDINGS) {
+        if (changes(&state().uniform_buffers[binding], buffer)) {
+            glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+        }
+        return;
+    }
+    state().counters.calls_issued++;
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+
+void GLState::Enable(GLenum capability) {
+    set_capability(capability, true);
+}
+
+
+void GLState::Disable(GLenum capability) {
+    set_capability(capability, false);
+}
+
+
+void GLState::BlendFunc(GLenum source_factor, GLenum destination_factor) {
+    if ((state().blend_source == source_factor) && (state().blend_destination == destination_factor)) {
+        state().counters.calls_skipped++;
+        return;
+    }
+    state().blend_source = source_factor;
+    state().blend_destination = destination_factor;
+    state().counters.calls_issued++;
+    glBlendFunc(source_factor, destination_factor);
+}
+
+
+void GLState::CullFace(GLenum mode) {
+    if (changes(&state().cull_mode, mode)) {
+        glCullFace(mode);
+    }
+}
+
+
+void GLState::DepthMask(GLboolean write) {
+    if (changes(&state().depth_mask, write)) {
+        glDepthMask(write);
+    }
+}
+
+
+void GLState::ReleaseProgram() {
+    if (!state().keep_bound) {
+        UseProgram(0);
+    }
+}
+
+
+void GLState::ReleaseVertexArray() {
+    if (!state().keep_bound) {
+        BindVertexArray(0);
+    }
+}
+
+
+void GLState::set_keep_bound(bool keep) {
+    state().keep_bound = keep;
+}
+
+
+bool GLState::keep_bound() {
+    return state().keep_bound;
+}
+
+
+void GLState::ForgetProgram(GLuint program) {
+    // a deleted program stays in use until another one is, so its id would
+    // not be freed for reuse
+    if (state().program == program) {
+        UseProgram(0);
+    }
+}
+
+
+void GLState::ForgetVertexArray(GLuint vertex_array) {
+    // deleting the bound vertex array binds 0 in its place
+    if (state().vertex_array == vertex_array) {
+        state().vertex_array = 0;
+    }
+}
+
+
+void GLState::ForgetTexture(GLuint texture) {
+    // deleting a texture unbinds it from every unit
+    for (int u=0; u<MAX_TEXTURE_UNITS; u++) {
+        for (int t=0; t<NUM_TEXTURE_TARGETS; t++) {
+            if (state().textures[u][t] == texture) {
+                state().textures[u][t] = 0;
+            }
+        }
+    }
+}
+
+
+void GLState::ForgetBuffer(GLuint buffer) {
+    // deleting a buffer unbinds it from every binding point
+    for (int b=0; b<MAX_UNIFORM_BUFFER_BINDINGS; b++) {
+        if (state().uniform_buffers[b] == buffer) {
+            state().uniform_buffers[b] = 0;
+        }
+    }
+}
+
+
+void GLState::Invalidate() {
+    state().Invalidate();
+}
+
+
+GLState::Counters GLState::counters() {
+    return state().counters;
+}
+
+
+void GLState::ResetCounters() {
+    state().counters = Counters();
+}
+
+
+} // end namespace
@@ -0,0 +1,153 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_GL_STATE_H_
+#define SRC_GL_STATE_H_
+
+#include "opengl_headers.h"
+
+
+namespace mingfx {
+
+
+/** Remembers the OpenGL state that MinGfx sets most often (the shader
+ program, vertex array, textures, uniform buffers, and the blend, depth, and
+ cull settings) and skips calls that would set something to the value it
+ already has.  OpenGL drivers do not always check for this themselves, and
+ with a software driver every call costs time.  All of the drawing code in
+ MinGfx goes through this class, so, e.g., drawing many meshes with the same
+ texture and settings binds the texture and sets the blend and depth state
+ once.  Example:
+ ~~~
+ GLState::Disable(GL_CULL_FACE);
+ GLState::Enable(GL_BLEND);
+ GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+ GLState::BindTexture(0, GL_TEXTURE_2D, tex.opengl_id());
+ ~~~
+ Code that makes its own OpenGL calls for any of this state, e.g., raw
+ glUseProgram(), glBindVertexArray(), glBindTexture(), or glEnable() calls,
+ must either go through this class too or call Invalidate() afterwards, or
+ the remembered state no longer matches OpenGL's and later MinGfx draws may
+ skip calls they need.  GraphicsApp calls Invalidate() each frame after
+ NanoGUI draws, since NanoGUI sets the state directly.
+
+ As OpenGL code usually does, MinGfx binds program 0 and vertex array 0
+ again after drawing, so raw glVertexAttribPointer() or element array buffer
+ calls cannot change a MinGfx mesh.  Apps that draw only through MinGfx, or
+ that bind their own vertex array before such calls, can call
+ set_keep_bound(true) to leave the last program and vertex array bound, which
+ saves binding them again when the next draw uses the same ones.
+ CommandList::Submit() does this for the draws it makes.
+
+ counters() says how many calls were made and how many were skipped.
+ GraphicsApp adds these to its FrameProfiler each frame and resets them.
+ The state is for the current OpenGL context, and all calls must come from
+ the thread that the context belongs to.  Call Invalidate() after making a
+ different context current; GraphicsApp does this when it creates its
+ context.
+ */
+class GLState {
+public:
+
+    /// The number of calls to the functions below that went through to
+    /// OpenGL and the number that were skipped because nothing would change.
+    class Counters {
+    public:
+        Counters() : calls_issued(0), calls_skipped(0) {}
+        int calls_issued;
+        int calls_skipped;
+    };
+
+    /// Same as glUseProgram(), skipped if program is already in use.
+    static void UseProgram(GLuint program);
+
+    /// Same as glBindVertexArray(), skipped if vertex_array is already bound.
+    static void BindVertexArray(GLuint vertex_array);
+
+    /// Same as glActiveTexture(GL_TEXTURE0 + unit).
+    static void ActiveTexture(int unit);
+
+    /// Same as glBindTexture(), binding to the active texture unit.
+    static void BindTexture(GLenum target, GLuint texture);
+
+    /// Binds texture to the given texture unit, only changing the active
+    /// texture unit if the texture is not already bound there.
+    static void BindTexture(int unit, GLenum target, GLuint texture);
+
+    /// Same as glEnable().  GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST,
+    /// GL_SCISSOR_TEST, GL_STENCIL_TEST, and GL_POLYGON_OFFSET_FILL are
+    /// remembered, and other capabilities are always passed on.
+    static void Enable(GLenum capability);
+
+    /// Same as glDisable(), see Enable().
+    static void Disable(GLenum capability);
+
+    /// Same as glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer), skipped
+    /// if buffer is already bound to that binding point.
+    static void BindUniformBuffer(GLuint binding, GLuint buffer);
+
+    /// Same as glBlendFunc().
+    static void BlendFunc(GLenum source_factor, GLenum destination_factor);
+
+    /// Same as glCullFace().
+    static void CullFace(GLenum mode);
+
+    /// Same as glDepthMask().
+    static void DepthMask(GLboolean write);
+
+    /// Binds program 0, unless set_keep_bound(true) has been called.
+    /// ShaderProgram::StopProgram() calls this.
+    static void ReleaseProgram();
+
+    /// Binds vertex array 0, unless set_keep_bound(true) has been called.
+    /// Mesh and the other MinGfx classes call this after drawing.
+    static void ReleaseVertexArray();
+
+    /// If keep is true, ReleaseProgram() and ReleaseVertexArray() do nothing,
+    /// so the last program and vertex array stay bound; see above for when
+    /// that is safe.  The default is false.
+    static void set_keep_bound(bool keep);
+    static bool keep_bound();
+
+    /// Call these right before deleting a program, vertex array, texture, or
+    /// uniform buffer, so a new object that OpenGL gives the same id is not
+    /// mistaken for it.
+    static void ForgetProgram(GLuint program);
+    static void ForgetVertexArray(GLuint vertex_array);
+    static void ForgetTexture(GLuint texture);
+    static void ForgetBuffer(GLuint buffer);
+
+    /// Forgets all of the remembered state, so the next call for each piece
+    /// of state goes through to OpenGL.  Call this after making OpenGL calls
+    /// that change the state directly.
+    static void Invalidate();
+
+    /// The calls issued and skipped since the last ResetCounters().
+    static Counters counters();
+
+    /// Sets the counters back to zero.
+    static void ResetCounters();
+
+    /// The number of texture units whose bindings are remembered.  Binding
+    /// to higher units always goes through to OpenGL.
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    /// The number of uniform buffer binding points whose buffers are
+    /// remembered.  Binding to higher points always goes through to OpenGL.
+    static const int MAX_UNIFORM_BUFFER_BINDINGS = 16;
+};
+
+
+} // end namespace
+
+#endif
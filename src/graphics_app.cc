@@ -6,13 +6,26 @@
 
 #include "graphics_app.h"
 
+#include "gl_state.h"
+
+#ifdef MINGFX_WITH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
 
 namespace mingfx {
 
 
 
 GraphicsApp::GraphicsApp(int width, int height, const std::string &caption) :
-    graphicsInitialized_(false), lastDrawT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL)
+    graphicsInitialized_(false), lastDrawT_(0.0), simulationAccumulator_(0.0), interpolationAlpha_(0.0), redrawNeeded_(true), simulationFrameStarted_(false), simulationStop_(false), lastSimulationStepT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL),
+    texture_loader_(&job_system_), fbo_(0), resolve_fbo_(0), renderbuffers_(), headlessOpenGLInitialized_(false), eglDisplay_(NULL), eglSurface_(NULL), eglContext_(NULL)
 {
     settings_.window_width = width;
     settings_.window_height = height;
@@ -20,16 +33,38 @@ GraphicsApp::GraphicsApp(int width, int height, const std::string &caption) :
 }
 
 GraphicsApp::GraphicsApp(const GraphicsSettings& settings) :
-    graphicsInitialized_(false), lastDrawT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL)
+    graphicsInitialized_(false), lastDrawT_(0.0), simulationAccumulator_(0.0), interpolationAlpha_(0.0), redrawNeeded_(true), simulationFrameStarted_(false), simulationStop_(false), lastSimulationStepT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL),
+    texture_loader_(&job_system_), fbo_(0), resolve_fbo_(0), renderbuffers_(), headlessOpenGLInitialized_(false), eglDisplay_(NULL), eglSurface_(NULL), eglContext_(NULL)
 {
     settings_ = settings;
 }
 
 GraphicsApp::GraphicsApp() :
-    graphicsInitialized_(false), lastDrawT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL)
+    graphicsInitialized_(false), lastDrawT_(0.0), simulationAccumulator_(0.0), interpolationAlpha_(0.0), redrawNeeded_(true), simulationFrameStarted_(false), simulationStop_(false), lastSimulationStepT_(0.0), leftDown_(false), middleDown_(false), rightDown_(false), screen_(NULL), window_(NULL),
+    texture_loader_(&job_system_), fbo_(0), resolve_fbo_(0), renderbuffers_(), headlessOpenGLInitialized_(false), eglDisplay_(NULL), eglSurface_(NULL), eglContext_(NULL)
 {}
 
 GraphicsApp::~GraphicsApp() {
+    // glfwTerminate() destroys the OpenGL context, so everything that uses it
+    // must be cleaned up first
+    if (graphicsInitialized_) {
+        profiler_.Clear();
+        frame_capture_.Stop();
+        pixel_readback_.Clear();
+        texture_loader_.Clear();
+        FreeHeadlessFramebuffer();
+        if (eglDisplay_ == NULL) {
+            glfwTerminate();
+        }
+#ifdef MINGFX_WITH_EGL
+        else {
+            eglMakeCurrent(eglDisplay_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(eglDisplay_, eglContext_);
+            eglDestroySurface(eglDisplay_, eglSurface_);
+            eglTerminate(eglDisplay_);
+        }
+#endif
+    }
 }
 
 void GraphicsApp::InitGraphicsContext(const GraphicsSettings& settings) {
@@ -39,6 +74,21 @@ void GraphicsApp::InitGraphicsContext(const GraphicsSettings& settings) {
 
 void GraphicsApp::InitGraphicsContext() {
 
+    // anything remembered about the state belongs to a previous context
+    GLState::Invalidate();
+
+#ifdef MINGFX_WITH_EGL
+    // EGL can create a context without a window system, so headless apps
+    // also run on servers without an X server
+    if (settings_.headless) {
+        InitEGLContext();
+        glClearColor(0.2f, 0.25f, 0.3f, 1.0f);
+        InitHeadlessFramebuffer();
+        graphicsInitialized_ = true;
+        return;
+    }
+#endif
+
     glfwInit();
     
     glfwSetTime(0);
@@ -59,6 +109,9 @@ void GraphicsApp::InitGraphicsContext() {
     glfwWindowHint(GLFW_RESIZABLE, settings_.window_resizable);
     glfwWindowHint(GLFW_DECORATED, settings_.window_decorated);
 
+    // without EGL, headless apps get their OpenGL context from a window that
+    // is never shown
+    glfwWindowHint(GLFW_VISIBLE, settings_.headless ? GL_FALSE : GL_TRUE);
     
     
     // on OSX, glfwCreateWindow bombs if we pass caption_.c_str() in for the 3rd
@@ -94,6 +147,12 @@ void GraphicsApp::InitGraphicsContext() {
     glClearColor(0.2f, 0.25f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     
+    if (settings_.headless) {
+        InitHeadlessFramebuffer();
+        graphicsInitialized_ = true;
+        return;
+    }
+
     // Create a nanogui screen and pass the glfw pointer to initialize
     screen_ = new nanogui::Screen();
     screen_->initialize(window_, true);
@@ -155,13 +214,184 @@ void GraphicsApp::InitGraphicsContext() {
         }
     );
 
+    // the window needs to be drawn again after being uncovered
+    glfwSetWindowRefreshCallback(window_,
+        [](GLFWwindow *window) {
+            GraphicsApp *app = (GraphicsApp*)glfwGetWindowUserPointer(window);
+            app->RequestRedraw();
+        }
+    );
+
     graphicsInitialized_ = true;
  }
 
 
+void GraphicsApp::InitEGLContext() {
+#ifdef MINGFX_WITH_EGL
+    // Prefer a display on one of the graphics devices, which does not need a
+    // window system, and fall back on the default display
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLQUERYDEVICESEXTPROC query_devices =
+        (PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if ((query_devices != NULL) && (get_platform_display != NULL)) {
+        EGLDeviceEXT devices[16];
+        EGLint num_devices = 0;
+        query_devices(16, devices, &num_devices);
+        for (int i = 0; (i < num_devices) && (display == EGL_NO_DISPLAY); i++) {
+            EGLDisplay d = get_platform_display(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL);
+            if ((d != EGL_NO_DISPLAY) && eglInitialize(d, NULL, NULL)) {
+                display = d;
+            }
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        EGLDisplay d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if ((d != EGL_NO_DISPLAY) && eglInitialize(d, NULL, NULL)) {
+            display = d;
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        std::cerr << "Failed to initialize EGL" << std::endl;
+        exit(-1);
+    }
+
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint num_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || (num_configs == 0) ||
+        !eglBindAPI(EGL_OPENGL_API))
+    {
+        std::cerr << "Failed to find an EGL config for OpenGL" << std::endl;
+        eglTerminate(display);
+        exit(-1);
+    }
+
+    // drawing goes to the headless framebuffer, so this surface is just to
+    // have something to make current
+    const EGLint pbuffer_attribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, settings_.gl_version_major,
+        EGL_CONTEXT_MINOR_VERSION_KHR, settings_.gl_version_minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+
+    if ((surface == EGL_NO_SURFACE) || (context == EGL_NO_CONTEXT) ||
+        !eglMakeCurrent(display, surface, surface, context))
+    {
+        std::cerr << "Failed to create EGL context" << std::endl;
+        eglTerminate(display);
+        exit(-1);
+    }
+    eglDisplay_ = display;
+    eglSurface_ = surface;
+    eglContext_ = context;
+
+#if defined(NANOGUI_GLAD)
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress))
+       throw std::runtime_error("Could not initialize GLAD!");
+    glGetError(); // pull and ignore unhandled errors like GL_INVALID_ENUM
+#endif
+#endif
+}
+
+
+void GraphicsApp::InitHeadlessFramebuffer() {
+    FreeHeadlessFramebuffer();
+
+    int w = settings_.window_width;
+    int h = settings_.window_height;
+    int samples = 0;
+    if (settings_.multi_samples > 0) {
+        GLint max_samples = 0;
+        glGetIntegerv(GL_MAX_SAMPLES, &max_samples);
+        samples = std::min(settings_.multi_samples, (int)max_samples);
+    }
+
+    glGenRenderbuffers((samples > 0) ? 4 : 2, renderbuffers_);
+
+    glGenFramebuffers(1, &resolve_fbo_);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo_);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers_[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers_[1]);
+
+    if (samples > 0) {
+        glGenFramebuffers(1, &fbo_);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[2]);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers_[2]);
+        glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers_[3]);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, w, h);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers_[3]);
+    }
+    else {
+        fbo_ = resolve_fbo_;
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "GraphicsApp: The headless framebuffer of size " << w << "x" << h
+            << " is not complete." << std::endl;
+    }
+    glViewport(0, 0, w, h);
+}
+
+
+void GraphicsApp::FreeHeadlessFramebuffer() {
+    if (fbo_ != resolve_fbo_) {
+        glDeleteFramebuffers(1, &fbo_);
+    }
+    if (resolve_fbo_ != 0) {
+        glDeleteFramebuffers(1, &resolve_fbo_);
+        glDeleteRenderbuffers(4, renderbuffers_);
+    }
+    fbo_ = 0;
+    resolve_fbo_ = 0;
+    for (int i = 0; i < 4; i++) {
+        renderbuffers_[i] = 0;
+    }
+}
+
+
+void GraphicsApp::ResolveHeadlessFramebuffer() {
+    if (fbo_ != resolve_fbo_) {
+        int w = settings_.window_width;
+        int h = settings_.window_height;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo_);
+        glBlitFramebuffer(0, 0, w, h, 0, 0, w, h,
+                          GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+    }
+}
+
+
     
 void GraphicsApp::Run() {
 
+    if (settings_.headless) {
+        std::cerr << "GraphicsApp: Use RunHeadless() rather than Run() for headless apps." << std::endl;
+        return;
+    }
+
     if (!graphicsInitialized_) {
         InitGraphicsContext();        
     }
@@ -172,46 +402,278 @@ void GraphicsApp::Run() {
     
     // Main program loop
     glfwSetTime(0.0);
+    redrawNeeded_ = true;
+    if (settings_.threaded_simulation) {
+        simulationStop_ = false;
+        simulationThread_ = std::thread(&GraphicsApp::RunSimulationThread, this);
+    }
     while (!glfwWindowShouldClose(window_)) {
+        // When drawing on demand, sleep until there is input, a redraw is
+        // requested, or it is time for the next simulation step.  Reads in
+        // progress are polled for instead, since they finish on their own.
+        bool waiting = settings_.redraw_on_demand && !redrawNeeded_ && (pixel_readback_.num_pending() == 0) &&
+            (texture_loader_.num_pending() == 0);
+        if (waiting && (settings_.fixed_timestep > 0.0) && !settings_.threaded_simulation) {
+            glfwWaitEventsTimeout(std::max(settings_.fixed_timestep - simulationAccumulator_, 0.0));
+        }
+        else if (waiting) {
+            glfwWaitEvents();
+        }
 
-        // Poll for new user input events and call callbacks
-        glfwPollEvents();
+        std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+        profiler_.BeginFrame();
+
+        // Poll for new user input events and call callbacks, including
+        // those for pixels read back from earlier frames
+        {
+            FrameProfiler::CPUScope scope(&profiler_, "Events");
+            pixel_readback_.Update();
+            if (texture_loader_.Update() > 0) {
+                redrawNeeded_ = true;
+            }
+            glfwPollEvents();
+        }
 
         // Update the simulation, i.e., perform all non-graphics updates that
         // should happen each frame.
-        double now = glfwGetTime();
-        UpdateSimulation(now-lastDrawT_);
-        lastDrawT_ = now;
-        
-        // Clear is handled in this mainloop so that drawing works even for
-        // users who do not want to fill in DrawUsingOpenGL()
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-        // NanoGUI sets these to something other than the OpenGL defaults, which
-        // screws up most OpenGL programs, so we need to reset them each frame here.
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        glEnable(GL_DEPTH_TEST);
+        {
+            FrameProfiler::CPUScope scope(&profiler_, "UpdateSimulation");
+            double now = glfwGetTime();
+            if (settings_.threaded_simulation && (settings_.fixed_timestep > 0.0)) {
+                double alpha = (now - lastSimulationStepT_) / settings_.fixed_timestep;
+                interpolationAlpha_ = std::min(std::max(alpha, 0.0), 1.0);
+            }
+            else if (settings_.threaded_simulation) {
+                // the simulation thread takes one step per frame
+                {
+                    std::lock_guard<std::mutex> lock(simulationMutex_);
+                    simulationFrameStarted_ = true;
+                }
+                simulationCondition_.notify_one();
+            }
+            else if (settings_.fixed_timestep > 0.0) {
+                double step = settings_.fixed_timestep;
+                simulationAccumulator_ += now - lastDrawT_;
+                int num_steps = 0;
+                while ((simulationAccumulator_ >= step) && (num_steps < settings_.max_simulation_steps)) {
+                    UpdateSimulation(step);
+                    simulationAccumulator_ -= step;
+                    num_steps++;
+                }
+                // too far behind to catch up, so drop the whole steps left over
+                simulationAccumulator_ = fmod(simulationAccumulator_, step);
+                interpolationAlpha_ = simulationAccumulator_ / step;
+            }
+            else {
+                UpdateSimulation(now-lastDrawT_);
+            }
+            lastDrawT_ = now;
+        }
+
+        // Frames that are not drawn are not counted by the profiler; the
+        // events and simulation times go with the next frame that is drawn
+        if (settings_.redraw_on_demand && !redrawNeeded_) {
+            continue;
+        }
+        redrawNeeded_ = false;
         
-        // Users may fill this in to do raw OpenGL rendering
-        DrawUsingOpenGL();
+        {
+            FrameProfiler::CPUScope cpu_scope(&profiler_, "DrawUsingOpenGL");
+            FrameProfiler::GPUScope gpu_scope(&profiler_, "DrawUsingOpenGL");
+
+            // Clear is handled in this mainloop so that drawing works even for
+            // users who do not want to fill in DrawUsingOpenGL()
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+            // NanoGUI sets these to something other than the OpenGL defaults, which
+            // screws up most OpenGL programs, so we need to reset them each frame here.
+            GLState::Enable(GL_CULL_FACE);
+            GLState::CullFace(GL_BACK);
+            GLState::Enable(GL_DEPTH_TEST);
+
+            // Users may fill this in to do raw OpenGL rendering
+            DrawUsingOpenGL();
+
+            ReadRequestedZValues();
+        }
 
         // This renders the nanogui widgets created on screen_
-        screen_->drawContents();
-        screen_->drawWidgets();
+        {
+            FrameProfiler::CPUScope cpu_scope(&profiler_, "NanoGUI");
+            FrameProfiler::GPUScope gpu_scope(&profiler_, "NanoGUI");
+            screen_->drawContents();
+            screen_->drawWidgets();
+        }
+        
+        // Users may fill this in to do additional 2D rendering with the NanoVG library.
+        // NanoVG sends its drawing to the GPU when the widgets are drawn, so the
+        // GPU time for this is included in the NanoGUI time.
+        {
+            FrameProfiler::CPUScope scope(&profiler_, "DrawUsingNanoVG");
+            DrawUsingNanoVG(screen_->nvgContext());
+            if (profiler_.overlay_visible()) {
+                profiler_.DrawOverlay(screen_->nvgContext(), 10.0f, 10.0f);
+            }
+        }
         
-        // Users may fill this in to do additional 2D rendering with the NanoVG library
-        DrawUsingNanoVG(screen_->nvgContext());
+        // NanoGUI and NanoVG set the OpenGL state directly
+        GLState::Invalidate();
         
-        glfwSwapBuffers(window_);
+        if (frame_capture_.capturing()) {
+            FrameProfiler::CPUScope scope(&profiler_, "FrameCapture");
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+            glReadBuffer(GL_BACK);
+            frame_capture_.CaptureFrame(framebuffer_width(), framebuffer_height());
+        }
+
+        {
+            FrameProfiler::CPUScope scope(&profiler_, "SwapBuffers");
+            glfwSwapBuffers(window_);
+        }
+
+        if (settings_.max_frame_rate > 0.0) {
+            FrameProfiler::CPUScope scope(&profiler_, "FrameRateCap");
+            std::chrono::duration<double> frame_time(1.0 / settings_.max_frame_rate);
+            std::this_thread::sleep_until(frame_start +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_time));
+        }
+
+        GLState::Counters gl_calls = GLState::counters();
+        profiler_.Count("GL state calls issued", gl_calls.calls_issued);
+        profiler_.Count("GL state calls skipped", gl_calls.calls_skipped);
+        GLState::ResetCounters();
+        profiler_.EndFrame();
     }
-    
-    glfwTerminate();
+
+    if (settings_.threaded_simulation) {
+        {
+            std::lock_guard<std::mutex> lock(simulationMutex_);
+            simulationStop_ = true;
+        }
+        simulationCondition_.notify_one();
+        simulationThread_.join();
+    }
+
+    // The window goes away along with the OpenGL context in the destructor,
+    // after any graphics objects owned by subclasses have been deleted
+    glfwHideWindow(window_);
+}
+
+
+void GraphicsApp::RunSimulationThread() {
+    double step = settings_.fixed_timestep;
+    double last_t = glfwGetTime();
+    double next_t = last_t + step;
+    while (true) {
+        if (step > 0.0) {
+            // sleep until the next step is due, or drop the time that
+            // cannot be caught up on, as in Run()
+            double now = glfwGetTime();
+            if (now < next_t) {
+                std::unique_lock<std::mutex> lock(simulationMutex_);
+                simulationCondition_.wait_for(lock, std::chrono::duration<double>(next_t - now),
+                                              [this] { return simulationStop_; });
+                if (simulationStop_) {
+                    return;
+                }
+                continue;
+            }
+            if (now - next_t > step * settings_.max_simulation_steps) {
+                next_t = now;
+            }
+            next_t += step;
+        }
+        else {
+            std::unique_lock<std::mutex> lock(simulationMutex_);
+            simulationCondition_.wait(lock, [this] { return simulationFrameStarted_ || simulationStop_; });
+            if (simulationStop_) {
+                return;
+            }
+            simulationFrameStarted_ = false;
+        }
+
+        FrameProfiler::CPUScope scope(&profiler_, "UpdateSimulation");
+        double now = glfwGetTime();
+        if (step > 0.0) {
+            UpdateSimulation(step);
+            lastSimulationStepT_ = next_t - step;
+        }
+        else {
+            UpdateSimulation(now - last_t);
+            lastSimulationStepT_ = now;
+        }
+        last_t = now;
+    }
+}
+
+
+void GraphicsApp::RunHeadless(int num_frames, double dt) {
+
+    if (!settings_.headless) {
+        std::cerr << "GraphicsApp: RunHeadless() needs GraphicsSettings::headless to be set." << std::endl;
+        return;
+    }
+
+    if (!graphicsInitialized_) {
+        InitGraphicsContext();
+    }
+
+    if (!headlessOpenGLInitialized_) {
+        InitOpenGL();
+        headlessOpenGLInitialized_ = true;
+    }
+
+    // There is no window to swap, so frames are drawn back to back without
+    // waiting for vsync
+    for (int i = 0; i < num_frames; i++) {
+        profiler_.BeginFrame();
+
+        pixel_readback_.Update();
+        texture_loader_.Update();
+
+        {
+            FrameProfiler::CPUScope scope(&profiler_, "UpdateSimulation");
+            UpdateSimulation(dt);
+        }
+
+        {
+            FrameProfiler::CPUScope cpu_scope(&profiler_, "DrawUsingOpenGL");
+            FrameProfiler::GPUScope gpu_scope(&profiler_, "DrawUsingOpenGL");
+
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+            glViewport(0, 0, settings_.window_width, settings_.window_height);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+            GLState::Enable(GL_CULL_FACE);
+            GLState::CullFace(GL_BACK);
+            GLState::Enable(GL_DEPTH_TEST);
+
+            DrawUsingOpenGL();
+
+            ReadRequestedZValues();
+        }
+
+        if (frame_capture_.capturing()) {
+            FrameProfiler::CPUScope scope(&profiler_, "FrameCapture");
+            ResolveHeadlessFramebuffer();
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, resolve_fbo_);
+            frame_capture_.CaptureFrame(settings_.window_width, settings_.window_height);
+        }
+
+        GLState::Counters gl_calls = GLState::counters();
+        profiler_.Count("GL state calls issued", gl_calls.calls_issued);
+        profiler_.Count("GL state calls skipped", gl_calls.calls_skipped);
+        GLState::ResetCounters();
+        profiler_.EndFrame();
+    }
+
+    ResolveHeadlessFramebuffer();
 }
     
 
 
 bool GraphicsApp::cursor_pos_glfw_cb(double x, double y) {
+    redrawNeeded_ = true;
     
     if (screen_->cursorPosCallbackEvent(x,y)) {
         // event was handled by nanogui
@@ -244,6 +706,7 @@ bool GraphicsApp::cursor_pos_glfw_cb(double x, double y) {
 }
 
 bool GraphicsApp::mouse_button_glfw_cb(int button, int action, int modifiers) {
+    redrawNeeded_ = true;
     if (screen_->mouseButtonCallbackEvent(button, action, modifiers)) {
         return true;
     }
@@ -291,6 +754,7 @@ bool GraphicsApp::mouse_button_glfw_cb(int button, int action, int modifiers) {
 
 
 bool GraphicsApp::key_glfw_cb(int key, int scancode, int action, int modifiers) {
+    redrawNeeded_ = true;
     if (screen_->keyCallbackEvent(key, scancode, action, modifiers)) {
         return true;
     }
@@ -326,6 +790,7 @@ bool GraphicsApp::key_glfw_cb(int key, int scancode, int action, int modifiers)
 
 
 bool GraphicsApp::char_glfw_cb(unsigned int codepoint) {
+    redrawNeeded_ = true;
     if (screen_->charCallbackEvent(codepoint)) {
         return true;
     }
@@ -338,6 +803,7 @@ bool GraphicsApp::char_glfw_cb(unsigned int codepoint) {
 
 
 bool GraphicsApp::drop_glfw_cb(int count, const char **filenames) {
+    redrawNeeded_ = true;
     if (screen_->dropCallbackEvent(count, filenames)) {
         return true;
     }
@@ -350,6 +816,7 @@ bool GraphicsApp::drop_glfw_cb(int count, const char **filenames) {
 
 
 bool GraphicsApp::scroll_glfw_cb(double x, double y) {
+    redrawNeeded_ = true;
     if (screen_->scrollCallbackEvent(x,y)) {
         return true;
     }
@@ -362,6 +829,7 @@ bool GraphicsApp::scroll_glfw_cb(double x, double y) {
 
 
 bool GraphicsApp::resize_glfw_cb(int width, int height) {
+    redrawNeeded_ = true;
     if (screen_->resizeCallbackEvent(width, height)) {
         return true;
     }
@@ -377,50 +845,77 @@ bool GraphicsApp::resize_glfw_cb(int width, int height) {
 
 
 bool GraphicsApp::IsKeyDown(int key) {
+    if (window_ == NULL) {
+        return false;
+    }
     return (glfwGetKey(window_, key) == GLFW_PRESS);
 }
 
 bool GraphicsApp::IsLeftMouseDown() {
+    if (window_ == NULL) {
+        return false;
+    }
     return (glfwGetMouseButton(window_, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS);
 }
 
 
 bool GraphicsApp::IsMiddleMouseDown() {
+    if (window_ == NULL) {
+        return false;
+    }
     return (glfwGetMouseButton(window_, GLFW_MOUSE_BUTTON_MIDDLE) == GLFW_PRESS);
 }
 
 
 bool GraphicsApp::IsRightMouseDown() {
+    if (window_ == NULL) {
+        return false;
+    }
     return (glfwGetMouseButton(window_, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS);
 }
 
     
 
 float GraphicsApp::aspect_ratio() {
+    if (settings_.headless) {
+        return (float)settings_.window_width/(float)settings_.window_height;
+    }
     int width, height;
     glfwGetFramebufferSize(window_, &width, &height);
     return (float)width/(float)height;
 }
     
 int GraphicsApp::window_width() {
+    if (settings_.headless) {
+        return settings_.window_width;
+    }
     int width, height;
     glfwGetWindowSize(window_, &width, &height);
     return width;
 }
 
 int GraphicsApp::framebuffer_width() {
+    if (settings_.headless) {
+        return settings_.window_width;
+    }
     int width, height;
     glfwGetFramebufferSize(window_, &width, &height);
     return width;
 }
 
 int GraphicsApp::window_height() {
+    if (settings_.headless) {
+        return settings_.window_height;
+    }
     int width, height;
     glfwGetWindowSize(window_, &width, &height);
     return height;
 }
 
 int GraphicsApp::framebuffer_height() {
+    if (settings_.headless) {
+        return settings_.window_height;
+    }
     int width, height;
     glfwGetFramebufferSize(window_, &width, &height);
     return height;
@@ -463,6 +958,40 @@ float GraphicsApp::ReadZValueAtPixel(const Point2 &pointInPixels, unsigned int w
     glReadPixels((int)x, (int)y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &z);
     return z;
 }
+
+void GraphicsApp::ReadZValueAtPixelAsync(const Point2 &pointInPixels, const std::function<void(float)> &callback) {
+    // scale screen points to framebuffer size, same as ReadZValueAtPixel()
+    float x01 = pointInPixels[0] / window_width();
+    float y01 = 1.0f - pointInPixels[1] / window_height();
+
+    ZValueRequest request;
+    request.x = (int)(x01 * (float)framebuffer_width());
+    request.y = (int)(y01 * (float)framebuffer_height());
+    request.callback = callback;
+    z_value_requests_.push_back(request);
+}
+
+void GraphicsApp::ReadRequestedZValues() {
+    if (z_value_requests_.empty()) {
+        return;
+    }
+    if (settings_.headless) {
+        // multisampled depth buffers have to be resolved before reading
+        ResolveHeadlessFramebuffer();
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, resolve_fbo_);
+    }
+    else {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+    for (int i=0; i<z_value_requests_.size(); i++) {
+        std::function<void(float)> callback = z_value_requests_[i].callback;
+        pixel_readback_.Read(PixelReadback::DEPTH, z_value_requests_[i].x, z_value_requests_[i].y, 1, 1,
+            [callback](const PixelReadback::Result &result) {
+                callback(result.depth(0, 0));
+            });
+    }
+    z_value_requests_.clear();
+}
     
     
 nanogui::Screen* GraphicsApp::screen() {
@@ -472,12 +1001,86 @@ nanogui::Screen* GraphicsApp::screen() {
 GLFWwindow* GraphicsApp::window() {
     return window_;
 }
+
+FrameProfiler* GraphicsApp::profiler() {
+    return &profiler_;
+}
+
+PixelReadback* GraphicsApp::pixel_readback() {
+    return &pixel_readback_;
+}
+
+FrameCapture* GraphicsApp::frame_capture() {
+    return &frame_capture_;
+}
+
+JobSystem* GraphicsApp::job_system() {
+    return &job_system_;
+}
+
+TextureLoader* GraphicsApp::texture_loader() {
+    return &texture_loader_;
+}
+
+bool GraphicsApp::headless() {
+    return settings_.headless;
+}
+
+void GraphicsApp::RequestRedraw() {
+    redrawNeeded_ = true;
+    // wake up Run() if it is waiting for events
+    if (window_ != NULL) {
+        glfwPostEmptyEvent();
+    }
+}
+
+double GraphicsApp::interpolation_alpha() {
+    return interpolationAlpha_;
+}
+
+
+bool GraphicsApp::ReadPixels(std::vector<unsigned char> *rgba) {
+    if (!graphicsInitialized_) {
+        return false;
+    }
+    int w = framebuffer_width();
+    int h = framebuffer_height();
+    rgba->resize(4 * w * h);
+    if (rgba->empty()) {
+        return true;
+    }
+
+    GLint prev_fbo = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prev_fbo);
+    if (settings_.headless) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, resolve_fbo_);
+    }
+    else {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glReadBuffer(GL_BACK);
+    }
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &(*rgba)[0]);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, prev_fbo);
+
+    // OpenGL returns the bottom row first
+    int row_bytes = 4 * w;
+    for (int y = 0; y < h/2; y++) {
+        std::swap_ranges(rgba->begin() + y * row_bytes, rgba->begin() + (y+1) * row_bytes,
+                         rgba->begin() + (h-1-y) * row_bytes);
+    }
+    return true;
+}
     
     
 void GraphicsApp::ResizeWindow(int new_width, int new_height) {
-    glfwSetWindowSize(window_, new_width, new_height);
+    if (!settings_.headless) {
+        glfwSetWindowSize(window_, new_width, new_height);
+    }
     settings_.window_width = new_width;
     settings_.window_height = new_height;
+    if (settings_.headless && graphicsInitialized_) {
+        InitHeadlessFramebuffer();
+    }
     OnWindowResize(new_width, new_height);
 }
 
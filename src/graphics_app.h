@@ -20,8 +20,19 @@
 #include <nanogui/nanogui.h>
 #pragma warning ( pop )
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
-
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_capture.h"
+#include "frame_profiler.h"
+#include "job_system.h"
+#include "pixel_readback.h"
+#include "texture_loader.h"
 #include "point2.h"
 #include "vector2.h"
 
@@ -153,7 +164,13 @@ public:
             window_y_pos(0),
             window_caption("MinGfx"),
             window_resizable(true),
-            window_decorated(true) {}
+            window_decorated(true),
+            headless(false),
+            fixed_timestep(0.0),
+            max_simulation_steps(5),
+            max_frame_rate(0.0),
+            redraw_on_demand(false),
+            threaded_simulation(false) {}
 
         int gl_version_major;
         int gl_version_minor;
@@ -172,6 +189,48 @@ public:
         std::string window_caption;
         bool window_resizable;
         bool window_decorated;
+
+        /// Renders offscreen into a framebuffer of window_width x
+        /// window_height pixels rather than opening a window, e.g., for
+        /// rendering images in batch jobs on servers without a display.
+        /// Needing no display at all requires MinGfx to be built with EGL
+        /// (the WITH_EGL CMake option, on by default where libEGL is found);
+        /// otherwise a hidden GLFW window is used, which still needs an X11 or
+        /// Wayland display, e.g., from xvfb-run.  See GraphicsApp::RunHeadless().
+        bool headless;
+
+        /// When > 0, UpdateSimulation() is always called with this dt, in
+        /// seconds, as many times per frame as needed to keep up with real
+        /// time, and GraphicsApp::interpolation_alpha() tells how far the
+        /// current time is between the last step and the next one.  When 0,
+        /// UpdateSimulation() is called once per frame with the time since
+        /// the last frame.
+        double fixed_timestep;
+
+        /// With a fixed_timestep, the most steps taken in one frame.  If the
+        /// simulation falls further behind than this, the extra time is
+        /// dropped rather than making every following frame slower.
+        int max_simulation_steps;
+
+        /// When > 0, Run() waits as needed to draw no more than this many
+        /// frames per second.
+        double max_frame_rate;
+
+        /// When true, Run() only draws a new frame after user input, a
+        /// resize, or a call to GraphicsApp::RequestRedraw(), and otherwise
+        /// waits without using the CPU.  UpdateSimulation() is still called
+        /// every fixed_timestep when one is set, and can call RequestRedraw()
+        /// when something changes.
+        bool redraw_on_demand;
+
+        /// When true, Run() calls UpdateSimulation() on a thread of its own,
+        /// so that it runs at the same time as the drawing for the previous
+        /// step.  UpdateSimulation() must not make OpenGL calls then, and
+        /// should hand its results to the drawing code with a TripleBuffer.
+        /// With a fixed_timestep, it is called every fixed_timestep seconds;
+        /// otherwise, it is called once for each frame that is drawn.  The
+        /// On*() input callbacks are still called on the main thread.
+        bool threaded_simulation;
     };
 
 
@@ -202,7 +261,10 @@ public:
     GraphicsApp();
 
 
-    /// The destructor will shutdown the graphics system and window
+    /// The destructor will shutdown the graphics system and window.  This
+    /// happens after the destructors of any subclasses, so meshes, textures,
+    /// and other graphics objects that are members of a subclass can still
+    /// free their OpenGL memory.
     virtual ~GraphicsApp();
 
 
@@ -324,11 +386,74 @@ public:
      any user input events by calling the On*() callback methods, 2. call
      UpdateSimulation(), and 3. call the two Draw*() methods.  Note that
      Run() does not return until the user closes the app and the program
-     is ready to shutdown.
+     is ready to shutdown.  Headless apps use RunHeadless() instead.
+     The timing of the loop can be changed with the fixed_timestep,
+     max_frame_rate, and redraw_on_demand GraphicsSettings.
      */
     virtual void Run();
 
     
+    /** Use this instead of Run() for apps created with
+     GraphicsSettings::headless set.  It renders num_frames frames as fast
+     as possible into an offscreen framebuffer and then returns, so that the
+     result can be read back with ReadPixels().  It may be called again to
+     render more frames.  The first call initializes the graphics context if
+     needed and calls InitOpenGL().  Each frame calls UpdateSimulation(dt)
+     and DrawUsingOpenGL(); NanoGUI and NanoVG are not available, and there
+     is no user input.  The same dt is passed every frame, so animations
+     come out the same no matter how long each frame takes to render.
+     
+     With MinGfx built with EGL (WITH_EGL, on by default where libEGL is
+     found), the OpenGL context is created without any window system, so
+     this runs on servers and CI machines with no display.  Built without
+     EGL, e.g., on Windows and macOS, the context comes from a hidden GLFW
+     window, so a display is still needed.
+     
+     The offscreen framebuffer is bound before DrawUsingOpenGL() is called,
+     so code that renders into framebuffers of its own should restore the
+     one that was bound (GL_DRAW_FRAMEBUFFER_BINDING) rather than binding 0.
+     Example:
+     ~~~
+     GraphicsApp::GraphicsSettings settings;
+     settings.headless = true;
+     settings.window_width = 512;
+     settings.window_height = 512;
+     MyApp app(settings);
+     app.RunHeadless(1);
+     std::vector<unsigned char> rgba;
+     app.ReadPixels(&rgba);  // 512*512*4 bytes, top row first
+     ~~~
+     */
+    virtual void RunHeadless(int num_frames, double dt = 1.0/60.0);
+
+    /** Reads the color of every pixel of the frame that was last drawn, 4
+     bytes per pixel in RGBA order, with the top row of the image first.  In
+     headless mode this reads the offscreen framebuffer after RunHeadless().
+     Otherwise, it reads the back buffer, so call it at the end of
+     DrawUsingOpenGL().  The image is framebuffer_width() x
+     framebuffer_height() pixels.  Returns false if there is no graphics
+     context yet.
+     */
+    virtual bool ReadPixels(std::vector<unsigned char> *rgba);
+
+    /// True if the app renders offscreen rather than to a window, see
+    /// GraphicsSettings::headless.
+    virtual bool headless();
+
+    /// Asks Run() to draw another frame when GraphicsSettings::redraw_on_demand
+    /// is set.  This may be called from any thread.
+    virtual void RequestRedraw();
+
+    /** With a GraphicsSettings::fixed_timestep, the fraction of a step, from
+     0 to 1, that has gone by since the last call to UpdateSimulation(), as of
+     the start of the current frame.
+     Drawing the simulation state interpolated this far between the previous
+     step and the latest one makes motion smooth even when the frame rate
+     and the simulation rate differ.  Always 0 without a fixed timestep.
+     */
+    virtual double interpolation_alpha();
+
+    
     /** Called at the beginning of the Run() method.  Override this to initialize
       any NanoGUI graphics related properties including 2D windows, buttons,
       sliders, etc...
@@ -436,15 +561,56 @@ public:
     virtual Vector2 NormalizedDeviceCoordsToPixels(const Vector2 &pointInNDC);
     
     /// Returns the z buffer value under the specified pixel.  z will be 0 at
-    /// the near plane and +1 at the far plane.
+    /// the near plane and +1 at the far plane.  This waits for the graphics
+    /// card to finish drawing, so ReadZValueAtPixelAsync() is faster when the
+    /// value is not needed right away.
     virtual float ReadZValueAtPixel(const Point2 &pointInPixels, unsigned int whichBuffer = GL_BACK);
 
+    /** Reads the z buffer value under the specified pixel without waiting
+     for the graphics card.  The value is read right after the next call to
+     DrawUsingOpenGL() and passed to the callback a frame or two later, when
+     it is ready, just before the input events for that frame are handled.
+     Example:
+     ~~~
+     void MyApp::OnLeftMouseDown(const Point2 &pos) {
+         ReadZValueAtPixelAsync(pos, [this, pos](float z) {
+             hit_point_ = GfxMath::ScreenToWorld(view_, proj_, PixelsToNormalizedDeviceCoords(pos), z);
+         });
+     }
+     ~~~
+     */
+    virtual void ReadZValueAtPixelAsync(const Point2 &pointInPixels, const std::function<void(float)> &callback);
+
     /// Access to the underlying NanoGUI Screen object
     virtual nanogui::Screen* screen();
 
     /// Access to the underlying GLFWwindow object
     virtual GLFWwindow* window();
 
+    /// Access to the profiler that times each stage of the main loop.  It is
+    /// off until enabled, see FrameProfiler.
+    virtual FrameProfiler* profiler();
+
+    /// Reads pixels back from the graphics card without waiting for it.  The
+    /// app calls PixelReadback::Update() once per frame, so reads started with
+    /// it only need a callback.
+    virtual PixelReadback* pixel_readback();
+
+    /// Saves each frame to an image file while it is capturing, see
+    /// FrameCapture.
+    virtual FrameCapture* frame_capture();
+
+    /// Worker threads for spreading work across all of the cores, with one
+    /// fewer worker than the number of cores, see JobSystem.  Pass it to the
+    /// parallel versions of slow operations, e.g., Mesh::LoadFromOBJ(), or
+    /// run jobs of your own on it.
+    virtual JobSystem* job_system();
+
+    /// Loads textures from files in the background, decoding them on
+    /// job_system() and showing a placeholder until they are ready.  The app
+    /// calls TextureLoader::Update() once per frame.
+    virtual TextureLoader* texture_loader();
+
 
     /// Cause the graphics windows to resize programmatically rather than by dragging
     /// on the corner manually.
@@ -484,6 +650,13 @@ private:
     bool drop_glfw_cb(int count, const char **filenames);
     bool scroll_glfw_cb(double x, double y);
     bool resize_glfw_cb(int width, int height);
+
+    void InitEGLContext();
+    void InitHeadlessFramebuffer();
+    void FreeHeadlessFramebuffer();
+    void ResolveHeadlessFramebuffer();
+    void ReadRequestedZValues();
+    void RunSimulationThread();
     
     virtual void mouse_move(const Point2 &pos, const Vector2 &delta) {
         OnMouseMove(pos, delta);
@@ -540,10 +713,50 @@ private:
     nanogui::Screen *screen_;
     GLFWwindow* window_;
     double lastDrawT_;
+    double simulationAccumulator_;
+    double interpolationAlpha_;
+    std::atomic<bool> redrawNeeded_;
+
+    // with GraphicsSettings::threaded_simulation
+    std::thread simulationThread_;
+    std::mutex simulationMutex_;
+    std::condition_variable simulationCondition_;
+    bool simulationFrameStarted_;
+    bool simulationStop_;
+    std::atomic<double> lastSimulationStepT_;
     Point2 lastMouse_;
     bool leftDown_;
     bool middleDown_;
     bool rightDown_;
+    FrameProfiler profiler_;
+    PixelReadback pixel_readback_;
+    FrameCapture frame_capture_;
+    JobSystem job_system_;
+    TextureLoader texture_loader_;
+
+    // ReadZValueAtPixelAsync() requests, in framebuffer pixels, waiting for
+    // the next DrawUsingOpenGL() to finish
+    class ZValueRequest {
+    public:
+        int x;
+        int y;
+        std::function<void(float)> callback;
+    };
+    std::vector<ZValueRequest> z_value_requests_;
+
+    // headless mode renders into fbo_, which is multisampled when
+    // settings_.multi_samples > 0 and then resolved into resolve_fbo_ for
+    // reading.  without multisampling they are the same.
+    GLuint fbo_;
+    GLuint resolve_fbo_;
+    GLuint renderbuffers_[4];
+    bool headlessOpenGLInitialized_;
+
+    // EGLDisplay, EGLSurface, and EGLContext when built with EGL, which
+    // is used instead of a hidden GLFW window in headless mode
+    void *eglDisplay_;
+    void *eglSurface_;
+    void *eglContext_;
 };
 
 
@@ -0,0 +1,267 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "isosurface.h"
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+namespace mingfx {
+
+
+Isosurface::Isosurface() : values_(NULL), nx_(0), ny_(0), nz_(0), iso_(0.0f) {
+}
+
+Isosurface::~Isosurface() {
+}
+
+
+void Isosurface::Extract(const float *values, int nx, int ny, int nz, float iso_value, Mesh *mesh,
+                         const Point3 &origin, const Vector3 &spacing, JobSystem *job_system)
+{
+    verts_.clear();
+    norms_.clear();
+    indices_.clear();
+    if ((nx < 2) || (ny < 2) || (nz < 2)) {
+        std::cerr << "Isosurface::Extract() -- the grid needs at least 2 values in each direction." << std::endl;
+        mesh->SetVertices(NULL, 0);
+        mesh->SetNormals(NULL, 0);
+        mesh->SetIndices(NULL, 0);
+        return;
+    }
+
+    values_ = values;
+    nx_ = nx;  ny_ = ny;  nz_ = nz;
+    iso_ = iso_value;
+    origin_ = origin;
+    spacing_ = spacing;
+    cell_vertex_.resize((size_t)(nx-1) * (ny-1) * (nz-1));
+
+    // Slabs of cell layers, a few per thread so that threads that finish
+    // early can take slabs from slower ones
+    int max_slabs = (job_system != NULL) ? 4 * job_system->num_threads() : 1;
+    const int nslabs = std::min(max_slabs, nz - 1);
+    slabs_.resize(nslabs);
+    for (int s=0; s<nslabs; s++) {
+        slabs_[s].first_k = (int)((long long)(nz-1) * s / nslabs);
+        slabs_[s].last_k = (int)((long long)(nz-1) * (s+1) / nslabs);
+    }
+
+    // Vertices, numbered within each slab at first since the slabs are done at
+    // the same time, then renumbered once the number in each slab is known
+    ParallelFor(job_system, nslabs, 1, [this](int begin, int end) {
+        for (int s=begin; s<end; s++) {
+            MakeVertices(&slabs_[s]);
+        }
+    });
+    int nverts = 0;
+    for (int s=0; s<nslabs; s++) {
+        slabs_[s].first_vertex = nverts;
+        nverts += (int)slabs_[s].cells.size();
+    }
+    ParallelFor(job_system, nslabs, 1, [this](int begin, int end) {
+        for (int s=begin; s<end; s++) {
+            const Slab &slab = slabs_[s];
+            for (int i=0; i<slab.cells.size(); i++) {
+                cell_vertex_[slab.cells[i]] += slab.first_vertex;
+            }
+        }
+    });
+
+    // Triangles, which can join vertices from neighboring slabs
+    ParallelFor(job_system, nslabs, 1, [this](int begin, int end) {
+        for (int s=begin; s<end; s++) {
+            MakeTriangles(&slabs_[s]);
+        }
+    });
+
+    size_t nindices = 0;
+    for (int s=0; s<nslabs; s++) {
+        nindices += slabs_[s].indices.size();
+    }
+    verts_.reserve(3 * (size_t)nverts);
+    norms_.reserve(3 * (size_t)nverts);
+    indices_.reserve(nindices);
+    for (int s=0; s<nslabs; s++) {
+        verts_.insert(verts_.end(), slabs_[s].verts.begin(), slabs_[s].verts.end());
+        norms_.insert(norms_.end(), slabs_[s].norms.begin(), slabs_[s].norms.end());
+        indices_.insert(indices_.end(), slabs_[s].indices.begin(), slabs_[s].indices.end());
+    }
+    mesh->SetVertices(verts_.data(), nverts);
+    mesh->SetNormals(norms_.data(), nverts);
+    mesh->SetIndices(indices_.data(), (int)indices_.size());
+    values_ = NULL;
+}
+
+
+Vector3 Isosurface::Gradient(int i, int j, int k) const {
+    // central differences, or one-sided at the edges of the grid
+    int i0 = std::max(i-1, 0), i1 = std::min(i+1, nx_-1);
+    int j0 = std::max(j-1, 0), j1 = std::min(j+1, ny_-1);
+    int k0 = std::max(k-1, 0), k1 = std::min(k+1, nz_-1);
+    const size_t row = nx_;
+    const size_t layer = (size_t)nx_ * ny_;
+    return Vector3((values_[i1 + row*j + layer*k] - values_[i0 + row*j + layer*k]) / ((i1 - i0) * spacing_[0]),
+                   (values_[i + row*j1 + layer*k] - values_[i + row*j0 + layer*k]) / ((j1 - j0) * spacing_[1]),
+                   (values_[i + row*j + layer*k1] - values_[i + row*j + layer*k0]) / ((k1 - k0) * spacing_[2]));
+}
+
+
+void Isosurface::MakeVertices(Slab *slab) {
+    slab->cells.clear();
+    slab->verts.clear();
+    slab->norms.clear();
+
+    const size_t row = nx_;
+    const size_t layer = (size_t)nx_ * ny_;
+    for (int k=slab->first_k; k<slab->last_k; k++) {
+        for (int j=0; j<ny_-1; j++) {
+            for (int i=0; i<nx_-1; i++) {
+                const int c = i + (nx_-1) * (j + (ny_-1) * k);
+
+                // corner n of the cell is at (i + (n&1), j + (n&2)/2, k + (n&4)/4)
+                const size_t base = i + row*j + layer*k;
+                float v[8];
+                v[0] = values_[base];
+                v[1] = values_[base + 1];
+                v[2] = values_[base + row];
+                v[3] = values_[base + row + 1];
+                v[4] = values_[base + layer];
+                v[5] = values_[base + layer + 1];
+                v[6] = values_[base + layer + row];
+                v[7] = values_[base + layer + row + 1];
+                int num_inside = 0;
+                for (int n=0; n<8; n++) {
+                    if (v[n] > iso_) {
+                        num_inside++;
+                    }
+                }
+                if ((num_inside == 0) || (num_inside == 8)) {
+                    cell_vertex_[c] = -1;
+                    continue;
+                }
+
+                // average the points where the surface crosses the 12 edges
+                float sum[3] = {0.0f, 0.0f, 0.0f};
+                int num_crossings = 0;
+                for (int axis=0; axis<3; axis++) {
+                    const int bit = 1 << axis;
+                    for (int a=0; a<8; a++) {
+                        if (a & bit) {
+                            continue;
+                        }
+                        const int b = a | bit;
+                        if ((v[a] > iso_) == (v[b] > iso_)) {
+                            continue;
+                        }
+                        float t = (iso_ - v[a]) / (v[b] - v[a]);
+                        sum[0] += (axis == 0) ? t : (float)(a & 1);
+                        sum[1] += (axis == 1) ? t : (float)((a >> 1) & 1);
+                        sum[2] += (axis == 2) ? t : (float)((a >> 2) & 1);
+                        num_crossings++;
+                    }
+                }
+                float f[3] = { sum[0] / num_crossings, sum[1] / num_crossings, sum[2] / num_crossings };
+
+                // the normal points toward smaller values, using the gradient
+                // at the corners blended the same way as the values
+                Vector3 g(0,0,0);
+                for (int n=0; n<8; n++) {
+                    float w = ((n & 1) ? f[0] : 1.0f - f[0]) *
+                              ((n & 2) ? f[1] : 1.0f - f[1]) *
+                              ((n & 4) ? f[2] : 1.0f - f[2]);
+                    g = g + w * Gradient(i + (n & 1), j + ((n >> 1) & 1), k + ((n >> 2) & 1));
+                }
+                float len = g.Length();
+                Vector3 normal = (len > 0.0f) ? (-1.0f / len) * g : Vector3(0,0,1);
+
+                cell_vertex_[c] = (int)slab->cells.size();
+                slab->cells.push_back(c);
+                slab->verts.push_back(origin_[0] + (i + f[0]) * spacing_[0]);
+                slab->verts.push_back(origin_[1] + (j + f[1]) * spacing_[1]);
+                slab->verts.push_back(origin_[2] + (k + f[2]) * spacing_[2]);
+                slab->norms.push_back(normal[0]);
+                slab->norms.push_back(normal[1]);
+                slab->norms.push_back(normal[2]);
+            }
+        }
+    }
+}
+
+
+void Isosurface::MakeTriangles(Slab *slab) {
+    slab->indices.clear();
+
+    const size_t row = nx_;
+    const size_t layer = (size_t)nx_ * ny_;
+    const int cell_row = nx_ - 1;
+    const int cell_layer = (nx_ - 1) * (ny_ - 1);
+
+    // Each grid edge that the surface crosses becomes a quad joining the
+    // vertices of the 4 cells around it.  Cell (i,j,k) is one of those 4 cells
+    // for the edges starting at grid point (i,j,k), so only the cells with
+    // vertices need to be checked, and each slab makes the quads for its own
+    // cells.
+    for (int n=0; n<slab->cells.size(); n++) {
+        const int c = slab->cells[n];
+        const int i = c % cell_row;
+        const int j = (c / cell_row) % (ny_ - 1);
+        const int k = c / cell_layer;
+        const size_t p = i + row*j + layer*k;
+        const bool inside = values_[p] > iso_;
+        int quad[4];
+        for (int axis=0; axis<3; axis++) {
+            // edges on the sides of the grid have fewer than 4 cells around them
+            if (axis == 0) {
+                if ((j == 0) || (k == 0) || ((values_[p + 1] > iso_) == inside)) {
+                    continue;
+                }
+                quad[0] = c - cell_row - cell_layer;
+                quad[1] = c - cell_layer;
+                quad[2] = c;
+                quad[3] = c - cell_row;
+            }
+            else if (axis == 1) {
+                if ((i == 0) || (k == 0) || ((values_[p + row] > iso_) == inside)) {
+                    continue;
+                }
+                quad[0] = c - 1 - cell_layer;
+                quad[1] = c - 1;
+                quad[2] = c;
+                quad[3] = c - cell_layer;
+            }
+            else {
+                if ((i == 0) || (j == 0) || ((values_[p + layer] > iso_) == inside)) {
+                    continue;
+                }
+                quad[0] = c - 1 - cell_row;
+                quad[1] = c - cell_row;
+                quad[2] = c;
+                quad[3] = c - 1;
+            }
+
+            // The quad as listed faces along +axis, which is outward when the
+            // inside is at the start of the edge
+            unsigned int v0 = cell_vertex_[quad[0]];
+            unsigned int v1 = cell_vertex_[quad[1]];
+            unsigned int v2 = cell_vertex_[quad[2]];
+            unsigned int v3 = cell_vertex_[quad[3]];
+            if (!inside) {
+                std::swap(v1, v3);
+            }
+            slab->indices.push_back(v0);  slab->indices.push_back(v1);  slab->indices.push_back(v2);
+            slab->indices.push_back(v0);  slab->indices.push_back(v2);  slab->indices.push_back(v3);
+        }
+    }
+}
+
+
+} // end namespace
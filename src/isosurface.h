@@ -0,0 +1,116 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_ISOSURFACE_H_
+#define SRC_ISOSURFACE_H_
+
+#include "mesh.h"
+#include "point3.h"
+#include "vector3.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+class JobSystem;
+
+
+/** Extracts the surface where a 3D grid of values (e.g., density from a
+ simulation or a CT scan) crosses an iso value and stores it in a Mesh.  The
+ result is an indexed mesh in which neighboring triangles share vertices, with
+ a smooth normal for each vertex taken from the gradient of the values, so it
+ can be drawn right away with DefaultShader.  Given a JobSystem, the work is
+ split into jobs by slabs of the grid, so large grids (256x256x256 and up) are
+ extracted quickly enough to do every frame.  Example:
+ ~~~
+ Isosurface iso;
+ Mesh surface;
+
+ void UpdateSimulation(double dt) {
+     sim.Step(dt);
+     iso.Extract(sim.density(), 256, 256, 256, 0.5f, &surface,
+                 Point3(-1,-1,-1), Vector3(2.0f/255.0f, 2.0f/255.0f, 2.0f/255.0f),
+                 job_system());
+ }
+
+ void DrawUsingOpenGL() {
+     shader.Draw(model, view, proj, &surface, material);
+ }
+ ~~~
+
+ The surface is built with the surface nets method, a simple form of dual
+ contouring: each grid cell that the surface passes through gets one vertex,
+ placed at the average of the points where the surface crosses the cell's
+ edges, and each grid edge that the surface crosses becomes a quad joining the
+ vertices of the four cells around it.  Unlike marching cubes, this needs no
+ lookup tables and makes fewer thin triangles.  Values greater than the iso
+ value are inside the surface, and the triangles face outward, toward smaller
+ values.  Reuse the same Isosurface object each frame so that its buffers do
+ not need to be allocated again.
+ */
+class Isosurface {
+public:
+
+    /// Creates an extractor with empty buffers.
+    Isosurface();
+
+    virtual ~Isosurface();
+
+    /** Replaces the contents of mesh with the surface where the values cross
+     iso_value.  The values are stored with x changing fastest, i.e., the
+     value at grid point (i,j,k) is values[i + nx*(j + ny*k)], and grid point
+     (i,j,k) is placed at origin + (i*spacing[0], j*spacing[1], k*spacing[2]).
+     The slabs are extracted as jobs on job_system, or serially if it is
+     NULL. */
+    void Extract(const float *values, int nx, int ny, int nz, float iso_value, Mesh *mesh,
+                 const Point3 &origin = Point3(0,0,0), const Vector3 &spacing = Vector3(1,1,1),
+                 JobSystem *job_system = NULL);
+
+private:
+
+    // The vertices and triangles made by one job from one slab of cells
+    class Slab {
+    public:
+        int first_k;
+        int last_k;
+        int first_vertex;
+        std::vector<int> cells;
+        std::vector<float> verts;
+        std::vector<float> norms;
+        std::vector<unsigned int> indices;
+    };
+
+    void MakeVertices(Slab *slab);
+    void MakeTriangles(Slab *slab);
+    Vector3 Gradient(int i, int j, int k) const;
+
+    // the grid being extracted
+    const float *values_;
+    int nx_, ny_, nz_;
+    float iso_;
+    Point3 origin_;
+    Vector3 spacing_;
+
+    // the vertex id of each cell, or -1 for cells the surface misses
+    std::vector<int> cell_vertex_;
+    std::vector<Slab> slabs_;
+    std::vector<float> verts_;
+    std::vector<float> norms_;
+    std::vector<unsigned int> indices_;
+};
+
+
+} // end namespace
+
+#endif
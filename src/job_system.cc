@@ -0,0 +1,202 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "job_system.h"
+
+#include <chrono>
+
+
+namespace mingfx {
+
+// the JobSystem and queue of the worker running on this thread, if any
+static thread_local JobSystem *current_job_system = NULL;
+static thread_local int current_queue = 0;
+
+// how long a thread waiting on a TaskGroup sleeps before checking for jobs
+// to help with again, since a job it could run may be queued in the meantime
+static const std::chrono::microseconds WAIT_POLL_INTERVAL(100);
+
+
+JobSystem::TaskGroup::TaskGroup(JobSystem *job_system) :
+    job_system_(job_system), state_(std::make_shared<State>())
+{
+}
+
+JobSystem::TaskGroup::~TaskGroup() {
+    Wait();
+}
+
+
+void JobSystem::TaskGroup::Run(const Job &job) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->pending++;
+    }
+    JobSystem *job_system = job_system_;
+    std::shared_ptr<State> state = state_;
+    job_system_->Submit([job, job_system, state] {
+        job();
+
+        Job continuation;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->pending--;
+            if (state->pending == 0) {
+                continuation.swap(state->continuation);
+                state->finished.notify_all();
+            }
+        }
+        if (continuation) {
+            job_system->Submit(continuation);
+        }
+    });
+}
+
+
+void JobSystem::TaskGroup::Wait() {
+    while (!done()) {
+        if (!job_system_->RunPendingJob()) {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            state_->finished.wait_for(lock, WAIT_POLL_INTERVAL, [this] { return state_->pending == 0; });
+        }
+    }
+}
+
+
+void JobSystem::TaskGroup::Then(const Job &continuation) {
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->pending > 0) {
+            state_->continuation = continuation;
+            return;
+        }
+    }
+    job_system_->Submit(continuation);
+}
+
+
+bool JobSystem::TaskGroup::done() const {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->pending == 0;
+}
+
+
+
+JobSystem::JobSystem(int num_threads) : num_queued_(0), stopping_(false) {
+    if (num_threads <= 0) {
+        // at least one worker, even on a single core, so that jobs nobody
+        // waits on, e.g., TextureLoader's decodes, still get to run
+        num_threads = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+    }
+    for (int i=0; i<num_threads+1; i++) {
+        queues_.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (int i=0; i<num_threads; i++) {
+        threads_.push_back(std::thread(&JobSystem::RunWorker, this, i+1));
+    }
+}
+
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (int i=0; i<threads_.size(); i++) {
+        threads_[i].join();
+    }
+    // jobs queued by the last jobs to run after the workers stopped looking
+    while (RunPendingJob()) {
+    }
+}
+
+
+void JobSystem::Submit(const Job &job) {
+    int queue = (current_job_system == this) ? current_queue : 0;
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+        queues_[queue]->jobs.push_back(job);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        num_queued_++;
+    }
+    wake_.notify_one();
+}
+
+
+bool JobSystem::RunPendingJob() {
+    Job job;
+    if (current_job_system == this) {
+        if (!PopJob(current_queue, &job) && !StealJob(current_queue, &job)) {
+            return false;
+        }
+    }
+    else if (!StealJob(0, &job)) {
+        return false;
+    }
+    job();
+    return true;
+}
+
+
+int JobSystem::num_threads() const {
+    return (int)threads_.size() + 1;
+}
+
+
+void JobSystem::RunWorker(int index) {
+    current_job_system = this;
+    current_queue = index;
+    while (true) {
+        Job job;
+        if (PopJob(index, &job) || StealJob(index, &job)) {
+            job();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return (num_queued_ > 0) || stopping_; });
+        if (stopping_ && (num_queued_ <= 0)) {
+            return;
+        }
+    }
+}
+
+
+bool JobSystem::PopJob(int queue, Job *job) {
+    std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+    if (queues_[queue]->jobs.empty()) {
+        return false;
+    }
+    // the newest job, whose data is most likely still in this core's cache
+    *job = std::move(queues_[queue]->jobs.back());
+    queues_[queue]->jobs.pop_back();
+    num_queued_--;
+    return true;
+}
+
+
+bool JobSystem::StealJob(int thief, Job *job) {
+    // look through the other queues, starting with the shared one when the
+    // thief is outside the pool and with the next worker's otherwise
+    int num_queues = (int)queues_.size();
+    for (int i=0; i<num_queues; i++) {
+        int queue = (thief + i + (thief != 0)) % num_queues;
+        std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+        if (queues_[queue]->jobs.size()) {
+            // the oldest job, which is usually the largest piece of work
+            *job = std::move(queues_[queue]->jobs.front());
+            queues_[queue]->jobs.pop_front();
+            num_queued_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+} // end namespace
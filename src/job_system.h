@@ -0,0 +1,218 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_JOB_SYSTEM_H_
+#define SRC_JOB_SYSTEM_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** A pool of worker threads that run small jobs, for spreading work across
+ all of the cores without starting a new thread each time.  Each worker has
+ its own queue of jobs.  Jobs started from a worker go on that worker's queue
+ and it runs the newest one first, which keeps the data it just touched in
+ its cache, and a worker with nothing left to do takes (steals) the oldest
+ job from another one's queue.  Threads that wait for jobs to finish run jobs
+ themselves in the meantime rather than sleeping.
+
+ GraphicsApp has one of these, available from GraphicsApp::job_system(), and
+ it can also be used on its own.  The library's slower operations have
+ versions that use it, e.g., Mesh::CalcPerVertexNormals(JobSystem*),
+ Mesh::LoadFromOBJ(const std::string&, JobSystem*),
+ BVH::CreateFromMesh(const Mesh&, JobSystem*), Texture2D::InitFromFiles(),
+ MeshAdjacency::Build(), and Isosurface::Extract().  Example:
+ ~~~
+ JobSystem::TaskGroup group(job_system());
+ group.Run([&] { terrain_.CalcPerVertexNormals(job_system()); });
+ group.Run([&] { rock_.LoadFromOBJ(rock_file, job_system()); });
+ group.Wait();
+
+ job_system()->ParallelFor((int)particles_.size(), 256, [&](int begin, int end) {
+     for (int i=begin; i<end; i++) {
+         particles_[i].Update(dt);
+     }
+ });
+ ~~~
+ Jobs run at the same time, so they must only write to data that no other job
+ touches, and they cannot make OpenGL calls, since the OpenGL context belongs
+ to the main thread.  A job may wait on a group of jobs that it started, but
+ not on a group that it or the job that started it belongs to, since a
+ waiting thread may be in the middle of running those jobs.
+ */
+class JobSystem {
+public:
+
+    typedef std::function<void()> Job;
+
+
+    /** A set of jobs that can be waited on together, optionally followed by
+     a job that starts once all of them are done.  Example:
+     ~~~
+     JobSystem::TaskGroup group(&jobs);
+     for (int i=0; i<chunks.size(); i++) {
+         group.Run([&chunks, i] { chunks[i].Process(); });
+     }
+     group.Then([&] { merged_ = Merge(chunks); });
+     group.Wait();
+     ~~~
+     */
+    class TaskGroup {
+    public:
+        /// Creates an empty group whose jobs run on job_system.
+        TaskGroup(JobSystem *job_system);
+
+        /// Waits for the group's jobs to finish.
+        virtual ~TaskGroup();
+
+        /// Starts running job as part of this group.  Jobs may add more jobs
+        /// to the group while it runs.
+        void Run(const Job &job);
+
+        /// Waits for all of the jobs in the group to finish, running jobs
+        /// from the JobSystem on the calling thread in the meantime.
+        void Wait();
+
+        /// Sets a job (a continuation) to start once all of the jobs in the
+        /// group are done, or right away if they already are.  Wait() does
+        /// not wait for the continuation itself; to wait for it, run it in
+        /// another group.
+        void Then(const Job &continuation);
+
+        /// True once all of the jobs in the group are done.
+        bool done() const;
+
+    private:
+
+        // shared with the jobs, which may outlive a group that is never waited on
+        class State {
+        public:
+            State() : pending(0) {}
+            std::mutex mutex;
+            std::condition_variable finished;
+            int pending;
+            Job continuation;
+        };
+
+        // for now, the copy constructor is private so no copies are allowed.
+        TaskGroup(const TaskGroup &other);
+        TaskGroup& operator=(const TaskGroup &other);
+
+        JobSystem *job_system_;
+        std::shared_ptr<State> state_;
+    };
+
+
+    /// Starts num_threads worker threads.  Threads waiting on jobs also run
+    /// them, so the default, 0, starts one fewer worker than the number of
+    /// cores, but always at least one so that jobs that are never waited on
+    /// still run.
+    JobSystem(int num_threads=0);
+
+    /// Runs any jobs that are still queued and stops the worker threads.
+    virtual ~JobSystem();
+
+    /// Starts a job without any way to wait for it.  Use a TaskGroup to wait.
+    void Submit(const Job &job);
+
+    /// Runs one queued job on the calling thread if there is one, and returns
+    /// true if it did.
+    bool RunPendingJob();
+
+    /** Splits the range [0, n) into pieces of at least min_per_job items and
+     calls func(begin, end) on each one as a job, returning once all of them
+     are done.  The calling thread runs pieces too.  There are several pieces
+     per thread, so threads that finish early can steal the rest of the work
+     from threads that are slower.  The pieces run at the same time, so func
+     must only write to data that no other piece touches.
+     */
+    template <class F>
+    void ParallelFor(int n, int min_per_job, const F &func) {
+        min_per_job = std::max(min_per_job, 1);
+        int num_jobs = std::min(4 * num_threads(), (n + min_per_job - 1) / min_per_job);
+        if (num_jobs <= 1) {
+            if (n > 0) {
+                func(0, n);
+            }
+            return;
+        }
+        TaskGroup group(this);
+        for (int i=1; i<num_jobs; i++) {
+            int begin = (int)((long long)n * i / num_jobs);
+            int end = (int)((long long)n * (i+1) / num_jobs);
+            group.Run([&func, begin, end] { func(begin, end); });
+        }
+        func(0, (int)((long long)n / num_jobs));
+        group.Wait();
+    }
+
+    /// The number of worker threads plus one for the thread that waits.
+    int num_threads() const;
+
+private:
+
+    class Worker {
+    public:
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void RunWorker(int index);
+    bool PopJob(int queue, Job *job);
+    bool StealJob(int thief, Job *job);
+
+    // for now, the copy constructor is private so no copies are allowed.
+    JobSystem(const JobSystem &other);
+    JobSystem& operator=(const JobSystem &other);
+
+    // queue 0 holds jobs submitted from threads outside the pool, and
+    // worker i uses queue i+1
+    std::vector<std::unique_ptr<Worker>> queues_;
+    std::vector<std::thread> threads_;
+
+    // idle workers sleep until there are jobs queued
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<int> num_queued_;
+    bool stopping_;
+};
+
+
+/** Calls job_system->ParallelFor(n, min_per_job, func), or just func(0, n) on
+ the calling thread if job_system is NULL.  The library's functions that take
+ a JobSystem use this, so passing NULL to any of them does the work serially.
+ */
+template <class F>
+void ParallelFor(JobSystem *job_system, int n, int min_per_job, const F &func) {
+    if (job_system != NULL) {
+        job_system->ParallelFor(n, min_per_job, func);
+    }
+    else if (n > 0) {
+        func(0, n);
+    }
+}
+
+
+} // end namespace
+
+#endif
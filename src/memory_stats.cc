@@ -0,0 +1,183 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "memory_stats.h"
+
+#include "mesh.h"
+#include "mesh_batch.h"
+#include "texture2d.h"
+#include "texture_array.h"
+
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <sstream>
+
+
+namespace mingfx {
+
+
+namespace {
+
+// The objects that currently exist.  Objects can be created on any thread, so
+// the sets are protected by a mutex.  This is created the first time it is
+// used, which is always before the first object finishes being constructed, so
+// it also outlives all of the objects, even global ones.
+class Registry {
+public:
+    std::mutex mutex;
+    std::set<const Mesh*> meshes;
+    std::set<const MeshBatch*> batches;
+    std::set<const Texture2D*> textures;
+    std::set<const TextureArray*> texture_arrays;
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+void AddUsage(const MemoryStats::Usage &u, MemoryStats::Usage *total) {
+    total->num_objects += u.num_objects;
+    total->cpu_bytes += u.cpu_bytes;
+    total->gpu_bytes += u.gpu_bytes;
+    total->bvh_bytes += u.bvh_bytes;
+}
+
+} // end anonymous namespace
+
+
+MemoryStats::Usage MemoryStats::MeshUsage() {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    Usage u;
+    for (std::set<const Mesh*>::const_iterator it = r.meshes.begin(); it != r.meshes.end(); ++it) {
+        u.num_objects++;
+        u.cpu_bytes += (*it)->cpu_bytes();
+        u.gpu_bytes += (*it)->gpu_bytes();
+        u.bvh_bytes += (*it)->bvh_bytes();
+    }
+    return u;
+}
+
+MemoryStats::Usage MemoryStats::MeshBatchUsage() {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    Usage u;
+    for (std::set<const MeshBatch*>::const_iterator it = r.batches.begin(); it != r.batches.end(); ++it) {
+        u.num_objects++;
+        u.cpu_bytes += (*it)->cpu_bytes();
+        u.gpu_bytes += (*it)->gpu_bytes();
+    }
+    return u;
+}
+
+MemoryStats::Usage MemoryStats::TextureUsage() {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    Usage u;
+    // copies of a Texture2D share their OpenGL texture and image data
+    std::set<GLuint> gpu_textures;
+    std::set<const unsigned char*> cpu_images;
+    for (std::set<const Texture2D*>::const_iterator it = r.textures.begin(); it != r.textures.end(); ++it) {
+        u.num_objects++;
+        if (cpu_images.insert((*it)->file_data_.get()).second) {
+            u.cpu_bytes += (*it)->cpu_bytes();
+        }
+        if (gpu_textures.insert((*it)->opengl_id()).second) {
+            u.gpu_bytes += (*it)->gpu_bytes();
+        }
+    }
+    for (std::set<const TextureArray*>::const_iterator it = r.texture_arrays.begin(); it != r.texture_arrays.end(); ++it) {
+        u.num_objects++;
+        u.gpu_bytes += (*it)->gpu_bytes();
+    }
+    return u;
+}
+
+MemoryStats::Usage MemoryStats::TotalUsage() {
+    Usage total;
+    AddUsage(MeshUsage(), &total);
+    AddUsage(MeshBatchUsage(), &total);
+    AddUsage(TextureUsage(), &total);
+    return total;
+}
+
+
+std::string MemoryStats::Summary() {
+    const char *names[4] = { "Meshes", "Mesh batches", "Textures", "Total" };
+    Usage usage[4] = { MeshUsage(), MeshBatchUsage(), TextureUsage(), Usage() };
+    for (int i=0; i<3; i++) {
+        AddUsage(usage[i], &usage[3]);
+    }
+
+    const double mb = 1024.0 * 1024.0;
+    std::ostringstream out;
+    out << std::left << std::setw(14) << "" << std::right
+        << std::setw(8) << "Count" << std::setw(12) << "CPU (MB)"
+        << std::setw(12) << "GPU (MB)" << std::setw(12) << "BVH (MB)" << std::endl;
+    out << std::fixed << std::setprecision(2);
+    for (int i=0; i<4; i++) {
+        out << std::left << std::setw(14) << names[i] << std::right
+            << std::setw(8) << usage[i].num_objects
+            << std::setw(12) << usage[i].cpu_bytes / mb
+            << std::setw(12) << usage[i].gpu_bytes / mb
+            << std::setw(12) << usage[i].bvh_bytes / mb << std::endl;
+    }
+    return out.str();
+}
+
+
+void MemoryStats::Register(const Mesh *mesh) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.meshes.insert(mesh);
+}
+
+void MemoryStats::Unregister(const Mesh *mesh) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.meshes.erase(mesh);
+}
+
+void MemoryStats::Register(const MeshBatch *batch) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.batches.insert(batch);
+}
+
+void MemoryStats::Unregister(const MeshBatch *batch) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.batches.erase(batch);
+}
+
+void MemoryStats::Register(const Texture2D *texture) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.textures.insert(texture);
+}
+
+void MemoryStats::Unregister(const Texture2D *texture) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.textures.erase(texture);
+}
+
+void MemoryStats::Register(const TextureArray *texture_array) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.texture_arrays.insert(texture_array);
+}
+
+void MemoryStats::Unregister(const TextureArray *texture_array) {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.texture_arrays.erase(texture_array);
+}
+
+
+} // end namespace
@@ -0,0 +1,109 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_MEMORY_STATS_H_
+#define SRC_MEMORY_STATS_H_
+
+#include <cstddef>
+#include <string>
+
+
+namespace mingfx {
+
+// forward declarations
+class Mesh;
+class MeshBatch;
+class Texture2D;
+class TextureArray;
+
+
+/** Keeps track of every Mesh, MeshBatch, Texture2D, and TextureArray that
+ currently exists and adds up how much memory they use, both in main memory
+ (CPU) and on the graphics card (GPU).  A mesh keeps a CPU copy of all of
+ its data after it has been copied to the GPU, plus its BVH if one has been
+ built, so geometry can take up more memory than expected.  Example:
+ ~~~
+ // print a table of memory use, e.g., when a key is pressed
+ std::cout << MemoryStats::Summary() << std::endl;
+
+ // or check on just the meshes
+ MemoryStats::Usage meshes = MemoryStats::MeshUsage();
+ std::cout << meshes.num_objects << " meshes use " << meshes.gpu_bytes << " bytes of GPU memory" << std::endl;
+ ~~~
+ Meshes and textures that will not change after they are loaded can free
+ their CPU copies with Mesh::ReleaseCPUData() and Texture2D::ReleaseCPUData().
+
+ GPU sizes are the sizes of the buffers and textures MinGfx asks OpenGL to
+ create; the driver may round these up or keep its own copies.  Copies of a
+ Texture2D share one OpenGL texture and one CPU copy of the image (e.g., the
+ surface_texture of copied DefaultShader::MaterialProperties), so these are
+ counted once no matter how many Texture2D objects share them.
+
+ The list of objects is locked while it is used, but the objects themselves
+ are not, so call these functions from the OpenGL thread and never while
+ another thread may be changing a Mesh, MeshBatch, or texture, e.g., the
+ write_buffer() of a TripleBuffer<Mesh> filled in by a threaded simulation
+ (see GraphicsApp::GraphicsSettings::threaded_simulation).
+ */
+class MemoryStats {
+public:
+
+    /// The memory used by one kind of object, added up over all of them.
+    class Usage {
+    public:
+        Usage() : num_objects(0), cpu_bytes(0), gpu_bytes(0), bvh_bytes(0) {}
+        /// The number of objects of this kind that exist.
+        int num_objects;
+        /// Bytes of CPU memory used for copies of the vertex, index, texture,
+        /// and per-instance data.
+        size_t cpu_bytes;
+        /// Bytes of GPU memory used for buffers and textures.
+        size_t gpu_bytes;
+        /// Bytes of CPU memory used for BVHs (only meshes have these).
+        size_t bvh_bytes;
+    };
+
+    /// The memory used by all Mesh objects.
+    static Usage MeshUsage();
+
+    /// The memory used by all MeshBatch objects.
+    static Usage MeshBatchUsage();
+
+    /// The memory used by all Texture2D and TextureArray objects, with
+    /// textures and images shared by several Texture2D objects counted once.
+    static Usage TextureUsage();
+
+    /// The memory used by all of the objects tracked.
+    static Usage TotalUsage();
+
+    /// A small table of the memory used by each kind of object, in MB.
+    static std::string Summary();
+
+
+    // The objects add and remove themselves in their constructors and
+    // destructors, so there should be no need to call these directly.
+
+    static void Register(const Mesh *mesh);
+    static void Unregister(const Mesh *mesh);
+    static void Register(const MeshBatch *batch);
+    static void Unregister(const MeshBatch *batch);
+    static void Register(const Texture2D *texture);
+    static void Unregister(const Texture2D *texture);
+    static void Register(const TextureArray *texture_array);
+    static void Unregister(const TextureArray *texture_array);
+};
+
+
+} // end namespace
+
+#endif
@@ -6,18 +6,28 @@
 
 #include "mesh.h"
 
+#include "gl_state.h"
+#include "job_system.h"
 #include "matrix4.h"
+#include "memory_stats.h"
 #include "opengl_headers.h"
 
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <fstream>
+#include <iterator>
+#include <unordered_map>
 
 namespace mingfx {
     
 #define MAX_TEX_ATTRIBS 5
 
 
-Mesh::Mesh() : gpu_dirty_(true), vertex_buffer_(0), vertex_array_(0), element_buffer_(0), bvh_dirty_(true) {
+Mesh::Mesh() : instance_layout_dirty_(true), instance_attrib_offset_(0), gpu_dirty_(true),
+    vertex_buffer_(0), vertex_array_(0), element_buffer_(0), indices_dirty_(true), element_buffer_bytes_(0),
+    vertex_buffer_bytes_(0), gpu_num_vertices_(0), gpu_num_indices_(0), bvh_dirty_(true) {
+    MemoryStats::Register(this);
 }
 
 Mesh::Mesh(const Mesh &other) {
@@ -26,11 +36,103 @@ Mesh::Mesh(const Mesh &other) {
     colors_ = other.colors_;
     tex_coords_ = other.tex_coords_;
     indices_ = other.indices_;
+    instance_xforms_ = other.instance_xforms_;
+    instance_colors_ = other.instance_colors_;
+    instance_ids_ = other.instance_ids_;
+    instance_layout_dirty_ = true;
+    instance_attrib_offset_ = 0;
     gpu_dirty_ = true;
+    vertex_buffer_ = 0;
+    vertex_array_ = 0;
+    element_buffer_ = 0;
+    indices_dirty_ = true;
+    element_buffer_bytes_ = 0;
+    vertex_buffer_bytes_ = 0;
+    gpu_num_vertices_ = 0;
+    gpu_num_indices_ = 0;
     bvh_dirty_ = true;
+    MemoryStats::Register(this);
+}
+
+Mesh::Mesh(Mesh &&other) : Mesh() {
+    *this = std::move(other);
 }
 
 Mesh::~Mesh() {
+    MemoryStats::Unregister(this);
+    FreeGPUMemory();
+}
+
+Mesh& Mesh::operator=(const Mesh &other) {
+    if (this == &other) {
+        return *this;
+    }
+    verts_ = other.verts_;
+    norms_ = other.norms_;
+    colors_ = other.colors_;
+    tex_coords_ = other.tex_coords_;
+    indices_ = other.indices_;
+    instance_xforms_ = other.instance_xforms_;
+    instance_colors_ = other.instance_colors_;
+    instance_ids_ = other.instance_ids_;
+    xform_stream_.MarkDirty(0, instance_xforms_.size() * sizeof(float));
+    color_stream_.MarkDirty(0, instance_colors_.size() * sizeof(float));
+    id_stream_.MarkDirty(0, instance_ids_.size() * sizeof(unsigned int));
+    instance_layout_dirty_ = true;
+    gpu_dirty_ = true;
+    indices_dirty_ = true;
+    bvh_dirty_ = true;
+    return *this;
+}
+
+Mesh& Mesh::operator=(Mesh &&other) {
+    if (this == &other) {
+        return *this;
+    }
+    FreeGPUMemory();
+    verts_ = std::move(other.verts_);
+    norms_ = std::move(other.norms_);
+    colors_ = std::move(other.colors_);
+    tex_coords_ = std::move(other.tex_coords_);
+    indices_ = std::move(other.indices_);
+    instance_xforms_ = std::move(other.instance_xforms_);
+    instance_colors_ = std::move(other.instance_colors_);
+    instance_ids_ = std::move(other.instance_ids_);
+    xform_stream_ = other.xform_stream_;
+    color_stream_ = other.color_stream_;
+    id_stream_ = other.id_stream_;
+    instance_layout_dirty_ = other.instance_layout_dirty_;
+    instance_attrib_offset_ = other.instance_attrib_offset_;
+    gpu_dirty_ = other.gpu_dirty_;
+    vertex_buffer_ = other.vertex_buffer_;
+    vertex_array_ = other.vertex_array_;
+    element_buffer_ = other.element_buffer_;
+    indices_dirty_ = other.indices_dirty_;
+    element_buffer_bytes_ = other.element_buffer_bytes_;
+    vertex_buffer_bytes_ = other.vertex_buffer_bytes_;
+    gpu_num_vertices_ = other.gpu_num_vertices_;
+    gpu_num_indices_ = other.gpu_num_indices_;
+    bvh_dirty_ = other.bvh_dirty_;
+    bvh_ = std::move(other.bvh_);
+
+    // other no longer owns any GPU buffers, so it must not delete them
+    other.verts_.clear();
+    other.norms_.clear();
+    other.colors_.clear();
+    other.tex_coords_.clear();
+    other.indices_.clear();
+    other.instance_xforms_.clear();
+    other.instance_colors_.clear();
+    other.instance_ids_.clear();
+    other.xform_stream_ = InstanceStream();
+    other.color_stream_ = InstanceStream();
+    other.id_stream_ = InstanceStream();
+    other.vertex_buffer_ = 0;
+    other.vertex_array_ = 0;
+    other.element_buffer_ = 0;
+    other.FreeGPUMemory();
+    other.bvh_dirty_ = true;
+    return *this;
 }
     
 int Mesh::AddTriangle(Point3 v1, Point3 v2, Point3 v3) {
@@ -204,7 +306,7 @@ void Mesh::SetTexCoords(int texture_unit, const std::vector<Point2> &tex_coords)
 
 
 void Mesh::SetIndices(const std::vector<unsigned int> indices) {
-    gpu_dirty_ = true;
+    indices_dirty_ = true;
     bvh_dirty_ = true;
 
     indices_.clear();
@@ -215,14 +317,97 @@ void Mesh::SetIndices(const std::vector<unsigned int> indices) {
 
 
 void Mesh::SetInstanceTransforms(const std::vector<Matrix4> &xforms) {
-    gpu_dirty_ = true;
-    instance_xforms_.clear();
+    if (xforms.size() != instance_xforms_.size() / 16) {
+        instance_layout_dirty_ = true;
+    }
+    instance_xforms_.resize(16 * xforms.size());
     for (int i=0; i<xforms.size(); i++) {
-        for (int j=0; j<16; j++) {
-            std::cout << xforms[i][j] << std::endl;
-            instance_xforms_.push_back(xforms[i][j]);
-        }
+        memcpy(&instance_xforms_[16*i], xforms[i].value_ptr(), 16*sizeof(float));
+    }
+    xform_stream_.MarkDirty(0, instance_xforms_.size() * sizeof(float));
+}
+
+void Mesh::SetInstanceColors(const std::vector<Color> &colors) {
+    if (colors.size() != instance_colors_.size() / 4) {
+        instance_layout_dirty_ = true;
+    }
+    instance_colors_.resize(4 * colors.size());
+    for (int i=0; i<colors.size(); i++) {
+        memcpy(&instance_colors_[4*i], colors[i].value_ptr(), 4*sizeof(float));
+    }
+    color_stream_.MarkDirty(0, instance_colors_.size() * sizeof(float));
+}
+
+void Mesh::SetInstanceIds(const std::vector<unsigned int> &ids) {
+    SetInstanceIds(ids.empty() ? NULL : &ids[0], (int)ids.size());
+}
+
+void Mesh::SetInstanceTransforms(const float *xformsArray, int numInstances) {
+    if (numInstances != instance_xforms_.size() / 16) {
+        instance_layout_dirty_ = true;
+    }
+    instance_xforms_.assign(xformsArray, xformsArray + 16 * numInstances);
+    xform_stream_.MarkDirty(0, instance_xforms_.size() * sizeof(float));
+}
+
+void Mesh::SetInstanceColors(const float *colorsArray, int numInstances) {
+    if (numInstances != instance_colors_.size() / 4) {
+        instance_layout_dirty_ = true;
     }
+    instance_colors_.assign(colorsArray, colorsArray + 4 * numInstances);
+    color_stream_.MarkDirty(0, instance_colors_.size() * sizeof(float));
+}
+
+void Mesh::SetInstanceIds(const unsigned int *idsArray, int numInstances) {
+    if (numInstances != instance_ids_.size()) {
+        instance_layout_dirty_ = true;
+    }
+    instance_ids_.assign(idsArray, idsArray + numInstances);
+    id_stream_.MarkDirty(0, instance_ids_.size() * sizeof(unsigned int));
+}
+
+void Mesh::UpdateInstanceTransforms(int firstInstance, const float *xformsArray, int count) {
+    if ((firstInstance < 0) || (16 * (firstInstance + count) > instance_xforms_.size())) {
+        std::cerr << "Mesh::UpdateInstanceTransforms() -- warning: instances " << firstInstance << " to " << firstInstance + count - 1 << " are out of range (num instance transforms = " << instance_xforms_.size() / 16 << ")" << std::endl;
+        return;
+    }
+    memcpy(&instance_xforms_[16 * firstInstance], xformsArray, 16 * count * sizeof(float));
+    xform_stream_.MarkDirty(16 * firstInstance * sizeof(float), 16 * (firstInstance + count) * sizeof(float));
+}
+
+void Mesh::UpdateInstanceColors(int firstInstance, const float *colorsArray, int count) {
+    if ((firstInstance < 0) || (4 * (firstInstance + count) > instance_colors_.size())) {
+        std::cerr << "Mesh::UpdateInstanceColors() -- warning: instances " << firstInstance << " to " << firstInstance + count - 1 << " are out of range (num instance colors = " << instance_colors_.size() / 4 << ")" << std::endl;
+        return;
+    }
+    memcpy(&instance_colors_[4 * firstInstance], colorsArray, 4 * count * sizeof(float));
+    color_stream_.MarkDirty(4 * firstInstance * sizeof(float), 4 * (firstInstance + count) * sizeof(float));
+}
+
+void Mesh::UpdateInstanceIds(int firstInstance, const unsigned int *idsArray, int count) {
+    if ((firstInstance < 0) || (firstInstance + count > instance_ids_.size())) {
+        std::cerr << "Mesh::UpdateInstanceIds() -- warning: instances " << firstInstance << " to " << firstInstance + count - 1 << " are out of range (num instance ids = " << instance_ids_.size() << ")" << std::endl;
+        return;
+    }
+    memcpy(&instance_ids_[firstInstance], idsArray, count * sizeof(unsigned int));
+    id_stream_.MarkDirty(firstInstance * sizeof(unsigned int), (firstInstance + count) * sizeof(unsigned int));
+}
+
+void Mesh::ClearInstances() {
+    instance_xforms_.clear();
+    instance_colors_.clear();
+    instance_ids_.clear();
+    instance_layout_dirty_ = true;
+}
+
+int Mesh::num_instances() const {
+    if (instance_xforms_.size()) {
+        return (int)instance_xforms_.size() / 16;
+    }
+    else if (instance_colors_.size()) {
+        return (int)instance_colors_.size() / 4;
+    }
+    return (int)instance_ids_.size();
 }
     
 
@@ -269,7 +454,7 @@ void Mesh::SetTexCoords(int textureUnit, float *texCoordsArray, int numTexCoords
 }
 
 void Mesh::SetIndices(unsigned int *indexArray, int numIndices) {
-    gpu_dirty_ = true;
+    indices_dirty_ = true;
     bvh_dirty_ = true;
 
     indices_.clear();
@@ -322,14 +507,15 @@ void Mesh::UpdateGPUMemory() {
             totalMemSize += texCoordsMemSize[i];
         }
 
-        GLsizeiptr instanceXformsMemSize = instance_xforms_.size() * sizeof(float);
-        GLsizeiptr instanceXformsMemOffset = totalMemSize;
-        totalMemSize += instanceXformsMemSize;
-
-        
-        glGenBuffers(1, &vertex_buffer_);
+        // reuse the buffers from a previous update if there are any so that
+        // meshes that change every frame do not leak gpu memory
+        if (vertex_buffer_ == 0) {
+            glGenBuffers(1, &vertex_buffer_);
+        }
         glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
         glBufferData(GL_ARRAY_BUFFER, totalMemSize, NULL, GL_STATIC_DRAW);
+        vertex_buffer_bytes_ = totalMemSize;
+        gpu_num_vertices_ = num_vertices();
 
         glBufferSubData(GL_ARRAY_BUFFER, vertsMemOffset, vertsMemSize, &verts_[0]);
         if (norms_.size() > 0) {
@@ -341,11 +527,10 @@ void Mesh::UpdateGPUMemory() {
         for (int i=0; i<tex_coords_.size(); i++) {
             glBufferSubData(GL_ARRAY_BUFFER, texCoordsMemOffset[i], texCoordsMemSize[i], &(tex_coords_[i][0]));
         }
-        if (instance_xforms_.size() > 0) {
-            glBufferSubData(GL_ARRAY_BUFFER, instanceXformsMemOffset, instanceXformsMemSize, &instance_xforms_[0]);
+        if (vertex_array_ == 0) {
+            glGenVertexArrays(1, &vertex_array_);
         }
-        glGenVertexArrays(1, &vertex_array_);
-        glBindVertexArray(vertex_array_);
+        GLState::BindVertexArray(vertex_array_);
         glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
         
         // attribute 0 = vertices (required)
@@ -389,40 +574,160 @@ void Mesh::UpdateGPUMemory() {
             }
         }
 
-        // attribute 8-11 (takes 4 vec4 attribs to represent a single mat4) = instance transform matrices (optional)
-        attribID = 8;
-        if (instance_xforms_.size()) {
-            glEnableVertexAttribArray(8);
-            glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (char*)0 + instanceXformsMemOffset);
-            glVertexAttribDivisor(8, 1);
-            glEnableVertexAttribArray(9);
-            glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (char*)0 + instanceXformsMemOffset + 4*sizeof(GLfloat));
-            glVertexAttribDivisor(9, 1);
-            glEnableVertexAttribArray(10);
-            glVertexAttribPointer(10, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (char*)0 + instanceXformsMemOffset + 8*sizeof(GLfloat));
-            glVertexAttribDivisor(10, 1);
-            glEnableVertexAttribArray(11);
-            glVertexAttribPointer(11, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), (char*)0 + instanceXformsMemOffset + 12*sizeof(GLfloat));
-            glVertexAttribDivisor(11, 1);
-        }
-        else {
-            glDisableVertexAttribArray(8);
-            glDisableVertexAttribArray(9);
-            glDisableVertexAttribArray(10);
-            glDisableVertexAttribArray(11);
-        }
+        // attributes 8-13 = per-instance data (optional), these come from
+        // separate buffers that are attached to the vertex array in Draw()
+        instance_layout_dirty_ = true;
         
-        glBindVertexArray(0);
+        GLState::ReleaseVertexArray();
         
+        gpu_dirty_ = false;
+        indices_dirty_ = true;
+    }
+    
+    // the indices have their own buffer so they can be changed without
+    // copying all of the vertex data again
+    if (indices_dirty_) {
         if (indices_.size()) {
-            glGenBuffers(1, &element_buffer_);
+            if (element_buffer_ == 0) {
+                glGenBuffers(1, &element_buffer_);
+            }
+            // the element buffer binding is part of the vertex array, so bind
+            // this mesh's own rather than changing whichever one is bound
+            GLState::BindVertexArray(vertex_array_);
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(unsigned int), &indices_[0], GL_STATIC_DRAW);
+            size_t nbytes = indices_.size() * sizeof(unsigned int);
+            if (nbytes > element_buffer_bytes_) {
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, nbytes, &indices_[0], GL_STATIC_DRAW);
+                element_buffer_bytes_ = nbytes;
+            }
+            else {
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, nbytes, &indices_[0]);
+            }
+            GLState::ReleaseVertexArray();
         }
-        
-        
-        gpu_dirty_ = false;
+        gpu_num_indices_ = (int)indices_.size();
+        indices_dirty_ = false;
+    }
+}
+
+
+void Mesh::FreeGPUMemory() {
+    // skip the GL calls for meshes that were never drawn, which may not have
+    // an OpenGL context at all
+    GLuint buffers[5] = { vertex_buffer_, element_buffer_, xform_stream_.buffer,
+                          color_stream_.buffer, id_stream_.buffer };
+    for (int i=0; i<5; i++) {
+        if (buffers[i] != 0) {
+            glDeleteBuffers(1, &buffers[i]);
+        }
+    }
+    if (vertex_array_ != 0) {
+        GLState::ForgetVertexArray(vertex_array_);
+        glDeleteVertexArrays(1, &vertex_array_);
+    }
+    vertex_buffer_ = 0;
+    vertex_array_ = 0;
+    element_buffer_ = 0;
+    vertex_buffer_bytes_ = 0;
+    element_buffer_bytes_ = 0;
+    gpu_num_vertices_ = 0;
+    gpu_num_indices_ = 0;
+    xform_stream_ = InstanceStream();
+    color_stream_ = InstanceStream();
+    id_stream_ = InstanceStream();
+    instance_layout_dirty_ = true;
+    gpu_dirty_ = true;
+    indices_dirty_ = true;
+}
+
+
+void Mesh::UpdateInstanceGPUMemory() {
+    if ((instance_xforms_.size() && (instance_xforms_.size() / 16 != num_instances())) ||
+        (instance_colors_.size() && (instance_colors_.size() / 4 != num_instances())) ||
+        (instance_ids_.size() && (instance_ids_.size() != num_instances()))) {
+        if (instance_layout_dirty_) {
+            std::cerr << "Mesh::UpdateInstanceGPUMemory() -- warning: the number of per instance transforms, colors, and ids are not equal. (Transforms = " << instance_xforms_.size() / 16 << ", Colors = " << instance_colors_.size() / 4 << ", IDs = " << instance_ids_.size() << ")" << std::endl;
+        }
+    }
+    upload_instance_stream(&xform_stream_, instance_xforms_.empty() ? NULL : &instance_xforms_[0],
+                           instance_xforms_.size() * sizeof(float));
+    upload_instance_stream(&color_stream_, instance_colors_.empty() ? NULL : &instance_colors_[0],
+                           instance_colors_.size() * sizeof(float));
+    upload_instance_stream(&id_stream_, instance_ids_.empty() ? NULL : &instance_ids_[0],
+                           instance_ids_.size() * sizeof(unsigned int));
+}
+
+
+void Mesh::upload_instance_stream(InstanceStream *stream, const void *data, size_t nbytes) {
+    if (nbytes == 0) {
+        stream->dirty_begin = stream->dirty_end = 0;
+        return;
+    }
+    if (stream->buffer == 0) {
+        glGenBuffers(1, &stream->buffer);
+        stream->gpu_bytes = 0;
+        instance_layout_dirty_ = true;
+    }
+    if ((nbytes > stream->gpu_bytes) || ((stream->dirty_begin == 0) && (stream->dirty_end >= nbytes))) {
+        // growing or replacing everything, so reallocate rather than wait for
+        // the gpu to finish with the old data
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glBufferData(GL_ARRAY_BUFFER, nbytes, data, GL_DYNAMIC_DRAW);
+        stream->gpu_bytes = nbytes;
+    }
+    else if (stream->dirty_end > stream->dirty_begin) {
+        size_t end = std::min(stream->dirty_end, nbytes);
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, stream->dirty_begin, end - stream->dirty_begin,
+                        (const char*)data + stream->dirty_begin);
+    }
+    stream->dirty_begin = stream->dirty_end = 0;
+}
+
+
+void Mesh::point_instance_attributes(int first_instance) {
+    // assumes vertex_array_ is bound
+    
+    // attribute 8-11 (takes 4 vec4 attribs to represent a single mat4) = instance transform matrices (optional)
+    if (instance_xforms_.size()) {
+        glBindBuffer(GL_ARRAY_BUFFER, xform_stream_.buffer);
+        for (int col=0; col<4; col++) {
+            glEnableVertexAttribArray(8 + col);
+            glVertexAttribPointer(8 + col, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat),
+                                  (char*)0 + (16*first_instance + 4*col)*sizeof(GLfloat));
+            glVertexAttribDivisor(8 + col, 1);
+        }
+    }
+    else {
+        for (int col=0; col<4; col++) {
+            glDisableVertexAttribArray(8 + col);
+        }
+    }
+    
+    // attribute 12 = instance colors (optional)
+    if (instance_colors_.size()) {
+        glBindBuffer(GL_ARRAY_BUFFER, color_stream_.buffer);
+        glEnableVertexAttribArray(12);
+        glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), (char*)0 + 4*first_instance*sizeof(GLfloat));
+        glVertexAttribDivisor(12, 1);
     }
+    else {
+        glDisableVertexAttribArray(12);
+    }
+    
+    // attribute 13 = instance ids (optional), passed as integers
+    if (instance_ids_.size()) {
+        glBindBuffer(GL_ARRAY_BUFFER, id_stream_.buffer);
+        glEnableVertexAttribArray(13);
+        glVertexAttribIPointer(13, 1, GL_UNSIGNED_INT, sizeof(GLuint), (char*)0 + first_instance*sizeof(GLuint));
+        glVertexAttribDivisor(13, 1);
+    }
+    else {
+        glDisableVertexAttribArray(13);
+    }
+    
+    instance_attrib_offset_ = first_instance;
+    instance_layout_dirty_ = false;
 }
 
 
@@ -440,10 +745,53 @@ BVH* Mesh::bvh_ptr() {
 }
 
 
+void Mesh::ReleaseCPUData() {
+    if ((gpu_dirty_) || (indices_dirty_)) {
+        UpdateGPUMemory();
+    }
+    // swapping with empty vectors frees the memory, clear() would keep it
+    std::vector<float>().swap(verts_);
+    std::vector<float>().swap(norms_);
+    std::vector<float>().swap(colors_);
+    std::vector< std::vector<float> >().swap(tex_coords_);
+    std::vector<unsigned int>().swap(indices_);
+    // the BVH refers to triangles that are no longer here, so free it too
+    bvh_.CreateFromMesh(*this);
+    bvh_dirty_ = false;
+}
+
+
+size_t Mesh::cpu_bytes() const {
+    size_t nbytes = (verts_.capacity() + norms_.capacity() + colors_.capacity()) * sizeof(float);
+    for (int i=0; i<tex_coords_.size(); i++) {
+        nbytes += tex_coords_[i].capacity() * sizeof(float);
+    }
+    nbytes += indices_.capacity() * sizeof(unsigned int);
+    nbytes += (instance_xforms_.capacity() + instance_colors_.capacity()) * sizeof(float);
+    nbytes += instance_ids_.capacity() * sizeof(unsigned int);
+    return nbytes;
+}
+
+size_t Mesh::gpu_bytes() const {
+    return vertex_buffer_bytes_ + element_buffer_bytes_ + xform_stream_.gpu_bytes +
+           color_stream_.gpu_bytes + id_stream_.gpu_bytes;
+}
+
+size_t Mesh::bvh_bytes() const {
+    return bvh_.memory_bytes();
+}
+
+
 void Mesh::Draw() {
-    if (gpu_dirty_) {
+    Draw(0, num_instances());
+}
+
+
+void Mesh::Draw(int first_instance, int instance_count) {
+    if ((gpu_dirty_) || (indices_dirty_)) {
         UpdateGPUMemory();
     }
+    UpdateInstanceGPUMemory();
     
     // set defaults to pass to shaders any for optional attribs
     glVertexAttrib3f(1, 0.0, 0.0, 1.0);        // normal = +Z
@@ -457,23 +805,45 @@ void Mesh::Draw() {
     glVertexAttrib4f(9, 0.0, 1.0, 0.0, 0.0);  // instance transform col 2
     glVertexAttrib4f(10, 0.0, 0.0, 1.0, 0.0); // instance transform col 3
     glVertexAttrib4f(11, 0.0, 0.0, 0.0, 1.0); // instance transform col 4
+    glVertexAttrib4f(12, 1.0, 1.0, 1.0, 1.0); // instance color = opaque white
+    glVertexAttribI4ui(13, 0, 0, 0, 0);       // instance id = 0
+    glVertexAttribI4ui(14, 0, 0, 0, 0);       // draw id = 0 (only used by MeshBatch)
     
     
-    glBindVertexArray(vertex_array_);
+    GLState::BindVertexArray(vertex_array_);
     
-    if (instance_xforms_.size()) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
-        glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)indices_.size(), GL_UNSIGNED_INT, (void*)0, (GLsizei)instance_xforms_.size()/16);
-    }
-    else if (indices_.size()) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
-        glDrawElements(GL_TRIANGLES, (GLsizei)indices_.size(), GL_UNSIGNED_INT, (void*)0);
+    if (num_instances()) {
+        first_instance = std::max(first_instance, 0);
+        instance_count = std::min(instance_count, num_instances() - first_instance);
+        if (instance_count > 0) {
+            // GL 3.3 has no base instance parameter for draw calls, so to draw a
+            // sub-range the per-instance attributes are pointed at its first instance
+            if ((instance_layout_dirty_) || (first_instance != instance_attrib_offset_)) {
+                point_instance_attributes(first_instance);
+            }
+            if (gpu_num_indices_) {
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
+                glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)gpu_num_indices_, GL_UNSIGNED_INT, (void*)0, (GLsizei)instance_count);
+            }
+            else {
+                glDrawArraysInstanced(GL_TRIANGLES, 0, gpu_num_vertices_, (GLsizei)instance_count);
+            }
+        }
     }
     else {
-        glDrawArrays(GL_TRIANGLES, 0, num_vertices());
+        if (instance_layout_dirty_) {
+            point_instance_attributes(0);
+        }
+        if (gpu_num_indices_) {
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
+            glDrawElements(GL_TRIANGLES, (GLsizei)gpu_num_indices_, GL_UNSIGNED_INT, (void*)0);
+        }
+        else {
+            glDrawArrays(GL_TRIANGLES, 0, gpu_num_vertices_);
+        }
     }
     
-    glBindVertexArray(0);
+    GLState::ReleaseVertexArray();
 }
 
 
@@ -492,38 +862,41 @@ int Mesh::num_triangles() const {
 
 
 
-void Mesh::LoadFromOBJ(const std::string &filename) {
-    std::fstream file(filename.c_str(), std::ios::in);
-    if (!file) {
-        std::cerr << "Failed to load " + filename << std::endl;
-        exit(1);
-    }
-    
-    // tmp arrays
+namespace {
+
+// The data read from part of an .obj file by Mesh::LoadFromOBJ()
+class OBJPiece {
+public:
     std::vector<Point3> vertices;
     std::vector<Vector3> normals;
     std::vector<Point2> texCoords;
-    
-    while (file) {
-        std::string line;
-        do
-            getline(file, line);
-        while (file && (line.length() == 0 || line[0] == '#'));
+    std::vector<unsigned int> indices;
+};
+
+// Parses the lines in [begin, end), which must start at the beginning of a line
+void ParseOBJLines(const char *begin, const char *end, OBJPiece *piece) {
+    while (begin < end) {
+        const char *eol = std::find(begin, end, '\n');
+        std::string line(begin, eol);
+        begin = (eol < end) ? eol + 1 : end;
+        if ((line.length() == 0) || (line[0] == '#')) {
+            continue;
+        }
         std::stringstream linestream(line);
         std::string keyword;
         linestream >> keyword;
         if (keyword == "v") {
             Point3 vertex;
             linestream >> vertex[0] >> vertex[1] >> vertex[2];
-            vertices.push_back(vertex);
+            piece->vertices.push_back(vertex);
         } else if (keyword == "vn") {
             Vector3 normal;
             linestream >> normal[0] >> normal[1] >> normal[2];
-            normals.push_back(normal);
+            piece->normals.push_back(normal);
         } else if (keyword == "vt") {
             Point2 texCoord;
             linestream >> texCoord[0] >> texCoord[1];
-            texCoords.push_back(texCoord);
+            piece->texCoords.push_back(texCoord);
         } else if (keyword == "f") {
             std::vector<int> polygon;
             std::string word;
@@ -534,26 +907,75 @@ void Mesh::LoadFromOBJ(const std::string &filename) {
                 polygon.push_back(v-1); // In OBJ files, indices start from 1
             }
             for (int i = 2; i < polygon.size(); i++) {
-                //triangles.push_back(ivec3(polygon[0], polygon[i-1], polygon[i]));
-                int i1 = polygon[0];
-                int i2 = polygon[(size_t)i-1];
-                int i3 = polygon[i];
-                //int t = AddTriangle(vertices[i1], vertices[i2], vertices[i3]);
-                //if (normals.size()) {
-                //    SetNormals(t, normals[i1], normals[i2], normals[i3]);
-                //}
-                //if (texCoords.size()) {
-                //    SetTexCoords(t, 0, texCoords[i1], texCoords[i2], texCoords[i3]);
-                //}
-                
-                indices_.push_back(i1);
-                indices_.push_back(i2);
-                indices_.push_back(i3);
+                piece->indices.push_back(polygon[0]);
+                piece->indices.push_back(polygon[(size_t)i-1]);
+                piece->indices.push_back(polygon[i]);
             }
         }
     }
+}
+
+} // end namespace
+
+
+void Mesh::LoadFromOBJ(const std::string &filename) {
+    LoadFromOBJ(filename, NULL);
+}
+
+void Mesh::LoadFromOBJ(const std::string &filename, JobSystem *job_system) {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to load " + filename << std::endl;
+        exit(1);
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    // split the file into pieces that each start at the beginning of a line.
+    // indices in the file are absolute, so the pieces can be parsed separately
+    // and appended in order.
+    const size_t MIN_BYTES_PER_PIECE = 256 * 1024;
+    int num_pieces = 1;
+    if (job_system != NULL) {
+        num_pieces = (int)std::min((size_t)(4 * job_system->num_threads()), text.size() / MIN_BYTES_PER_PIECE);
+        num_pieces = std::max(num_pieces, 1);
+    }
+    const char *data = text.data();
+    std::vector<const char*> bounds;
+    bounds.push_back(data);
+    for (int i=1; i<num_pieces; i++) {
+        const char *p = std::max(data + text.size() * i / num_pieces, bounds.back());
+        bounds.push_back(std::find(p, data + text.size(), '\n'));
+        if (bounds.back() < data + text.size()) {
+            bounds.back()++;
+        }
+    }
+    bounds.push_back(data + text.size());
+    
+    std::vector<OBJPiece> pieces(num_pieces);
+    if (num_pieces == 1) {
+        ParseOBJLines(bounds[0], bounds[1], &pieces[0]);
+    }
+    else {
+        job_system->ParallelFor(num_pieces, 1, [&](int begin, int end) {
+            for (int i=begin; i<end; i++) {
+                ParseOBJLines(bounds[i], bounds[(size_t)i+1], &pieces[i]);
+            }
+        });
+    }
+    
+    // tmp arrays
+    std::vector<Point3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Point2> texCoords;
+    for (int i=0; i<pieces.size(); i++) {
+        vertices.insert(vertices.end(), pieces[i].vertices.begin(), pieces[i].vertices.end());
+        normals.insert(normals.end(), pieces[i].normals.begin(), pieces[i].normals.end());
+        texCoords.insert(texCoords.end(), pieces[i].texCoords.begin(), pieces[i].texCoords.end());
+        indices_.insert(indices_.end(), pieces[i].indices.begin(), pieces[i].indices.end());
+    }
     
     gpu_dirty_ = true;
+    bvh_dirty_ = true;
     std::vector<float> verts, norms, uvs;
     for (int i=0;i<vertices.size();i++) {
         verts_.push_back(vertices[i][0]);
@@ -592,6 +1014,25 @@ Point2 Mesh::read_tex_coords_data(int textureUnit, int i) const {
     return Point2(tex_coords_[textureUnit][(size_t)2*i], tex_coords_[textureUnit][(size_t)2*i+1]);
 }
 
+int Mesh::num_normals() const {
+    return (int)norms_.size()/3;
+}
+
+int Mesh::num_colors() const {
+    return (int)colors_.size()/4;
+}
+
+int Mesh::num_texture_units() const {
+    return (int)tex_coords_.size();
+}
+
+int Mesh::num_tex_coords(int textureUnit) const {
+    if ((textureUnit < 0) || (textureUnit >= tex_coords_.size())) {
+        return 0;
+    }
+    return (int)tex_coords_[textureUnit].size()/2;
+}
+
 std::vector<unsigned int> Mesh::read_triangle_indices_data(int triangle_id) const {
     std::vector<unsigned int> tri;
     int i = 3*triangle_id;
@@ -610,11 +1051,28 @@ std::vector<unsigned int> Mesh::read_triangle_indices_data(int triangle_id) cons
     return tri;
 }
 
+void Mesh::read_triangle_indices_data(int triangle_id, unsigned int indices[3]) const {
+    int i = 3*triangle_id;
+    if (indices_.size()) {
+        // indexed faces mode
+        indices[0] = indices_[(size_t)i+0];
+        indices[1] = indices_[(size_t)i+1];
+        indices[2] = indices_[(size_t)i+2];
+    }
+    else {
+        // ordered faces mode
+        indices[0] = i;
+        indices[1] = i+1;
+        indices[2] = i+2;
+    }
+}
+
 
 void Mesh::CalcPerFaceNormals() {
     std::vector<Vector3> norms(num_vertices());
     for (int i=0; i<num_triangles(); i++) {
-        std::vector<unsigned int> indices = read_triangle_indices_data(i);
+        unsigned int indices[3];
+        read_triangle_indices_data(i, indices);
         Point3 a = read_vertex_data(indices[0]);
         Point3 b = read_vertex_data(indices[1]);
         Point3 c = read_vertex_data(indices[2]);
@@ -630,7 +1088,8 @@ void Mesh::CalcPerFaceNormals() {
 void Mesh::CalcPerVertexNormals() {
     std::vector<Vector3> norms(num_vertices());
     for (int i=0; i<num_triangles(); i++) {
-        std::vector<unsigned int> indices = read_triangle_indices_data(i);
+        unsigned int indices[3];
+        read_triangle_indices_data(i, indices);
         Point3 a = read_vertex_data(indices[0]);
         Point3 b = read_vertex_data(indices[1]);
         Point3 c = read_vertex_data(indices[2]);
@@ -647,5 +1106,237 @@ void Mesh::CalcPerVertexNormals() {
     SetNormals(norms);
 }
 
+
+void Mesh::CalcPerVertexNormals(JobSystem *job_system) {
+    // neighboring triangles share vertices, so each piece of the triangle
+    // list adds its face normals into an array of its own, and then the arrays
+    // are added together.  the number of pieces is capped since each one
+    // needs an array as large as the mesh.
+    const int MIN_TRIANGLES_PER_PIECE = 4096;
+    const int MAX_PIECES = 8;
+    int ntris = num_triangles();
+    int nverts = num_vertices();
+    int num_pieces = 1;
+    if (job_system != NULL) {
+        num_pieces = std::min(std::min(job_system->num_threads(), MAX_PIECES), ntris / MIN_TRIANGLES_PER_PIECE);
+        num_pieces = std::max(num_pieces, 1);
+    }
+    
+    std::vector<std::vector<Vector3>> sums(num_pieces);
+    ParallelFor(job_system, num_pieces, 1, [&](int begin, int end) {
+        for (int p=begin; p<end; p++) {
+            sums[p].resize(nverts);
+            int first = (int)((long long)ntris * p / num_pieces);
+            int last = (int)((long long)ntris * (p+1) / num_pieces);
+            for (int i=first; i<last; i++) {
+                unsigned int indices[3];
+                read_triangle_indices_data(i, indices);
+                Point3 a = read_vertex_data(indices[0]);
+                Point3 b = read_vertex_data(indices[1]);
+                Point3 c = read_vertex_data(indices[2]);
+                Vector3 n = Vector3::Cross(b-a, c-a);
+                sums[p][indices[0]] = sums[p][indices[0]] + n;
+                sums[p][indices[1]] = sums[p][indices[1]] + n;
+                sums[p][indices[2]] = sums[p][indices[2]] + n;
+            }
+        }
+    });
+    
+    std::vector<Vector3> norms(nverts);
+    ParallelFor(job_system, nverts, 4096, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            Vector3 n = sums[0][i];
+            for (int p=1; p<num_pieces; p++) {
+                n = n + sums[p][i];
+            }
+            norms[i] = n.ToUnit();
+        }
+    });
+    
+    SetNormals(norms);
+}
+
+
+namespace {
+
+// A cell of the spatial hash used by Mesh::Weld()
+class WeldCell {
+public:
+    long long x, y, z;
+    bool operator==(const WeldCell &o) const { return (x == o.x) && (y == o.y) && (z == o.z); }
+};
+
+class WeldCellHash {
+public:
+    size_t operator()(const WeldCell &c) const {
+        return ((size_t)c.x * 73856093u) ^ ((size_t)c.y * 19349663u) ^ ((size_t)c.z * 83492791u);
+    }
+};
+
+} // end anonymous namespace
+
+
+Mesh::WeldReport Mesh::Weld(float position_epsilon, float attribute_epsilon) {
+    WeldReport report;
+    const int nverts = num_vertices();
+    const int ntris = num_triangles();
+    const bool has_normals = (num_normals() == nverts);
+    const bool has_colors = (num_colors() == nverts);
+
+    size_t nfloats = verts_.size() + norms_.size() + colors_.size();
+    for (int u=0; u<tex_coords_.size(); u++) {
+        nfloats += tex_coords_[u].size();
+    }
+    report.vertices_before = nverts;
+    report.bytes_before = nfloats * sizeof(float) + indices_.size() * sizeof(unsigned int);
+
+    // With an epsilon of 0 the cells are the exact float values (with -0 the
+    // same as 0), otherwise they are cubes of the epsilon's size, and a match
+    // can be in any of the 27 cells around a vertex.
+    const bool exact = (position_epsilon <= 0.0f);
+    const double inv_cell = exact ? 0.0 : 1.0 / position_epsilon;
+    const float eps2 = position_epsilon * position_epsilon;
+    const int reach = exact ? 0 : 1;
+    std::unordered_map<WeldCell, int, WeldCellHash> cells;
+    cells.reserve(nverts);
+    std::vector<int> next_in_cell;   // the kept vertices in each cell, as linked lists
+    std::vector<int> kept;           // old id of each kept vertex
+    std::vector<int> remap(nverts);
+
+    for (int i=0; i<nverts; i++) {
+        const float *p = &verts_[3*(size_t)i];
+        WeldCell cell;
+        if (exact) {
+            int bits[3];
+            float q[3] = { p[0] + 0.0f, p[1] + 0.0f, p[2] + 0.0f };
+            memcpy(bits, q, sizeof(q));
+            cell.x = bits[0];  cell.y = bits[1];  cell.z = bits[2];
+        }
+        else {
+            cell.x = (long long)std::floor((double)p[0] * inv_cell);
+            cell.y = (long long)std::floor((double)p[1] * inv_cell);
+            cell.z = (long long)std::floor((double)p[2] * inv_cell);
+        }
+
+        // find the closest kept vertex that matches
+        int best = -1;
+        float best_d2 = 0.0f;
+        for (int dx=-reach; dx<=reach; dx++) {
+            for (int dy=-reach; dy<=reach; dy++) {
+                for (int dz=-reach; dz<=reach; dz++) {
+                    WeldCell c = { cell.x + dx, cell.y + dy, cell.z + dz };
+                    std::unordered_map<WeldCell, int, WeldCellHash>::const_iterator it = cells.find(c);
+                    for (int k = (it == cells.end()) ? -1 : it->second; k >= 0; k = next_in_cell[k]) {
+                        int j = kept[k];
+                        const float *q = &verts_[3*(size_t)j];
+                        float d2 = (p[0]-q[0])*(p[0]-q[0]) + (p[1]-q[1])*(p[1]-q[1]) + (p[2]-q[2])*(p[2]-q[2]);
+                        if ((d2 > eps2) || ((best >= 0) && (d2 >= best_d2))) {
+                            continue;
+                        }
+                        bool same = true;
+                        for (int a=0; (a<3) && (same) && (has_normals); a++) {
+                            same = std::fabs(norms_[3*(size_t)i+a] - norms_[3*(size_t)j+a]) <= attribute_epsilon;
+                        }
+                        for (int a=0; (a<4) && (same) && (has_colors); a++) {
+                            same = std::fabs(colors_[4*(size_t)i+a] - colors_[4*(size_t)j+a]) <= attribute_epsilon;
+                        }
+                        for (int u=0; (u<tex_coords_.size()) && (same); u++) {
+                            if (tex_coords_[u].size() == 2*(size_t)nverts) {
+                                same = (std::fabs(tex_coords_[u][2*(size_t)i] - tex_coords_[u][2*(size_t)j]) <= attribute_epsilon) &&
+                                       (std::fabs(tex_coords_[u][2*(size_t)i+1] - tex_coords_[u][2*(size_t)j+1]) <= attribute_epsilon);
+                            }
+                        }
+                        if (same) {
+                            best = k;
+                            best_d2 = d2;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (best >= 0) {
+            remap[i] = best;
+        }
+        else {
+            remap[i] = (int)kept.size();
+            std::unordered_map<WeldCell, int, WeldCellHash>::iterator it = cells.find(cell);
+            next_in_cell.push_back((it == cells.end()) ? -1 : it->second);
+            cells[cell] = (int)kept.size();
+            kept.push_back(i);
+        }
+    }
+
+    // Compact the vertex attributes, keeping the data of the first vertex in
+    // each group of merged vertices
+    const int nkept = (int)kept.size();
+    std::vector<float> verts(3*(size_t)nkept);
+    std::vector<float> norms(has_normals ? 3*(size_t)nkept : 0);
+    std::vector<float> colors(has_colors ? 4*(size_t)nkept : 0);
+    for (int k=0; k<nkept; k++) {
+        memcpy(&verts[3*(size_t)k], &verts_[3*(size_t)kept[k]], 3*sizeof(float));
+        if (has_normals) {
+            memcpy(&norms[3*(size_t)k], &norms_[3*(size_t)kept[k]], 3*sizeof(float));
+        }
+        if (has_colors) {
+            memcpy(&colors[4*(size_t)k], &colors_[4*(size_t)kept[k]], 4*sizeof(float));
+        }
+    }
+    for (int u=0; u<tex_coords_.size(); u++) {
+        if (tex_coords_[u].size() == 2*(size_t)nverts) {
+            std::vector<float> uvs(2*(size_t)nkept);
+            for (int k=0; k<nkept; k++) {
+                uvs[2*(size_t)k] = tex_coords_[u][2*(size_t)kept[k]];
+                uvs[2*(size_t)k+1] = tex_coords_[u][2*(size_t)kept[k]+1];
+            }
+            tex_coords_[u].swap(uvs);
+        }
+        else {
+            tex_coords_[u].clear();
+        }
+    }
+
+    // Triangles, dropping those that became degenerate
+    std::vector<unsigned int> indices;
+    indices.reserve(3*(size_t)ntris);
+    for (int t=0; t<ntris; t++) {
+        unsigned int tri[3];
+        read_triangle_indices_data(t, tri);
+        unsigned int a = remap[tri[0]], b = remap[tri[1]], c = remap[tri[2]];
+        if ((a != b) && (b != c) && (a != c)) {
+            indices.push_back(a);  indices.push_back(b);  indices.push_back(c);
+        }
+        else {
+            report.triangles_removed++;
+        }
+    }
+
+    verts_.swap(verts);
+    if (has_normals) {
+        norms_.swap(norms);
+    }
+    else {
+        norms_.clear();
+    }
+    if (has_colors) {
+        colors_.swap(colors);
+    }
+    else {
+        colors_.clear();
+    }
+    indices_.swap(indices);
+    gpu_dirty_ = true;
+    indices_dirty_ = true;
+    bvh_dirty_ = true;
+
+    nfloats = verts_.size() + norms_.size() + colors_.size();
+    for (int u=0; u<tex_coords_.size(); u++) {
+        nfloats += tex_coords_[u].size();
+    }
+    report.vertices_after = nkept;
+    report.bytes_after = nfloats * sizeof(float) + indices_.size() * sizeof(unsigned int);
+    return report;
+}
+
     
 } // end namespace
@@ -23,11 +23,13 @@
 #include "point3.h"
 #include "vector3.h"
 
+#include <algorithm>
 #include <vector>
 
 
 namespace mingfx {
 
+class JobSystem;
 class Matrix4;
     
 /** A triangle mesh data structure that can be rendered with a ShaderProgram
@@ -123,6 +125,13 @@ class Matrix4;
  
  // then you can draw the same way as in the previous example.
  ~~~
+ 
+ The functions that add or set data only change the copy of the mesh kept in
+ CPU memory and mark it to be copied to the graphics card the next time the
+ mesh is drawn (or UpdateGPUMemory() is called).  So, a mesh may be filled in
+ by a thread that does not have the OpenGL context, such as a simulation
+ thread, as long as no other thread uses the same mesh at the same time.  A
+ TripleBuffer of meshes is an easy way to do this.
  */
 class Mesh {
 public:
@@ -132,8 +141,21 @@ public:
     /// Copies all data and sets GPU dirty bit for the new mesh.
     Mesh(const Mesh &other);
     
+    /// Takes the data and GPU buffers from other, which is left empty.
+    Mesh(Mesh &&other);
+    
+    /// Frees the mesh's GPU buffers, so if the mesh is a global or static
+    /// variable, make sure the OpenGL context still exists when it is deleted.
     virtual ~Mesh();
     
+    /// Copies all data and sets the GPU dirty bit.  This mesh's GPU buffers
+    /// are kept and reused the next time the data are copied to the GPU.
+    Mesh& operator=(const Mesh &other);
+    
+    /// Frees this mesh's GPU buffers and takes the data and GPU buffers from
+    /// other, which is left empty.
+    Mesh& operator=(Mesh &&other);
+    
     
     /** This reads a mesh stored in the common Wavefront Obj file format.  The
      loader here is simplistic and not guaranteed to work on all valid .obj
@@ -141,6 +163,12 @@ public:
      called automatically after the model is loaded. */
     void LoadFromOBJ(const std::string &filename);
     
+    /** Same as LoadFromOBJ() above, but splits the file into pieces that are
+     parsed at the same time as jobs on job_system, which is much faster for
+     large models.  The result is the same.  If job_system is NULL, the whole
+     file is parsed on the calling thread. */
+    void LoadFromOBJ(const std::string &filename, JobSystem *job_system);
+    
     
     
     // ---- TRIANGLE LIST MODE ----
@@ -195,11 +223,72 @@ public:
     /// Sets the indices into the vertex array to use to create the triangles.
     /// Each consecutive set of 3 indices forms one triangle:
     /// (v1,v2,v3), (v1,v2,v3), (v1,v2,v3), ...
+    /// When only the indices change, only the index buffer is copied to the
+    /// GPU again, so it is cheap to change which triangles are drawn each
+    /// frame (e.g., after culling with Meshlets).
     void SetIndices(const std::vector<unsigned int> index_array);
     
     
+    // ---- Per-instance data ----
+    // When the mesh has per-instance data, Draw() draws the whole mesh once per
+    // instance in a single instanced draw call.  Each per-instance attribute is
+    // stored in its own GPU buffer, separate from the vertex data, so the
+    // instances can be changed every frame without re-uploading the mesh, and
+    // the Update...() functions only re-upload the instances that changed.
+    // In the shader, the per-instance attributes are available as:
+    //   layout(location = 8) in mat4 instance_xform;  // defaults to identity
+    //   layout(location = 12) in vec4 instance_color; // defaults to opaque white
+    //   layout(location = 13) in uint instance_id;    // defaults to 0
+    // All of the per-instance arrays that are set should have the same length.
+    
+    /// Sets a transformation matrix for each instance to draw.  Pass an empty
+    /// array (or call ClearInstances()) to go back to drawing a single copy.
     void SetInstanceTransforms(const std::vector<Matrix4> &xforms);
     
+    /// Sets a color for each instance to draw, following the same ordering as
+    /// SetInstanceTransforms().
+    void SetInstanceColors(const std::vector<Color> &colors);
+    
+    /// Sets an integer ID for each instance to draw, following the same
+    /// ordering as SetInstanceTransforms().  Useful for picking or for looking
+    /// up additional per-instance data in the shader.
+    void SetInstanceIds(const std::vector<unsigned int> &ids);
+    
+    /// Sets a transformation matrix for each instance.  Matrices are stored as
+    /// 16 floats each, in the same column-major order as Matrix4::value_ptr().
+    /// This version of the function accepts a C-style array rather than std::vector<>
+    void SetInstanceTransforms(const float *xforms_array, int num_instances);
+    
+    /// Sets a color for each instance.  Colors are stored as (r,g,b,a), (r,g,b,a), ...
+    /// This version of the function accepts a C-style array rather than std::vector<>
+    void SetInstanceColors(const float *colors_array, int num_instances);
+    
+    /// Sets an integer ID for each instance.
+    /// This version of the function accepts a C-style array rather than std::vector<>
+    void SetInstanceIds(const unsigned int *ids_array, int num_instances);
+    
+    /// Replaces the transforms for instances first_instance to
+    /// first_instance + count - 1, which must already exist.  Only this range
+    /// is re-uploaded to the GPU.
+    void UpdateInstanceTransforms(int first_instance, const float *xforms_array, int count);
+    
+    /// Replaces the colors for instances first_instance to
+    /// first_instance + count - 1, which must already exist.  Only this range
+    /// is re-uploaded to the GPU.
+    void UpdateInstanceColors(int first_instance, const float *colors_array, int count);
+    
+    /// Replaces the IDs for instances first_instance to
+    /// first_instance + count - 1, which must already exist.  Only this range
+    /// is re-uploaded to the GPU.
+    void UpdateInstanceIds(int first_instance, const unsigned int *ids_array, int count);
+    
+    /// Removes all per-instance data so the mesh is drawn as a single copy.
+    void ClearInstances();
+    
+    /// The number of instances drawn by Draw(), or 0 if the mesh does not use
+    /// instancing.
+    int num_instances() const;
+    
     
     // ---- These functions can be used instead of the above if you are working with
     // regular C-style arrays and floats rather than the higher level types like
@@ -245,12 +334,28 @@ public:
      the vertex array. */
     void UpdateGPUMemory();
     
+    /** Deletes the OpenGL buffers and vertex array holding the mesh but keeps
+     the data in CPU memory, so they will be created and filled again the next
+     time the mesh is drawn.  This happens automatically when the mesh is
+     deleted, and it can be called directly to free GPU memory used by meshes
+     that will not be drawn for a while. */
+    void FreeGPUMemory();
+    
     /** This sends the mesh vertices and attributes down the graphics pipe using
      glDrawArrays() for the non-indexed mode and glDrawElements() for the indexed
      mode.  This is just the geometry -- for anything to show up on the screen,
      you must already have a ShaderProgram enabled before calling this function. */
     void Draw();
     
+    /** Draws only instances first_instance to first_instance + instance_count - 1
+     of an instanced mesh.  For a mesh without per-instance data, this is the
+     same as Draw(). */
+    void Draw(int first_instance, int instance_count);
+    
+    /** Copies any per-instance data that changed since the last draw to the
+     GPU.  This is called automatically by Draw(). */
+    void UpdateInstanceGPUMemory();
+    
 
     
     /** This (re)calculates the normals for the mesh and stores them with the mesh
@@ -269,7 +374,45 @@ public:
      triangle contributes more to the vertex normal than a small one). */
     void CalcPerVertexNormals();
     
-    
+    /** Same as CalcPerVertexNormals() above, but the triangles are split into
+     pieces that are processed at the same time as jobs on job_system.  The
+     sums are added up in a different order, so the normals may differ in the
+     last few bits.  If job_system is NULL, all of the work is done on the
+     calling thread. */
+    void CalcPerVertexNormals(JobSystem *job_system);
+
+
+    /// Small data structure returned by Weld() to describe what it did
+    class WeldReport {
+    public:
+        int vertices_before;
+        int vertices_after;
+        /// Degenerate triangles dropped, e.g., because two of their corners
+        /// were merged.
+        int triangles_removed;
+        /// Bytes of vertex attribute and index data before and after.
+        size_t bytes_before;
+        size_t bytes_after;
+
+        WeldReport() : vertices_before(0), vertices_after(0), triangles_removed(0),
+            bytes_before(0), bytes_after(0) {}
+    };
+
+    /** Merges vertices that are within position_epsilon of each other and whose
+     normals, colors, and texture coordinates are all within attribute_epsilon,
+     then stores the mesh in indexed mode with the triangles sharing the merged
+     vertices.  Meshes made with AddTriangle() repeat each shared vertex for
+     every triangle that uses it, so this often cuts their size by more than
+     half and lets the GPU reuse vertices it has already transformed.  Vertices
+     on a seam, e.g., the corners of a cube, where the normals differ, are kept
+     separate.  Any per-instance data is left as it is.  Since the mesh is
+     indexed afterward, do not call AddTriangle() or the other triangle list
+     functions on it again.  A spatial hash with cells the size of
+     position_epsilon finds the nearby vertices, so welding is fast even for
+     large meshes. */
+    WeldReport Weld(float position_epsilon = 1e-6f, float attribute_epsilon = 1e-6f);
+
+
     /** This (re)calculates a Bounding Volume Hierarchy for the mesh, which can
      be used together with Ray::FastIntersectMesh() to do faster ray-mesh
      intersection testing. */
@@ -281,6 +424,27 @@ public:
      the pointer. */
     BVH* bvh_ptr();
     
+    
+    // Memory use, see also MemoryStats
+    
+    /** Frees the CPU copies of the vertex data and indices once they have been
+     copied to the GPU (this calls UpdateGPUMemory() first if needed).  The mesh
+     can still be drawn, but it then reports 0 vertices and triangles, and
+     anything that reads its data (e.g., Ray::IntersectMesh(), bvh_ptr(),
+     MeshBatch::AddMesh()) will see an empty mesh.  Setting new vertices or
+     indices works as usual.  The BVH is freed as well.  Per-instance data is kept since it usually
+     changes. */
+    void ReleaseCPUData();
+    
+    /// Bytes of CPU memory used for the vertex data, indices, and per-instance data.
+    size_t cpu_bytes() const;
+    
+    /// Bytes of GPU memory used for the vertex, index, and per-instance buffers.
+    size_t gpu_bytes() const;
+    
+    /// Bytes of CPU memory used for the BVH, which is 0 until it is built.
+    size_t bvh_bytes() const;
+    
     // Access to properties indexed by vertex number
     
     /// The total number of vertices in the mesh.
@@ -302,6 +466,19 @@ public:
     /// Use the SetTexCoords() function to set (or edit) per-vertex tex coords.
 	Point2 read_tex_coords_data(int texture_unit, int vertex_id) const;
     
+    /// The number of per-vertex normals, either 0 or num_vertices().
+    int num_normals() const;
+    
+    /// The number of per-vertex colors, either 0 or num_vertices().
+    int num_colors() const;
+    
+    /// The number of texture units that have texture coordinates set.
+    int num_texture_units() const;
+    
+    /// The number of per-vertex texture coordinates for the texture unit,
+    /// either 0 or num_vertices().
+    int num_tex_coords(int texture_unit) const;
+    
     
     // Access to triangles
     
@@ -312,6 +489,10 @@ public:
     // of unsigned ints.  Use the SetIndices() function to set (or edit) the indices for the mesh.
 	std::vector<unsigned int> read_triangle_indices_data(int triangle_id) const;
     
+    /// Same as above, but copies the 3 indices into the array passed in rather than
+    /// allocating a new vector, which is much faster inside loops over all the triangles.
+    void read_triangle_indices_data(int triangle_id, unsigned int indices[3]) const;
+    
    
 private:
     std::vector<float> verts_;
@@ -320,11 +501,48 @@ private:
     std::vector< std::vector<float> > tex_coords_;
     std::vector<unsigned int> indices_;
     std::vector<float> instance_xforms_;
+    std::vector<float> instance_colors_;
+    std::vector<unsigned int> instance_ids_;
+    
+    // A separately updatable GPU buffer holding one per-instance attribute,
+    // along with the range of bytes that need to be re-uploaded
+    class InstanceStream {
+    public:
+        InstanceStream() : buffer(0), gpu_bytes(0), dirty_begin(0), dirty_end(0) {}
+        void MarkDirty(size_t begin, size_t end) {
+            if (dirty_end <= dirty_begin) {
+                dirty_begin = begin;
+                dirty_end = end;
+            }
+            else {
+                dirty_begin = std::min(dirty_begin, begin);
+                dirty_end = std::max(dirty_end, end);
+            }
+        }
+        GLuint buffer;
+        size_t gpu_bytes;
+        size_t dirty_begin;
+        size_t dirty_end;
+    };
+    void upload_instance_stream(InstanceStream *stream, const void *data, size_t nbytes);
+    void point_instance_attributes(int first_instance);
+    
+    InstanceStream xform_stream_;
+    InstanceStream color_stream_;
+    InstanceStream id_stream_;
+    bool instance_layout_dirty_;
+    int instance_attrib_offset_;
     
     bool gpu_dirty_;
     GLuint vertex_buffer_;
     GLuint vertex_array_;
     GLuint element_buffer_;
+    bool indices_dirty_;
+    size_t element_buffer_bytes_;
+    size_t vertex_buffer_bytes_;
+    // what was last copied to the GPU, which is what gets drawn
+    int gpu_num_vertices_;
+    int gpu_num_indices_;
     
     bool bvh_dirty_;
     BVH bvh_;
@@ -0,0 +1,289 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "mesh_adjacency.h"
+
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+
+namespace mingfx {
+
+
+namespace {
+
+// Fewer items than this are not worth making a job for
+const int MIN_PER_JOB = 4096;
+
+// True if corner j of the triangle repeats an earlier corner, as happens in
+// degenerate triangles, so each vertex is only counted once per triangle.
+inline bool RepeatedCorner(const unsigned int *tri, int j) {
+    return ((j > 0) && (tri[j] == tri[0])) || ((j > 1) && (tri[j] == tri[1]));
+}
+
+} // end anonymous namespace
+
+
+MeshAdjacency::MeshAdjacency() : num_vertices_(0), num_boundary_edges_(0), manifold_(true) {
+}
+
+MeshAdjacency::~MeshAdjacency() {
+}
+
+
+void MeshAdjacency::Clear() {
+    num_vertices_ = 0;
+    tris_.clear();
+    vert_tris_start_.assign(1, 0);
+    vert_tris_.clear();
+    vert_nbrs_start_.assign(1, 0);
+    vert_nbrs_.clear();
+    opposite_.clear();
+    boundary_vert_.clear();
+    num_boundary_edges_ = 0;
+    manifold_ = true;
+}
+
+
+void MeshAdjacency::Build(const Mesh &mesh, JobSystem *job_system) {
+    Clear();
+
+    const int nverts = mesh.num_vertices();
+    const int ntris = mesh.num_triangles();
+
+    // Copy the triangles
+    tris_.resize(3 * (size_t)ntris);
+    std::atomic<bool> bad_index(false);
+    ParallelFor(job_system, ntris, MIN_PER_JOB, [&](int begin, int end) {
+        for (int t=begin; t<end; t++) {
+            unsigned int *tri = &tris_[3*(size_t)t];
+            mesh.read_triangle_indices_data(t, tri);
+            if ((tri[0] >= nverts) || (tri[1] >= nverts) || (tri[2] >= nverts)) {
+                bad_index = true;
+            }
+        }
+    });
+    if (bad_index) {
+        std::cerr << "MeshAdjacency::Build() -- mesh has indices past the last vertex." << std::endl;
+        Clear();
+        return;
+    }
+    num_vertices_ = nverts;
+
+    // Vertex -> triangles.  Count the triangles around each vertex, turn the
+    // counts into the start of each vertex's list, then fill in the lists.
+    // Threads filling the same list can finish in any order, so each list is
+    // sorted at the end to make the result the same every time.
+    std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[nverts + 1]);
+    for (int v=0; v<=nverts; v++) {
+        counts[v] = 0;
+    }
+    ParallelFor(job_system, ntris, MIN_PER_JOB, [&](int begin, int end) {
+        for (int t=begin; t<end; t++) {
+            const unsigned int *tri = &tris_[3*(size_t)t];
+            for (int j=0; j<3; j++) {
+                if (!RepeatedCorner(tri, j)) {
+                    counts[tri[j]]++;
+                }
+            }
+        }
+    });
+    vert_tris_start_.resize(nverts + 1);
+    vert_tris_start_[0] = 0;
+    for (int v=0; v<nverts; v++) {
+        vert_tris_start_[v+1] = vert_tris_start_[v] + counts[v];
+        counts[v] = vert_tris_start_[v];
+    }
+    vert_tris_.resize(vert_tris_start_[nverts]);
+    ParallelFor(job_system, ntris, MIN_PER_JOB, [&](int begin, int end) {
+        for (int t=begin; t<end; t++) {
+            const unsigned int *tri = &tris_[3*(size_t)t];
+            for (int j=0; j<3; j++) {
+                if (!RepeatedCorner(tri, j)) {
+                    vert_tris_[counts[tri[j]]++] = t;
+                }
+            }
+        }
+    });
+    ParallelFor(job_system, nverts, MIN_PER_JOB, [&](int begin, int end) {
+        for (int v=begin; v<end; v++) {
+            std::sort(vert_tris_.begin() + vert_tris_start_[v], vert_tris_.begin() + vert_tris_start_[v+1]);
+        }
+    });
+
+    // Opposite half-edges.  The half-edge a->b is matched with the half-edge
+    // b->a, which must be in one of the triangles around b, but only if each
+    // of them is the only half-edge with its direction along that edge.
+    opposite_.resize(3 * (size_t)ntris);
+    std::vector<char> shared(3 * (size_t)ntris, 0);
+    ParallelFor(job_system, ntris, MIN_PER_JOB, [&](int begin, int end) {
+        for (int t=begin; t<end; t++) {
+            for (int j=0; j<3; j++) {
+                int h = 3*t + j;
+                unsigned int a = tris_[h];
+                unsigned int b = tris_[3*t + (j+1)%3];
+                opposite_[h] = -1;
+                if (a == b) {
+                    continue;
+                }
+                int num_same = 0;
+                int num_reverse = 0;
+                int reverse = -1;
+                for (int k=vert_tris_start_[b]; k<vert_tris_start_[b+1]; k++) {
+                    int u = vert_tris_[k];
+                    const unsigned int *tri = &tris_[3*(size_t)u];
+                    for (int i=0; i<3; i++) {
+                        unsigned int from = tri[i];
+                        unsigned int to = tri[(i+1)%3];
+                        if ((from == b) && (to == a)) {
+                            num_reverse++;
+                            reverse = 3*u + i;
+                        }
+                        else if ((from == a) && (to == b)) {
+                            num_same++;
+                        }
+                    }
+                }
+                if ((num_same == 1) && (num_reverse == 1)) {
+                    opposite_[h] = reverse;
+                }
+                else if ((num_same > 1) || (num_reverse > 1)) {
+                    shared[h] = 1;
+                }
+            }
+        }
+    });
+    for (size_t h=0; h<opposite_.size(); h++) {
+        if (opposite_[h] < 0) {
+            num_boundary_edges_++;
+        }
+        if (shared[h]) {
+            manifold_ = false;
+        }
+    }
+
+    // Vertex -> vertices and boundary vertices.  The neighbors are gathered
+    // from the triangles around each vertex, once to count them and again to
+    // store them.
+    vert_nbrs_start_.resize(nverts + 1);
+    vert_nbrs_start_[0] = 0;
+    boundary_vert_.resize(nverts, 0);
+    auto gather_neighbors = [this](int v, std::vector<int> *nbrs) {
+        nbrs->clear();
+        for (int k=vert_tris_start_[v]; k<vert_tris_start_[v+1]; k++) {
+            const unsigned int *tri = &tris_[3*(size_t)vert_tris_[k]];
+            for (int j=0; j<3; j++) {
+                if (tri[j] != (unsigned int)v) {
+                    nbrs->push_back((int)tri[j]);
+                }
+            }
+        }
+        std::sort(nbrs->begin(), nbrs->end());
+        nbrs->erase(std::unique(nbrs->begin(), nbrs->end()), nbrs->end());
+    };
+    ParallelFor(job_system, nverts, MIN_PER_JOB, [&](int begin, int end) {
+        std::vector<int> nbrs;
+        for (int v=begin; v<end; v++) {
+            gather_neighbors(v, &nbrs);
+            vert_nbrs_start_[v+1] = (int)nbrs.size();
+            // a vertex is on the boundary if one of the two half-edges that
+            // meet at it in some triangle has no opposite
+            for (int k=vert_tris_start_[v]; k<vert_tris_start_[v+1]; k++) {
+                int t = vert_tris_[k];
+                for (int j=0; j<3; j++) {
+                    if ((tris_[3*t+j] == (unsigned int)v) &&
+                        ((opposite_[3*t+j] < 0) || (opposite_[prev_half_edge(3*t+j)] < 0))) {
+                        boundary_vert_[v] = 1;
+                    }
+                }
+            }
+        }
+    });
+    for (int v=0; v<nverts; v++) {
+        vert_nbrs_start_[v+1] += vert_nbrs_start_[v];
+    }
+    vert_nbrs_.resize(vert_nbrs_start_[nverts]);
+    ParallelFor(job_system, nverts, MIN_PER_JOB, [&](int begin, int end) {
+        std::vector<int> nbrs;
+        for (int v=begin; v<end; v++) {
+            gather_neighbors(v, &nbrs);
+            std::copy(nbrs.begin(), nbrs.end(), vert_nbrs_.begin() + vert_nbrs_start_[v]);
+        }
+    });
+}
+
+
+int MeshAdjacency::num_vertices() const {
+    return num_vertices_;
+}
+
+int MeshAdjacency::num_triangles() const {
+    return (int)tris_.size() / 3;
+}
+
+const unsigned int* MeshAdjacency::triangle(int triangle_id) const {
+    return &tris_[3*(size_t)triangle_id];
+}
+
+int MeshAdjacency::num_vertex_triangles(int vertex_id) const {
+    return vert_tris_start_[vertex_id+1] - vert_tris_start_[vertex_id];
+}
+
+const int* MeshAdjacency::vertex_triangles(int vertex_id) const {
+    return vert_tris_.data() + vert_tris_start_[vertex_id];
+}
+
+int MeshAdjacency::num_vertex_neighbors(int vertex_id) const {
+    return vert_nbrs_start_[vertex_id+1] - vert_nbrs_start_[vertex_id];
+}
+
+const int* MeshAdjacency::vertex_neighbors(int vertex_id) const {
+    return vert_nbrs_.data() + vert_nbrs_start_[vertex_id];
+}
+
+bool MeshAdjacency::is_boundary_vertex(int vertex_id) const {
+    return boundary_vert_[vertex_id] != 0;
+}
+
+int MeshAdjacency::num_half_edges() const {
+    return (int)opposite_.size();
+}
+
+int MeshAdjacency::opposite_half_edge(int half_edge_id) const {
+    return opposite_[half_edge_id];
+}
+
+int MeshAdjacency::half_edge_start(int half_edge_id) const {
+    return (int)tris_[half_edge_id];
+}
+
+int MeshAdjacency::half_edge_end(int half_edge_id) const {
+    return (int)tris_[next_half_edge(half_edge_id)];
+}
+
+int MeshAdjacency::triangle_neighbor(int triangle_id, int j) const {
+    int opp = opposite_[3*triangle_id + j];
+    return (opp < 0) ? -1 : half_edge_triangle(opp);
+}
+
+bool MeshAdjacency::is_boundary_edge(int half_edge_id) const {
+    return opposite_[half_edge_id] < 0;
+}
+
+int MeshAdjacency::num_boundary_edges() const {
+    return num_boundary_edges_;
+}
+
+bool MeshAdjacency::is_manifold() const {
+    return manifold_;
+}
+
+
+} // end namespace
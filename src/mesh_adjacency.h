@@ -0,0 +1,174 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_MESH_ADJACENCY_H_
+#define SRC_MESH_ADJACENCY_H_
+
+#include "mesh.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+class JobSystem;
+
+
+/** Answers topology questions about a triangle mesh, such as which triangles
+ touch a vertex, which vertices are connected to a vertex by an edge, and
+ which triangle is on the other side of an edge.  Algorithms like smoothing,
+ region growing, computing normals, and finding silhouettes all need these.
+ Everything is built once from a Mesh and stored in a few flat arrays, so the
+ queries are just array lookups and never allocate memory.  Example:
+ ~~~
+ MeshAdjacency adj;
+ adj.Build(mesh);
+
+ // average each vertex with its neighbors
+ for (int v=0; v<adj.num_vertices(); v++) {
+     const int *nbrs = adj.vertex_neighbors(v);
+     Vector3 sum(0,0,0);
+     for (int i=0; i<adj.num_vertex_neighbors(v); i++) {
+         sum = sum + (mesh.read_vertex_data(nbrs[i]) - Point3::Origin());
+     }
+     ...
+ }
+ ~~~
+
+ The edges are stored as half-edges: each triangle t has three half-edges,
+ numbered 3t, 3t+1, and 3t+2, where half-edge 3t+j runs from corner j of the
+ triangle to corner j+1.  Two triangles that share an edge (and are oriented
+ the same way) each have a half-edge along it running in opposite directions,
+ and opposite_half_edge() links them.  Half-edges along the boundary of the
+ mesh have no opposite.  Since the numbering follows the triangles, stepping
+ around a triangle needs no lookups at all.
+
+ Note that the adjacency comes from the indices, so triangles that do not
+ share vertices in the Mesh (e.g., a mesh made without indices or with
+ vertices duplicated to give faces their own normals) are not connected.
+ */
+class MeshAdjacency {
+public:
+
+    /// Creates an empty adjacency structure.
+    MeshAdjacency();
+
+    virtual ~MeshAdjacency();
+
+    /** Builds the adjacency for the mesh, doing the work in parallel as jobs
+     on job_system, or serially if it is NULL.  Call this again if the mesh's
+     indices change. */
+    void Build(const Mesh &mesh, JobSystem *job_system = NULL);
+
+    /// Frees all of the adjacency data.
+    void Clear();
+
+
+    // Vertices and triangles
+
+    /// The number of vertices in the mesh used to build the adjacency.
+    int num_vertices() const;
+
+    /// The number of triangles in the mesh used to build the adjacency.
+    int num_triangles() const;
+
+    /// The 3 vertex indices of the triangle.
+    const unsigned int* triangle(int triangle_id) const;
+
+    /// The number of triangles that use the vertex.
+    int num_vertex_triangles(int vertex_id) const;
+
+    /// The ids of the triangles that use the vertex, in increasing order.
+    const int* vertex_triangles(int vertex_id) const;
+
+    /// The number of vertices connected to the vertex by an edge.
+    int num_vertex_neighbors(int vertex_id) const;
+
+    /// The ids of the vertices connected to the vertex by an edge, in
+    /// increasing order.
+    const int* vertex_neighbors(int vertex_id) const;
+
+    /// True if the vertex is on the boundary of the mesh, i.e., one of the
+    /// edges that touch it has a triangle on only one side.
+    bool is_boundary_vertex(int vertex_id) const;
+
+
+    // Half-edges
+
+    /// The number of half-edges, always 3*num_triangles().
+    int num_half_edges() const;
+
+    /// The half-edge running the other way along the same edge in the
+    /// neighboring triangle, or -1 if the edge is on the boundary.
+    int opposite_half_edge(int half_edge_id) const;
+
+    /// The next half-edge around the same triangle.
+    static int next_half_edge(int half_edge_id) {
+        return (half_edge_id % 3 == 2) ? half_edge_id - 2 : half_edge_id + 1;
+    }
+
+    /// The previous half-edge around the same triangle.
+    static int prev_half_edge(int half_edge_id) {
+        return (half_edge_id % 3 == 0) ? half_edge_id + 2 : half_edge_id - 1;
+    }
+
+    /// The triangle that the half-edge belongs to.
+    static int half_edge_triangle(int half_edge_id) {
+        return half_edge_id / 3;
+    }
+
+    /// The vertex that the half-edge starts from.
+    int half_edge_start(int half_edge_id) const;
+
+    /// The vertex that the half-edge points to.
+    int half_edge_end(int half_edge_id) const;
+
+    /// The triangle on the other side of edge j of the triangle (the edge from
+    /// corner j to corner j+1), or -1 if the edge is on the boundary.
+    int triangle_neighbor(int triangle_id, int j) const;
+
+    /// True if the half-edge has no opposite.
+    bool is_boundary_edge(int half_edge_id) const;
+
+    /// The number of half-edges without an opposite.  This is 0 for a closed
+    /// mesh.
+    int num_boundary_edges() const;
+
+    /** False if some edge is shared by more than two triangles, or by two
+     triangles that list its vertices in the same order (i.e., that are not
+     oriented consistently).  No opposites are set for these edges, so they
+     are treated as boundary edges. */
+    bool is_manifold() const;
+
+private:
+
+    int num_vertices_;
+    std::vector<unsigned int> tris_;
+
+    // vertex -> triangles and vertex -> vertices, each stored as one array of
+    // lists with the list for vertex v running from start[v] to start[v+1]
+    std::vector<int> vert_tris_start_;
+    std::vector<int> vert_tris_;
+    std::vector<int> vert_nbrs_start_;
+    std::vector<int> vert_nbrs_;
+
+    std::vector<int> opposite_;
+    std::vector<char> boundary_vert_;
+    int num_boundary_edges_;
+    bool manifold_;
+};
+
+
+} // end namespace
+
+#endif
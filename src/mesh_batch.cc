@@ -0,0 +1,265 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "mesh_batch.h"
+#include "gl_state.h"
+#include "memory_stats.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace mingfx {
+
+
+MeshBatch::MeshBatch() : draws_dirty_(true), gpu_dirty_(true), transforms_dirty_(true),
+    vertex_buffer_(0), vertex_array_(0), element_buffer_(0), transform_buffer_(0),
+    transform_texture_(0), vertex_buffer_bytes_(0), element_buffer_bytes_(0),
+    transform_buffer_bytes_(0)
+{
+    MemoryStats::Register(this);
+}
+
+MeshBatch::~MeshBatch() {
+    MemoryStats::Unregister(this);
+    // the buffers are all created together the first time the batch is drawn
+    if (vertex_buffer_ != 0) {
+        GLuint buffers[2] = { vertex_buffer_, element_buffer_ };
+        glDeleteBuffers(2, buffers);
+        GLState::ForgetVertexArray(vertex_array_);
+        glDeleteVertexArrays(1, &vertex_array_);
+    }
+    if (transform_buffer_ != 0) {
+        glDeleteBuffers(1, &transform_buffer_);
+        GLState::ForgetTexture(transform_texture_);
+        glDeleteTextures(1, &transform_texture_);
+    }
+}
+
+
+int MeshBatch::AddMesh(const Mesh &mesh, const Matrix4 &transform, const Color &color) {
+    Record r;
+    r.first_index = (int)indices_.size();
+    r.base_vertex = num_vertices();
+    r.visible = true;
+
+    const int nverts = mesh.num_vertices();
+    const unsigned int id = (unsigned int)records_.size();
+    const bool has_normals = (mesh.num_normals() == nverts);
+    const bool has_colors = (mesh.num_colors() == nverts);
+    const bool has_uvs = (mesh.num_tex_coords(0) == nverts);
+    for (int i=0; i<nverts; i++) {
+        Point3 p = mesh.read_vertex_data(i);
+        verts_.push_back(p[0]);  verts_.push_back(p[1]);  verts_.push_back(p[2]);
+        Vector3 n = has_normals ? mesh.read_normal_data(i) : Vector3(0,0,1);
+        norms_.push_back(n[0]);  norms_.push_back(n[1]);  norms_.push_back(n[2]);
+        Color c = has_colors ? mesh.read_color_data(i) : Color(1,1,1,1);
+        colors_.insert(colors_.end(), c.value_ptr(), c.value_ptr() + 4);
+        Point2 uv = has_uvs ? mesh.read_tex_coords_data(0, i) : Point2(0,0);
+        tex_coords_.push_back(uv[0]);  tex_coords_.push_back(uv[1]);
+        draw_ids_.push_back(id);
+    }
+
+    // indices stay relative to the mesh, the base vertex offsets them when drawing
+    for (int t=0; t<mesh.num_triangles(); t++) {
+        unsigned int tri[3];
+        mesh.read_triangle_indices_data(t, tri);
+        indices_.insert(indices_.end(), tri, tri + 3);
+    }
+    r.num_indices = (int)indices_.size() - r.first_index;
+    records_.push_back(r);
+
+    transforms_.insert(transforms_.end(), transform.value_ptr(), transform.value_ptr() + 16);
+    transforms_.insert(transforms_.end(), color.value_ptr(), color.value_ptr() + 4);
+
+    gpu_dirty_ = true;
+    transforms_dirty_ = true;
+    draws_dirty_ = true;
+    return (int)id;
+}
+
+
+void MeshBatch::Clear() {
+    records_.clear();
+    verts_.clear();
+    norms_.clear();
+    colors_.clear();
+    tex_coords_.clear();
+    draw_ids_.clear();
+    indices_.clear();
+    transforms_.clear();
+    gpu_dirty_ = true;
+    transforms_dirty_ = true;
+    draws_dirty_ = true;
+}
+
+
+void MeshBatch::SetTransform(int id, const Matrix4 &transform) {
+    memcpy(&transforms_[(size_t)4*TEXELS_PER_MESH*id], transform.value_ptr(), 16*sizeof(float));
+    transforms_dirty_ = true;
+}
+
+void MeshBatch::SetColor(int id, const Color &color) {
+    memcpy(&transforms_[(size_t)4*TEXELS_PER_MESH*id + 16], color.value_ptr(), 4*sizeof(float));
+    transforms_dirty_ = true;
+}
+
+void MeshBatch::SetVisible(int id, bool visible) {
+    if (records_[id].visible != visible) {
+        records_[id].visible = visible;
+        draws_dirty_ = true;
+    }
+}
+
+
+Matrix4 MeshBatch::transform(int id) const {
+    return Matrix4(&transforms_[(size_t)4*TEXELS_PER_MESH*id]);
+}
+
+Color MeshBatch::color(int id) const {
+    const float *c = &transforms_[(size_t)4*TEXELS_PER_MESH*id + 16];
+    return Color(c[0], c[1], c[2], c[3]);
+}
+
+bool MeshBatch::visible(int id) const {
+    return records_[id].visible;
+}
+
+int MeshBatch::num_meshes() const {
+    return (int)records_.size();
+}
+
+int MeshBatch::num_vertices() const {
+    return (int)verts_.size() / 3;
+}
+
+int MeshBatch::num_triangles() const {
+    return (int)indices_.size() / 3;
+}
+
+GLuint MeshBatch::transform_texture() const {
+    return transform_texture_;
+}
+
+
+void MeshBatch::UpdateGPUMemory() {
+    if (gpu_dirty_) {
+        GLsizeiptr vertsSize = verts_.size() * sizeof(float);
+        GLsizeiptr normsSize = norms_.size() * sizeof(float);
+        GLsizeiptr colorsSize = colors_.size() * sizeof(float);
+        GLsizeiptr uvsSize = tex_coords_.size() * sizeof(float);
+        GLsizeiptr idsSize = draw_ids_.size() * sizeof(unsigned int);
+        GLsizeiptr normsOffset = vertsSize;
+        GLsizeiptr colorsOffset = normsOffset + normsSize;
+        GLsizeiptr uvsOffset = colorsOffset + colorsSize;
+        GLsizeiptr idsOffset = uvsOffset + uvsSize;
+        GLsizeiptr totalSize = idsOffset + idsSize;
+
+        if (vertex_buffer_ == 0) {
+            glGenBuffers(1, &vertex_buffer_);
+            glGenBuffers(1, &element_buffer_);
+            glGenVertexArrays(1, &vertex_array_);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer_);
+        glBufferData(GL_ARRAY_BUFFER, totalSize, NULL, GL_STATIC_DRAW);
+        if (totalSize > 0) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, vertsSize, &verts_[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, normsOffset, normsSize, &norms_[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, colorsOffset, colorsSize, &colors_[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, uvsOffset, uvsSize, &tex_coords_[0]);
+            glBufferSubData(GL_ARRAY_BUFFER, idsOffset, idsSize, &draw_ids_[0]);
+        }
+
+        // same attribute locations as Mesh, plus the draw id at location 14
+        GLState::BindVertexArray(vertex_array_);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), (char*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, 3*sizeof(GLfloat), (char*)0 + normsOffset);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_TRUE, 4*sizeof(GLfloat), (char*)0 + colorsOffset);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), (char*)0 + uvsOffset);
+        glEnableVertexAttribArray(14);
+        glVertexAttribIPointer(14, 1, GL_UNSIGNED_INT, sizeof(GLuint), (char*)0 + idsOffset);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_buffer_);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(unsigned int),
+                     indices_.empty() ? NULL : &indices_[0], GL_STATIC_DRAW);
+        GLState::ReleaseVertexArray();
+        vertex_buffer_bytes_ = totalSize;
+        element_buffer_bytes_ = indices_.size() * sizeof(unsigned int);
+
+        gpu_dirty_ = false;
+    }
+
+    if (transforms_dirty_) {
+        if (transform_buffer_ == 0) {
+            glGenBuffers(1, &transform_buffer_);
+            glGenTextures(1, &transform_texture_);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, transform_buffer_);
+        size_t nbytes = transforms_.size() * sizeof(float);
+        if ((nbytes > transform_buffer_bytes_) || (transform_buffer_bytes_ == 0)) {
+            // an empty buffer texture is not allowed, so always keep at least one mesh's worth
+            transform_buffer_bytes_ = std::max(nbytes, (size_t)(4*TEXELS_PER_MESH*sizeof(float)));
+            glBufferData(GL_TEXTURE_BUFFER, transform_buffer_bytes_, NULL, GL_DYNAMIC_DRAW);
+            GLState::BindTexture(GL_TEXTURE_BUFFER, transform_texture_);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, transform_buffer_);
+        }
+        if (nbytes > 0) {
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, nbytes, &transforms_[0]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        transforms_dirty_ = false;
+    }
+
+    if (draws_dirty_) {
+        draw_counts_.clear();
+        draw_offsets_.clear();
+        draw_base_vertices_.clear();
+        for (int i=0; i<records_.size(); i++) {
+            const Record &r = records_[i];
+            if ((!r.visible) || (r.num_indices == 0)) {
+                continue;
+            }
+            draw_counts_.push_back(r.num_indices);
+            draw_offsets_.push_back((char*)0 + (size_t)r.first_index*sizeof(unsigned int));
+            draw_base_vertices_.push_back(r.base_vertex);
+        }
+        draws_dirty_ = false;
+    }
+}
+
+
+void MeshBatch::Draw() {
+    UpdateGPUMemory();
+    if (draw_counts_.empty()) {
+        return;
+    }
+    GLState::BindVertexArray(vertex_array_);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &draw_counts_[0], GL_UNSIGNED_INT,
+                                  (const GLvoid* const*)&draw_offsets_[0], (GLsizei)draw_counts_.size(),
+                                  &draw_base_vertices_[0]);
+    GLState::ReleaseVertexArray();
+}
+
+
+size_t MeshBatch::cpu_bytes() const {
+    return records_.capacity() * sizeof(Record) +
+        (verts_.capacity() + norms_.capacity() + colors_.capacity() +
+         tex_coords_.capacity() + transforms_.capacity()) * sizeof(float) +
+        (draw_ids_.capacity() + indices_.capacity()) * sizeof(unsigned int) +
+        draw_counts_.capacity() * sizeof(GLsizei) +
+        draw_offsets_.capacity() * sizeof(void*) +
+        draw_base_vertices_.capacity() * sizeof(GLint);
+}
+
+size_t MeshBatch::gpu_bytes() const {
+    return vertex_buffer_bytes_ + element_buffer_bytes_ + transform_buffer_bytes_;
+}
+
+
+} // end namespace
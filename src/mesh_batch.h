@@ -0,0 +1,177 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_MESH_BATCH_H_
+#define SRC_MESH_BATCH_H_
+
+#include "color.h"
+#include "matrix4.h"
+#include "mesh.h"
+#include "opengl_headers.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Packs many small meshes into one shared set of GPU buffers so that they
+ can all be drawn with a single draw call.  Each Mesh normally has its own
+ vertex buffer, index buffer, and vertex array, so a scene made of thousands
+ of small meshes spends most of its time switching between them.  A MeshBatch
+ copies the meshes' vertices and indices into one big buffer of each, keeps a
+ record of where each mesh starts, and draws them all at once with
+ glMultiDrawElementsBaseVertex().  Each mesh keeps its own transform and color,
+ which are stored in a buffer texture that the shader looks up using an id
+ stored with each vertex.  Example:
+ ~~~
+ DefaultShader shader;
+ MeshBatch rocks;
+
+ void Init() {
+     Mesh rock;
+     rock.LoadFromOBJ(Platform::FindMinGfxDataFile("rock.obj"));
+     for (int i=0; i<10000; i++) {
+         rocks.AddMesh(rock, Matrix4::Translation(random_position()));
+     }
+ }
+
+ void DrawUsingOpenGL() {
+     shader.Draw(Matrix4(), view, proj, &rocks, material);
+ }
+ ~~~
+
+ This is meant for static geometry: adding a mesh after the batch has been
+ drawn copies all of the vertex data to the GPU again.  Changing the
+ transforms, colors, or visibility of meshes already in the batch is cheap.
+ Normals, colors, and the texture coordinates for texture unit 0 are kept;
+ meshes without them get the same defaults Mesh::Draw() uses.
+ */
+class MeshBatch {
+public:
+
+    /// Creates an empty batch.
+    MeshBatch();
+
+    /// Frees the batch's GPU buffers and textures.
+    virtual ~MeshBatch();
+
+    /** Copies the mesh's vertices and triangles into the batch and returns an
+     id for it.  The mesh is drawn with the transform applied after the model
+     matrix passed to DefaultShader::Draw(), and its color multiplies the
+     ambient and diffuse reflectance of the material. */
+    int AddMesh(const Mesh &mesh, const Matrix4 &transform = Matrix4(),
+                const Color &color = Color(1,1,1));
+
+    /// Removes all of the meshes.
+    void Clear();
+
+    /// Changes the transform of a mesh in the batch.
+    void SetTransform(int id, const Matrix4 &transform);
+
+    /// Changes the color of a mesh in the batch.
+    void SetColor(int id, const Color &color);
+
+    /// Shows or hides a mesh in the batch, e.g., based on frustum culling.
+    void SetVisible(int id, bool visible);
+
+    /// The transform of a mesh in the batch.
+    Matrix4 transform(int id) const;
+
+    /// The color of a mesh in the batch.
+    Color color(int id) const;
+
+    /// True unless the mesh has been hidden with SetVisible().
+    bool visible(int id) const;
+
+    /// The number of meshes in the batch.
+    int num_meshes() const;
+
+    /// The total number of vertices in the batch.
+    int num_vertices() const;
+
+    /// The total number of triangles in the batch.
+    int num_triangles() const;
+
+    /// Copies the vertices, indices, and transforms to the GPU as needed.  This
+    /// happens automatically inside Draw().
+    void UpdateGPUMemory();
+
+    /** Draws all of the visible meshes with one call.  The shader must look up
+     each mesh's transform and color using the draw id attribute (location 14)
+     and the buffer texture returned by transform_texture(), as DefaultShader
+     does, so usually this is called through DefaultShader::Draw(). */
+    void Draw();
+
+    /** The OpenGL id of the buffer texture (GL_RGBA32F) holding each mesh's
+     transform and color.  Mesh i uses texels 5i to 5i+3 for the columns of its
+     transform and texel 5i+4 for its color. */
+    GLuint transform_texture() const;
+
+    /// Number of texels per mesh in the transform texture.
+    static const int TEXELS_PER_MESH = 5;
+
+    /// Bytes of CPU memory used by the batch's copies of the vertices,
+    /// indices, and transforms.
+    size_t cpu_bytes() const;
+
+    /// Bytes of GPU memory used by the batch's buffers.
+    size_t gpu_bytes() const;
+
+private:
+
+    // the batch owns its GPU buffers, so copies are not allowed
+    MeshBatch(const MeshBatch &other);
+    MeshBatch& operator=(const MeshBatch &other);
+
+    class Record {
+    public:
+        int first_index;
+        int num_indices;
+        int base_vertex;
+        bool visible;
+    };
+
+    std::vector<Record> records_;
+
+    std::vector<float> verts_;
+    std::vector<float> norms_;
+    std::vector<float> colors_;
+    std::vector<float> tex_coords_;
+    std::vector<unsigned int> draw_ids_;
+    std::vector<unsigned int> indices_;
+    std::vector<float> transforms_;
+
+    // the arguments for glMultiDrawElementsBaseVertex(), rebuilt when the
+    // visibility changes
+    std::vector<GLsizei> draw_counts_;
+    std::vector<void*> draw_offsets_;
+    std::vector<GLint> draw_base_vertices_;
+    bool draws_dirty_;
+
+    bool gpu_dirty_;
+    bool transforms_dirty_;
+    GLuint vertex_buffer_;
+    GLuint vertex_array_;
+    GLuint element_buffer_;
+    GLuint transform_buffer_;
+    GLuint transform_texture_;
+    size_t vertex_buffer_bytes_;
+    size_t element_buffer_bytes_;
+    size_t transform_buffer_bytes_;
+};
+
+
+} // end namespace
+
+#endif
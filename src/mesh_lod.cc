@@ -0,0 +1,589 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "mesh_lod.h"
+
+#include "aabb.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <queue>
+
+
+namespace mingfx {
+
+
+// Boundary and seam edges get a plane perpendicular to the surface, weighted
+// by this much more than the surface itself, to keep them from moving.
+static const double BOUNDARY_PENALTY = 100.0;
+
+// Collapses that turn a triangle more than this (cosine of the angle between
+// its old and new normals) are rejected to avoid folding the surface over.
+static const double MIN_NORMAL_DOT = 0.2;
+
+
+// The symmetric 4x4 matrix Q of the quadric error metric, such that the sum of
+// squared distances from a point p to a set of planes is [p 1] Q [p 1]^T.
+// Also keeps the total weight of the planes so the error can be normalized.
+class Quadric {
+public:
+    Quadric() {
+        for (int i=0; i<10; i++) q[i] = 0.0;
+        weight = 0.0;
+    }
+
+    // plane a*x + b*y + c*z + d = 0, with (a,b,c) unit length
+    Quadric(double a, double b, double c, double d, double w) {
+        q[0] = w*a*a;  q[1] = w*a*b;  q[2] = w*a*c;  q[3] = w*a*d;
+        q[4] = w*b*b;  q[5] = w*b*c;  q[6] = w*b*d;
+        q[7] = w*c*c;  q[8] = w*c*d;
+        q[9] = w*d*d;
+        weight = w;
+    }
+
+    void operator+=(const Quadric &o) {
+        for (int i=0; i<10; i++) q[i] += o.q[i];
+        weight += o.weight;
+    }
+
+    double Evaluate(double x, double y, double z) const {
+        return q[0]*x*x + 2.0*q[1]*x*y + 2.0*q[2]*x*z + 2.0*q[3]*x
+                        +     q[4]*y*y + 2.0*q[5]*y*z + 2.0*q[6]*y
+                                       +     q[7]*z*z + 2.0*q[8]*z
+                                                      +     q[9];
+    }
+
+    // Finds the point that minimizes the error, returns false if the system is
+    // (nearly) singular, e.g., for a flat or cylindrical region
+    bool Optimize(double *x, double *y, double *z) const {
+        double a00 = q[0], a01 = q[1], a02 = q[2];
+        double a11 = q[4], a12 = q[5], a22 = q[7];
+        double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+        double c00 = a11*a22 - a12*a12;
+        double c01 = a02*a12 - a01*a22;
+        double c02 = a01*a12 - a02*a11;
+        double det = a00*c00 + a01*c01 + a02*c02;
+        double scale = std::fabs(a00) + std::fabs(a11) + std::fabs(a22);
+        if (std::fabs(det) <= 1e-12 * scale * scale * scale) {
+            return false;
+        }
+        double c11 = a00*a22 - a02*a02;
+        double c12 = a01*a02 - a00*a12;
+        double c22 = a00*a11 - a01*a01;
+        *x = (c00*b0 + c01*b1 + c02*b2) / det;
+        *y = (c01*b0 + c11*b1 + c12*b2) / det;
+        *z = (c02*b0 + c12*b1 + c22*b2) / det;
+        return true;
+    }
+
+    double q[10];
+    double weight;
+};
+
+
+// A candidate edge collapse waiting in the priority queue
+class Collapse {
+public:
+    float error;
+    int u, v;
+    unsigned int u_version, v_version;
+    float pos[3];
+    float t;  // where pos falls along the edge from u (0) to v (1), for attributes
+
+    bool operator<(const Collapse &o) const {
+        // std::priority_queue puts the largest first, we want the smallest error
+        return error > o.error;
+    }
+};
+
+
+// Working copy of the mesh used during simplification
+class SimplifyState {
+public:
+    int num_attribs;                       // floats of attribute data per vertex
+    std::vector<float> pos;                // 3 per vertex
+    std::vector<float> attribs;            // num_attribs per vertex
+    std::vector<unsigned int> tris;        // 3 per triangle
+    std::vector<bool> tri_alive;
+    std::vector<bool> vert_alive;
+    std::vector<unsigned int> version;
+    std::vector<Quadric> quadrics;
+    std::vector< std::vector<int> > vert_tris;
+
+    Point3 P(int i) const {
+        return Point3(pos[3*i], pos[3*i+1], pos[3*i+2]);
+    }
+
+    bool Contains(int t, int v) const {
+        return (tris[3*t] == v) || (tris[3*t+1] == v) || (tris[3*t+2] == v);
+    }
+
+    // Finds the best place to put the merged vertex for the edge (u,v)
+    void Evaluate(int u, int v, Collapse *c) const {
+        Quadric q = quadrics[u];
+        q += quadrics[v];
+        Point3 pu = P(u);
+        Point3 pv = P(v);
+        Vector3 e = pv - pu;
+        double elen2 = e.Dot(e);
+
+        // candidates: the two ends, the midpoint, and the optimal point if
+        // there is one that lies reasonably close to the edge
+        double cand[4][3] = {
+            {pu[0], pu[1], pu[2]},
+            {pv[0], pv[1], pv[2]},
+            {0.5*(pu[0]+pv[0]), 0.5*(pu[1]+pv[1]), 0.5*(pu[2]+pv[2])},
+            {0, 0, 0}
+        };
+        int ncand = 3;
+        if (q.Optimize(&cand[3][0], &cand[3][1], &cand[3][2])) {
+            double dx = cand[3][0] - cand[2][0];
+            double dy = cand[3][1] - cand[2][1];
+            double dz = cand[3][2] - cand[2][2];
+            if (dx*dx + dy*dy + dz*dz <= elen2) {
+                ncand = 4;
+            }
+        }
+
+        double best = std::numeric_limits<double>::max();
+        int besti = 0;
+        for (int i=0; i<ncand; i++) {
+            double err = q.Evaluate(cand[i][0], cand[i][1], cand[i][2]);
+            if (err < best) {
+                best = err;
+                besti = i;
+            }
+        }
+
+        c->u = u;
+        c->v = v;
+        c->u_version = version[u];
+        c->v_version = version[v];
+        c->pos[0] = (float)cand[besti][0];
+        c->pos[1] = (float)cand[besti][1];
+        c->pos[2] = (float)cand[besti][2];
+        if (elen2 > 0.0) {
+            Vector3 d = Point3(c->pos[0], c->pos[1], c->pos[2]) - pu;
+            c->t = (float)std::min(std::max(d.Dot(e) / elen2, 0.0), 1.0);
+        }
+        else {
+            c->t = 0.0f;
+        }
+        // normalize by the weight (surface area) so the error is an rms distance
+        c->error = (float)std::sqrt(std::max(best, 0.0) / std::max(q.weight, 1e-20));
+    }
+
+    // True if moving vertices u and v to p would flip or badly distort any of
+    // the triangles around them
+    bool WouldFold(int u, int v, const Point3 &p) const {
+        for (int k=0; k<2; k++) {
+            int moving = (k == 0) ? u : v;
+            int other = (k == 0) ? v : u;
+            const std::vector<int> &list = vert_tris[moving];
+            for (int i=0; i<list.size(); i++) {
+                int t = list[i];
+                if ((!tri_alive[t]) || (Contains(t, other))) {
+                    continue;  // removed, or will be removed by the collapse
+                }
+                Point3 a = P(tris[3*t]);
+                Point3 b = P(tris[3*t+1]);
+                Point3 c = P(tris[3*t+2]);
+                Vector3 n_old = (b - a).Cross(c - a);
+                if (tris[3*t] == moving) a = p;
+                else if (tris[3*t+1] == moving) b = p;
+                else c = p;
+                Vector3 n_new = (b - a).Cross(c - a);
+                double len = (double)n_old.Length() * (double)n_new.Length();
+                if ((len <= 0.0) || (n_old.Dot(n_new) < MIN_NORMAL_DOT * len)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void PushEdgesAround(int u, std::priority_queue<Collapse> *heap) const {
+        std::vector<int> neighbors;
+        const std::vector<int> &list = vert_tris[u];
+        for (int i=0; i<list.size(); i++) {
+            int t = list[i];
+            if (!tri_alive[t]) continue;
+            for (int j=0; j<3; j++) {
+                int n = tris[3*t+j];
+                if (n != u) neighbors.push_back(n);
+            }
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+        for (int i=0; i<neighbors.size(); i++) {
+            Collapse c;
+            Evaluate(u, neighbors[i], &c);
+            heap->push(c);
+        }
+    }
+};
+
+
+Mesh MeshLOD::Simplify(const Mesh &mesh, int target_triangles, float max_error, float *error) {
+    SimplifyState s;
+
+    // Merge identical vertices so that the triangles share them.  Vertices with
+    // the same position but different attributes stay separate (seams).
+    Mesh welded = mesh;
+    welded.Weld(0.0f, 0.0f);
+
+    const int nv = welded.num_vertices();
+    const bool has_normals = (welded.num_normals() == nv) && (nv > 0);
+    const bool has_colors = (welded.num_colors() == nv) && (nv > 0);
+    std::vector<int> uv_units;
+    for (int i=0; i<welded.num_texture_units(); i++) {
+        if ((welded.num_tex_coords(i) == nv) && (nv > 0)) {
+            uv_units.push_back(i);
+        }
+    }
+    s.num_attribs = (has_normals ? 3 : 0) + (has_colors ? 4 : 0) + 2 * (int)uv_units.size();
+
+    // Gather the vertex data
+    s.pos.resize(3 * (size_t)nv);
+    s.attribs.resize((size_t)s.num_attribs * nv);
+    for (int i=0; i<nv; i++) {
+        Point3 p = welded.read_vertex_data(i);
+        s.pos[3*i] = p[0];  s.pos[3*i+1] = p[1];  s.pos[3*i+2] = p[2];
+        float *a = s.num_attribs ? &s.attribs[(size_t)s.num_attribs * i] : NULL;
+        if (has_normals) {
+            Vector3 n = welded.read_normal_data(i);
+            *a++ = n[0];  *a++ = n[1];  *a++ = n[2];
+        }
+        if (has_colors) {
+            Color c = welded.read_color_data(i);
+            *a++ = c[0];  *a++ = c[1];  *a++ = c[2];  *a++ = c[3];
+        }
+        for (int u=0; u<uv_units.size(); u++) {
+            Point2 uv = welded.read_tex_coords_data(uv_units[u], i);
+            *a++ = uv[0];  *a++ = uv[1];
+        }
+    }
+
+    // Triangles, which no longer include any that are degenerate
+    s.tris.resize(3 * (size_t)welded.num_triangles());
+    for (int t=0; t<welded.num_triangles(); t++) {
+        welded.read_triangle_indices_data(t, &s.tris[3*(size_t)t]);
+    }
+    const int nt = (int)s.tris.size() / 3;
+
+    s.tri_alive.assign(nt, true);
+    s.vert_alive.assign(nv, true);
+    s.version.assign(nv, 0);
+    s.quadrics.assign(nv, Quadric());
+    s.vert_tris.assign(nv, std::vector<int>());
+
+    // Plane quadrics for each triangle, weighted by area
+    for (int t=0; t<nt; t++) {
+        Point3 a = s.P(s.tris[3*t]), b = s.P(s.tris[3*t+1]), c = s.P(s.tris[3*t+2]);
+        Vector3 n = (b - a).Cross(c - a);
+        float len = n.Length();
+        for (int j=0; j<3; j++) {
+            s.vert_tris[s.tris[3*t+j]].push_back(t);
+        }
+        if (len <= 0.0f) continue;
+        n = n / len;
+        Quadric q(n[0], n[1], n[2], -n.Dot(a - Point3::Origin()), 0.5 * len);
+        for (int j=0; j<3; j++) {
+            s.quadrics[s.tris[3*t+j]] += q;
+        }
+    }
+
+    // Penalize moving the boundary (and seam) edges, i.e., edges used by just
+    // one triangle, by adding a plane through the edge perpendicular to the surface
+    {
+        std::map<std::pair<int,int>, int> edge_count;
+        for (int t=0; t<nt; t++) {
+            for (int j=0; j<3; j++) {
+                int a = s.tris[3*t+j], b = s.tris[3*t + (j+1)%3];
+                edge_count[std::make_pair(std::min(a,b), std::max(a,b))]++;
+            }
+        }
+        for (int t=0; t<nt; t++) {
+            Point3 pa = s.P(s.tris[3*t]), pb = s.P(s.tris[3*t+1]), pc = s.P(s.tris[3*t+2]);
+            Vector3 n = (pb - pa).Cross(pc - pa);
+            for (int j=0; j<3; j++) {
+                int a = s.tris[3*t+j], b = s.tris[3*t + (j+1)%3];
+                if (edge_count[std::make_pair(std::min(a,b), std::max(a,b))] != 1) continue;
+                Vector3 e = s.P(b) - s.P(a);
+                Vector3 perp = e.Cross(n);
+                float len = perp.Length();
+                if (len <= 0.0f) continue;
+                perp = perp / len;
+                Quadric q(perp[0], perp[1], perp[2], -perp.Dot(s.P(a) - Point3::Origin()),
+                          BOUNDARY_PENALTY * e.Dot(e));
+                s.quadrics[a] += q;
+                s.quadrics[b] += q;
+            }
+        }
+    }
+
+    // Initial set of candidate collapses, one per edge
+    std::priority_queue<Collapse> heap;
+    for (int t=0; t<nt; t++) {
+        for (int j=0; j<3; j++) {
+            int a = s.tris[3*t+j], b = s.tris[3*t + (j+1)%3];
+            if (a < b) {
+                Collapse c;
+                s.Evaluate(a, b, &c);
+                heap.push(c);
+            }
+        }
+    }
+
+    // Collapse edges, cheapest first
+    int live_tris = nt;
+    float max_collapse_error = 0.0f;
+    std::vector<float> blended(s.num_attribs);
+    while ((live_tris > target_triangles) && (!heap.empty())) {
+        Collapse c = heap.top();
+        heap.pop();
+        if ((!s.vert_alive[c.u]) || (!s.vert_alive[c.v]) ||
+            (s.version[c.u] != c.u_version) || (s.version[c.v] != c.v_version)) {
+            continue;  // stale
+        }
+        if ((max_error >= 0.0f) && (c.error > max_error)) {
+            break;
+        }
+        Point3 p(c.pos[0], c.pos[1], c.pos[2]);
+        if (s.WouldFold(c.u, c.v, p)) {
+            continue;
+        }
+
+        // u takes the merged position, attributes, and error
+        int u = c.u, v = c.v;
+        s.pos[3*u] = p[0];  s.pos[3*u+1] = p[1];  s.pos[3*u+2] = p[2];
+        for (int i=0; i<s.num_attribs; i++) {
+            float au = s.attribs[(size_t)s.num_attribs*u + i];
+            float av = s.attribs[(size_t)s.num_attribs*v + i];
+            s.attribs[(size_t)s.num_attribs*u + i] = au + c.t * (av - au);
+        }
+        if (has_normals) {
+            float *n = &s.attribs[(size_t)s.num_attribs*u];
+            float len = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            if (len > 0.0f) {
+                n[0] /= len;  n[1] /= len;  n[2] /= len;
+            }
+        }
+        s.quadrics[u] += s.quadrics[v];
+        s.vert_alive[v] = false;
+        s.version[u]++;
+
+        // move v's triangles over to u, removing the ones that collapse
+        for (int i=0; i<s.vert_tris[v].size(); i++) {
+            int t = s.vert_tris[v][i];
+            if (!s.tri_alive[t]) continue;
+            if (s.Contains(t, u)) {
+                s.tri_alive[t] = false;
+                live_tris--;
+            }
+            else {
+                for (int j=0; j<3; j++) {
+                    if (s.tris[3*t+j] == v) s.tris[3*t+j] = u;
+                }
+                s.vert_tris[u].push_back(t);
+            }
+        }
+        s.vert_tris[v].clear();
+
+        // drop dead triangles from u's list so it does not keep growing
+        std::vector<int> &ulist = s.vert_tris[u];
+        int keep = 0;
+        for (int i=0; i<ulist.size(); i++) {
+            if (s.tri_alive[ulist[i]]) ulist[keep++] = ulist[i];
+        }
+        ulist.resize(keep);
+
+        max_collapse_error = std::max(max_collapse_error, c.error);
+        s.PushEdgesAround(u, &heap);
+    }
+
+    // Copy the remaining vertices and triangles into a new mesh
+    std::vector<int> new_id(nv, -1);
+    std::vector<float> out_pos;
+    std::vector<float> out_attribs;
+    std::vector<unsigned int> out_indices;
+    for (int t=0; t<nt; t++) {
+        if (!s.tri_alive[t]) continue;
+        for (int j=0; j<3; j++) {
+            int v = s.tris[3*t+j];
+            if (new_id[v] < 0) {
+                new_id[v] = (int)out_pos.size() / 3;
+                out_pos.insert(out_pos.end(), s.pos.begin() + 3*v, s.pos.begin() + 3*v + 3);
+                out_attribs.insert(out_attribs.end(), s.attribs.begin() + (size_t)s.num_attribs*v,
+                                   s.attribs.begin() + (size_t)s.num_attribs*(v+1));
+            }
+            out_indices.push_back(new_id[v]);
+        }
+    }
+
+    Mesh result;
+    const int nout = (int)out_pos.size() / 3;
+    if (nout > 0) {
+        result.SetVertices(&out_pos[0], nout);
+        result.SetIndices(&out_indices[0], (int)out_indices.size());
+        int offset = 0;
+        std::vector<float> tmp;
+        if (has_normals) {
+            tmp.resize(3 * nout);
+            for (int i=0; i<nout; i++) {
+                memcpy(&tmp[3*i], &out_attribs[(size_t)s.num_attribs*i + offset], 3*sizeof(float));
+            }
+            result.SetNormals(&tmp[0], nout);
+            offset += 3;
+        }
+        if (has_colors) {
+            tmp.resize(4 * nout);
+            for (int i=0; i<nout; i++) {
+                memcpy(&tmp[4*i], &out_attribs[(size_t)s.num_attribs*i + offset], 4*sizeof(float));
+            }
+            result.SetColors(&tmp[0], nout);
+            offset += 4;
+        }
+        for (int u=0; u<uv_units.size(); u++) {
+            tmp.resize(2 * nout);
+            for (int i=0; i<nout; i++) {
+                memcpy(&tmp[2*i], &out_attribs[(size_t)s.num_attribs*i + offset], 2*sizeof(float));
+            }
+            result.SetTexCoords(uv_units[u], &tmp[0], nout);
+            offset += 2;
+        }
+    }
+
+    if (error != NULL) {
+        *error = max_collapse_error;
+    }
+    return result;
+}
+
+
+
+MeshLOD::MeshLOD() : radius_(0.0f) {
+}
+
+MeshLOD::~MeshLOD() {
+}
+
+
+void MeshLOD::Create(const Mesh &mesh, int num_levels, float reduction, int min_triangles, float max_error) {
+    levels_.clear();
+    errors_.clear();
+
+    // reserve up front so pointers returned by level() stay valid
+    levels_.reserve(std::max(num_levels, 1));
+    levels_.push_back(mesh);
+    errors_.push_back(0.0f);
+
+    AABB box(mesh);
+    center_ = box.Center();
+    radius_ = 0.5f * box.Dimensions().Length();
+
+    while (levels_.size() < num_levels) {
+        int ntris = levels_.back().num_triangles();
+        int target = (int)(reduction * ntris);
+        if (target < min_triangles) {
+            break;
+        }
+        float remaining = -1.0f;
+        if (max_error >= 0.0f) {
+            remaining = max_error - errors_.back();
+            if (remaining <= 0.0f) break;
+        }
+        float err = 0.0f;
+        Mesh simpler = Simplify(levels_.back(), target, remaining, &err);
+        // stop if the mesh could not be simplified much further
+        if ((simpler.num_triangles() == 0) || (simpler.num_triangles() > 0.9f * ntris)) {
+            break;
+        }
+        // the errors of each step add up since each level is made from the last
+        errors_.push_back(errors_.back() + err);
+        levels_.push_back(simpler);
+    }
+}
+
+
+int MeshLOD::SelectLevel(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+                         float viewport_height, float pixel_tolerance) const
+{
+    if (levels_.size() <= 1) {
+        return 0;
+    }
+
+    // the largest scale factor in the model matrix
+    float scale = 0.0f;
+    for (int c=0; c<3; c++) {
+        Vector3 col(model(0,c), model(1,c), model(2,c));
+        scale = std::max(scale, col.Length());
+    }
+
+    // screen pixels per unit of error at the point of the mesh closest to the camera
+    float pixels_per_unit;
+    if (projection(3,2) != 0.0f) {
+        Point3 eye = view * (model * center_);
+        float depth = -eye[2] - scale * radius_;
+        if (depth <= 0.0f) {
+            return 0;
+        }
+        pixels_per_unit = projection(1,1) * 0.5f * viewport_height / depth;
+    }
+    else {
+        pixels_per_unit = projection(1,1) * 0.5f * viewport_height;
+    }
+
+    int best = 0;
+    for (int i=1; i<levels_.size(); i++) {
+        if (errors_[i] * scale * pixels_per_unit <= pixel_tolerance) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+int MeshLOD::num_levels() const {
+    return (int)levels_.size();
+}
+
+Mesh* MeshLOD::level(int i) {
+    return &levels_[i];
+}
+
+float MeshLOD::level_error(int i) const {
+    return errors_[i];
+}
+
+Point3 MeshLOD::bounding_sphere_center() const {
+    return center_;
+}
+
+float MeshLOD::bounding_sphere_radius() const {
+    return radius_;
+}
+
+
+float MeshLOD::ProjectedRadius(const Point3 &center, float radius,
+                               const Matrix4 &view, const Matrix4 &projection)
+{
+    if (projection(3,2) != 0.0f) {
+        Point3 eye = view * center;
+        float depth = -eye[2];
+        if (depth <= radius) {
+            return std::numeric_limits<float>::max();
+        }
+        return radius * projection(1,1) / depth;
+    }
+    return radius * projection(1,1);
+}
+
+
+} // end namespace
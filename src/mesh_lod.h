@@ -0,0 +1,122 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_MESH_LOD_H_
+#define SRC_MESH_LOD_H_
+
+#include "matrix4.h"
+#include "mesh.h"
+#include "point3.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** A chain of progressively simpler versions of a mesh, i.e., levels of detail
+ (LODs), plus a routine for picking the right level based on how big the mesh
+ appears on screen.  Level 0 is the original mesh and each following level has
+ roughly half as many triangles (by default).  Example:
+ ~~~
+ MeshLOD bunny_lods;
+
+ void Init() {
+     Mesh bunny;
+     bunny.LoadFromOBJ(Platform::FindMinGfxDataFile("bunny.obj"));
+     bunny_lods.Create(bunny);
+ }
+
+ void DrawUsingOpenGL() {
+     int level = bunny_lods.SelectLevel(model, view, proj, window_height());
+     shader.Draw(model, view, proj, bunny_lods.level(level), material);
+ }
+ ~~~
+
+ The levels are made with Simplify(), which repeatedly collapses the mesh
+ edge that changes the shape the least, as measured by the quadric error
+ metric of Garland and Heckbert.  Normals, colors, and texture coordinates are
+ interpolated along each collapsed edge.  Vertices where these attributes are
+ discontinuous (e.g., texture seams and the sharp edges of a faceted mesh) are
+ stored as separate vertices, and the edges along these seams and along the
+ open boundaries of the mesh are penalized so that they stay in place.
+ */
+class MeshLOD {
+public:
+
+    /// Creates an empty chain of levels.
+    MeshLOD();
+
+    virtual ~MeshLOD();
+
+    /** Builds the chain of levels from the mesh.  Level 0 is a copy of the
+     mesh and each additional level is simplified from the previous one to
+     reduction times as many triangles.  Stops after num_levels levels, when a
+     level would have fewer than min_triangles triangles, when the mesh cannot
+     be simplified any further, or when the error would be greater than
+     max_error (in the same units as the mesh vertices, negative means no
+     limit). */
+    void Create(const Mesh &mesh, int num_levels = 5, float reduction = 0.5f,
+                int min_triangles = 32, float max_error = -1.0f);
+
+    /** Picks the coarsest level for which the simplification error, when
+     drawn with these matrices in a viewport that is viewport_height pixels
+     tall, is at most pixel_tolerance pixels on screen. */
+    int SelectLevel(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+                    float viewport_height, float pixel_tolerance = 1.0f) const;
+
+    /// The number of levels, including the original mesh.
+    int num_levels() const;
+
+    /// A pointer to the mesh for level i, ready to draw.
+    Mesh* level(int i);
+
+    /// The approximate geometric error of level i, i.e., how far its surface
+    /// may be from the original, in the same units as the mesh vertices.
+    float level_error(int i) const;
+
+    /// The center of a sphere that contains the original mesh.
+    Point3 bounding_sphere_center() const;
+
+    /// The radius of a sphere that contains the original mesh.
+    float bounding_sphere_radius() const;
+
+
+    /** Returns a simplified copy of the mesh with target_triangles or fewer
+     triangles, or as few as possible without exceeding max_error (in the units
+     of the mesh vertices) if max_error is not negative.  The result is always
+     an indexed mesh.  If error is not NULL, it is set to the approximate
+     geometric error of the result.  Meshes without indices have duplicate
+     vertices (same position and attributes) merged first so that the
+     triangles are connected. */
+    static Mesh Simplify(const Mesh &mesh, int target_triangles, float max_error = -1.0f,
+                         float *error = NULL);
+
+    /** Returns the radius of a sphere drawn with the view and projection
+     matrices as a fraction of half of the viewport height, so 1.0 means the
+     sphere would just fill the height of the screen.  Returns a very large
+     value if the camera is inside the sphere. */
+    static float ProjectedRadius(const Point3 &center, float radius,
+                                 const Matrix4 &view, const Matrix4 &projection);
+
+private:
+    std::vector<Mesh> levels_;
+    std::vector<float> errors_;
+    Point3 center_;
+    float radius_;
+};
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "meshlets.h"
+
+#include "frustum.h"
+#include "mesh_adjacency.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace mingfx {
+
+
+Meshlets::Meshlets() {
+}
+
+Meshlets::~Meshlets() {
+}
+
+
+void Meshlets::Build(const Mesh &mesh, int max_vertices, int max_triangles) {
+    meshlets_.clear();
+    indices_.clear();
+    max_vertices = std::max(max_vertices, 3);
+    max_triangles = std::max(max_triangles, 1);
+
+    const int ntris = mesh.num_triangles();
+    const int nverts = mesh.num_vertices();
+    MeshAdjacency adj;
+    adj.Build(mesh);
+    std::vector<Vector3> normals(ntris);
+    for (int t=0; t<ntris; t++) {
+        const unsigned int *tri = adj.triangle(t);
+        Point3 a = mesh.read_vertex_data(tri[0]);
+        Point3 b = mesh.read_vertex_data(tri[1]);
+        Point3 c = mesh.read_vertex_data(tri[2]);
+        normals[t] = (b - a).Cross(c - a);
+        if (normals[t].Length() > 0.0f) {
+            normals[t].Normalize();
+        }
+    }
+
+    // Grow each meshlet from a seed triangle by repeatedly adding the
+    // neighboring triangle that needs the fewest new vertices, breaking ties
+    // in favor of triangles that face the same way as the meshlet so far.
+    // This keeps the meshlets compact and their normal cones narrow.
+    std::vector<bool> used(ntris, false);
+    std::vector<int> in_meshlet(nverts, -1);
+    std::vector<int> candidates;
+    int next_seed = 0;
+    int current = 0;
+    while (true) {
+        while ((next_seed < ntris) && (used[next_seed])) {
+            next_seed++;
+        }
+        if (next_seed == ntris) {
+            break;
+        }
+
+        int first_index = (int)indices_.size();
+        int meshlet_verts = 0;
+        int meshlet_tris = 0;
+        Vector3 normal_sum(0,0,0);
+        candidates.clear();
+        candidates.push_back(next_seed);
+
+        while ((meshlet_tris < max_triangles) && (!candidates.empty())) {
+            // pick the best candidate that still fits
+            int best = -1;
+            float best_cost = 0.0f;
+            Vector3 axis = (normal_sum.Length() > 0.0f) ? normal_sum.ToUnit() : Vector3(0,0,0);
+            for (int i=0; i<candidates.size(); i++) {
+                int t = candidates[i];
+                if (used[t]) {
+                    continue;
+                }
+                // vertices repeated in degenerate triangles only count once
+                int new_verts = 0;
+                const unsigned int *tri = adj.triangle(t);
+                for (int j=0; j<3; j++) {
+                    unsigned int v = tri[j];
+                    if ((in_meshlet[v] != current) &&
+                        ((j == 0) || (v != tri[0])) && ((j < 2) || (v != tri[1]))) {
+                        new_verts++;
+                    }
+                }
+                if (meshlet_verts + new_verts > max_vertices) {
+                    continue;
+                }
+                float cost = (float)new_verts + (1.0f - axis.Dot(normals[t]));
+                if ((best < 0) || (cost < best_cost)) {
+                    best = t;
+                    best_cost = cost;
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+
+            used[best] = true;
+            meshlet_tris++;
+            normal_sum = normal_sum + normals[best];
+            for (int j=0; j<3; j++) {
+                unsigned int v = adj.triangle(best)[j];
+                indices_.push_back(v);
+                if (in_meshlet[v] != current) {
+                    in_meshlet[v] = current;
+                    meshlet_verts++;
+                    // the triangles around a new vertex become candidates
+                    const int *vert_tris = adj.vertex_triangles(v);
+                    for (int k=0; k<adj.num_vertex_triangles(v); k++) {
+                        if (!used[vert_tris[k]]) {
+                            candidates.push_back(vert_tris[k]);
+                        }
+                    }
+                }
+            }
+
+            // drop the candidates that have been used so the list stays short
+            int keep = 0;
+            for (int i=0; i<candidates.size(); i++) {
+                if (!used[candidates[i]]) {
+                    candidates[keep++] = candidates[i];
+                }
+            }
+            candidates.resize(keep);
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        }
+
+        AddMeshlet(mesh, first_index, meshlet_verts);
+        current++;
+    }
+}
+
+
+void Meshlets::AddMeshlet(const Mesh &mesh, int first_index, int num_vertices) {
+    Meshlet m;
+    m.first_index = first_index;
+    m.num_triangles = ((int)indices_.size() - first_index) / 3;
+    m.num_vertices = num_vertices;
+
+    for (int i=first_index; i<indices_.size(); i++) {
+        m.box = m.box + AABB(mesh.read_vertex_data(indices_[i]));
+    }
+    m.center = m.box.Center();
+    m.radius = 0.0f;
+    for (int i=first_index; i<indices_.size(); i++) {
+        m.radius = std::max(m.radius, (mesh.read_vertex_data(indices_[i]) - m.center).Length());
+    }
+
+    // The cone axis is the average of the triangle normals, and the cone is
+    // just wide enough to hold all of them
+    std::vector<Vector3> normals;
+    Vector3 sum(0,0,0);
+    for (int i=first_index; i<indices_.size(); i+=3) {
+        Point3 a = mesh.read_vertex_data(indices_[i]);
+        Point3 b = mesh.read_vertex_data(indices_[i+1]);
+        Point3 c = mesh.read_vertex_data(indices_[i+2]);
+        Vector3 n = (b - a).Cross(c - a);
+        if (n.Length() > 0.0f) {
+            n.Normalize();
+            normals.push_back(n);
+            sum = sum + n;
+        }
+    }
+    m.axis = Vector3(0,0,0);
+    m.cutoff = 1.0f;
+    if (sum.Length() > 1e-6f) {
+        m.axis = sum.ToUnit();
+        float min_dot = 1.0f;
+        for (int i=0; i<normals.size(); i++) {
+            min_dot = std::min(min_dot, m.axis.Dot(normals[i]));
+        }
+        // a cone wider than a hemisphere never faces entirely away from the camera
+        if (min_dot > 0.0f) {
+            m.cutoff = std::sqrt(std::max(1.0f - min_dot*min_dot, 0.0f));
+        }
+    }
+    meshlets_.push_back(m);
+}
+
+
+int Meshlets::Cull(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+                   std::vector<unsigned int> *indices, bool cone_culling) const
+{
+    indices->clear();
+
+    // Do the tests in the mesh's own coordinates so the meshlets do not need
+    // to be transformed
+    Frustum frustum;
+    frustum.Set(projection * view * model);
+    Matrix4 to_model = (view * model).Inverse();
+    bool perspective = (projection(3,2) != 0.0f);
+    Point3 eye = to_model * Point3::Origin();
+    Vector3 look = (to_model * Vector3(0,0,-1)).ToUnit();
+
+    int count = 0;
+    for (int i=0; i<meshlets_.size(); i++) {
+        const Meshlet &m = meshlets_[i];
+        if (!frustum.IsVisible(m.box)) {
+            continue;
+        }
+
+        if ((cone_culling) && (m.cutoff < 1.0f)) {
+            // All of the triangles face away if every normal in the cone points
+            // away from the camera by more than the meshlet's radius, i.e., if
+            // (angle to the camera) + (cone half angle) < 90 degrees with room
+            // to spare.
+            Vector3 to_meshlet = perspective ? (m.center - eye) : look;
+            float dist = to_meshlet.Length();
+            if (dist > 0.0f) {
+                float cos_a = m.axis.Dot(to_meshlet) / dist;
+                float sin_a = std::sqrt(std::max(1.0f - cos_a*cos_a, 0.0f));
+                float cos_cone = std::sqrt(std::max(1.0f - m.cutoff*m.cutoff, 0.0f));
+                float closest = cos_a * cos_cone - sin_a * m.cutoff;
+                if ((cos_a > 0.0f) && (perspective ? (dist * closest > m.radius) : (closest > 0.0f))) {
+                    continue;
+                }
+            }
+        }
+
+        indices->insert(indices->end(), indices_.begin() + m.first_index,
+                        indices_.begin() + m.first_index + 3 * m.num_triangles);
+        count++;
+    }
+    return count;
+}
+
+
+int Meshlets::num_meshlets() const {
+    return (int)meshlets_.size();
+}
+
+int Meshlets::num_triangles(int i) const {
+    return meshlets_[i].num_triangles;
+}
+
+int Meshlets::num_vertices(int i) const {
+    return meshlets_[i].num_vertices;
+}
+
+AABB Meshlets::bounding_box(int i) const {
+    return meshlets_[i].box;
+}
+
+Point3 Meshlets::bounding_sphere_center(int i) const {
+    return meshlets_[i].center;
+}
+
+float Meshlets::bounding_sphere_radius(int i) const {
+    return meshlets_[i].radius;
+}
+
+Vector3 Meshlets::cone_axis(int i) const {
+    return meshlets_[i].axis;
+}
+
+float Meshlets::cone_cutoff(int i) const {
+    return meshlets_[i].cutoff;
+}
+
+const std::vector<unsigned int>& Meshlets::indices() const {
+    return indices_;
+}
+
+
+} // end namespace
@@ -0,0 +1,138 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_MESHLETS_H_
+#define SRC_MESHLETS_H_
+
+#include "aabb.h"
+#include "matrix4.h"
+#include "mesh.h"
+#include "point3.h"
+#include "vector3.h"
+
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Splits the triangles of a large mesh into small groups called meshlets
+ (by default at most 64 vertices and 124 triangles each) so that the parts of
+ the mesh that cannot be seen can be skipped.  Each meshlet stores a bounding
+ box, a bounding sphere, and a normal cone, which bounds the directions that
+ its triangles face.  Cull() tests each meshlet against the view frustum and,
+ using the normal cone, checks whether all of its triangles face away from
+ the camera.  It then builds an index list with just the triangles of the
+ meshlets that pass, ready to give to Mesh::SetIndices().  Example:
+ ~~~
+ Mesh model;
+ Mesh visible_part;
+ Meshlets meshlets;
+ std::vector<unsigned int> visible_indices;
+
+ void Init() {
+     model.LoadFromOBJ(Platform::FindMinGfxDataFile("bunny.obj"));
+     meshlets.Build(model);
+     // a copy to draw so that the original mesh keeps all of its triangles
+     visible_part = model;
+ }
+
+ void DrawUsingOpenGL() {
+     meshlets.Cull(model_matrix, view, proj, &visible_indices);
+     // only the index buffer is updated on the GPU, not the vertices
+     visible_part.SetIndices(visible_indices);
+     shader.Draw(model_matrix, view, proj, &visible_part, material);
+ }
+ ~~~
+
+ Each meshlet is grown outward from a starting triangle, adding the neighboring
+ triangles that need the fewest new vertices and that face the same way as the
+ rest of the meshlet, which keeps the meshlets compact and their normal cones
+ narrow.  Meshes without indices also work, but then the triangles do not share
+ vertices, so each meshlet holds fewer triangles.
+ */
+class Meshlets {
+public:
+
+    /// Creates an empty set of meshlets.
+    Meshlets();
+
+    virtual ~Meshlets();
+
+    /** Splits the triangles of the mesh into meshlets that each use at most
+     max_vertices vertices and max_triangles triangles. */
+    void Build(const Mesh &mesh, int max_vertices = 64, int max_triangles = 124);
+
+    /** Fills indices with the triangles of the meshlets that may be visible
+     when drawn with these matrices, and returns the number of those meshlets.
+     Meshlets outside the view frustum are always culled, and those that face
+     entirely away from the camera are also culled when cone_culling is true.
+     Turn cone culling off for meshes drawn without back face culling where
+     the back sides should still show. */
+    int Cull(const Matrix4 &model, const Matrix4 &view, const Matrix4 &projection,
+             std::vector<unsigned int> *indices, bool cone_culling = true) const;
+
+    /// The number of meshlets.
+    int num_meshlets() const;
+
+    /// The number of triangles in meshlet i.
+    int num_triangles(int i) const;
+
+    /// The number of different vertices used by meshlet i.
+    int num_vertices(int i) const;
+
+    /// The box that contains meshlet i.
+    AABB bounding_box(int i) const;
+
+    /// The center of a sphere that contains meshlet i.
+    Point3 bounding_sphere_center(int i) const;
+
+    /// The radius of a sphere that contains meshlet i.
+    float bounding_sphere_radius(int i) const;
+
+    /// The average direction that the triangles of meshlet i face.
+    Vector3 cone_axis(int i) const;
+
+    /// The sine of the largest angle between the axis and the normals of the
+    /// triangles of meshlet i, or 1 if the normals spread too far for the
+    /// meshlet to ever be culled as back facing.
+    float cone_cutoff(int i) const;
+
+    /// The indices of the triangles of all the meshlets, one meshlet after
+    /// another.
+    const std::vector<unsigned int>& indices() const;
+
+private:
+
+    class Meshlet {
+    public:
+        int first_index;
+        int num_triangles;
+        int num_vertices;
+        AABB box;
+        Point3 center;
+        float radius;
+        Vector3 axis;
+        float cutoff;
+    };
+
+    void AddMeshlet(const Mesh &mesh, int first_index, int num_vertices);
+
+    std::vector<Meshlet> meshlets_;
+    std::vector<unsigned int> indices_;
+};
+
+
+} // end namespace
+
+#endif
@@ -19,16 +19,30 @@
 
 #include "aabb.h"
 #include "bvh.h"
+#include "clustered_lights.h"
 #include "color.h"
+#include "command_list.h"
 #include "craft_cam.h"
 #include "default_shader.h"
+#include "frame_capture.h"
+#include "frame_profiler.h"
+#include "frustum.h"
 #include "gfxmath.h"
 #include "gl_points_and_lines.h"
+#include "gl_state.h"
 #include "graphics_app.h"
+#include "isosurface.h"
+#include "job_system.h"
 #include "matrix4.h"
+#include "memory_stats.h"
 #include "mesh.h"
+#include "mesh_adjacency.h"
+#include "mesh_batch.h"
+#include "mesh_lod.h"
+#include "meshlets.h"
 #include "mingfx_config.h"
 #include "opengl_headers.h"
+#include "pixel_readback.h"
 #include "platform.h"
 #include "point2.h"
 #include "point3.h"
@@ -38,6 +52,10 @@
 #include "shader_program.h"
 #include "text_shader.h"
 #include "texture2d.h"
+#include "texture_array.h"
+#include "texture_atlas.h"
+#include "texture_loader.h"
+#include "triple_buffer.h"
 #include "unicam.h"
 #include "vector2.h"
 #include "vector3.h"
@@ -0,0 +1,163 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "pixel_readback.h"
+
+#include <cstring>
+#include <iostream>
+
+
+namespace mingfx {
+
+// Finish() waits this long at a time, in nanoseconds, for a read to finish
+static const GLuint64 FINISH_TIMEOUT = 1000000000;
+
+
+Color PixelReadback::Result::color(int col, int row) const {
+    const unsigned char *p = &data[4 * (row * width + col)];
+    return Color((float)p[0] / 255.0f, (float)p[1] / 255.0f, (float)p[2] / 255.0f, (float)p[3] / 255.0f);
+}
+
+float PixelReadback::Result::depth(int col, int row) const {
+    float z;
+    memcpy(&z, &data[4 * (row * width + col)], sizeof(float));
+    return z;
+}
+
+unsigned int PixelReadback::Result::object_id(int col, int row) const {
+    unsigned int id;
+    memcpy(&id, &data[4 * (row * width + col)], sizeof(unsigned int));
+    return id;
+}
+
+
+PixelReadback::PixelReadback() {
+}
+
+PixelReadback::~PixelReadback() {
+    Clear();
+}
+
+
+void PixelReadback::Read(Format format, int x, int y, int width, int height, const Callback &callback) {
+    if ((width <= 0) || (height <= 0)) {
+        return;
+    }
+
+    PendingRead read;
+    read.result.format = format;
+    read.result.x = x;
+    read.result.y = y;
+    read.result.width = width;
+    read.result.height = height;
+    read.callback = callback;
+
+    // reuse a buffer from an earlier read if there is one, since they are
+    // usually the same size from frame to frame
+    size_t bytes = 4 * (size_t)width * (size_t)height;
+    if (free_buffers_.size()) {
+        read.buffer = free_buffers_.back();
+        free_buffers_.pop_back();
+    }
+    else {
+        glGenBuffers(1, &read.buffer.id);
+        read.buffer.bytes = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, read.buffer.id);
+    if (read.buffer.bytes < bytes) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        read.buffer.bytes = bytes;
+    }
+
+    // with a pack buffer bound, this starts a copy on the GPU and returns
+    if (format == COLOR) {
+        glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    }
+    else if (format == DEPTH) {
+        glReadPixels(x, y, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+    }
+    else {
+        glReadPixels(x, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    read.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pending_.push_back(read);
+}
+
+
+void PixelReadback::Update() {
+    // fences finish in the order they were issued, so stop at the first one
+    // that is not done.  the flush makes sure it will be done eventually.
+    while (pending_.size()) {
+        GLenum status = glClientWaitSync(pending_.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return;
+        }
+        // callbacks may start new reads, so take this one out of the queue first
+        PendingRead read = pending_.front();
+        pending_.pop_front();
+        Complete(&read);
+    }
+}
+
+
+void PixelReadback::Finish() {
+    while (pending_.size()) {
+        GLenum status;
+        do {
+            status = glClientWaitSync(pending_.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, FINISH_TIMEOUT);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        PendingRead read = pending_.front();
+        pending_.pop_front();
+        Complete(&read);
+    }
+}
+
+
+void PixelReadback::Complete(PendingRead *read) {
+    glDeleteSync(read->fence);
+
+    size_t bytes = 4 * (size_t)read->result.width * (size_t)read->result.height;
+    read->result.data.resize(bytes);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, read->buffer.id);
+    void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (pixels != NULL) {
+        memcpy(&read->result.data[0], pixels, bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    else {
+        std::cerr << "PixelReadback: Could not map the pixel buffer." << std::endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    free_buffers_.push_back(read->buffer);
+
+    if (read->callback) {
+        read->callback(read->result);
+    }
+}
+
+
+int PixelReadback::num_pending() const {
+    return (int)pending_.size();
+}
+
+
+void PixelReadback::Clear() {
+    for (int i=0; i<pending_.size(); i++) {
+        glDeleteSync(pending_[i].fence);
+        glDeleteBuffers(1, &pending_[i].buffer.id);
+    }
+    for (int i=0; i<free_buffers_.size(); i++) {
+        glDeleteBuffers(1, &free_buffers_[i].id);
+    }
+    pending_.clear();
+    free_buffers_.clear();
+}
+
+
+} // end namespace
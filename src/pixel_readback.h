@@ -0,0 +1,155 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_PIXEL_READBACK_H_
+#define SRC_PIXEL_READBACK_H_
+
+#include "opengl_headers.h"
+#include "color.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+
+namespace mingfx {
+
+
+/** Reads pixels back from the graphics card without waiting for it.  Reading
+ with glReadPixels() makes the CPU wait until the GPU has finished drawing
+ everything that came before, which stalls the program every time.  Instead,
+ Read() starts copying the pixels into a pixel buffer object on the graphics
+ card and returns right away.  Update() should then be called once per frame;
+ when a copy has finished, usually one or two frames later, it passes the
+ pixels to the callback that was given to Read().  Example:
+ ~~~
+ PixelReadback readback;
+
+ void MyApp::DrawUsingOpenGL() {
+     DrawScene();
+     if (pick_requested_) {
+         readback.Read(PixelReadback::OBJECT_ID, x, y, 1, 1,
+             [this](const PixelReadback::Result &result) {
+                 selected_object_ = result.object_id(0, 0);
+             });
+         pick_requested_ = false;
+     }
+     readback.Update();
+ }
+ ~~~
+
+ Pixels are read from the framebuffer bound to GL_READ_FRAMEBUFFER, with
+ (x,y) in pixels from the bottom left corner, as in glReadPixels().
+ GraphicsApp has one of these, which it updates every frame and uses for
+ GraphicsApp::ReadZValueAtPixelAsync().
+ */
+class PixelReadback {
+public:
+
+    /// What to read from the framebuffer
+    enum Format {
+        /// RGBA colors, 1 byte per channel, from the current read buffer
+        COLOR,
+        /// Depth buffer values from 0 at the near plane to 1 at the far plane
+        DEPTH,
+        /// Unsigned ints from the current read buffer, which must be an
+        /// integer color attachment, e.g., GL_R32UI, selected with
+        /// glReadBuffer()
+        OBJECT_ID
+    };
+
+    /// The pixels from one finished read.  Rows are stored from the bottom
+    /// of the region to the top, as returned by OpenGL.
+    class Result {
+    public:
+        Format format;
+        int x;
+        int y;
+        int width;
+        int height;
+        /// 4 bytes per pixel in every format
+        std::vector<unsigned char> data;
+
+        /// The color of a pixel read with COLOR, where (col,row) are relative
+        /// to the bottom left corner of the region.
+        Color color(int col, int row) const;
+
+        /// The depth of a pixel read with DEPTH.
+        float depth(int col, int row) const;
+
+        /// The id of a pixel read with OBJECT_ID.
+        unsigned int object_id(int col, int row) const;
+    };
+
+    /// Called with the pixels once they have been read
+    typedef std::function<void(const Result &result)> Callback;
+
+
+    PixelReadback();
+
+    /// Deletes any OpenGL buffers that are still in use.
+    virtual ~PixelReadback();
+
+    /// Starts reading a region of the framebuffer and returns without
+    /// waiting for it.  The callback is called from a later Update() or
+    /// Finish() once the pixels are available.
+    void Read(Format format, int x, int y, int width, int height, const Callback &callback);
+
+    /// Passes the pixels of every read that has finished to its callback, in
+    /// the order they were started, without waiting for the others.  Call
+    /// this once per frame.
+    void Update();
+
+    /// Waits for every read to finish and passes the pixels to the callbacks.
+    void Finish();
+
+    /// Number of reads that have been started but not yet passed to their
+    /// callbacks.
+    int num_pending() const;
+
+    /// Discards any reads in progress without calling their callbacks and
+    /// deletes the OpenGL buffers, which must happen while the OpenGL context
+    /// still exists.
+    void Clear();
+
+private:
+
+    // a pixel buffer object, kept for reuse once its read is done
+    class Buffer {
+    public:
+        GLuint id;
+        size_t bytes;
+    };
+
+    class PendingRead {
+    public:
+        Result result;
+        Callback callback;
+        Buffer buffer;
+        GLsync fence;
+    };
+
+    void Complete(PendingRead *read);
+
+    // for now, the copy constructor is private so no copies are allowed.
+    PixelReadback(const PixelReadback &other);
+    PixelReadback& operator=(const PixelReadback &other);
+
+    std::deque<PendingRead> pending_;
+    std::vector<Buffer> free_buffers_;
+};
+
+
+} // end namespace
+
+#endif
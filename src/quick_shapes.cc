@@ -5,8 +5,10 @@
  */
 
 #include "quick_shapes.h"
+#include "gl_state.h"
 #include "platform.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <string>
@@ -21,6 +23,12 @@ namespace mingfx {
 #define TWOPI 6.28318530718f
     
     
+// Resolution of each tessellation level, finest first
+static const int CYL_SLICES[] = {20, 12, 8, 6};
+static const int SPH_SLICES[] = {40, 24, 14, 8};
+static const int SPH_STACKS[] = {40, 12, 7, 4};
+    
+    
     
 // Helper datastructure for building shapes algorithmically
 class Vertex {
@@ -39,7 +47,9 @@ public:
     
     
     
-QuickShapes::QuickShapes() {
+QuickShapes::QuickShapes() : batching_(false), batch_size_(0), adaptive_(true),
+    tessTolerance_(0.5f), viewportHeight_(0.0f), viewportKnown_(false)
+{
 }
 
 QuickShapes::~QuickShapes() {
@@ -94,6 +104,7 @@ void QuickShapes::initCube() {
     
     cubeMesh_.SetVertices(vertices, 36);
     cubeMesh_.SetNormals(normals, 36);
+    cubeMesh_.Weld();
     cubeMesh_.UpdateGPUMemory();
 }
 
@@ -101,6 +112,10 @@ void QuickShapes::initCube() {
 void QuickShapes::DrawCube(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                 const Matrix4 &projectionMatrix, const Color &color)
 {
+    if (batching_) {
+        AddToBatch(BATCH_CUBE, 0, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
     if (cubeMesh_.num_vertices() == 0) {
         initCube();
     }
@@ -135,6 +150,7 @@ void QuickShapes::initSquare() {
     squareMesh_.SetVertices(vertices, 6);
     squareMesh_.SetNormals(normals, 6);
     squareMesh_.SetTexCoords(0, texcoords, 6);
+    squareMesh_.Weld();
     squareMesh_.UpdateGPUMemory();
 }
 
@@ -142,6 +158,10 @@ void QuickShapes::initSquare() {
 void QuickShapes::DrawSquare(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                   const Matrix4 &projectionMatrix, const Color &color)
 {
+    if (batching_) {
+        AddToBatch(BATCH_SQUARE, 0, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
     if (squareMesh_.num_vertices() == 0) {
         initSquare();
     }
@@ -172,38 +192,39 @@ void QuickShapes::DrawSquare(const Matrix4 &modelMatrix, const Matrix4 &viewMatr
 // ------------  CYLINDER  ------------
 
 
-void QuickShapes::initCyl() {
+void QuickShapes::initCyl(int level) {
     
     std::vector<Vertex> verts;
+    std::vector<unsigned int> indices;
+    
+    verts.push_back(Vertex(0,1,0, 0,1,0));    // top
+    verts.push_back(Vertex(0,-1,0, 0,-1,0));  // bottom
+    
+    // each point around the rim is used for the top, both sides, and the
+    // bottom, with a different normal for the caps and the sides
+    const int nslices = CYL_SLICES[level];
+    for (int s=0; s<nslices+1; s++) {
+        GLfloat x = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
+        GLfloat z = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
+        verts.push_back(Vertex(x,1,z, 0,1,0));
+        verts.push_back(Vertex(x,1,z, x,0,z));
+        verts.push_back(Vertex(x,-1,z, x,0,z));
+        verts.push_back(Vertex(x,-1,z, 0,-1,0));
+    }
     
-    Vertex top(0,1,0, 0,1,0);
-    Vertex bot(0,-1,0, 0,-1,0);
-    
-    const int nslices = 20;
     for (int s=1; s<nslices+1; s++) {
-        GLfloat xlast = GfxMath::cos(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat zlast = GfxMath::sin(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat xnew = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
-        GLfloat znew = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
+        unsigned int last = 2 + 4*(s-1);
+        unsigned int next = 2 + 4*s;
         
         // one triangle on the top
-        verts.push_back(top);
-        verts.push_back(Vertex(xlast,1,zlast, 0,1,0));
-        verts.push_back(Vertex(xnew,1,znew, 0,1,0));
+        indices.push_back(0);  indices.push_back(last);  indices.push_back(next);
         
         // two triangles to create a rect on the side
-        verts.push_back(Vertex(xlast,1,zlast, xlast,0,zlast));
-        verts.push_back(Vertex(xlast,-1,zlast, xlast,0,zlast));
-        verts.push_back(Vertex(xnew,1,znew, xnew,0,znew));
-        
-        verts.push_back(Vertex(xnew,-1,znew, xnew,0,znew));
-        verts.push_back(Vertex(xnew,1,znew, xnew,0,znew));
-        verts.push_back(Vertex(xlast,-1,zlast, xlast,0,zlast));
+        indices.push_back(last+1);  indices.push_back(last+2);  indices.push_back(next+1);
+        indices.push_back(next+2);  indices.push_back(next+1);  indices.push_back(last+2);
         
         // one triangle on the bottom
-        verts.push_back(bot);
-        verts.push_back(Vertex(xnew,-1,znew, 0,-1,0));
-        verts.push_back(Vertex(xlast,-1,zlast, 0,-1,0));
+        indices.push_back(1);  indices.push_back(next+3);  indices.push_back(last+3);
     }
     
     std::vector<Point3> vertices;
@@ -212,22 +233,28 @@ void QuickShapes::initCyl() {
         vertices.push_back(Point3(verts[i].x, verts[i].y, verts[i].z));
         normals.push_back(Vector3(verts[i].nx, verts[i].ny, verts[i].nz));
     }    
-    cylMesh_.SetVertices(vertices);
-    cylMesh_.SetNormals(normals);
-    cylMesh_.UpdateGPUMemory();
+    cylMeshes_[level].SetVertices(vertices);
+    cylMeshes_[level].SetNormals(normals);
+    cylMeshes_[level].SetIndices(indices);
+    cylMeshes_[level].UpdateGPUMemory();
 }
 
 
 void QuickShapes::DrawCylinder(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                     const Matrix4 &projectionMatrix, const Color &color)
 {
-    if (cylMesh_.num_vertices() == 0) {
-        initCyl();
+    int level = TessellationLevel(BATCH_CYL, modelMatrix, viewMatrix, projectionMatrix);
+    if (batching_) {
+        AddToBatch(BATCH_CYL, level, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
+    if (cylMeshes_[level].num_vertices() == 0) {
+        initCyl(level);
     }
     defaultMaterial_.ambient_reflectance = color;
     defaultMaterial_.diffuse_reflectance = color;
     defaultMaterial_.surface_texture = emptyTex_;
-    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &cylMesh_, defaultMaterial_);
+    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &cylMeshes_[level], defaultMaterial_);
 }
 
 
@@ -236,34 +263,39 @@ void QuickShapes::DrawCylinder(const Matrix4 &modelMatrix, const Matrix4 &viewMa
 // ------------  CONE  ------------
 
 
-void QuickShapes::initCone() {
+void QuickShapes::initCone(int level) {
     
     std::vector<Vertex> verts;
+    std::vector<unsigned int> indices;
     
-    Vertex top(0,1,0, 0,1,0);
-    Vertex bot(0,-1,0, 0,-1,0);
+    verts.push_back(Vertex(0,-1,0, 0,-1,0));  // bottom
     
-    const int nslices = 20;
-    for (int s=1; s<nslices+1; s++) {
-        GLfloat xlast = GfxMath::cos(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat zlast = GfxMath::sin(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat xnew = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
-        GLfloat znew = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
-        
-        // one triangle on the side
+    // points around the base, each used for the side and the bottom
+    const int nslices = CYL_SLICES[level];
+    for (int s=0; s<nslices+1; s++) {
+        GLfloat x = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
+        GLfloat z = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
         // normals are a bit more complex than for other shapes...
-        Vector3 nlast = Vector3(xlast, 2, zlast).ToUnit();
-        Vector3 nnew = Vector3(xnew, 2, znew).ToUnit();
-        Vector3 ntop = 0.5*(nlast + nnew);
-        
-        verts.push_back(Vertex(top.x, top.y, top.z, ntop[0], ntop[1], ntop[2]));
-        verts.push_back(Vertex(xlast,-1,zlast, nlast[0], nlast[1], nlast[2]));
-        verts.push_back(Vertex(xnew,-1,znew, nnew[0], nnew[1], nnew[2]));
+        Vector3 n = Vector3(x, 2, z).ToUnit();
+        verts.push_back(Vertex(x,-1,z, n[0], n[1], n[2]));
+        verts.push_back(Vertex(x,-1,z, 0,-1,0));
+    }
+    
+    for (int s=1; s<nslices+1; s++) {
+        unsigned int last = 1 + 2*(s-1);
+        unsigned int next = 1 + 2*s;
+        
+        // one triangle on the side, the top gets its own copy for each side
+        // with a normal halfway between those at the base
+        Vector3 ntop = 0.5*(Vector3(verts[last].nx, verts[last].ny, verts[last].nz) +
+                            Vector3(verts[next].nx, verts[next].ny, verts[next].nz));
+        indices.push_back((unsigned int)verts.size());
+        indices.push_back(last);
+        indices.push_back(next);
+        verts.push_back(Vertex(0,1,0, ntop[0], ntop[1], ntop[2]));
         
         // one triangle on the bottom
-        verts.push_back(bot);
-        verts.push_back(Vertex(xnew,-1,znew, 0,-1,0));
-        verts.push_back(Vertex(xlast,-1,zlast, 0,-1,0));
+        indices.push_back(0);  indices.push_back(next+1);  indices.push_back(last+1);
     }
     
     std::vector<Point3> vertices;
@@ -273,22 +305,28 @@ void QuickShapes::initCone() {
         normals.push_back(Vector3(verts[i].nx, verts[i].ny, verts[i].nz));
     }
     
-    coneMesh_.SetVertices(vertices);
-    coneMesh_.SetNormals(normals);
-    coneMesh_.UpdateGPUMemory();
+    coneMeshes_[level].SetVertices(vertices);
+    coneMeshes_[level].SetNormals(normals);
+    coneMeshes_[level].SetIndices(indices);
+    coneMeshes_[level].UpdateGPUMemory();
 }
 
 
 void QuickShapes::DrawCone(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                 const Matrix4 &projectionMatrix, const Color &color)
 {
-    if (coneMesh_.num_vertices() == 0) {
-        initCone();
+    int level = TessellationLevel(BATCH_CONE, modelMatrix, viewMatrix, projectionMatrix);
+    if (batching_) {
+        AddToBatch(BATCH_CONE, level, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
+    if (coneMeshes_[level].num_vertices() == 0) {
+        initCone(level);
     }
     defaultMaterial_.ambient_reflectance = color;
     defaultMaterial_.diffuse_reflectance = color;
     defaultMaterial_.surface_texture = emptyTex_;
-    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &coneMesh_, defaultMaterial_);
+    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &coneMeshes_[level], defaultMaterial_);
 }
 
 
@@ -298,86 +336,79 @@ void QuickShapes::DrawCone(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix
 // ------------  SPHERE  ------------
 
 
-void QuickShapes::initSph() {
+void QuickShapes::initSph(int level) {
     
     std::vector<Vertex> verts;
+    std::vector<unsigned int> indices;
+    
+    // a grid of points running from the top (stack 0) to the bottom, the
+    // poles are repeated for each slice
+    const int nslices = SPH_SLICES[level];
+    const int nstacks = SPH_STACKS[level];
+    for (int s=0; s<nslices+1; s++) {
+        GLfloat x = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
+        GLfloat z = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
+        for (int t=0; t<nstacks+1; t++) {
+            if (t == 0) {
+                verts.push_back(Vertex(0,1,0, 0,1,0));
+            }
+            else if (t == nstacks) {
+                verts.push_back(Vertex(0,-1,0, 0,-1,0));
+            }
+            else {
+                GLfloat y = GfxMath::cos(PI * (float)(t)/(float)nstacks);
+                GLfloat r = GfxMath::sin(PI * (float)(t)/(float)nstacks);
+                verts.push_back(Vertex(r*x,y,r*z, r*x,y,r*z));
+            }
+        }
+    }
     
-    Vertex top(0,1,0, 0,1,0);
-    Vertex bot(0,-1,0, 0,-1,0);
-    
-    const int nslices = 40;
-    const int nstacks = 40;
     for (int s=1; s<nslices+1; s++) {
-        GLfloat xlast = GfxMath::cos(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat zlast = GfxMath::sin(-TWOPI * (float)(s-1)/(float)nslices);
-        GLfloat xnew = GfxMath::cos(-TWOPI * (float)(s)/(float)nslices);
-        GLfloat znew = GfxMath::sin(-TWOPI * (float)(s)/(float)nslices);
-        
-        float stackstep = PI/(float)nstacks;
-        
-        // one triangle on the top
-        verts.push_back(top);
-        verts.push_back(Vertex(GfxMath::sin(stackstep)*xlast,GfxMath::cos(stackstep),
-                               GfxMath::sin(stackstep)*zlast,
-                               GfxMath::sin(stackstep)*xlast,GfxMath::cos(stackstep),
-                               GfxMath::sin(stackstep)*zlast));
-        verts.push_back(Vertex(GfxMath::sin(stackstep)*xnew,GfxMath::cos(stackstep),
-                               GfxMath::sin(stackstep)*znew,
-                               GfxMath::sin(stackstep)*xnew,GfxMath::cos(stackstep),
-                               GfxMath::sin(stackstep)*znew));
-        
-        for (int t=2; t<nstacks; t++) {
-            GLfloat ylast = GfxMath::cos(PI*(float)(t-1)/(float)nstacks);
-            GLfloat ynew = GfxMath::cos(PI*(float)(t)/(float)nstacks);
-            
-            GLfloat rlast = GfxMath::sin(PI * (float)(t-1)/(float)nstacks);
-            GLfloat rnew = GfxMath::sin(PI * (float)(t)/(float)nstacks);
+        for (int t=1; t<nstacks+1; t++) {
+            unsigned int lastlast = (s-1)*(nstacks+1) + (t-1);
+            unsigned int lastnew = (s-1)*(nstacks+1) + t;
+            unsigned int newnew = s*(nstacks+1) + t;
+            unsigned int newlast = s*(nstacks+1) + (t-1);
             
-            // two triangles to create a rect on the side
-            verts.push_back(Vertex(rlast*xlast,ylast,rlast*zlast, rlast*xlast,ylast,rlast*zlast));
-            verts.push_back(Vertex(rnew*xlast,ynew,rnew*zlast, rnew*xlast,ynew,rnew*zlast));
-            verts.push_back(Vertex(rnew*xnew,ynew,rnew*znew, rnew*xnew,ynew,rnew*znew));
-            
-            verts.push_back(Vertex(rnew*xnew,ynew,rnew*znew, rnew*xnew,ynew,rnew*znew));
-            verts.push_back(Vertex(rlast*xnew,ylast,rlast*znew, rlast*xnew,ylast,rlast*znew));
-            verts.push_back(Vertex(rlast*xlast,ylast,rlast*zlast, rlast*xlast,ylast,rlast*zlast));
+            // two triangles to create a rect on the side, only one of which
+            // is needed next to the poles
+            if (t < nstacks) {
+                indices.push_back(lastlast);  indices.push_back(lastnew);  indices.push_back(newnew);
+            }
+            if (t > 1) {
+                indices.push_back(newnew);  indices.push_back(newlast);  indices.push_back(lastlast);
+            }
         }
-        
-        // one triangle on the bottom
-        verts.push_back(bot);
-        verts.push_back(Vertex(GfxMath::sin(stackstep)*xnew,GfxMath::cos(PI-stackstep),
-                               GfxMath::sin(stackstep)*znew,
-                               GfxMath::sin(stackstep)*xnew,GfxMath::cos(PI-stackstep),
-                               GfxMath::sin(stackstep)*znew));
-        verts.push_back(Vertex(GfxMath::sin(stackstep)*xlast,GfxMath::cos(PI-stackstep),
-                               GfxMath::sin(stackstep)*zlast,
-                               GfxMath::sin(stackstep)*xlast,GfxMath::cos(PI-stackstep),
-                               GfxMath::sin(stackstep)*zlast));
     }
     
-    
     std::vector<Point3> vertices;
     std::vector<Vector3> normals;
     for (int i = 0; i < verts.size(); i++) {
         vertices.push_back(Point3(verts[i].x, verts[i].y, verts[i].z));
         normals.push_back(Vector3(verts[i].nx, verts[i].ny, verts[i].nz));
     }
-    sphereMesh_.SetVertices(vertices);
-    sphereMesh_.SetNormals(normals);
-    sphereMesh_.UpdateGPUMemory();
+    sphereMeshes_[level].SetVertices(vertices);
+    sphereMeshes_[level].SetNormals(normals);
+    sphereMeshes_[level].SetIndices(indices);
+    sphereMeshes_[level].UpdateGPUMemory();
 }
 
 
 void QuickShapes::DrawSphere(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                   const Matrix4 &projectionMatrix, const Color &color)
 {
-    if (sphereMesh_.num_vertices() == 0) {
-        initSph();
+    int level = TessellationLevel(BATCH_SPH, modelMatrix, viewMatrix, projectionMatrix);
+    if (batching_) {
+        AddToBatch(BATCH_SPH, level, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
+    if (sphereMeshes_[level].num_vertices() == 0) {
+        initSph(level);
     }
     defaultMaterial_.ambient_reflectance = color;
     defaultMaterial_.diffuse_reflectance = color;
     defaultMaterial_.surface_texture = emptyTex_;
-    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &sphereMesh_, defaultMaterial_);
+    defaultShader_.Draw(modelMatrix, viewMatrix, projectionMatrix, &sphereMeshes_[level], defaultMaterial_);
 }
 
 
@@ -541,6 +572,7 @@ void QuickShapes::initBrush() {
     
     brushMesh_.SetVertices((float*)verts, 102);
     brushMesh_.SetNormals((float*)norms, 102);
+    brushMesh_.Weld();
     brushMesh_.UpdateGPUMemory();
 }
 
@@ -548,6 +580,10 @@ void QuickShapes::initBrush() {
 void QuickShapes::DrawBrush(const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
                  const Matrix4 &projectionMatrix, const Color &color)
 {
+    if (batching_) {
+        AddToBatch(BATCH_BRUSH, 0, modelMatrix, viewMatrix, projectionMatrix, color);
+        return;
+    }
     if (brushMesh_.num_vertices() == 0) {
         initBrush();
     }
@@ -677,6 +713,7 @@ void QuickShapes::initFull() {
     fullMesh_.SetVertices(vertices, 6);
     fullMesh_.SetNormals(normals, 6);
     fullMesh_.SetTexCoords(0, texcoords, 6);
+    fullMesh_.Weld();
     fullMesh_.UpdateGPUMemory();
 }
     
@@ -699,8 +736,8 @@ void QuickShapes::DrawWithFullscreen(const Color &color, Mesh *mesh, const Textu
         fullscreenShader_.LinkProgram();
     }
 
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_FALSE);
+    GLState::Disable(GL_DEPTH_TEST);
+    GLState::DepthMask(GL_FALSE);
     
     // Activate the shader program
     fullscreenShader_.UseProgram();
@@ -715,8 +752,205 @@ void QuickShapes::DrawWithFullscreen(const Color &color, Mesh *mesh, const Textu
     // Deactivate the shader program
     fullscreenShader_.StopProgram();
     
-    glEnable(GL_DEPTH_TEST);
-    glDepthMask(GL_TRUE);
+    GLState::Enable(GL_DEPTH_TEST);
+    GLState::DepthMask(GL_TRUE);
+}
+
+
+// ------------  BATCH MODE  ------------
+
+
+void QuickShapes::BeginBatch() {
+    batching_ = true;
+    // usually once per frame, so this picks up changes to the window size
+    viewportKnown_ = false;
+}
+
+
+void QuickShapes::EndBatch() {
+    FlushBatch();
+    batching_ = false;
+}
+
+
+bool QuickShapes::batching() const {
+    return batching_;
+}
+
+
+Mesh* QuickShapes::shape_mesh(BatchShape shape, int level) {
+    switch (shape) {
+        case BATCH_CUBE:
+            if (cubeMesh_.num_vertices() == 0) {
+                initCube();
+            }
+            return &cubeMesh_;
+        case BATCH_SQUARE:
+            if (squareMesh_.num_vertices() == 0) {
+                initSquare();
+            }
+            return &squareMesh_;
+        case BATCH_CYL:
+            if (cylMeshes_[level].num_vertices() == 0) {
+                initCyl(level);
+            }
+            return &cylMeshes_[level];
+        case BATCH_CONE:
+            if (coneMeshes_[level].num_vertices() == 0) {
+                initCone(level);
+            }
+            return &coneMeshes_[level];
+        case BATCH_SPH:
+            if (sphereMeshes_[level].num_vertices() == 0) {
+                initSph(level);
+            }
+            return &sphereMeshes_[level];
+        case BATCH_BRUSH:
+            if (brushMesh_.num_vertices() == 0) {
+                initBrush();
+            }
+            return &brushMesh_;
+        default:
+            return NULL;
+    }
+}
+
+
+void QuickShapes::AddToBatch(BatchShape shape, int level, const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
+                             const Matrix4 &projectionMatrix, const Color &color)
+{
+    // all of the shapes in a batch are drawn with the same camera, so start a
+    // new batch if the camera changes
+    if ((batch_size_ > 0) && ((viewMatrix != batchView_) || (projectionMatrix != batchProj_))) {
+        FlushBatch();
+    }
+    batchView_ = viewMatrix;
+    batchProj_ = projectionMatrix;
+    ShapeBatch *batch = &batches_[shape][level];
+    batch->xforms.insert(batch->xforms.end(), modelMatrix.value_ptr(), modelMatrix.value_ptr() + 16);
+    batch->colors.insert(batch->colors.end(), color.value_ptr(), color.value_ptr() + 4);
+    batch_size_++;
+}
+
+
+void QuickShapes::FlushBatch() {
+    if (batch_size_ == 0) {
+        return;
+    }
+    
+    // the per-instance colors multiply the ambient and diffuse reflectance, so
+    // use white for these in the shared material
+    DefaultShader::MaterialProperties batchMaterial = defaultMaterial_;
+    batchMaterial.ambient_reflectance = Color(1,1,1);
+    batchMaterial.diffuse_reflectance = Color(1,1,1);
+    batchMaterial.surface_texture = emptyTex_;
+    
+    for (int i=0; i<NUM_BATCH_SHAPES; i++) {
+        for (int level=0; level<NUM_TESS_LEVELS; level++) {
+            ShapeBatch *batch = &batches_[i][level];
+            if (batch->xforms.size() == 0) {
+                continue;
+            }
+            if (batch->mesh.num_vertices() == 0) {
+                batch->mesh = Mesh(*shape_mesh((BatchShape)i, level));
+            }
+            // only the instance buffers are re-uploaded, not the shape itself
+            int n = (int)batch->xforms.size() / 16;
+            batch->mesh.SetInstanceTransforms(&batch->xforms[0], n);
+            batch->mesh.SetInstanceColors(&batch->colors[0], n);
+            defaultShader_.Draw(Matrix4(), batchView_, batchProj_, &batch->mesh, batchMaterial);
+            
+            // clear, but keep the memory for the next frame
+            batch->xforms.clear();
+            batch->colors.clear();
+        }
+    }
+    batch_size_ = 0;
+}
+
+
+// ------------  ADAPTIVE TESSELLATION  ------------
+
+
+int QuickShapes::TessellationLevel(BatchShape shape, const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
+                                   const Matrix4 &projectionMatrix)
+{
+    if ((!adaptive_) || ((shape != BATCH_CYL) && (shape != BATCH_CONE) && (shape != BATCH_SPH))) {
+        return 0;
+    }
+    
+    // the viewport is only read again when the camera changes, the same test
+    // AddToBatch() uses to start a new batch
+    if ((!viewportKnown_) || (viewMatrix != viewportView_) || (projectionMatrix != viewportProj_)) {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        viewportHeight_ = (float)viewport[3];
+        viewportView_ = viewMatrix;
+        viewportProj_ = projectionMatrix;
+        viewportKnown_ = true;
+    }
+    
+    // the shapes are all built around a unit circle in the x-z plane (or a
+    // unit sphere), so the size of that circle after the model matrix tells us
+    // how big the shape is
+    float sx = Vector3(modelMatrix(0,0), modelMatrix(1,0), modelMatrix(2,0)).Length();
+    float sy = Vector3(modelMatrix(0,1), modelMatrix(1,1), modelMatrix(2,1)).Length();
+    float sz = Vector3(modelMatrix(0,2), modelMatrix(1,2), modelMatrix(2,2)).Length();
+    float radius = std::max(sx, sz);
+    if (shape == BATCH_SPH) {
+        radius = std::max(radius, sy);
+    }
+    
+    // pixels per unit at the point of the shape closest to the camera
+    float pixels_per_unit;
+    if (projectionMatrix(3,2) != 0.0f) {
+        Point3 eye = viewMatrix * (modelMatrix * Point3::Origin());
+        float depth = -eye[2] - std::sqrt(sx*sx + sy*sy + sz*sz);
+        if (depth <= 0.0f) {
+            return 0;
+        }
+        pixels_per_unit = projectionMatrix(1,1) * 0.5f * viewportHeight_ / depth;
+    }
+    else {
+        pixels_per_unit = projectionMatrix(1,1) * 0.5f * viewportHeight_;
+    }
+    float radius_pixels = radius * pixels_per_unit;
+    
+    // pick the coarsest level where the flat sides are no more than the
+    // tolerance in from the true silhouette
+    for (int level=NUM_TESS_LEVELS-1; level>0; level--) {
+        float half_angle;
+        if (shape == BATCH_SPH) {
+            half_angle = std::max(PI / (float)SPH_SLICES[level], 0.5f * PI / (float)SPH_STACKS[level]);
+        }
+        else {
+            half_angle = PI / (float)CYL_SLICES[level];
+        }
+        if (radius_pixels * (1.0f - std::cos(half_angle)) <= tessTolerance_) {
+            return level;
+        }
+    }
+    return 0;
+}
+
+
+void QuickShapes::set_adaptive_tessellation(bool on) {
+    adaptive_ = on;
+}
+
+
+bool QuickShapes::adaptive_tessellation() const {
+    return adaptive_;
+}
+
+
+void QuickShapes::set_tessellation_tolerance(float pixels) {
+    tessTolerance_ = pixels;
+}
+
+
+float QuickShapes::tessellation_tolerance() const {
+    return tessTolerance_;
 }
 
 
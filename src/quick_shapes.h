@@ -65,6 +65,29 @@ namespace mingfx {
         quick_shapes.DrawLines(m_loop, view, proj, Color(1,1,1), loop, QuickShapes::LinesType::LINE_LOOP, 0.1);
     }
     ~~~
+ 
+    Each Draw...() call normally issues its own draw call, which is fine for a
+    few hundred shapes but becomes the bottleneck when drawing tens of
+    thousands of arrows or line segments per frame.  For these cases, wrap the
+    drawing in BeginBatch() and EndBatch().  In between, the Draw...() calls
+    only record the shape's transform and color, and EndBatch() draws all of
+    the recorded shapes of each type with a single instanced draw call:
+    ~~~
+    quick_shapes.BeginBatch();
+    for (int i=0; i<vectors.size(); i++) {
+        quick_shapes.DrawArrow(Matrix4(), view, proj, Color(1,1,0), points[i], vectors[i], 0.01);
+    }
+    quick_shapes.EndBatch();
+    ~~~
+
+    Spheres, cylinders, and cones (and so also line segments, lines, and
+    arrows) are stored at several levels of tessellation.  Each time one is
+    drawn, the coarsest level that still looks round on screen is picked based
+    on how many pixels the shape covers, so a scene with thousands of tiny
+    far-away spheres uses a small fraction of the triangles.  The viewport
+    size this needs is read from OpenGL only when the view or projection
+    matrix changes and at each BeginBatch().  Use
+    set_adaptive_tessellation(false) to always draw the finest level.
  */
 class QuickShapes {
 public:
@@ -204,6 +227,58 @@ public:
     void DrawFullscreenTexture(const Color &color, const Texture2D &texture);
     
     
+    // -------- BATCH MODE --------
+    
+    /** Starts recording shapes rather than drawing them right away.  Until
+        EndBatch() is called, cubes, cylinders, cones, spheres, brushes,
+        untextured squares, and the composite shapes built from them (line
+        segments, lines, arrows, and axes) are saved and then drawn together,
+        one instanced draw call per type of shape.  Textured squares and
+        fullscreen textures are still drawn immediately.  Since shapes are
+        drawn grouped by type, the drawing order changes, so batching is
+        intended for opaque shapes drawn with the depth test on.
+     */
+    void BeginBatch();
+    
+    /** Draws all of the shapes recorded since BeginBatch() and returns to
+        drawing each shape immediately.
+     */
+    void EndBatch();
+    
+    /** Draws all of the shapes recorded so far but stays in batch mode.  This
+        happens automatically if the view or projection matrix changes partway
+        through a batch.
+     */
+    void FlushBatch();
+    
+    /** True between calls to BeginBatch() and EndBatch().
+     */
+    bool batching() const;
+    
+    
+    // -------- ADAPTIVE TESSELLATION --------
+    
+    /** Turns on (the default) or off choosing the tessellation level for
+        spheres, cylinders, and cones based on their size on screen.  When off,
+        the finest level is always used.
+     */
+    void set_adaptive_tessellation(bool on);
+    
+    /** True if the tessellation level is chosen based on the size on screen.
+     */
+    bool adaptive_tessellation() const;
+    
+    /** Sets how far, in pixels, the silhouette of a tessellated shape may be
+        from the true round shape when choosing a tessellation level.  Smaller
+        values use more triangles.  The default is 0.5.
+     */
+    void set_tessellation_tolerance(float pixels);
+    
+    /** The tolerance, in pixels, used to choose a tessellation level.
+     */
+    float tessellation_tolerance() const;
+    
+    
     /** Returns a pointer to the default shader used internally by the Draw class
         so that you may change the default lighting properties if you wish. 
      */
@@ -220,6 +295,48 @@ private:
         
     void DrawWithFullscreen(const Color &color, Mesh *mesh, const Texture2D &tex);
     
+    // Shapes recorded in batch mode, one list per type of shape
+    enum BatchShape {
+        BATCH_CUBE, BATCH_SQUARE, BATCH_CYL, BATCH_CONE, BATCH_SPH, BATCH_BRUSH, NUM_BATCH_SHAPES
+    };
+    
+    static const int NUM_TESS_LEVELS = 4;
+    
+    class ShapeBatch {
+    public:
+        // a copy of the shape's mesh that holds the instance data so that the
+        // regular, non-instanced mesh stays untouched
+        Mesh mesh;
+        // 16 floats per transform, 4 per color, ready to pass to the mesh
+        std::vector<float> xforms;
+        std::vector<float> colors;
+    };
+    
+    void AddToBatch(BatchShape shape, int level, const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
+                    const Matrix4 &projectionMatrix, const Color &color);
+    Mesh* shape_mesh(BatchShape shape, int level);
+    
+    bool batching_;
+    int batch_size_;
+    Matrix4 batchView_;
+    Matrix4 batchProj_;
+    // batched shapes are also grouped by tessellation level, shapes that are
+    // not tessellated only use level 0
+    ShapeBatch batches_[NUM_BATCH_SHAPES][NUM_TESS_LEVELS];
+    
+    // Level 0 is the finest tessellation
+    int TessellationLevel(BatchShape shape, const Matrix4 &modelMatrix, const Matrix4 &viewMatrix,
+                          const Matrix4 &projectionMatrix);
+    
+    bool adaptive_;
+    float tessTolerance_;
+    // the viewport height and the camera it was read for, since asking OpenGL
+    // for it may stall
+    float viewportHeight_;
+    bool viewportKnown_;
+    Matrix4 viewportView_;
+    Matrix4 viewportProj_;
+    
     Mesh cubeMesh_;
 	void initCube();
 
@@ -229,14 +346,14 @@ private:
     Mesh fullMesh_;
     void initFull();
     
-    Mesh cylMesh_;
-    void initCyl();
+    Mesh cylMeshes_[NUM_TESS_LEVELS];
+    void initCyl(int level);
     
-    Mesh coneMesh_;
-    void initCone();
+    Mesh coneMeshes_[NUM_TESS_LEVELS];
+    void initCone(int level);
 
-    Mesh sphereMesh_;
-    void initSph();
+    Mesh sphereMeshes_[NUM_TESS_LEVELS];
+    void initSph(int level);
     
     Mesh brushMesh_;
     void initBrush();
@@ -215,7 +215,8 @@ namespace mingfx {
         for (int i=0; i<mesh.num_triangles(); i++) {
             Point3 p;
             float t;
-            std::vector<unsigned int> indices = mesh.read_triangle_indices_data(i);
+            unsigned int indices[3];
+            mesh.read_triangle_indices_data(i, indices);
             if (IntersectTriangle(mesh.read_vertex_data(indices[0]), mesh.read_vertex_data(indices[1]), mesh.read_vertex_data(indices[2]), &t, &p)) {
                 if ((*iTime < 0.0) || (t < *iTime)) {
                     *iPoint = p;
@@ -236,7 +237,8 @@ namespace mingfx {
             for (int i=0; i<tri_ids.size(); i++) {
                 Point3 p;
                 float t;
-                std::vector<unsigned int> indices = mesh->read_triangle_indices_data(tri_ids[i]);
+                unsigned int indices[3];
+                mesh->read_triangle_indices_data(tri_ids[i], indices);
                 if (IntersectTriangle(mesh->read_vertex_data(indices[0]), mesh->read_vertex_data(indices[1]), mesh->read_vertex_data(indices[2]), &t, &p)) {
                     if ((*iTime < 0.0) || (t < *iTime)) {
                         *iPoint = p;
@@ -6,6 +6,7 @@
 
 #include "shader_program.h"
 
+#include "gl_state.h"
 #include "opengl_headers.h"
 
 #include <vector>
@@ -169,6 +170,7 @@ bool ShaderProgram::LinkProgram() {
         glGetProgramInfoLog(program_, maxLength, &maxLength, &infoLog[0]);
         
         // We don't need the program anymore.
+        GLState::ForgetProgram(program_);
         glDeleteProgram(program_);
         // Don't leak shaders either.
         glDeleteShader(vertexShader_);
@@ -192,12 +194,12 @@ void ShaderProgram::UseProgram() {
         std::cerr << "ShaderProgram: Warning cannot UseProgram() until it shaders have been added and linked.  Calling LinkProgram() for you now." << std::endl;
         LinkProgram();
     }
-    glUseProgram(program_);
+    GLState::UseProgram(program_);
 }
 
     
 void ShaderProgram::StopProgram() {
-    glUseProgram(0);
+    GLState::ReleaseProgram();
 }
     
     
@@ -259,6 +261,21 @@ void ShaderProgram::SetUniform(const std::string &name, float f) {
 }
 
 
+// uniform locations
+GLint ShaderProgram::GetUniformLocation(const std::string &name) {
+    return glGetUniformLocation(program_, name.c_str());
+}
+
+void ShaderProgram::SetUniform(GLint location, const Matrix4 &m) {
+    UseProgram();
+    glUniformMatrix4fv(location, 1, GL_FALSE, m.value_ptr());
+}
+
+void ShaderProgram::SetUniform(GLint location, int i) {
+    UseProgram();
+    glUniform1i(location, i);
+}
+
 
 // built-in types - arrays
 void ShaderProgram::SetUniformArray1(const std::string &name, int *i, int count) {
@@ -338,6 +355,17 @@ void ShaderProgram::SetUniformArray4(const std::string &name, float *f, int coun
 
 
 
+void ShaderProgram::BindUniformBlock(const std::string &name, GLuint binding_point) {
+    GLuint index = glGetUniformBlockIndex(program_, name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        std::cerr << "ShaderProgram: Warning, uniform block " << name << " is not used by the program." << std::endl;
+        return;
+    }
+    glUniformBlockBinding(program_, index, binding_point);
+}
+
+
+
 void ShaderProgram::BindTexture(const std::string &name, const Texture2D &tex) {
     UseProgram();
 
@@ -365,8 +393,7 @@ void ShaderProgram::BindTexture(const std::string &name, const Texture2D &tex) {
     GLint loc = glGetUniformLocation(program_, name.c_str());
     glUniform1i(loc, texUnit);
     // bind the opengl texture handle to the same texture unit
-    glActiveTexture(GL_TEXTURE0 + texUnit);
-    glBindTexture(GL_TEXTURE_2D, tex.opengl_id());
+    GLState::BindTexture(texUnit, GL_TEXTURE_2D, tex.opengl_id());
 }
 
 void ShaderProgram::BindTexture(const std::string &name, const Texture2D &tex, int texUnit) {
@@ -378,10 +405,20 @@ void ShaderProgram::BindTexture(const std::string &name, const Texture2D &tex, i
     GLint loc = glGetUniformLocation(program_, name.c_str());
     glUniform1i(loc, texUnit);
     // bind the opengl texture handle to the same texture unit
-    glActiveTexture(GL_TEXTURE0 + texUnit);
-    glBindTexture(GL_TEXTURE_2D, tex.opengl_id());
+    GLState::BindTexture(texUnit, GL_TEXTURE_2D, tex.opengl_id());
 }
 
+void ShaderProgram::BindTextureBuffer(const std::string &name, GLuint texture_id, int texUnit) {
+    UseProgram();
+
+    texBindings_[name] = texUnit;
+
+    // associate the named shader program sampler variable with the selected texture unit
+    GLint loc = glGetUniformLocation(program_, name.c_str());
+    glUniform1i(loc, texUnit);
+    // bind the opengl buffer texture to the same texture unit
+    GLState::BindTexture(texUnit, GL_TEXTURE_BUFFER, texture_id);
+}
 
     
 } // end namespace
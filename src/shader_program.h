@@ -153,6 +153,21 @@ public:
     void SetUniform(const std::string &name, float f);
 
     
+    // Uniform locations
+    
+    /// Returns the location of the uniform variable named name, or -1 if the
+    /// program has no such variable.  Looking up a name takes time, so for
+    /// uniforms that are set on every draw, call this once after LinkProgram()
+    /// and pass the location to the versions of SetUniform() below.
+    GLint GetUniformLocation(const std::string &name);
+    
+    /// Same as SetUniform(name, m) for the uniform at location.
+    void SetUniform(GLint location, const Matrix4 &m);
+    
+    /// Same as SetUniform(name, i) for the uniform at location.
+    void SetUniform(GLint location, int i);
+
+    
     // built-in types (arrays)
     
     /// Passes an array of count ints to the shader program and stores the result
@@ -207,6 +222,16 @@ public:
     void SetUniformArray4(const std::string &name, float *f, int count);
 
     
+    // Uniform Blocks
+    
+    /// Associates a uniform block declared in the shader, e.g.,
+    /// layout(std140) uniform MyBlock { ... }, with a uniform buffer binding
+    /// point.  The data for the block are then read from whichever buffer is
+    /// bound to that point with glBindBufferBase(GL_UNIFORM_BUFFER, ...).  Call
+    /// once after LinkProgram().
+    void BindUniformBlock(const std::string &name, GLuint binding_point);
+    
+    
     // Set Textures (Sampler Variables in the Shader)
     
     /// Binds a Texture2D to a sampler2D in the shader program.
@@ -218,8 +243,16 @@ public:
     /// This version allows you to specify the texture unit to use.
     void BindTexture(const std::string &name, const Texture2D &tex, int texUnit);
     
+    /// Binds a buffer texture (created with glTexBuffer()) to a samplerBuffer,
+    /// isamplerBuffer, or usamplerBuffer in the shader program using the
+    /// specified texture unit.  Buffer textures are a convenient way to pass
+    /// large arrays of data to a shader, much larger than fit in uniforms.
+    void BindTextureBuffer(const std::string &name, GLuint texture_id, int texUnit);
+    
     
-    /// Call this after rendering geometry to deactivate the shader.
+    /// Call this after rendering geometry to deactivate the shader.  With
+    /// GLState::set_keep_bound(true), the program is instead left bound until
+    /// another one is used.
     void StopProgram();
 
     /// Returns true if the shader program has been successfully compiled and linked.
@@ -19,22 +19,78 @@ in vec3 N;
 in vec3 v;
 in vec2 uv;
 in vec4 col_interp;
+in vec4 instance_col;
 
 out vec4 fragColor;
 
-uniform int NumLights;
-uniform vec3 LightPositions[MAX_LIGHTS];
-uniform vec4 LightIntensitiesAmbient[MAX_LIGHTS];
-uniform vec4 LightIntensitiesDiffuse[MAX_LIGHTS];
-uniform vec4 LightIntensitiesSpecular[MAX_LIGHTS];
+// Per-frame data, shared by every draw that uses the same view, projection, and
+// lights.  This must match the declaration in default.vert and
+// DefaultShader::PerFrameBlock.  Light positions are already in eye space, and
+// the w coordinate holds the light's range (0 for no falloff).
+layout(std140) uniform PerFrameData {
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    vec4 LightPositions[MAX_LIGHTS];
+    vec4 LightIntensitiesAmbient[MAX_LIGHTS];
+    vec4 LightIntensitiesDiffuse[MAX_LIGHTS];
+    vec4 LightIntensitiesSpecular[MAX_LIGHTS];
+    int NumLights;
+    int UseClusteredLights;
+    vec4 ClusterGrid;     // tiles in x, tiles in y, depth slices, unused
+    vec4 ClusterDepth;    // near, far, slices / log(far / near), unused
+    vec4 Viewport;        // x, y, width, height in pixels
+};
 
-uniform vec4 MatReflectanceAmbient;
-uniform vec4 MatReflectanceDiffuse;
-uniform vec4 MatReflectanceSpecular;
-uniform float MatReflectanceShininess;
+// Per-material data, only re-uploaded when the material changes.  This must
+// match DefaultShader::MaterialBlock.
+layout(std140) uniform MaterialData {
+    vec4 MatReflectanceAmbient;
+    vec4 MatReflectanceDiffuse;
+    vec4 MatReflectanceSpecular;
+    float MatReflectanceShininess;
+    int UseSurfaceTexture;
+    int UseSurfaceTextureArray;
+    int SurfaceTextureLayer;
+    vec4 SurfaceTextureRect;  // u min, v min, u size, v size within the layer
+};
 
-uniform int UseSurfaceTexture;
 uniform sampler2D SurfaceTexture;
+uniform sampler2DArray SurfaceTextureArray;
+
+// Clustered lighting, used when there are more than MAX_LIGHTS lights.  4 texels
+// per light: eye space position + range, ambient, diffuse, specular intensity.
+uniform samplerBuffer LightData;
+// Per-cluster offset into LightIndexList and number of lights in the cluster
+uniform usamplerBuffer LightClusters;
+uniform usamplerBuffer LightIndexList;
+
+
+// Smooth falloff that reaches zero at the light's range
+float Attenuation(float range, float d) {
+    if (range <= 0.0) {
+        return 1.0;
+    }
+    float x = clamp(1.0 - (d*d) / (range*range), 0.0, 1.0);
+    return x*x;
+}
+
+void AddLight(vec3 light_pos, float range, vec3 ambient, vec3 diffuse, vec3 specular,
+              vec3 n, inout vec3 Ia, inout vec3 Id, inout vec3 Is) {
+    vec3 L = normalize(light_pos - v);
+    vec3 V = normalize(-v); // eye is at (0,0,0)
+    vec3 R = normalize(-reflect(L,N));
+    float atten = Attenuation(range, length(light_pos - v));
+
+    // per-instance colors tint the ambient and diffuse reflectance
+    Ia += MatReflectanceAmbient.rgb * instance_col.rgb * ambient * atten;
+
+    if (dot(n,L) > 0.0) {
+        Id += clamp(MatReflectanceDiffuse.rgb * instance_col.rgb * diffuse * max(dot(n, L), 0.0) * atten, 0.0, 1.0);
+
+        Is += MatReflectanceSpecular.rgb * specular * pow(max(dot(R, V), 0.0), MatReflectanceShininess) * atten;
+        Is = clamp(Is, 0.0, 1.0);
+    }
+}
 
 void main() {
 
@@ -46,7 +102,15 @@ void main() {
 
     // if there is a surface texture, then factor this into the base color of this
     // fragment as well
-    if (UseSurfaceTexture != 0) {
+    if (UseSurfaceTextureArray != 0) {
+        // the image may be packed into part of an atlas page, so repeat it
+        // within its rectangle, with derivatives taken before the wrap so
+        // the mipmap level does not jump at the seams
+        vec2 st = SurfaceTextureRect.xy + fract(uv) * SurfaceTextureRect.zw;
+        fragColor *= textureGrad(SurfaceTextureArray, vec3(st, SurfaceTextureLayer),
+                                 dFdx(uv) * SurfaceTextureRect.zw, dFdy(uv) * SurfaceTextureRect.zw);
+    }
+    else if (UseSurfaceTexture != 0) {
         fragColor *= texture(SurfaceTexture, uv);
     }
 
@@ -57,20 +121,37 @@ void main() {
     
     vec3 n = normalize(N);
     
-    for (int i=0; i<NumLights; i++) {
-        vec3 L = normalize(LightPositions[i] - v);
-        vec3 V = normalize(-v); // eye is at (0,0,0)
-        vec3 R = normalize(-reflect(L,N));
-
-        Ia += MatReflectanceAmbient.rgb * LightIntensitiesAmbient[i].rgb;
-        
-        if (dot(n,L) > 0.0) {
-            Id += clamp(MatReflectanceDiffuse.rgb * LightIntensitiesDiffuse[i].rgb * max(dot(n, L), 0.0), 0.0, 1.0);
-
-            Is += MatReflectanceSpecular.rgb * LightIntensitiesSpecular[i].rgb * pow(max(dot(R, V), 0.0), MatReflectanceShininess);
-            Is = clamp(Is, 0.0, 1.0);
+    if (UseClusteredLights != 0) {
+        // find the cluster this fragment is in, matching ClusteredLights::ClusterIndex()
+        ivec3 grid = ivec3(ClusterGrid.xyz);
+        int x = int(floor((gl_FragCoord.x - Viewport.x) / Viewport.z * ClusterGrid.x));
+        int y = int(floor((gl_FragCoord.y - Viewport.y) / Viewport.w * ClusterGrid.y));
+        int z = int(floor(log(max(-v.z, ClusterDepth.x) / ClusterDepth.x) * ClusterDepth.z));
+        x = clamp(x, 0, grid.x - 1);
+        y = clamp(y, 0, grid.y - 1);
+        z = clamp(z, 0, grid.z - 1);
+        uvec2 cluster = texelFetch(LightClusters, x + grid.x * (y + grid.y * z)).xy;
+
+        for (uint i=0u; i<cluster.y; i++) {
+            int light = int(texelFetch(LightIndexList, int(cluster.x + i)).r);
+            vec4 pos = texelFetch(LightData, 4*light);
+            AddLight(pos.xyz, pos.w,
+                     texelFetch(LightData, 4*light + 1).rgb,
+                     texelFetch(LightData, 4*light + 2).rgb,
+                     texelFetch(LightData, 4*light + 3).rgb,
+                     n, Ia, Id, Is);
+        }
+    }
+    else {
+        for (int i=0; i<NumLights; i++) {
+            AddLight(LightPositions[i].xyz, LightPositions[i].w,
+                     LightIntensitiesAmbient[i].rgb,
+                     LightIntensitiesDiffuse[i].rgb,
+                     LightIntensitiesSpecular[i].rgb,
+                     n, Ia, Id, Is);
         }
     }
     fragColor.rgb *= Ia + Id + Is;
+    fragColor.a *= instance_col.a;
 }
 
@@ -19,21 +19,62 @@ layout(location = 2) in vec4 color;
 layout(location = 3) in vec2 texcoord;
 
 layout(location = 8) in mat4 instance_xform;
+layout(location = 12) in vec4 instance_color;
+layout(location = 14) in uint draw_id;
 
+const int MAX_LIGHTS = 10;
+
+// Per-frame data, shared by every draw that uses the same view, projection, and
+// lights.  Uploaded once per frame by DefaultShader rather than once per draw.
+// This must match the declaration in default.frag and DefaultShader::PerFrameBlock.
+layout(std140) uniform PerFrameData {
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+    vec4 LightPositions[MAX_LIGHTS];
+    vec4 LightIntensitiesAmbient[MAX_LIGHTS];
+    vec4 LightIntensitiesDiffuse[MAX_LIGHTS];
+    vec4 LightIntensitiesSpecular[MAX_LIGHTS];
+    int NumLights;
+    int UseClusteredLights;
+    vec4 ClusterGrid;     // tiles in x, tiles in y, depth slices, unused
+    vec4 ClusterDepth;    // near, far, slices / log(far / near), unused
+    vec4 Viewport;        // x, y, width, height in pixels
+};
+
+// Per-draw data
 uniform mat4 ModelMatrix; 
-uniform mat4 ViewMatrix; 
-uniform mat4 ProjectionMatrix; 
 uniform mat4 NormalMatrix; 
+// Non-zero when drawing instances with their own transforms, in which case the
+// normal matrix must be computed per instance
+uniform int InstancedDraw;
+// Non-zero when drawing a MeshBatch, in which case each vertex's draw_id picks
+// its mesh's transform and color out of BatchTransforms
+uniform int BatchedDraw;
+uniform samplerBuffer BatchTransforms;
 
 out vec3 N; 
 out vec3 v; 
 out vec2 uv; 
 out vec4 col_interp; 
+out vec4 instance_col;
 
 void main() { 
-   v = (ViewMatrix * ModelMatrix * vec4(position, 1)).xyz; 
-   N = normalize((NormalMatrix * vec4(normal, 0)).xyz); 
+   mat4 xform = instance_xform;
+   instance_col = instance_color;
+   if (BatchedDraw != 0) {
+      int texel = 5 * int(draw_id);
+      xform = mat4(texelFetch(BatchTransforms, texel), texelFetch(BatchTransforms, texel + 1),
+                   texelFetch(BatchTransforms, texel + 2), texelFetch(BatchTransforms, texel + 3));
+      instance_col = texelFetch(BatchTransforms, texel + 4);
+   }
+   v = (ViewMatrix * xform * ModelMatrix * vec4(position, 1)).xyz; 
+   if (InstancedDraw != 0) {
+      N = normalize(transpose(inverse(mat3(ViewMatrix * xform * ModelMatrix))) * normal);
+   }
+   else {
+      N = normalize((NormalMatrix * vec4(normal, 0)).xyz); 
+   }
    uv = texcoord.xy; 
-   gl_Position	= ProjectionMatrix * ViewMatrix * instance_xform * ModelMatrix * vec4(position, 1);
+   gl_Position	= ProjectionMatrix * ViewMatrix * xform * ModelMatrix * vec4(position, 1);
    col_interp = color; 
-} 
\ No newline at end of file
+} 
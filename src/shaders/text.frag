@@ -20,6 +20,6 @@ uniform sampler2D font_atlas;
 out vec4 frag_color;
 
 void main() {
-    frag_color = color * texture(font_atlas, uv);
-    //    frag_color.a = frag_color.r;
+    // the atlas has 1 channel, the glyph's coverage of each pixel
+    frag_color = color * texture(font_atlas, uv).r;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #include "text_shader.h"
 
+#include "gl_state.h"
 #include "platform.h"
 #include <fstream>
 
@@ -68,20 +69,12 @@ bool TextShader::Init(const std::string &filename, int font_size) {
         stbtt_PackFontRange(&pc, (unsigned char*)ttf_buffer, 0, (float)font_size, 32, 95, chardata_+32);
         stbtt_PackEnd(&pc);
         
-        // convert to 4-channel since that is all that Texture2D currently supports
-        unsigned char *bitmap4D = new unsigned char[(size_t)4 * atlas_width * atlas_height];
-        for (int i=0; i < atlas_width * atlas_height; i++) {
-            bitmap4D[4*i + 0] = bitmap[i];
-            bitmap4D[4*i + 1] = bitmap[i];
-            bitmap4D[4*i + 2] = bitmap[i];
-            bitmap4D[4*i + 3] = bitmap[i];
-        }
-        
-        atlas_.InitFromBytes(atlas_width, atlas_height, bitmap4D);
+        // the glyph coverage is all that is needed, so 1 byte per pixel
+        atlas_.InitFromBytes(atlas_width, atlas_height, bitmap, 1);
+        atlas_.ReleaseCPUData();
         
         delete [] ttf_buffer;
         delete [] bitmap;
-        delete [] bitmap4D;
      
         return true;
     }
@@ -157,9 +150,9 @@ void TextShader::Draw3D(const Matrix4 &model, const Matrix4 &view, const Matrix4
         offset[1] = -md->min[1];
     }
     
-    glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GLState::Disable(GL_CULL_FACE);
+    GLState::Enable(GL_BLEND);
+    GLState::BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     
     shader_.UseProgram();
     Matrix4 mvp = projection * view * model;
@@ -174,7 +167,7 @@ void TextShader::Draw3D(const Matrix4 &model, const Matrix4 &view, const Matrix4
     md->mesh.Draw();
     shader_.StopProgram();
 
-    glEnable(GL_CULL_FACE);
+    GLState::Enable(GL_CULL_FACE);
 }
     
 
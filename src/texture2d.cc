@@ -5,7 +5,12 @@
  */
 
 #include "texture2d.h"
+#include "gfxmath.h"
+#include "gl_state.h"
+#include "job_system.h"
+#include "memory_stats.h"
 #include "platform.h"
+#include "texture_filters.h"
 
 #pragma warning (push)
 #pragma warning (disable : 6001)
@@ -28,138 +33,756 @@
 
 #pragma warning (pop)
 
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 
 namespace mingfx {
 
-    
-    
+
+namespace {
+
+// formats for 1 to 4 channels, stored with 1 byte per channel
+const GLint INTERNAL_FORMATS[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA };
+const GLenum FORMATS[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+
+// compressed formats, which not every OpenGL header defines
+const GLenum COMPRESSED_RGBA_S3TC_DXT1 = 0x83F1;
+const GLenum COMPRESSED_RGBA_S3TC_DXT3 = 0x83F2;
+const GLenum COMPRESSED_RGBA_S3TC_DXT5 = 0x83F3;
+const GLenum COMPRESSED_SRGB_ALPHA_S3TC_DXT1 = 0x8C4D;
+const GLenum COMPRESSED_SRGB_ALPHA_S3TC_DXT3 = 0x8C4E;
+const GLenum COMPRESSED_SRGB_ALPHA_S3TC_DXT5 = 0x8C4F;
+const GLenum COMPRESSED_RED_RGTC1 = 0x8DBB;
+const GLenum COMPRESSED_SIGNED_RED_RGTC1 = 0x8DBC;
+const GLenum COMPRESSED_RG_RGTC2 = 0x8DBD;
+const GLenum COMPRESSED_SIGNED_RG_RGTC2 = 0x8DBE;
+const GLenum COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C;
+const GLenum COMPRESSED_SRGB_ALPHA_BPTC_UNORM = 0x8E8D;
+const GLenum COMPRESSED_RGB_BPTC_SIGNED_FLOAT = 0x8E8E;
+const GLenum COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT = 0x8E8F;
+
+// anisotropic filtering, an extension until OpenGL 4.6
+const GLenum TEXTURE_MAX_ANISOTROPY = 0x84FE;
+const GLenum MAX_TEXTURE_MAX_ANISOTROPY = 0x84FF;
+
+const float KAISER_RADIUS = 3.0f;
+const float KAISER_ALPHA = 4.0f;
+
+
+// the largest anisotropy the graphics card supports, or 0 for none
+float MaxSupportedAnisotropy() {
+    static float max_supported = -1.0f;
+    if (max_supported < 0.0f) {
+        max_supported = 0.0f;
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for (int i=0; i<num_extensions; i++) {
+            const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if ((name != NULL) && ((strcmp(name, "GL_EXT_texture_filter_anisotropic") == 0) ||
+                                   (strcmp(name, "GL_ARB_texture_filter_anisotropic") == 0))) {
+                glGetFloatv(MAX_TEXTURE_MAX_ANISOTROPY, &max_supported);
+                break;
+            }
+        }
+    }
+    return max_supported;
+}
+
+
+// One source pixel and how much it counts toward a downsampled pixel
+class Tap {
+public:
+    int index;
+    float weight;
+};
+
+float Sinc(float x) {
+    if (fabs(x) < 1e-6f) {
+        return 1.0f;
+    }
+    return sinf(GfxMath::PI * x) / (GfxMath::PI * x);
+}
+
+// modified Bessel function of the first kind, order 0
+float BesselI0(float x) {
+    float sum = 1.0f;
+    float term = 1.0f;
+    for (int k=1; k<30; k++) {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+        if (term < 1e-8f * sum) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// For each pixel along one axis of the downsampled image, the source pixels
+// that go into it.  A box keeps the area of each source pixel that the new
+// pixel covers, which is a plain 2x2 average when the size halves exactly.
+std::vector<std::vector<Tap>> FilterTaps(int src_size, int dst_size, Texture2D::MipmapMethod method, bool wrap) {
+    float scale = (float)src_size / (float)dst_size;
+    float radius = (method == Texture2D::MIPMAPS_KAISER) ? KAISER_RADIUS * scale : 0.5f * scale;
+    std::vector<std::vector<Tap>> taps(dst_size);
+    for (int x=0; x<dst_size; x++) {
+        float center = ((float)x + 0.5f) * scale;
+        int first = (int)floorf(center - radius);
+        int last = (int)ceilf(center + radius);
+        float total = 0.0f;
+        for (int i=first; i<last; i++) {
+            float weight;
+            if (method == Texture2D::MIPMAPS_KAISER) {
+                float d = ((float)i + 0.5f - center) / scale;
+                float t = d / KAISER_RADIUS;
+                if (fabs(t) >= 1.0f) {
+                    continue;
+                }
+                weight = Sinc(d) * BesselI0(KAISER_ALPHA * sqrtf(1.0f - t*t)) / BesselI0(KAISER_ALPHA);
+            }
+            else {
+                weight = std::min((float)i + 1.0f, center + radius) - std::max((float)i, center - radius);
+                if (weight <= 0.0f) {
+                    continue;
+                }
+            }
+            Tap tap;
+            if (wrap) {
+                tap.index = ((i % src_size) + src_size) % src_size;
+            }
+            else {
+                tap.index = std::min(std::max(i, 0), src_size - 1);
+            }
+            tap.weight = weight;
+            taps[x].push_back(tap);
+            total += weight;
+        }
+        for (int t=0; t<taps[x].size(); t++) {
+            taps[x][t].weight /= total;
+        }
+    }
+    return taps;
+}
+
+void StoreFiltered(float value, unsigned char *out) {
+    *out = (unsigned char)std::min(std::max(value + 0.5f, 0.0f), 255.0f);
+}
+
+void StoreFiltered(float value, float *out) {
+    *out = value;
+}
+
+// Makes each mipmap level from the one before it on the CPU, filtering
+// first across and then down, and copies them to the bound texture
+template <class T>
+void UploadCPUMipmaps(const T *data, int width, int height, int channels, GLenum type,
+                      Texture2D::MipmapMethod method, bool wrap)
+{
+    std::vector<T> level;
+    std::vector<T> next;
+    std::vector<float> across;
+    const T *src = data;
+    int level_num = 0;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    while ((width > 1) || (height > 1)) {
+        int new_width = std::max(1, width / 2);
+        int new_height = std::max(1, height / 2);
+        std::vector<std::vector<Tap>> taps_x = FilterTaps(width, new_width, method, wrap);
+        std::vector<std::vector<Tap>> taps_y = FilterTaps(height, new_height, method, wrap);
+
+        across.assign((size_t)new_width * height * channels, 0.0f);
+        for (int y=0; y<height; y++) {
+            for (int x=0; x<new_width; x++) {
+                float *out = &across[((size_t)y * new_width + x) * channels];
+                for (int t=0; t<taps_x[x].size(); t++) {
+                    const T *in = &src[((size_t)y * width + taps_x[x][t].index) * channels];
+                    for (int c=0; c<channels; c++) {
+                        out[c] += taps_x[x][t].weight * (float)in[c];
+                    }
+                }
+            }
+        }
+
+        next.resize((size_t)new_width * new_height * channels);
+        for (int y=0; y<new_height; y++) {
+            for (int x=0; x<new_width; x++) {
+                for (int c=0; c<channels; c++) {
+                    float sum = 0.0f;
+                    for (int t=0; t<taps_y[y].size(); t++) {
+                        sum += taps_y[y][t].weight * across[((size_t)taps_y[y][t].index * new_width + x) * channels + c];
+                    }
+                    StoreFiltered(sum, &next[((size_t)y * new_width + x) * channels + c]);
+                }
+            }
+        }
+
+        level.swap(next);
+        src = &level[0];
+        width = new_width;
+        height = new_height;
+        level_num++;
+        glTexImage2D(GL_TEXTURE_2D, level_num, INTERNAL_FORMATS[channels-1], width, height, 0,
+                     FORMATS[channels-1], type, src);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+
+unsigned int ReadUInt32(const unsigned char *p) {
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+unsigned int FourCC(const char *code) {
+    return ReadUInt32((const unsigned char*)code);
+}
+
+// Finds the OpenGL format and the size of each 4x4 block for a DDS file's
+// DXGI format, returning false for formats that are not supported
+bool DXGIFormat(unsigned int dxgi, GLenum *format, int *block_bytes) {
+    *block_bytes = 16;
+    switch (dxgi) {
+        case 70: case 71: *format = COMPRESSED_RGBA_S3TC_DXT1; *block_bytes = 8; return true;
+        case 72: *format = COMPRESSED_SRGB_ALPHA_S3TC_DXT1; *block_bytes = 8; return true;
+        case 73: case 74: *format = COMPRESSED_RGBA_S3TC_DXT3; return true;
+        case 75: *format = COMPRESSED_SRGB_ALPHA_S3TC_DXT3; return true;
+        case 76: case 77: *format = COMPRESSED_RGBA_S3TC_DXT5; return true;
+        case 78: *format = COMPRESSED_SRGB_ALPHA_S3TC_DXT5; return true;
+        case 79: case 80: *format = COMPRESSED_RED_RGTC1; *block_bytes = 8; return true;
+        case 81: *format = COMPRESSED_SIGNED_RED_RGTC1; *block_bytes = 8; return true;
+        case 82: case 83: *format = COMPRESSED_RG_RGTC2; return true;
+        case 84: *format = COMPRESSED_SIGNED_RG_RGTC2; return true;
+        case 94: case 95: *format = COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; return true;
+        case 96: *format = COMPRESSED_RGB_BPTC_SIGNED_FLOAT; return true;
+        case 97: case 98: *format = COMPRESSED_RGBA_BPTC_UNORM; return true;
+        case 99: *format = COMPRESSED_SRGB_ALPHA_BPTC_UNORM; return true;
+        default: return false;
+    }
+}
+
+// The same for the older DDS files that give the format as a four letter code
+bool FourCCFormat(unsigned int four_cc, GLenum *format, int *block_bytes) {
+    *block_bytes = 16;
+    if (four_cc == FourCC("DXT1")) {
+        *format = COMPRESSED_RGBA_S3TC_DXT1;
+        *block_bytes = 8;
+    }
+    else if ((four_cc == FourCC("DXT2")) || (four_cc == FourCC("DXT3"))) {
+        *format = COMPRESSED_RGBA_S3TC_DXT3;
+    }
+    else if ((four_cc == FourCC("DXT4")) || (four_cc == FourCC("DXT5"))) {
+        *format = COMPRESSED_RGBA_S3TC_DXT5;
+    }
+    else if ((four_cc == FourCC("ATI1")) || (four_cc == FourCC("BC4U"))) {
+        *format = COMPRESSED_RED_RGTC1;
+        *block_bytes = 8;
+    }
+    else if ((four_cc == FourCC("ATI2")) || (four_cc == FourCC("BC5U"))) {
+        *format = COMPRESSED_RG_RGTC2;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+} // end namespace
+
+
+
 Texture2D::Texture2D(GLenum wrapMode, GLenum filterMode) :
     dataType_(GL_UNSIGNED_BYTE), data_ubyte_(NULL), data_float_(NULL),
-    width_(0), height_(0), handleMemInternally_(true), texID_(0),
-    wrapMode_(wrapMode), filterMode_(filterMode)
+    width_(0), height_(0), numChannels_(4), compressedFormat_(0), texID_(0),
+    wrapMode_(wrapMode), filterMode_(filterMode), numLevels_(0), mipmapMethod_(MIPMAPS_GPU),
+    maxAnisotropy_(1.0f), gpuBytes_(0)
+{
+    MemoryStats::Register(this);
+}
+
+Texture2D::Texture2D(const Texture2D &other) :
+    dataType_(other.dataType_), data_ubyte_(other.data_ubyte_), data_float_(other.data_float_),
+    file_data_(other.file_data_), width_(other.width_), height_(other.height_),
+    numChannels_(other.numChannels_), compressedFormat_(other.compressedFormat_),
+    compressedLevels_(other.compressedLevels_), texture_(other.texture_), texID_(other.texID_),
+    wrapMode_(other.wrapMode_), filterMode_(other.filterMode_), numLevels_(other.numLevels_),
+    mipmapMethod_(other.mipmapMethod_), maxAnisotropy_(other.maxAnisotropy_), gpuBytes_(other.gpuBytes_)
+{
+    MemoryStats::Register(this);
+}
+
+Texture2D::Texture2D(Texture2D &&other) :
+    dataType_(GL_UNSIGNED_BYTE), data_ubyte_(NULL), data_float_(NULL),
+    width_(0), height_(0), numChannels_(4), compressedFormat_(0), texID_(0),
+    wrapMode_(other.wrapMode_), filterMode_(other.filterMode_), numLevels_(0), mipmapMethod_(MIPMAPS_GPU),
+    maxAnisotropy_(1.0f), gpuBytes_(0)
 {
+    MemoryStats::Register(this);
+    *this = std::move(other);
 }
 
 Texture2D::~Texture2D() {
-    
-    // Mem handled internally is always of type data_ubyte_ because that is
-    // what the stbi image loading library returns
-    if ((handleMemInternally_) && (data_ubyte_ != NULL)) {
-        // BUG, TODO: Not sure why the call below does not seem to work.
-        // There will be a mem leak unless we can call this somehow.
-        //stbi_image_free(data_);
-    }
-
-    // This is how to delete GL's version of the texture on the GPU
-    // but you have to be very careful with this.  For example, if we cause
-    // C++ to make a tmp copy of the Texture2D or we do an assignment tex1=tex2
-    // we now have two Texture2D objects pointing to the same OpenGL texture id.
-    // If one of them is deleted before the other, then the other will not be
-    // able to draw itself because the OpenGL tex id will be invalid.  For now,
-    // this is "addressed" by simply skipping the glDeleteTextures call.  This
-    // leads to some wasted OpenGL memory, and that would be a good thing to
-    // fix in the future, maybe via a shared_ptr or static refcount that maps
-    // opengl texids to a count of Texture2D objects that reference them.  Then,
-    // only delete the opengl tex if the refcount would go to 0.
-    //glDeleteTextures(1, &texID_);
-}
-
-    
+    // the image data and OpenGL texture are freed by the shared_ptrs once no
+    // other copies are using them
+    MemoryStats::Unregister(this);
+}
+
+Texture2D& Texture2D::operator=(const Texture2D &other) {
+    dataType_ = other.dataType_;
+    data_ubyte_ = other.data_ubyte_;
+    data_float_ = other.data_float_;
+    file_data_ = other.file_data_;
+    width_ = other.width_;
+    height_ = other.height_;
+    numChannels_ = other.numChannels_;
+    compressedFormat_ = other.compressedFormat_;
+    compressedLevels_ = other.compressedLevels_;
+    texture_ = other.texture_;
+    texID_ = other.texID_;
+    wrapMode_ = other.wrapMode_;
+    filterMode_ = other.filterMode_;
+    numLevels_ = other.numLevels_;
+    mipmapMethod_ = other.mipmapMethod_;
+    maxAnisotropy_ = other.maxAnisotropy_;
+    gpuBytes_ = other.gpuBytes_;
+    return *this;
+}
+
+Texture2D& Texture2D::operator=(Texture2D &&other) {
+    if (this != &other) {
+        *this = other;
+        other.data_ubyte_ = NULL;
+        other.data_float_ = NULL;
+        other.file_data_.reset();
+        other.width_ = 0;
+        other.height_ = 0;
+        other.compressedFormat_ = 0;
+        other.compressedLevels_.clear();
+        other.texture_.reset();
+        other.texID_ = 0;
+        other.numLevels_ = 0;
+        other.gpuBytes_ = 0;
+    }
+    return *this;
+}
+
+
+Texture2D::GLTexture::GLTexture() : id(0) {
+    glGenTextures(1, &id);
+}
+
+Texture2D::GLTexture::~GLTexture() {
+    GLState::ForgetTexture(id);
+    glDeleteTextures(1, &id);
+}
+
+
 bool Texture2D::InitFromFile(const std::string &filename) {
-    handleMemInternally_ = true;
-    dataType_ = GL_UNSIGNED_BYTE;
+    if (!LoadFile(filename)) {
+        return false;
+    }
+    return InitOpenGL();
+}
 
+bool Texture2D::InitFromFiles(const std::vector<Texture2D*> &textures,
+                              const std::vector<std::string> &filenames, JobSystem *job_system)
+{
+    int n = (int)std::min(textures.size(), filenames.size());
+    std::vector<char> loaded(n);
+    ParallelFor(job_system, n, 1, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            loaded[i] = textures[i]->LoadFile(filenames[i]);
+        }
+    });
 
-    std::cout << "Loading texture from file: " << filename << std::endl;
+    // OpenGL calls must come from the thread with the context
+    bool all_loaded = (textures.size() == filenames.size());
+    for (int i=0; i<n; i++) {
+        all_loaded = loaded[i] && textures[i]->InitOpenGL() && all_loaded;
+    }
+    return all_loaded;
+}
 
-    if (Platform::FileExists(filename)) {
+std::shared_ptr<const unsigned char> Texture2D::DecodeFile(const std::string &filename, int *width, int *height) {
+    // these stbi settings are global, so they are set once, before the first
+    // file is decoded, rather than by each of the jobs that may be decoding
+    static const bool stbi_settings = [] {
         stbi_set_unpremultiply_on_load(1);
         stbi_convert_iphone_png_to_rgb(1);
-        int numChannels;
-        data_ubyte_ = stbi_load(filename.c_str(), &width_, &height_, &numChannels, 4);
-        if (data_ubyte_ == NULL) {
-            std::cerr << "Texture2D: Failed to load file " << filename << " - " << stbi_failure_reason() << std::endl;
+        return true;
+    }();
+    (void)stbi_settings;
+
+    // one string per line, so lines from different threads do not mix
+    std::cout << ("Loading texture from file: " + filename + "\n") << std::flush;
+    if (!Platform::FileExists(filename)) {
+        std::cerr << ("Texture2D: File " + filename + " does not exist.\n") << std::flush;
+        return nullptr;
+    }
+    int num_channels;
+    unsigned char *data = stbi_load(filename.c_str(), width, height, &num_channels, 4);
+    if (data == NULL) {
+        std::cerr << ("Texture2D: Failed to load file " + filename + " - " + stbi_failure_reason() + "\n") << std::flush;
+        return nullptr;
+    }
+    return std::shared_ptr<const unsigned char>(data, [](const unsigned char *p) { stbi_image_free((void*)p); });
+}
+
+bool Texture2D::LoadFile(const std::string &filename) {
+    dataType_ = GL_UNSIGNED_BYTE;
+    numChannels_ = 4;
+    compressedFormat_ = 0;
+    compressedLevels_.clear();
+
+    std::string extension = filename.substr(std::min(filename.find_last_of('.'), filename.size()));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if ((extension == ".ktx") || (extension == ".dds")) {
+        return LoadCompressedFile(filename);
+    }
+
+    data_float_ = NULL;
+    file_data_ = DecodeFile(filename, &width_, &height_);
+    data_ubyte_ = file_data_.get();
+    return file_data_ != nullptr;
+}
+
+bool Texture2D::LoadCompressedFile(const std::string &filename) {
+    data_ubyte_ = NULL;
+    data_float_ = NULL;
+    file_data_.reset();
+
+    std::cout << ("Loading texture from file: " + filename + "\n") << std::flush;
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Texture2D: File " << filename << " does not exist." << std::endl;
+        return false;
+    }
+    size_t size = (size_t)file.tellg();
+    std::shared_ptr<unsigned char> bytes(new unsigned char[std::max(size, (size_t)1)],
+                                         std::default_delete<unsigned char[]>());
+    file.seekg(0, std::ios::beg);
+    file.read((char*)bytes.get(), size);
+    if (!file) {
+        std::cerr << "Texture2D: Could not read file " << filename << std::endl;
+        return false;
+    }
+    const unsigned char *p = bytes.get();
+
+    static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+    bool ktx = false;
+    int num_levels = 0;
+    size_t offset = 0;
+    int block_bytes = 0;
+    if ((size >= 128) && (memcmp(p, "DDS ", 4) == 0)) {
+        height_ = (int)ReadUInt32(p + 12);
+        width_ = (int)ReadUInt32(p + 16);
+        num_levels = std::max((int)ReadUInt32(p + 28), 1);
+        unsigned int pixel_flags = ReadUInt32(p + 80);
+        unsigned int four_cc = ReadUInt32(p + 84);
+        unsigned int caps2 = ReadUInt32(p + 112);
+        offset = 128;
+        // 0x4 means the format is given by four_cc, 0x200 is a cube map,
+        // and 0x200000 is a volume texture
+        bool supported = ((pixel_flags & 0x4) != 0) && ((caps2 & 0x200200) == 0);
+        if (supported && (four_cc == FourCC("DX10"))) {
+            // an extra header follows, where 3 is a 2D texture
+            supported = (size >= 148) && DXGIFormat(ReadUInt32(p + 128), &compressedFormat_, &block_bytes) &&
+                        (ReadUInt32(p + 132) == 3) && (ReadUInt32(p + 140) <= 1);
+            offset = 148;
+        }
+        else if (supported) {
+            supported = FourCCFormat(four_cc, &compressedFormat_, &block_bytes);
+        }
+        if (!supported) {
+            std::cerr << "Texture2D: " << filename << " is not a compressed 2D texture in a supported format (BC1-BC7)." << std::endl;
+            compressedFormat_ = 0;
+            return false;
+        }
+    }
+    else if ((size >= 64) && (memcmp(p, KTX_IDENTIFIER, 12) == 0)) {
+        ktx = true;
+        if (ReadUInt32(p + 12) != 0x04030201) {
+            std::cerr << "Texture2D: " << filename << " has the opposite byte order, which is not supported." << std::endl;
+            return false;
+        }
+        // a gl_type of 0 means the data are compressed
+        unsigned int gl_type = ReadUInt32(p + 16);
+        compressedFormat_ = ReadUInt32(p + 28);
+        width_ = (int)ReadUInt32(p + 36);
+        height_ = (int)ReadUInt32(p + 40);
+        unsigned int depth = ReadUInt32(p + 44);
+        unsigned int array_elements = ReadUInt32(p + 48);
+        unsigned int faces = ReadUInt32(p + 52);
+        num_levels = std::max((int)ReadUInt32(p + 56), 1);
+        offset = 64 + (size_t)ReadUInt32(p + 60);
+        if ((gl_type != 0) || (height_ == 0) || (depth > 1) || (array_elements > 0) || (faces != 1)) {
+            std::cerr << "Texture2D: " << filename << " is not a compressed 2D texture; use KTX only for compressed formats." << std::endl;
+            compressedFormat_ = 0;
             return false;
         }
     }
     else {
-        std::cerr << "Texture2D: File " << filename << " does not exist." << std::endl;
+        std::cerr << "Texture2D: " << filename << " is not a KTX (version 1) or DDS file." << std::endl;
         return false;
     }
-    
-    return InitOpenGL();
+
+    int w = width_;
+    int h = height_;
+    for (int l=0; l<num_levels; l++) {
+        CompressedLevel level;
+        level.width = w;
+        level.height = h;
+        if (ktx) {
+            // each level starts with its size and is padded to 4 bytes
+            if (offset + 4 > size) {
+                break;
+            }
+            level.bytes = ReadUInt32(p + offset);
+            offset += 4;
+        }
+        else {
+            level.bytes = (size_t)std::max(1, (w + 3) / 4) * std::max(1, (h + 3) / 4) * block_bytes;
+        }
+        level.offset = offset;
+        if (offset + level.bytes > size) {
+            break;
+        }
+        compressedLevels_.push_back(level);
+        offset += ktx ? ((level.bytes + 3) & ~(size_t)3) : level.bytes;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    if (compressedLevels_.size() < num_levels) {
+        std::cerr << "Texture2D: " << filename << " is shorter than its header says." << std::endl;
+        compressedFormat_ = 0;
+        compressedLevels_.clear();
+        return false;
+    }
+    file_data_ = bytes;
+    return true;
 }
 
-bool Texture2D::InitFromBytes(int width, int height, const unsigned char * data) {
-    handleMemInternally_ = false;
+bool Texture2D::InitFromBytes(int width, int height, const unsigned char * data, int num_channels) {
+    file_data_.reset();
+    data_float_ = NULL;
     width_ = width;
     height_ = height;
     data_ubyte_ = data;
     dataType_ = GL_UNSIGNED_BYTE;
-    
+    numChannels_ = num_channels;
+    compressedFormat_ = 0;
+    compressedLevels_.clear();
+
     return InitOpenGL();
 }
 
-bool Texture2D::InitFromFloats(int width, int height, const float * data) {
-    handleMemInternally_ = false;
+bool Texture2D::InitFromSharedBytes(int width, int height, const std::shared_ptr<const unsigned char> &data,
+                                    bool upload)
+{
+    file_data_ = data;
+    data_float_ = NULL;
+    width_ = width;
+    height_ = height;
+    data_ubyte_ = upload ? data.get() : NULL;
+    dataType_ = GL_UNSIGNED_BYTE;
+    numChannels_ = 4;
+    compressedFormat_ = 0;
+    compressedLevels_.clear();
+
+    bool ok = InitOpenGL();
+    data_ubyte_ = data.get();
+    return ok;
+}
+
+bool Texture2D::InitFromFloats(int width, int height, const float * data, int num_channels) {
+    file_data_.reset();
+    data_ubyte_ = NULL;
     width_ = width;
     height_ = height;
     data_float_ = data;
     dataType_ = GL_FLOAT;
-    
+    numChannels_ = num_channels;
+    compressedFormat_ = 0;
+    compressedLevels_.clear();
+
     return InitOpenGL();
 }
-    
+
 bool Texture2D::InitOpenGL() {
-    glGenTextures(1, &texID_);
-    glBindTexture(GL_TEXTURE_2D, texID_);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode_);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode_);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterMode_);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterMode_);
-    
-    if (dataType_ == GL_UNSIGNED_BYTE) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width_, height_, 0, GL_RGBA, dataType_, data_ubyte_);
+    if (compressedFormat_ != 0) {
+        return InitOpenGLCompressed();
     }
-    else if (dataType_ == GL_FLOAT) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width_, height_, 0, GL_RGBA, dataType_, data_float_);
+    if ((numChannels_ < 1) || (numChannels_ > 4)) {
+        std::cerr << "Texture2D: Unsupported number of channels " << numChannels_ << "." << std::endl;
+        return false;
     }
-    else {
+    if ((dataType_ != GL_UNSIGNED_BYTE) && (dataType_ != GL_FLOAT)) {
         std::cerr << "Texture2D: Unsupported texture data type " << dataType_ << "." << std::endl;
         return false;
     }
 
+    // reuse the texture from a previous init unless a copy is still using it
+    if ((texture_ == nullptr) || (texture_.use_count() > 1)) {
+        texture_ = std::make_shared<GLTexture>();
+    }
+    texID_ = texture_->id;
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode_);
+
+    // rows of 1 to 3 channel data are not padded to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, INTERNAL_FORMATS[numChannels_-1], width_, height_, 0,
+                 FORMATS[numChannels_-1], dataType_, pixel_data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    numLevels_ = 1;
+    gpuBytes_ = (size_t)width_ * height_ * numChannels_;
+
+    // a texture whose pixels are filled in later gets its mipmaps then
+    if (IsMipmapFilter(filterMode_) && (pixel_data() != NULL)) {
+        return GenerateMipmaps(mipmapMethod_);
+    }
+    SetParameters();
     return true;
 }
 
-    
+bool Texture2D::InitOpenGLCompressed() {
+    if ((texture_ == nullptr) || (texture_.use_count() > 1)) {
+        texture_ = std::make_shared<GLTexture>();
+    }
+    texID_ = texture_->id;
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode_);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode_);
+
+    // the only way to find out if the format is supported is to try it
+    while (glGetError() != GL_NO_ERROR) {}
+    gpuBytes_ = 0;
+    for (int l=0; l<compressedLevels_.size(); l++) {
+        const CompressedLevel &level = compressedLevels_[l];
+        glCompressedTexImage2D(GL_TEXTURE_2D, l, compressedFormat_, level.width, level.height, 0,
+                               (GLsizei)level.bytes, file_data_.get() + level.offset);
+        gpuBytes_ += level.bytes;
+    }
+    numLevels_ = (int)compressedLevels_.size();
+    GLenum error = glGetError();
+
+    // the compressed data are not useful on the CPU
+    file_data_.reset();
+    compressedLevels_.clear();
+    if (error != GL_NO_ERROR) {
+        std::cerr << "Texture2D: The graphics card does not support compressed format 0x" << std::hex
+                  << compressedFormat_ << std::dec << "." << std::endl;
+        numLevels_ = 0;
+        gpuBytes_ = 0;
+        texID_ = 0;
+        texture_.reset();
+        return false;
+    }
+    SetParameters();
+    return true;
+}
+
+void Texture2D::SetParameters() {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, BaseFilter(filterMode_));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (numLevels_ > 1) ? MipmapFilter(filterMode_) : BaseFilter(filterMode_));
+    // without this, a texture without the full set of levels is incomplete
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, std::max(numLevels_ - 1, 0));
+    float max_supported = MaxSupportedAnisotropy();
+    if (max_supported > 0.0f) {
+        glTexParameterf(GL_TEXTURE_2D, TEXTURE_MAX_ANISOTROPY, std::min(std::max(maxAnisotropy_, 1.0f), max_supported));
+    }
+}
+
+const void* Texture2D::pixel_data() const {
+    if (dataType_ == GL_FLOAT) {
+        return data_float_;
+    }
+    return data_ubyte_;
+}
+
+
 bool Texture2D::UpdateFromBytes(const unsigned char * data) {
     dataType_ = GL_UNSIGNED_BYTE;
     data_ubyte_ = data;
-    glBindTexture(GL_TEXTURE_2D, texID_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width_, height_, 0, GL_RGBA, dataType_, data_ubyte_);
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, INTERNAL_FORMATS[numChannels_-1], width_, height_, 0, FORMATS[numChannels_-1], dataType_, data_ubyte_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     // presumably glTexSubImage2D is faster, but this crashes on OSX for some reason
     //glActiveTexture(texID_);
     //glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGBA, dataType_, data_ubyte_);
+    if (numLevels_ > 1) {
+        return GenerateMipmaps(mipmapMethod_);
+    }
     return true;
 }
 
 bool Texture2D::UpdateFromFloats(const float * data) {
     dataType_ = GL_FLOAT;
     data_float_ = data;
-    glBindTexture(GL_TEXTURE_2D, texID_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width_, height_, 0, GL_RGBA, dataType_, data_float_);
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, INTERNAL_FORMATS[numChannels_-1], width_, height_, 0, FORMATS[numChannels_-1], dataType_, data_float_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     // presumably glTexSubImage2D is faster, but this crashes on OSX for some reason
     //glActiveTexture(texID_);
     //glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGBA, dataType_, data_ubyte_);
+    if (numLevels_ > 1) {
+        return GenerateMipmaps(mipmapMethod_);
+    }
     return true;
 }
-    
 
-    
+
+bool Texture2D::GenerateMipmaps(MipmapMethod method) {
+    if (!initialized()) {
+        std::cerr << "Texture2D: GenerateMipmaps() called before the texture was initialized." << std::endl;
+        return false;
+    }
+    if (compressed()) {
+        std::cerr << "Texture2D: Compressed textures can only use the mipmaps stored in their files." << std::endl;
+        return false;
+    }
+    if ((method != MIPMAPS_GPU) && (pixel_data() == NULL)) {
+        std::cerr << "Texture2D: Making mipmaps on the CPU needs the image in CPU memory, making them on the GPU instead." << std::endl;
+        method = MIPMAPS_GPU;
+    }
+
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+    int levels = NumMipmapLevels(width_, height_);
+    if (method == MIPMAPS_GPU) {
+        // glGenerateMipmap() only fills in levels up to the max level
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+    else if (dataType_ == GL_FLOAT) {
+        UploadCPUMipmaps(data_float_, width_, height_, numChannels_, GL_FLOAT, method, wrapMode_ == GL_REPEAT);
+    }
+    else {
+        UploadCPUMipmaps(data_ubyte_, width_, height_, numChannels_, GL_UNSIGNED_BYTE, method, wrapMode_ == GL_REPEAT);
+    }
+
+    numLevels_ = levels;
+    mipmapMethod_ = method;
+    gpuBytes_ = 0;
+    int w = width_;
+    int h = height_;
+    for (int l=0; l<levels; l++) {
+        gpuBytes_ += (size_t)w * h * numChannels_;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    SetParameters();
+    return true;
+}
+
+
+
 int Texture2D::width() const {
     return width_;
 }
@@ -168,6 +791,22 @@ int Texture2D::height() const {
     return height_;
 }
 
+int Texture2D::num_channels() const {
+    return numChannels_;
+}
+
+bool Texture2D::compressed() const {
+    return compressedFormat_ != 0;
+}
+
+int Texture2D::num_levels() const {
+    return numLevels_;
+}
+
+bool Texture2D::mipmapped() const {
+    return (numLevels_ > 1) || IsMipmapFilter(filterMode_);
+}
+
 
 GLuint Texture2D::opengl_id() const {
     if (!initialized()) {
@@ -188,45 +827,83 @@ GLenum Texture2D::filter_mode() const {
 
 void Texture2D::set_wrap_mode(GLenum wrapMode) {
     wrapMode_ = wrapMode;
-    glBindTexture(GL_TEXTURE_2D, texID_);
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapMode_);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapMode_);
 }
 
 void Texture2D::set_filter_mode(GLenum filterMode) {
     filterMode_ = filterMode;
-    glBindTexture(GL_TEXTURE_2D, texID_);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterMode_);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterMode_);
+    if (IsMipmapFilter(filterMode_) && (numLevels_ == 1) && !compressed()) {
+        GenerateMipmaps(MIPMAPS_GPU);
+        return;
+    }
+    GLState::BindTexture(GL_TEXTURE_2D, texID_);
+    SetParameters();
+}
+
+void Texture2D::set_max_anisotropy(float max_anisotropy) {
+    maxAnisotropy_ = max_anisotropy;
+    if (initialized()) {
+        GLState::BindTexture(GL_TEXTURE_2D, texID_);
+        SetParameters();
+    }
+}
+
+float Texture2D::max_anisotropy() const {
+    return maxAnisotropy_;
 }
 
 bool Texture2D::initialized() const {
     return texID_ != 0;
 }
 
-    
+
+void Texture2D::ReleaseCPUData() {
+    // copies made before this keep the image until they are done with it
+    file_data_.reset();
+    data_ubyte_ = NULL;
+    data_float_ = NULL;
+}
+
+size_t Texture2D::cpu_bytes() const {
+    if ((file_data_ != nullptr) && !compressed()) {
+        return (size_t)width_ * height_ * numChannels_;
+    }
+    return 0;
+}
+
+size_t Texture2D::gpu_bytes() const {
+    // stored with 1 byte per channel, whether the data were bytes or floats
+    return initialized() ? gpuBytes_ : 0;
+}
+
+
 Color Texture2D::Pixel(int x, int y) const {
-    int index = y*4*width() + x*4;
-    
-    if (dataType_ == GL_UNSIGNED_BYTE) {
-        unsigned char r = data_ubyte_[index+0];
-        unsigned char g = data_ubyte_[index+1];
-        unsigned char b = data_ubyte_[index+2];
-        unsigned char a = data_ubyte_[index+3];
-        return Color((float)r/255.0f, (float)g/255.0f, (float)b/255.0f, (float)a/255.0f);
+    int index = (y*width() + x) * numChannels_;
+
+    if ((data_ubyte_ == NULL) && (data_float_ == NULL)) {
+        std::cerr << "Texture2D: Pixel() called without CPU data, e.g., after ReleaseCPUData()." << std::endl;
+        return Color();
+    }
+    else if (dataType_ == GL_UNSIGNED_BYTE) {
+        float channels[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        for (int c=0; c<numChannels_; c++) {
+            channels[c] = (float)data_ubyte_[index+c] / 255.0f;
+        }
+        return Color(channels);
     }
     else if (dataType_ == GL_FLOAT) {
-        float r = data_float_[index+0];
-        float g = data_float_[index+1];
-        float b = data_float_[index+2];
-        float a = data_float_[index+3];
-        return Color(r, g, b, a);
+        float channels[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        for (int c=0; c<numChannels_; c++) {
+            channels[c] = data_float_[index+c];
+        }
+        return Color(channels);
     }
     else {
         std::cerr << "Texture2D: Unsupported texture data type " << dataType_ << "." << std::endl;
         return Color();
     }
 }
-    
-} // end namespace
 
+} // end namespace
@@ -18,16 +18,29 @@
 #include "opengl_headers.h"
 #include "color.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
 
 namespace mingfx {
 
+class JobSystem;
+
 /** A wrapper around a 2D texture that supports loading images from files or
- setting texture color data directly.  Example:
+ setting texture color data directly.  Data may have 1 to 4 channels, e.g.,
+ single-channel data such as a font atlas or a height map only takes 1 byte
+ per pixel on the graphics card.  Textures that are drawn smaller than their
+ size should use mipmaps, smaller copies of the image that avoid flickering
+ and moire patterns and read less memory.  Passing one of the OpenGL
+ GL_*_MIPMAP_* filter modes makes them automatically, or GenerateMipmaps()
+ makes them on request.  Textures may also be loaded pre-compressed from KTX
+ and DDS files.  Example:
  ~~~
  Texture2D tex1;
  Texture2D tex2(GL_CLAMP_TO_EDGE);
+ Texture2D tex3(GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR);
+ Texture2D heights;
  
  void MyGraphicsApp::InitOpenGL() {
      std::vector<std::string> search_path;
@@ -36,24 +49,84 @@ namespace mingfx {
      search_path.push_back("./shaders");
      tex1.InitFromFile(Platform::FindFile("earth-2k.png", search_path));
      tex2.InitFromFile(Platform::FindFile("toon-ramp.png", search_path));
+     tex3.InitFromFile(Platform::FindFile("ground-bc7.dds", search_path));
+     tex3.set_max_anisotropy(8.0f);
+     heights.InitFromBytes(256, 256, height_data, 1);
+     heights.GenerateMipmaps(Texture2D::MIPMAPS_KAISER);
  }
  ~~~
  */
 class Texture2D {
 public:
 
+    /// Ways of making mipmaps, see GenerateMipmaps().
+    enum MipmapMethod {
+        /// glGenerateMipmap(), which is fast and usually averages each 2x2
+        /// block of pixels
+        MIPMAPS_GPU,
+        /// averages each 2x2 block of pixels on the CPU
+        MIPMAPS_BOX,
+        /// a Kaiser-windowed sinc filter on the CPU, which is slower but
+        /// keeps the smaller levels sharper
+        MIPMAPS_KAISER
+    };
+
     /// Creates an empty texture.  Optional parameters can be provided to set
-    /// the texture wrap mode and filter mode.
+    /// the texture wrap mode and filter mode.  With one of the GL_*_MIPMAP_*
+    /// filter modes, mipmaps are made on the GPU whenever pixels are set.
     Texture2D(GLenum wrapMode=GL_REPEAT, GLenum filterMode=GL_LINEAR);
+    
+    /// Copies share the same OpenGL texture and image data, which are freed
+    /// once the last Texture2D using them is deleted.  Re-initializing one of
+    /// the copies gives it a texture of its own and leaves the others as is.
+    Texture2D(const Texture2D &other);
+    
+    /// Takes the OpenGL texture and image data from other, which is left empty.
+    Texture2D(Texture2D &&other);
+    
     virtual ~Texture2D();
+    
+    Texture2D& operator=(const Texture2D &other);
+    
+    Texture2D& operator=(Texture2D &&other);
 
     
     /// Call this from within the InitOpenGL() function since it will initialize
     /// not just the Texture2D's internal data but also an OpenGL texture to be
     /// stored on the graphics card.  Internally, this uses the stbi library to
-    /// load images.  It supports png, jpg, bmp, and other file formats.
+    /// load images.  It supports png, jpg, bmp, and other file formats.  To
+    /// load images without stopping the program while they load, see
+    /// TextureLoader.
+    ///
+    /// Files ending in .ktx (KTX version 1) or .dds hold textures that are
+    /// already compressed, along with their mipmaps.  KTX files may use any
+    /// compressed format OpenGL knows, e.g., BC1-BC7 or ETC2/EAC; DDS files
+    /// may only use BC1-BC7 (S3TC, RGTC, and BPTC), so use KTX for ETC2.
+    /// These are copied to the graphics card as they are, so they load
+    /// quickly and take less memory there, but only if the graphics card
+    /// supports the format.  Pixel() and GenerateMipmaps() cannot be used
+    /// with them.
     bool InitFromFile(const std::string &filename);
     
+    /// Same as calling InitFromFile() for each of the textures with the
+    /// matching filename, but the files are read and decoded at the same time
+    /// as jobs on job_system, which is where most of the time goes for large
+    /// images.  The OpenGL textures are then created on the calling thread,
+    /// so call this from within the InitOpenGL() function too.  If job_system
+    /// is NULL, the files are decoded one at a time on the calling thread.
+    /// Returns true if all of the textures loaded.
+    static bool InitFromFiles(const std::vector<Texture2D*> &textures,
+                              const std::vector<std::string> &filenames, JobSystem *job_system);
+    
+    /// Reads an image file (png, jpg, bmp, etc.) and decodes it to RGBA data
+    /// with 1 byte per channel, top row first, setting width and height.
+    /// Returns NULL, after reporting why, if the file cannot be read.  This
+    /// makes no OpenGL calls, so it may be called from any thread, e.g., in a
+    /// job; InitFromFiles(), TextureLoader, TextureArray, and TextureAtlas all
+    /// use it.
+    static std::shared_ptr<const unsigned char> DecodeFile(const std::string &filename,
+                                                           int *width, int *height);
+    
     /// Call this from within the InitOpenGL() function since it will initialize
     /// not just the Texture2D's internal data but also an OpenGL texture to be
     /// stored on the graphics card.
@@ -63,7 +136,9 @@ public:
     /// for this array.  If you will never call Pixel(), then it is safe to free
     /// data as soon as this function returns.  Otherwise, you need to make sure
     /// data does not change in memory until you destroy the Texture2D object.
-    bool InitFromBytes(int width, int height, const unsigned char * data);
+    /// For data with fewer channels, set num_channels to 1 (R), 2 (RG), or
+    /// 3 (RGB), and the texture is stored with that many bytes per pixel.
+    bool InitFromBytes(int width, int height, const unsigned char * data, int num_channels=4);
     
     /// Call this from within the InitOpenGL() function since it will initialize
     /// not just the Texture2D's internal data but also an OpenGL texture to be
@@ -74,19 +149,38 @@ public:
     /// for this array.  If you will never call Pixel(), then it is safe to free
     /// data as soon as this function returns.  Otherwise, you need to make sure
     /// data does not change in memory until you destroy the Texture2D object.
-    bool InitFromFloats(int width, int height, const float * data);
+    /// As with InitFromBytes(), num_channels may be 1 to 4.  The texture is
+    /// stored with 1 byte per channel.
+    bool InitFromFloats(int width, int height, const float * data, int num_channels=4);
+
+    /// Like InitFromBytes(), but the texture shares ownership of data, so the
+    /// image is kept for Pixel() without the caller having to keep it alive.
+    /// If upload is false, the OpenGL texture is made the right size but its
+    /// pixels are left for the caller to fill, e.g., a piece at a time with
+    /// glTexSubImage2D() as TextureLoader does.
+    bool InitFromSharedBytes(int width, int height, const std::shared_ptr<const unsigned char> &data,
+                             bool upload=true);
 
     
     /// This function may be called to re-read the texture data from an array
-    /// formated the same as in InitFromBytes.  The width and height of the
-    /// texture must remain the same.
+    /// formated the same as in InitFromBytes.  The width, height, and number
+    /// of channels of the texture must remain the same.  Mipmaps, if any, are
+    /// made again with the same method as before.
     bool UpdateFromBytes(const unsigned char * data);
 
     /// This function may be called to re-read the texture data from an array
-    /// formated the same as in InitFromFloats.  The width and height of the
-    /// texture must remain the same.
+    /// formated the same as in InitFromFloats.  The width, height, and number
+    /// of channels of the texture must remain the same.
     bool UpdateFromFloats(const float * data);
 
+
+    /// Makes the full set of mipmaps for the texture, down to 1x1 pixels,
+    /// and filters it with them from then on, trilinearly if the filter mode
+    /// is GL_LINEAR.  The CPU methods need the image in CPU memory, so they
+    /// cannot be used after ReleaseCPUData(), and making mipmaps ahead of
+    /// time, e.g., when preparing assets, is a good use for them.
+    bool GenerateMipmaps(MipmapMethod method=MIPMAPS_GPU);
+
     
     /// Returns true if the texture data has been successfully transferred to OpenGL.
     bool initialized() const;
@@ -97,6 +191,20 @@ public:
     /// Returns the height in pixels of the texture.
     int height() const;
 
+    /// Returns the number of channels in the texture's data, from 1 to 4.
+    int num_channels() const;
+
+    /// Returns true if the texture was loaded from a compressed KTX or DDS file.
+    bool compressed() const;
+
+    /// Returns the number of mipmap levels on the graphics card, which is 1
+    /// for a texture without mipmaps.
+    int num_levels() const;
+
+    /// Returns true if the texture has mipmaps or will get them as soon as
+    /// its pixels are set, because its filter mode is one of GL_*_MIPMAP_*.
+    bool mipmapped() const;
+
     /// Returns the unsigned int used as the texture handle by OpenGL
     GLuint opengl_id() const;
 
@@ -109,28 +217,92 @@ public:
     /// Uses the OpenGL texture wrap mode arguments
     void set_wrap_mode(GLenum wrapMode);
 
-    /// Uses the OpenGL texture filter mode arguments
+    /// Uses the OpenGL texture filter mode arguments.  Changing to one of the
+    /// GL_*_MIPMAP_* modes makes mipmaps on the GPU if there are none yet.
     void set_filter_mode(GLenum filterMode);
+
+    /// Anisotropic filtering keeps textures seen at a steep angle, e.g., the
+    /// ground stretching away from the camera, from blurring, by taking up
+    /// to this many samples along the direction they are stretched.  The
+    /// default is 1, i.e., off.  It is limited to what the graphics card
+    /// supports, usually 16, and has no effect if it supports none.
+    void set_max_anisotropy(float max_anisotropy);
+
+    /// Returns the value set with set_max_anisotropy().
+    float max_anisotropy() const;
     
     /// Returns the color at the specified pixel.  The top left corner of the
-    /// image is (0,0) and the bottom right is (width()-1, height()-1).
+    /// image is (0,0) and the bottom right is (width()-1, height()-1).  As
+    /// when OpenGL samples the texture, missing green and blue channels are
+    /// 0 and a missing alpha channel is 1.
     Color Pixel(int x, int y) const;
     
+    /// Frees the copy of the image kept in CPU memory after loading it with
+    /// InitFromFile(), since OpenGL has its own copy on the graphics card.
+    /// For textures made with InitFromBytes() or InitFromFloats(), this just
+    /// forgets the pointer so that the data passed in can be freed.  Pixel()
+    /// cannot be used afterward.
+    void ReleaseCPUData();
+    
+    /// Bytes of CPU memory used by the texture's own copy of the image, which
+    /// does not include data passed in with InitFromBytes() or InitFromFloats().
+    size_t cpu_bytes() const;
+    
+    /// Bytes of GPU memory used by the texture, including its mipmaps.
+    size_t gpu_bytes() const;
+    
 private:
     
+    // counts textures shared by copies only once
+    friend class MemoryStats;
+    
+    bool LoadFile(const std::string &filename);
+    bool LoadCompressedFile(const std::string &filename);
     bool InitOpenGL();
+    bool InitOpenGLCompressed();
+    void SetParameters();
+    const void* pixel_data() const;
+
+    // One mipmap level of a compressed file, found in file_data_
+    class CompressedLevel {
+    public:
+        size_t offset;
+        size_t bytes;
+        int width;
+        int height;
+    };
+    
+    // Deletes the OpenGL texture when the last Texture2D using it goes away
+    class GLTexture {
+    public:
+        GLTexture();
+        ~GLTexture();
+        GLuint id;
+    };
     
     GLenum dataType_; // GL_UNSIGNED_BYTE or GL_FLOAT
     const unsigned char * data_ubyte_;
     const float * data_float_;
+    // holds the image loaded by stbi in InitFromFile(), data_ubyte_ points into it
+    std::shared_ptr<const unsigned char> file_data_;
     
     int width_;
     int height_;
-    bool handleMemInternally_;
+    int numChannels_;
+    
+    // set by LoadCompressedFile(), and the levels are freed once they are
+    // on the graphics card
+    GLenum compressedFormat_;
+    std::vector<CompressedLevel> compressedLevels_;
     
+    std::shared_ptr<GLTexture> texture_;
     GLuint texID_;
     GLenum wrapMode_;
     GLenum filterMode_;
+    int numLevels_;
+    MipmapMethod mipmapMethod_;
+    float maxAnisotropy_;
+    size_t gpuBytes_;
 };
 
     
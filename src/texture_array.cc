@@ -0,0 +1,174 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "texture_array.h"
+#include "gl_state.h"
+#include "job_system.h"
+#include "memory_stats.h"
+#include "texture2d.h"
+#include "texture_filters.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+
+namespace mingfx {
+
+
+TextureArray::TextureArray(GLenum wrapMode, GLenum filterMode) :
+    texID_(0), width_(0), height_(0), numLayers_(0), numLevels_(0),
+    wrapMode_(wrapMode), filterMode_(filterMode)
+{
+    MemoryStats::Register(this);
+}
+
+TextureArray::~TextureArray() {
+    MemoryStats::Unregister(this);
+    if (texID_ != 0) {
+        GLState::ForgetTexture(texID_);
+        glDeleteTextures(1, &texID_);
+    }
+}
+
+
+bool TextureArray::Init(int width, int height, int num_layers) {
+    if ((width <= 0) || (height <= 0) || (num_layers <= 0)) {
+        std::cerr << "TextureArray: Cannot create an array of " << num_layers << " layers of "
+                  << width << "x" << height << " pixels." << std::endl;
+        return false;
+    }
+    if (texID_ == 0) {
+        glGenTextures(1, &texID_);
+    }
+    width_ = width;
+    height_ = height;
+    numLayers_ = num_layers;
+    numLevels_ = 1;
+
+    GLState::BindTexture(GL_TEXTURE_2D_ARRAY, texID_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrapMode_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrapMode_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, BaseFilter(filterMode_));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, BaseFilter(filterMode_));
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width_, height_, numLayers_, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // until GenerateMipmaps(), only the first level exists
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    return true;
+}
+
+
+bool TextureArray::InitFromFiles(const std::vector<std::string> &filenames, JobSystem *job_system) {
+    int n = (int)filenames.size();
+    std::vector<std::shared_ptr<const unsigned char>> images(n);
+    std::vector<int> widths(n, 0);
+    std::vector<int> heights(n, 0);
+    ParallelFor(job_system, n, 1, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            images[i] = Texture2D::DecodeFile(filenames[i], &widths[i], &heights[i]);
+        }
+    });
+
+    // the first image that loaded sets the size
+    int first = 0;
+    while ((first < n) && (images[first] == nullptr)) {
+        first++;
+    }
+    if ((first == n) || !Init(widths[first], heights[first], n)) {
+        return false;
+    }
+    bool all_loaded = true;
+    for (int i=0; i<n; i++) {
+        if (images[i] == nullptr) {
+            all_loaded = false;
+        }
+        else if ((widths[i] != width_) || (heights[i] != height_)) {
+            std::cerr << "TextureArray: " << filenames[i] << " is " << widths[i] << "x" << heights[i]
+                      << " but the array is " << width_ << "x" << height_ << "." << std::endl;
+            all_loaded = false;
+        }
+        else {
+            SetLayer(i, images[i].get());
+        }
+    }
+    if (IsMipmapFilter(filterMode_)) {
+        GenerateMipmaps();
+    }
+    return all_loaded;
+}
+
+
+bool TextureArray::SetLayer(int layer, const unsigned char *data) {
+    if ((texID_ == 0) || (layer < 0) || (layer >= numLayers_)) {
+        std::cerr << "TextureArray: SetLayer() called for layer " << layer << " of " << numLayers_ << "." << std::endl;
+        return false;
+    }
+    GLState::BindTexture(GL_TEXTURE_2D_ARRAY, texID_);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width_, height_, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    return true;
+}
+
+
+void TextureArray::GenerateMipmaps() {
+    if (texID_ == 0) {
+        return;
+    }
+    numLevels_ = NumMipmapLevels(width_, height_);
+    GLState::BindTexture(GL_TEXTURE_2D_ARRAY, texID_);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, MipmapFilter(filterMode_));
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, numLevels_ - 1);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+}
+
+
+TextureArray::Region TextureArray::region(int layer) const {
+    Region r;
+    r.layer = layer;
+    return r;
+}
+
+bool TextureArray::initialized() const {
+    return texID_ != 0;
+}
+
+GLuint TextureArray::opengl_id() const {
+    return texID_;
+}
+
+int TextureArray::width() const {
+    return width_;
+}
+
+int TextureArray::height() const {
+    return height_;
+}
+
+int TextureArray::num_layers() const {
+    return numLayers_;
+}
+
+GLenum TextureArray::wrap_mode() const {
+    return wrapMode_;
+}
+
+GLenum TextureArray::filter_mode() const {
+    return filterMode_;
+}
+
+size_t TextureArray::gpu_bytes() const {
+    size_t bytes = 0;
+    int w = width_;
+    int h = height_;
+    for (int l=0; l<numLevels_; l++) {
+        bytes += (size_t)w * h * 4 * numLayers_;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+    return bytes;
+}
+
+
+} // end namespace
@@ -0,0 +1,135 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_TEXTURE_ARRAY_H_
+#define SRC_TEXTURE_ARRAY_H_
+
+#include "opengl_headers.h"
+#include "point2.h"
+
+#include <string>
+#include <vector>
+
+
+namespace mingfx {
+
+class JobSystem;
+
+
+/** A 2D array texture: a stack of images (layers) that are all the same size
+ and are bound to the shader as a single texture.  Materials that use
+ different layers of the same array can be drawn one after another without
+ binding a different texture in between, which matters in scenes with many
+ materials.  DefaultShader::MaterialProperties can point to a layer in place
+ of its surface_texture.  Example:
+ ~~~
+ TextureArray bricks;
+
+ void MyApp::InitOpenGL() {
+     std::vector<std::string> files;
+     files.push_back(Platform::FindFile("brick-red.png", search_path));
+     files.push_back(Platform::FindFile("brick-gray.png", search_path));
+     bricks.InitFromFiles(files, job_system());
+     for (int i=0; i<2; i++) {
+         wall_materials_[i].surface_texture_array = &bricks;
+         wall_materials_[i].surface_texture_region = bricks.region(i);
+     }
+ }
+ ~~~
+ Images of different sizes can be packed into the layers of an array with
+ TextureAtlas.  Data are stored in RGBA format with 1 byte per channel, and
+ the top row of each image is at v = 0, as with Texture2D.
+ */
+class TextureArray {
+public:
+
+    /// The part of the array that one image uses: a layer and, for images
+    /// packed by TextureAtlas, the rectangle of texture coordinates within
+    /// it.  A whole layer runs from (0,0) to (1,1).
+    class Region {
+    public:
+        Region() : layer(0), uv_min(0,0), uv_max(1,1) {}
+        int layer;
+        Point2 uv_min;
+        Point2 uv_max;
+    };
+
+
+    /// Creates an empty array.  The wrap and filter modes are as for
+    /// Texture2D, and the default uses mipmaps.
+    TextureArray(GLenum wrapMode=GL_REPEAT, GLenum filterMode=GL_LINEAR_MIPMAP_LINEAR);
+
+    /// Deletes the OpenGL texture.
+    virtual ~TextureArray();
+
+    /// Creates the OpenGL texture with room for num_layers images of the
+    /// given size, whose contents start out undefined.  Call this from
+    /// within InitOpenGL(), followed by SetLayer() for each layer.
+    bool Init(int width, int height, int num_layers);
+
+    /// Loads one image file into each layer.  The files are decoded as jobs
+    /// on job_system if it is not NULL.  Every image must be the same size as
+    /// the first; layers whose images are a different size or cannot be read
+    /// are reported and left empty, and false is returned.  Mipmaps are made
+    /// if the filter mode uses them.
+    bool InitFromFiles(const std::vector<std::string> &filenames, JobSystem *job_system=NULL);
+
+    /// Copies RGBA data, width() * height() * 4 bytes, into one layer.  Call
+    /// GenerateMipmaps() once all of the layers are set if the filter mode
+    /// uses mipmaps.
+    bool SetLayer(int layer, const unsigned char *data);
+
+    /// Makes the mipmaps of all layers on the GPU.
+    void GenerateMipmaps();
+
+    /// The region covering all of a layer.
+    Region region(int layer) const;
+
+    /// Returns true once Init() has created the OpenGL texture.
+    bool initialized() const;
+
+    /// Returns the OpenGL id of the GL_TEXTURE_2D_ARRAY texture.
+    GLuint opengl_id() const;
+
+    int width() const;
+    int height() const;
+    int num_layers() const;
+
+    /// Returns an enumerated constant for the OpenGL wrap mode used by the texture.
+    GLenum wrap_mode() const;
+
+    /// Returns an enumerated constant for the OpenGL filter mode used by the texture.
+    GLenum filter_mode() const;
+
+    /// Bytes of GPU memory used by the texture, including its mipmaps.
+    size_t gpu_bytes() const;
+
+private:
+
+    // for now, the copy constructor is private so no copies are allowed.
+    TextureArray(const TextureArray &other);
+    TextureArray& operator=(const TextureArray &other);
+
+    GLuint texID_;
+    int width_;
+    int height_;
+    int numLayers_;
+    int numLevels_;
+    GLenum wrapMode_;
+    GLenum filterMode_;
+};
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "texture_atlas.h"
+#include "job_system.h"
+#include "texture2d.h"
+
+// disable warnings for this 3rd party code
+#pragma warning (push, 0)
+#include "stb_rect_pack.h"
+#pragma warning (pop)
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+namespace mingfx {
+
+
+TextureAtlas::TextureAtlas(int page_width, int page_height, int padding) :
+    pages_(GL_CLAMP_TO_EDGE, GL_LINEAR_MIPMAP_LINEAR),
+    pageWidth_(page_width), pageHeight_(page_height), padding_(padding), built_(false)
+{
+}
+
+TextureAtlas::~TextureAtlas() {
+}
+
+
+int TextureAtlas::Add(int width, int height, const unsigned char *data) {
+    if (built_) {
+        std::cerr << "TextureAtlas: Images cannot be added after Build()." << std::endl;
+        return -1;
+    }
+    if ((width <= 0) || (height <= 0)) {
+        std::cerr << "TextureAtlas: Cannot add a " << width << "x" << height << " image." << std::endl;
+        return -1;
+    }
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.data.assign(data, data + (size_t)width * height * 4);
+    image.x = 0;
+    image.y = 0;
+    images_.push_back(image);
+    return (int)images_.size() - 1;
+}
+
+
+int TextureAtlas::AddFromFile(const std::string &filename) {
+    return AddFromFiles(std::vector<std::string>(1, filename))[0];
+}
+
+
+std::vector<int> TextureAtlas::AddFromFiles(const std::vector<std::string> &filenames, JobSystem *job_system) {
+    int n = (int)filenames.size();
+    std::vector<int> handles(n, -1);
+    if (built_) {
+        std::cerr << "TextureAtlas: Images cannot be added after Build()." << std::endl;
+        return handles;
+    }
+    std::vector<std::shared_ptr<const unsigned char>> images(n);
+    std::vector<int> widths(n, 0);
+    std::vector<int> heights(n, 0);
+    ParallelFor(job_system, n, 1, [&](int begin, int end) {
+        for (int i=begin; i<end; i++) {
+            images[i] = Texture2D::DecodeFile(filenames[i], &widths[i], &heights[i]);
+        }
+    });
+
+    for (int i=0; i<n; i++) {
+        if (images[i] != nullptr) {
+            handles[i] = Add(widths[i], heights[i], images[i].get());
+        }
+    }
+    return handles;
+}
+
+
+bool TextureAtlas::Build() {
+    if (built_) {
+        std::cerr << "TextureAtlas: Build() has already been called." << std::endl;
+        return false;
+    }
+    if (images_.empty()) {
+        std::cerr << "TextureAtlas: Build() called with no images." << std::endl;
+        return false;
+    }
+    built_ = true;
+
+    // each rectangle holds an image plus its padding
+    bool all_fit = true;
+    std::vector<stbrp_rect> rects;
+    for (int i=0; i<images_.size(); i++) {
+        stbrp_rect r;
+        memset(&r, 0, sizeof(r));
+        r.id = i;
+        int w = images_[i].width + 2*padding_;
+        int h = images_[i].height + 2*padding_;
+        if ((w > pageWidth_) || (h > pageHeight_)) {
+            std::cerr << "TextureAtlas: A " << images_[i].width << "x" << images_[i].height
+                      << " image does not fit on a " << pageWidth_ << "x" << pageHeight_ << " page." << std::endl;
+            all_fit = false;
+            continue;
+        }
+        r.w = (stbrp_coord)w;
+        r.h = (stbrp_coord)h;
+        rects.push_back(r);
+    }
+
+    // fill one page at a time with whatever is left over from the page before
+    int num_pages = 0;
+    std::vector<stbrp_node> nodes(pageWidth_);
+    while (!rects.empty()) {
+        stbrp_context context;
+        stbrp_init_target(&context, pageWidth_, pageHeight_, &nodes[0], (int)nodes.size());
+        stbrp_pack_rects(&context, &rects[0], (int)rects.size());
+        std::vector<stbrp_rect> left_over;
+        for (int r=0; r<rects.size(); r++) {
+            if (!rects[r].was_packed) {
+                left_over.push_back(rects[r]);
+                continue;
+            }
+            Image &image = images_[rects[r].id];
+            image.x = rects[r].x + padding_;
+            image.y = rects[r].y + padding_;
+            image.region.layer = num_pages;
+            image.region.uv_min = Point2((float)image.x / pageWidth_, (float)image.y / pageHeight_);
+            image.region.uv_max = Point2((float)(image.x + image.width) / pageWidth_,
+                                         (float)(image.y + image.height) / pageHeight_);
+        }
+        rects.swap(left_over);
+        num_pages++;
+    }
+    if (num_pages == 0) {
+        return false;
+    }
+
+    // copy each image into its page, extending its edge pixels out into the
+    // padding, then upload the page
+    pages_.Init(pageWidth_, pageHeight_, num_pages);
+    std::vector<unsigned char> page((size_t)pageWidth_ * pageHeight_ * 4);
+    for (int p=0; p<num_pages; p++) {
+        std::fill(page.begin(), page.end(), 0);
+        for (int i=0; i<images_.size(); i++) {
+            const Image &image = images_[i];
+            if ((image.region.layer != p) || image.data.empty() ||
+                ((image.width + 2*padding_ > pageWidth_) || (image.height + 2*padding_ > pageHeight_))) {
+                continue;
+            }
+            for (int y=-padding_; y<image.height+padding_; y++) {
+                int src_y = std::min(std::max(y, 0), image.height - 1);
+                const unsigned char *src = &image.data[(size_t)src_y * image.width * 4];
+                unsigned char *dst = &page[((size_t)(image.y + y) * pageWidth_ + image.x) * 4];
+                for (int x=-padding_; x<0; x++) {
+                    memcpy(dst + x*4, src, 4);
+                }
+                memcpy(dst, src, (size_t)image.width * 4);
+                for (int x=image.width; x<image.width+padding_; x++) {
+                    memcpy(dst + x*4, src + (image.width-1)*4, 4);
+                }
+            }
+        }
+        pages_.SetLayer(p, &page[0]);
+    }
+    pages_.GenerateMipmaps();
+
+    for (int i=0; i<images_.size(); i++) {
+        std::vector<unsigned char>().swap(images_[i].data);
+    }
+    return all_fit;
+}
+
+
+TextureArray::Region TextureAtlas::region(int handle) const {
+    if ((handle < 0) || (handle >= images_.size())) {
+        std::cerr << "TextureAtlas: No image with handle " << handle << "." << std::endl;
+        return TextureArray::Region();
+    }
+    return images_[handle].region;
+}
+
+const TextureArray& TextureAtlas::texture_array() const {
+    return pages_;
+}
+
+int TextureAtlas::num_images() const {
+    return (int)images_.size();
+}
+
+int TextureAtlas::num_pages() const {
+    return pages_.num_layers();
+}
+
+
+} // end namespace
@@ -0,0 +1,121 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_TEXTURE_ATLAS_H_
+#define SRC_TEXTURE_ATLAS_H_
+
+#include "texture_array.h"
+
+#include <string>
+#include <vector>
+
+
+namespace mingfx {
+
+class JobSystem;
+
+
+/** Packs many small images, which may all be different sizes, into the pages
+ of one TextureArray so that materials using any of them can be drawn without
+ binding a different texture in between.  Add the images first, then call
+ Build(), which places them on as few pages as it can using stb_rect_pack and
+ copies the pages to the graphics card as layers of the array.  Each image is
+ then known by the handle returned when it was added, and region() gives the
+ layer and texture coordinate rectangle it ended up in.  Example:
+ ~~~
+ TextureAtlas atlas;
+
+ void MyApp::InitOpenGL() {
+     std::vector<int> handles = atlas.AddFromFiles(icon_files_, job_system());
+     atlas.Build();
+     for (int i=0; i<handles.size(); i++) {
+         icon_materials_[i].surface_texture_array = &atlas.texture_array();
+         icon_materials_[i].surface_texture_region = atlas.region(handles[i]);
+     }
+ }
+ ~~~
+ DefaultShader maps each mesh's texture coordinates from 0 to 1 onto the
+ image's rectangle, and coordinates outside that range repeat the image.
+ Each image is surrounded by padding filled with copies of its edge pixels so
+ that filtering does not pick up its neighbors; mipmap levels finer than the
+ padding (e.g., the first 3 levels for a padding of 4 pixels) stay clean.
+ */
+class TextureAtlas {
+public:
+
+    /// Creates an empty atlas whose pages are page_width by page_height
+    /// pixels, with padding pixels around each image.
+    TextureAtlas(int page_width=2048, int page_height=2048, int padding=4);
+
+    virtual ~TextureAtlas();
+
+    /// Adds an image of RGBA data, width * height * 4 bytes, which is copied.
+    /// Returns the handle used to look up where it is placed, or -1 if the
+    /// atlas has already been built.
+    int Add(int width, int height, const unsigned char *data);
+
+    /// Adds the image in an image file, returning its handle, or -1 if it
+    /// cannot be read.
+    int AddFromFile(const std::string &filename);
+
+    /// Adds the images in several files, decoding them as jobs on job_system if
+    /// it is not NULL.  Returns one handle per file, with -1 for those that
+    /// cannot be read.
+    std::vector<int> AddFromFiles(const std::vector<std::string> &filenames, JobSystem *job_system=NULL);
+
+    /// Packs the images into pages and creates the texture array, with
+    /// mipmaps.  Call this from within InitOpenGL() after all of the images
+    /// have been added; the CPU copies of the images are freed afterwards.
+    /// Returns false, after reporting them, if some images are too big to
+    /// fit on a page.
+    bool Build();
+
+    /// The layer and texture coordinate rectangle of an image once the atlas
+    /// has been built.
+    TextureArray::Region region(int handle) const;
+
+    /// The texture holding the pages, one page per layer.
+    const TextureArray& texture_array() const;
+
+    int num_images() const;
+    int num_pages() const;
+
+private:
+
+    class Image {
+    public:
+        int width;
+        int height;
+        std::vector<unsigned char> data;
+        // top left corner of the image itself (inside the padding) on its page
+        int x;
+        int y;
+        TextureArray::Region region;
+    };
+
+    // for now, the copy constructor is private so no copies are allowed.
+    TextureAtlas(const TextureAtlas &other);
+    TextureAtlas& operator=(const TextureAtlas &other);
+
+    std::vector<Image> images_;
+    TextureArray pages_;
+    int pageWidth_;
+    int pageHeight_;
+    int padding_;
+    bool built_;
+};
+
+
+} // end namespace
+
+#endif
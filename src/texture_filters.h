@@ -0,0 +1,69 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_TEXTURE_FILTERS_H_
+#define SRC_TEXTURE_FILTERS_H_
+
+#include "opengl_headers.h"
+
+#include <algorithm>
+
+
+namespace mingfx {
+
+
+// Helpers for the OpenGL filter modes, used internally by Texture2D and
+// TextureArray so that both treat the same filter mode the same way.  A
+// texture's filter mode is the one it uses when minifying with mipmaps; the
+// base filter is used when magnifying and when there is only one level.
+
+/// True for the four *_MIPMAP_* filter modes.
+inline bool IsMipmapFilter(GLenum filter_mode) {
+    return (filter_mode == GL_NEAREST_MIPMAP_NEAREST) || (filter_mode == GL_LINEAR_MIPMAP_NEAREST) ||
+           (filter_mode == GL_NEAREST_MIPMAP_LINEAR) || (filter_mode == GL_LINEAR_MIPMAP_LINEAR);
+}
+
+/// The filter to use when magnifying, which cannot use mipmaps.
+inline GLenum BaseFilter(GLenum filter_mode) {
+    if ((filter_mode == GL_NEAREST_MIPMAP_NEAREST) || (filter_mode == GL_NEAREST_MIPMAP_LINEAR)) {
+        return GL_NEAREST;
+    }
+    if ((filter_mode == GL_LINEAR_MIPMAP_NEAREST) || (filter_mode == GL_LINEAR_MIPMAP_LINEAR)) {
+        return GL_LINEAR;
+    }
+    return filter_mode;
+}
+
+/// The filter to use when minifying a texture with mipmaps.
+inline GLenum MipmapFilter(GLenum filter_mode) {
+    if (IsMipmapFilter(filter_mode)) {
+        return filter_mode;
+    }
+    return (filter_mode == GL_NEAREST) ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR;
+}
+
+/// The number of levels in a full set of mipmaps, down to 1x1.
+inline int NumMipmapLevels(int width, int height) {
+    int levels = 1;
+    while ((width > 1) || (height > 1)) {
+        width = std::max(1, width / 2);
+        height = std::max(1, height / 2);
+        levels++;
+    }
+    return levels;
+}
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+ See corresponding header file for details.
+ */
+
+#include "texture_loader.h"
+#include "gl_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+
+namespace mingfx {
+
+
+// the default placeholder, which Texture2D::Pixel() may read at any time
+static const unsigned char WHITE_PIXEL[4] = { 255, 255, 255, 255 };
+
+
+TextureLoader::TextureLoader(JobSystem *job_system) :
+    decodes_(job_system), buffer_(0), upload_milliseconds_(2.0)
+{
+}
+
+TextureLoader::~TextureLoader() {
+    // decode jobs only touch their own Image, so the ones still running can
+    // finish after this, but the TaskGroup waits for them anyway
+    Clear();
+}
+
+
+void TextureLoader::Load(Texture2D *texture, const std::string &filename, const Callback &callback) {
+    // an earlier load into the same texture would overwrite this one if it
+    // finished later
+    Cancel(texture);
+
+    if (!placeholder_.initialized()) {
+        placeholder_.InitFromBytes(1, 1, WHITE_PIXEL);
+    }
+
+    requests_.push_back(Request());
+    Request &request = requests_.back();
+    request.texture = texture;
+    request.filename = filename;
+    request.callback = callback;
+    request.image = std::make_shared<Image>();
+    request.staging = Texture2D(texture->wrap_mode(), texture->filter_mode());
+    request.next_row = 0;
+    *texture = placeholder_;
+
+    std::shared_ptr<Image> image = request.image;
+    decodes_.Run([image, filename] {
+        image->data = Texture2D::DecodeFile(filename, &image->width, &image->height);
+        image->done = true;
+    });
+}
+
+
+int TextureLoader::Update() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int num_finished = 0;
+    bool uploaded = false;
+    std::list<Request>::iterator it = requests_.begin();
+    while (it != requests_.end()) {
+        if (!it->image->done) {
+            it++;
+            continue;
+        }
+        bool success = (it->image->data != nullptr);
+        if (success) {
+            if (uploaded) {
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                if (elapsed.count() >= upload_milliseconds_) {
+                    break;
+                }
+            }
+            uploaded = true;
+            if (!UploadChunk(&(*it))) {
+                continue;
+            }
+            *(it->texture) = std::move(it->staging);
+        }
+
+        // callbacks may start or cancel loads, so take this one out of the
+        // list first and then start over from the beginning
+        Texture2D *texture = it->texture;
+        Callback callback = it->callback;
+        requests_.erase(it);
+        num_finished++;
+        if (callback) {
+            callback(texture, success);
+        }
+        it = requests_.begin();
+    }
+    return num_finished;
+}
+
+
+bool TextureLoader::UploadChunk(Request *request) {
+    const Image &image = *(request->image);
+    if (request->next_row == 0) {
+        request->staging.InitFromSharedBytes(image.width, image.height, image.data, false);
+    }
+
+    size_t row_bytes = 4 * (size_t)image.width;
+    int rows = std::max(1, (int)(UPLOAD_CHUNK_BYTES / std::max(row_bytes, (size_t)1)));
+    rows = std::min(rows, image.height - request->next_row);
+    size_t bytes = row_bytes * rows;
+    const unsigned char *pixels = image.data.get() + row_bytes * request->next_row;
+
+    if (buffer_ == 0) {
+        glGenBuffers(1, &buffer_);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+    // new storage for each piece means writing it never has to wait for the
+    // copy out of the previous piece to finish
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    GLState::BindTexture(GL_TEXTURE_2D, request->staging.opengl_id());
+    if (mapped != NULL) {
+        memcpy(mapped, pixels, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // with an unpack buffer bound, the last argument is an offset into it
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, request->next_row, image.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else {
+        std::cerr << "TextureLoader: Could not map the pixel buffer." << std::endl;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, request->next_row, image.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    request->next_row += rows;
+    if (request->next_row < image.height) {
+        return false;
+    }
+    // mipmaps can only be made once all of the pixels are there
+    if (request->staging.mipmapped()) {
+        request->staging.GenerateMipmaps();
+    }
+    return true;
+}
+
+
+void TextureLoader::Finish() {
+    // callbacks may start more loads
+    while (requests_.size()) {
+        decodes_.Wait();
+        double milliseconds = upload_milliseconds_;
+        upload_milliseconds_ = std::numeric_limits<double>::max();
+        Update();
+        upload_milliseconds_ = milliseconds;
+    }
+}
+
+
+void TextureLoader::Cancel(Texture2D *texture) {
+    std::list<Request>::iterator it = requests_.begin();
+    while (it != requests_.end()) {
+        if (it->texture == texture) {
+            it = requests_.erase(it);
+        }
+        else {
+            it++;
+        }
+    }
+}
+
+
+int TextureLoader::num_pending() const {
+    return (int)requests_.size();
+}
+
+
+void TextureLoader::Clear() {
+    requests_.clear();
+    placeholder_ = Texture2D();
+    if (buffer_ != 0) {
+        glDeleteBuffers(1, &buffer_);
+        buffer_ = 0;
+    }
+}
+
+
+void TextureLoader::set_placeholder(const Texture2D &placeholder) {
+    placeholder_ = placeholder;
+}
+
+
+void TextureLoader::set_upload_milliseconds(double milliseconds) {
+    upload_milliseconds_ = milliseconds;
+}
+
+
+} // end namespace
@@ -0,0 +1,166 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_TEXTURE_LOADER_H_
+#define SRC_TEXTURE_LOADER_H_
+
+#include "opengl_headers.h"
+#include "job_system.h"
+#include "texture2d.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+
+
+namespace mingfx {
+
+
+/** Loads textures from image files without stopping the program while they
+ load.  Texture2D::InitFromFile() reads and decodes the file and copies it to
+ the graphics card all at once on the main thread, so loading many large
+ images freezes the window for as long as that takes.  Load() instead
+ decodes the file as a job on a JobSystem and returns right away, and the
+ texture shows a placeholder (plain white unless set_placeholder() is used)
+ until the image is ready.  Update() should then be called once per frame;
+ it copies decoded images to the graphics card a piece at a time through a
+ pixel buffer object, stopping once it has used up its time for the frame,
+ and calls the callback given to Load() when a texture is done.  Example:
+ ~~~
+ void MyApp::InitOpenGL() {
+     for (int i=0; i<materials_.size(); i++) {
+         texture_loader()->Load(&materials_[i].surface_texture, files_[i],
+             [this](Texture2D *texture, bool success) {
+                 if (!success) {
+                     missing_textures_++;
+                 }
+             });
+     }
+ }
+ ~~~
+ GraphicsApp has one of these, available from GraphicsApp::texture_loader(),
+ which decodes on GraphicsApp::job_system() and is updated every frame.
+ Compressed KTX and DDS files need no decoding, so load those with
+ Texture2D::InitFromFile() instead.
+
+ Load(), Update(), and the other functions must be called from the thread
+ with the OpenGL context, and the callbacks are called from Update() on that
+ thread too.  The Texture2D passed to Load() must not be deleted until its
+ callback has been called, or until Cancel() is called for it.  Re-initializing
+ it in the meantime is fine, but the loaded image replaces whatever it was
+ given once it is ready.
+ */
+class TextureLoader {
+public:
+
+    /// Called once a texture has loaded, with success false if the file could
+    /// not be read, in which case the texture keeps the placeholder.
+    typedef std::function<void(Texture2D *texture, bool success)> Callback;
+
+
+    /// Decodes images as jobs on job_system, which must exist for as long as
+    /// the loader does.
+    TextureLoader(JobSystem *job_system);
+
+    /// Waits for any images still being decoded and deletes the OpenGL
+    /// buffers, see Clear().
+    virtual ~TextureLoader();
+
+    /// Gives texture the placeholder right away and starts loading filename
+    /// into it.  The texture keeps its wrap and filter modes.  The callback
+    /// is called from a later Update() or Finish() once the texture is ready.
+    void Load(Texture2D *texture, const std::string &filename, const Callback &callback = Callback());
+
+    /// Copies decoded images to the graphics card until the time set with
+    /// set_upload_milliseconds() is used up, and calls the callbacks of the
+    /// textures that are done.  At least one piece is copied each call, so
+    /// loading always makes progress.  Call this once per frame.  Returns the
+    /// number of textures that finished.
+    int Update();
+
+    /// Waits for every image to be decoded and copied, and calls all of the
+    /// callbacks, e.g., for a loading screen that should not go away until
+    /// everything is ready.
+    void Finish();
+
+    /// Stops loading into texture without calling its callback.  The texture
+    /// keeps the placeholder.
+    void Cancel(Texture2D *texture);
+
+    /// Number of textures that have started loading but have not yet been
+    /// passed to their callbacks.
+    int num_pending() const;
+
+    /// Discards any loads in progress without calling their callbacks and
+    /// deletes the OpenGL buffers, which must happen while the OpenGL context
+    /// still exists.
+    void Clear();
+
+    /// Sets the texture shown until a load finishes.  Textures given it by
+    /// Load() share its OpenGL texture rather than making copies.
+    void set_placeholder(const Texture2D &placeholder);
+
+    /// The most time Update() spends copying to the graphics card each frame.
+    /// The default is 2 milliseconds.
+    void set_upload_milliseconds(double milliseconds);
+
+    /// Bytes copied to the graphics card at a time.  Smaller pieces keep
+    /// Update() closer to its time limit, and bigger pieces need fewer OpenGL
+    /// calls.
+    static const int UPLOAD_CHUNK_BYTES = 512 * 1024;
+
+private:
+
+    // filled in by the decode job, which sets done last
+    class Image {
+    public:
+        Image() : width(0), height(0), done(false) {}
+        std::shared_ptr<const unsigned char> data;
+        int width;
+        int height;
+        std::atomic<bool> done;
+    };
+
+    class Request {
+    public:
+        Texture2D *texture;
+        std::string filename;
+        Callback callback;
+        std::shared_ptr<Image> image;
+        // the texture the image is copied into, which replaces the one in
+        // texture when it is complete.  rows below next_row are copied.
+        Texture2D staging;
+        int next_row;
+    };
+
+    // copies the next piece of the request's image, returning true once it
+    // is all there
+    bool UploadChunk(Request *request);
+
+    // for now, the copy constructor is private so no copies are allowed.
+    TextureLoader(const TextureLoader &other);
+    TextureLoader& operator=(const TextureLoader &other);
+
+    JobSystem::TaskGroup decodes_;
+    std::list<Request> requests_;
+    Texture2D placeholder_;
+    GLuint buffer_;
+    double upload_milliseconds_;
+};
+
+
+} // end namespace
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+#ifndef SRC_TRIPLE_BUFFER_H_
+#define SRC_TRIPLE_BUFFER_H_
+
+#include <atomic>
+
+
+namespace mingfx {
+
+
+/** Hands data from one thread to another without either one waiting, e.g.,
+ from a simulation running on its own thread (see
+ GraphicsApp::GraphicsSettings::threaded_simulation) to the drawing code.  It
+ keeps three copies of the data: one that the writing thread is filling in,
+ one that the reading thread is using, and the most recent one published
+ by the writer, which the reader switches to when it is ready.  Only the
+ index of that middle copy is shared, and it is swapped atomically, so
+ neither thread ever locks or waits for the other.  Example:
+ ~~~
+ TripleBuffer<Mesh> cloth_;
+
+ // on the simulation thread
+ void MyApp::UpdateSimulation(double dt) {
+     cloth_sim_.Step(dt);
+     cloth_.write_buffer().SetVertices(cloth_sim_.positions());
+     cloth_.write_buffer().SetNormals(cloth_sim_.normals());
+     cloth_.Publish();
+ }
+
+ // on the OpenGL thread
+ void MyApp::DrawUsingOpenGL() {
+     cloth_.Acquire();
+     shader_.Draw(model, view, proj, &cloth_.read_buffer(), material);
+ }
+ ~~~
+ Mesh only changes its copy of the data in CPU memory when it is modified and
+ copies it to the graphics card when it is next drawn, so a TripleBuffer of
+ meshes can be written by a thread without an OpenGL context.  Each of the
+ three meshes keeps its own GPU buffers.
+
+ After Publish(), write_buffer() is a copy that was published two times ago
+ (or never), not the one just published, so the writer should set all of the
+ data it changes every time.  Only one thread may write and one read.
+ */
+template <class T>
+class TripleBuffer {
+public:
+
+    TripleBuffer() : write_(0), read_(1), middle_(2) {}
+
+    /// The copy to fill in, for the writing thread only.
+    T& write_buffer() {
+        return buffers_[write_];
+    }
+
+    /// Makes write_buffer() the most recent copy, for the reader to pick up
+    /// with its next Acquire(), and moves the writer on to another copy.
+    void Publish() {
+        write_ = middle_.exchange(write_ | NEW_DATA, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /// Switches read_buffer() to the most recently published copy, if there
+    /// is one that has not been acquired yet.  Returns true if it switched.
+    bool Acquire() {
+        if ((middle_.load(std::memory_order_relaxed) & NEW_DATA) == 0) {
+            return false;
+        }
+        read_ = middle_.exchange(read_, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    /// The copy to use, for the reading thread only.  It does not change
+    /// until the next Acquire().
+    T& read_buffer() {
+        return buffers_[read_];
+    }
+
+private:
+
+    static const int INDEX_MASK = 3;
+    static const int NEW_DATA = 4;
+
+    // for now, the copy constructor is private so no copies are allowed.
+    TripleBuffer(const TripleBuffer &other);
+    TripleBuffer& operator=(const TripleBuffer &other);
+
+    T buffers_[3];
+    int write_;
+    int read_;
+    // index of the middle copy, with NEW_DATA set until the reader takes it
+    std::atomic<int> middle_;
+};
+
+
+} // end namespace
+
+#endif
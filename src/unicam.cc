@@ -77,6 +77,26 @@ void UniCam::OnButtonDown(const Point2 &mousePos, float mouseZ) {
     }
 }
 
+void UniCam::UpdateButtonDownDepth(float mouseZ) {
+    // panning only uses the depth of the hit point for its speed, so it can
+    // change during a pan, but dolly and rotate fix their speed and center
+    // when they start
+    if ((state_ == UniCamState::PAN_DOLLY_ROT_DECISION) ||
+        (state_ == UniCamState::PAN_DOLLY_DECISION) ||
+        (state_ == UniCamState::ROT_WAIT_FOR_SECOND_CLICK) ||
+        (state_ == UniCamState::PAN) ||
+        ((state_ == UniCamState::DOLLY) && !dollyInitialized_))
+    {
+        hitGeometry_ = (mouseZ < 1.0);
+        if (hitGeometry_) {
+            hitPoint_ = GfxMath::ScreenToWorld(V_, Pdraw_, initialClickPos_, mouseZ);
+        }
+        else {
+            hitPoint_ = GfxMath::ScreenToDepthPlane(V_, Pdraw_, Point2(0,0), defaultDepth_);
+        }
+    }
+}
+
 void UniCam::OnDrag(const Point2 &mousePos) {
     if (state_ == UniCamState::PAN_DOLLY_ROT_DECISION) {
         const double panMovementThreshold  = 0.01;
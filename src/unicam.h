@@ -74,6 +74,16 @@ void MyGraphicsApp::OnLeftMouseDown(const Point2 &pos) {
     unicam_.OnButtonDown(mouse_xy, mouse_z);
 }
 
+// Or, to avoid waiting for the graphics card to finish drawing on each click,
+// start with no depth and fill it in when the graphics card has it:
+void MyGraphicsApp::OnLeftMouseDown(const Point2 &pos) {
+    Point2 mouse_xy = PixelsToNormalizedDeviceCoords(pos);
+    unicam_.OnButtonDown(mouse_xy, 1.0);
+    ReadZValueAtPixelAsync(pos, [this](float mouse_z) {
+        unicam_.UpdateButtonDownDepth(mouse_z);
+    });
+}
+
 void MyGraphicsApp::OnLeftMouseDrag(const Point2 &pos, const Vector2 &delta) {
     Point2 mouse_xy = PixelsToNormalizedDeviceCoords(pos);
     unicam_.OnDrag(mouse_xy);
@@ -130,6 +140,14 @@ public:
     /// uniCam.OnButtonDown(mouse_xy, mouse_z);
     /// ~~~
     void OnButtonDown(const Point2 &normalizedMousePos, float mouseZ);
+
+    /// Sets the depth buffer value under the mouse for the last call to
+    /// OnButtonDown(), for when it is read back later, e.g., with
+    /// GraphicsApp::ReadZValueAtPixelAsync().  The depth is not used until the
+    /// user has dragged far enough to choose between pan, dolly, and rotate,
+    /// so a value that arrives a few frames after the click still works.  It
+    /// is ignored once a dolly or rotation has started.
+    void UpdateButtonDownDepth(float mouseZ);
     
     /// Attach this to the corresponding mouse move event, for example, call this
     /// from within GraphicsApp::OnRightMouseDrag().  If your mousePos is reported
@@ -0,0 +1,222 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+// Checks that Mesh, MeshBatch, and Texture2D free their OpenGL objects when
+// they are deleted, reuse them when their data change, and hand them over
+// correctly when copied or moved.  This counts the OpenGL buffers, vertex
+// arrays, and textures that exist before and after each test, so it prints
+// PASS or FAIL for each one and returns non-zero if any of them fail.  It
+// opens a window but does not need to draw anything, so it also runs under a
+// software OpenGL context, e.g., on Linux with Mesa and no GPU:
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./mingfx-test-gpu-resource-lifetime
+
+#include <mingfx.h>
+using namespace mingfx;
+
+#include <iostream>
+#include <vector>
+
+
+// OpenGL ids are small integers that are reused after being deleted, so
+// checking every id up to this is enough to find all of the objects made here
+static const GLuint MAX_ID = 10000;
+
+class GLObjectCount {
+public:
+    GLObjectCount() : buffers(0), vertex_arrays(0), textures(0) {
+        for (GLuint id=1; id<MAX_ID; id++) {
+            if (glIsBuffer(id)) buffers++;
+            if (glIsVertexArray(id)) vertex_arrays++;
+            if (glIsTexture(id)) textures++;
+        }
+    }
+    bool operator==(const GLObjectCount &other) const {
+        return (buffers == other.buffers) && (vertex_arrays == other.vertex_arrays) &&
+            (textures == other.textures);
+    }
+    int buffers;
+    int vertex_arrays;
+    int textures;
+};
+
+std::ostream & operator<< (std::ostream &os, const GLObjectCount &c) {
+    return os << c.buffers << " buffers, " << c.vertex_arrays << " vertex arrays, " << c.textures << " textures";
+}
+
+
+static int num_failed = 0;
+
+void Check(const std::string &name, bool passed) {
+    std::cout << (passed ? "PASS: " : "FAIL: ") << name << std::endl;
+    if (!passed) {
+        num_failed++;
+    }
+}
+
+void CheckCount(const std::string &name, const GLObjectCount &expected, const GLObjectCount &actual) {
+    Check(name, expected == actual);
+    if (!(expected == actual)) {
+        std::cout << "  expected " << expected << std::endl;
+        std::cout << "  found    " << actual << std::endl;
+    }
+}
+
+
+// A small indexed mesh with per-instance data, so that it uses every kind of
+// buffer a Mesh can have
+void MakeMesh(int n, Mesh *mesh) {
+    std::vector<Point3> verts;
+    std::vector<Vector3> norms;
+    std::vector<unsigned int> indices;
+    for (int i=0; i<=n; i++) {
+        verts.push_back(Point3((float)i, 0, 0));
+        verts.push_back(Point3((float)i, 1, 0));
+        norms.push_back(Vector3(0,0,1));
+        norms.push_back(Vector3(0,0,1));
+    }
+    for (int i=0; i<n; i++) {
+        unsigned int a = 2*i;
+        indices.push_back(a);  indices.push_back(a+2);  indices.push_back(a+3);
+        indices.push_back(a);  indices.push_back(a+3);  indices.push_back(a+1);
+    }
+    mesh->SetVertices(verts);
+    mesh->SetNormals(norms);
+    mesh->SetIndices(indices);
+    std::vector<Matrix4> xforms(3);
+    std::vector<Color> colors(3, Color(1,0,0));
+    mesh->SetInstanceTransforms(xforms);
+    mesh->SetInstanceColors(colors);
+    mesh->UpdateGPUMemory();
+    mesh->UpdateInstanceGPUMemory();
+}
+
+
+void TestMesh() {
+    GLObjectCount before;
+    {
+        Mesh mesh;
+        MakeMesh(10, &mesh);
+        GLObjectCount one_mesh;
+        for (int i=0; i<100; i++) {
+            MakeMesh(10 + i, &mesh);
+        }
+        CheckCount("Mesh reuses its buffers when updated", one_mesh, GLObjectCount());
+
+        mesh.FreeGPUMemory();
+        CheckCount("Mesh::FreeGPUMemory() frees its buffers", before, GLObjectCount());
+        mesh.UpdateGPUMemory();
+        mesh.UpdateInstanceGPUMemory();
+        CheckCount("Mesh recreates its buffers after FreeGPUMemory()", one_mesh, GLObjectCount());
+    }
+    CheckCount("Mesh frees its buffers when deleted", before, GLObjectCount());
+
+    for (int i=0; i<100; i++) {
+        Mesh mesh;
+        MakeMesh(i + 1, &mesh);
+    }
+    CheckCount("100 meshes free their buffers when deleted", before, GLObjectCount());
+
+    {
+        Mesh a;
+        MakeMesh(10, &a);
+        Mesh b(a);
+        b.UpdateGPUMemory();
+        b.UpdateInstanceGPUMemory();
+        GLObjectCount two_meshes;
+
+        Mesh c;
+        c = a;
+        c.UpdateGPUMemory();
+        c.UpdateInstanceGPUMemory();
+        GLObjectCount three_meshes;
+        c = b;
+        c.UpdateGPUMemory();
+        c.UpdateInstanceGPUMemory();
+        CheckCount("Mesh copy assignment reuses its buffers", three_meshes, GLObjectCount());
+        Check("Mesh copies have the same data", (b.num_triangles() == 20) && (c.num_triangles() == 20));
+
+        Mesh d(std::move(a));
+        Check("Mesh move constructor takes the data", (d.num_triangles() == 20) && (a.num_triangles() == 0));
+        CheckCount("Mesh move constructor takes the buffers", three_meshes, GLObjectCount());
+        d = std::move(b);
+        CheckCount("Mesh move assignment frees the old buffers", two_meshes, GLObjectCount());
+        Check("Mesh move assignment takes the data", (d.num_triangles() == 20) && (b.num_triangles() == 0));
+    }
+    CheckCount("copied and moved meshes free their buffers", before, GLObjectCount());
+}
+
+
+void TestMeshBatch() {
+    GLObjectCount before;
+    {
+        Mesh mesh;
+        MakeMesh(10, &mesh);
+        MeshBatch batch;
+        for (int i=0; i<10; i++) {
+            batch.AddMesh(mesh, Matrix4::Translation(Vector3(0, 0, (float)i)));
+        }
+        batch.UpdateGPUMemory();
+        batch.AddMesh(mesh);
+        batch.UpdateGPUMemory();
+    }
+    CheckCount("MeshBatch frees its buffers and texture when deleted", before, GLObjectCount());
+}
+
+
+void TestTexture2D() {
+    std::vector<unsigned char> pixels(64 * 64 * 4, 255);
+    GLObjectCount before;
+    {
+        Texture2D tex;
+        tex.InitFromBytes(64, 64, &pixels[0]);
+        GLObjectCount one_texture;
+        for (int i=0; i<100; i++) {
+            tex.InitFromBytes(64, 64, &pixels[0]);
+        }
+        CheckCount("Texture2D reuses its texture when initialized again", one_texture, GLObjectCount());
+
+        Texture2D copy(tex);
+        Texture2D assigned;
+        assigned = tex;
+        CheckCount("Texture2D copies share the texture", one_texture, GLObjectCount());
+        Check("Texture2D copies have the same id", (copy.opengl_id() == tex.opengl_id()) &&
+              (assigned.opengl_id() == tex.opengl_id()));
+
+        copy.InitFromBytes(64, 64, &pixels[0]);
+        Check("Texture2D copy gets its own texture when initialized again",
+              copy.opengl_id() != tex.opengl_id());
+
+        Texture2D moved(std::move(tex));
+        Check("Texture2D move constructor takes the texture", moved.initialized() && !tex.initialized());
+        assigned = std::move(copy);
+        Check("Texture2D move assignment takes the texture", assigned.initialized() && !copy.initialized());
+    }
+    CheckCount("Texture2D frees its texture when the last copy is deleted", before, GLObjectCount());
+}
+
+
+int main(int argc, char **argv) {
+
+    GraphicsApp *app = new GraphicsApp(256, 256, "GPU Resource Lifetime Test");
+    app->InitGraphicsContext();
+
+    TestMesh();
+    TestMeshBatch();
+    TestTexture2D();
+    Check("no OpenGL errors", glGetError() == GL_NO_ERROR);
+
+    delete app;
+
+    std::cout << (num_failed == 0 ? "All tests passed." : "Some tests failed.") << std::endl;
+    return (num_failed == 0) ? 0 : 1;
+}
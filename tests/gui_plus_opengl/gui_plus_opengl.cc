@@ -139,8 +139,10 @@ void GuiPlusOpenGL::OnLeftMouseDown(const Point2 &pos) {
     //std::cout << "Left mouse button down at " << pos << std::endl;
     
     Point2 mouseInNDC = PixelsToNormalizedDeviceCoords(pos);
-    float mouseZ = ReadZValueAtPixel(pos);
-    uniCam.OnButtonDown(mouseInNDC, mouseZ);
+    uniCam.OnButtonDown(mouseInNDC, 1.0);
+    ReadZValueAtPixelAsync(pos, [this](float mouseZ) {
+        uniCam.UpdateButtonDownDepth(mouseZ);
+    });
     
 }
 
@@ -0,0 +1,93 @@
+/*
+ This file is part of the MinGfx Project.
+
+ Copyright (c) 2017,2018 Regents of the University of Minnesota.
+ All Rights Reserved.
+
+ Original Author(s) of this File:
+	Dan Keefe, 2018, University of Minnesota
+
+ Author(s) of Significant Updates/Modifications to the File:
+	...
+ */
+
+// Checks that TextureLoader finishes loading textures when only Update() is
+// called, the way GraphicsApp calls it once per frame, with nothing ever
+// waiting on the decode jobs.  The loader runs on a JobSystem with a single
+// worker, which is also what the default JobSystem starts on a single-core
+// machine.  It prints PASS or FAIL for each check and returns non-zero if any
+// of them fail.  Like gpu_resource_lifetime, it opens a window but does not
+// draw anything, e.g.:
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./mingfx-test-texture-loader
+
+#include <mingfx.h>
+using namespace mingfx;
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+
+static int num_failed = 0;
+
+void Check(const std::string &name, bool passed) {
+    std::cout << (passed ? "PASS: " : "FAIL: ") << name << std::endl;
+    if (!passed) {
+        num_failed++;
+    }
+}
+
+
+// Calls Update() the way a frame loop would until nothing is pending, giving
+// up after a generous timeout so that a load that never finishes fails
+// instead of hanging
+bool UpdateUntilDone(TextureLoader *loader) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (loader->num_pending() > 0) {
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds(30)) {
+            return false;
+        }
+        loader->Update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return true;
+}
+
+
+void TestLoad(JobSystem *job_system) {
+    TextureLoader loader(job_system);
+    Texture2D tex;
+    Texture2D missing;
+    int num_callbacks = 0;
+    bool tex_success = false;
+    bool missing_success = true;
+    loader.Load(&tex, Platform::FindMinGfxDataFile("test.png"),
+        [&](Texture2D *texture, bool success) { num_callbacks++; tex_success = success; });
+    loader.Load(&missing, "no-such-file.png",
+        [&](Texture2D *texture, bool success) { num_callbacks++; missing_success = success; });
+    Check("textures show the placeholder while loading", (tex.width() == 1) && (missing.width() == 1));
+
+    Check("Update() alone finishes all of the loads", UpdateUntilDone(&loader));
+    Check("both callbacks are called", num_callbacks == 2);
+    Check("the image file loads", tex_success && (tex.width() == 1024) && (tex.height() == 1024));
+    Check("a missing file fails and keeps the placeholder", !missing_success && (missing.width() == 1));
+}
+
+
+int main(int argc, char **argv) {
+
+    GraphicsApp *app = new GraphicsApp(256, 256, "Texture Loader Test");
+    app->InitGraphicsContext();
+
+    Check("the default JobSystem starts at least one worker", JobSystem().num_threads() >= 2);
+    {
+        JobSystem job_system(1);
+        TestLoad(&job_system);
+    }
+    Check("no OpenGL errors", glGetError() == GL_NO_ERROR);
+
+    delete app;
+
+    std::cout << (num_failed == 0 ? "All tests passed." : "Some tests failed.") << std::endl;
+    return (num_failed == 0) ? 0 : 1;
+}